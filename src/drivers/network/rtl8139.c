@@ -5,6 +5,14 @@
 #include <kheap.h>
 #include <network.h>
 #include <pci.h>
+#include <waitqueue.h>
+#include <softirq.h>
+#include <irq.h>
+#include <isr.h>
+#include <terminal.h>
+
+// Ticks to wait for a free transmit descriptor
+#define RTL8139_TX_TIMEOUT 100
 
 // RTL8139 driver instance
 static rtl8139_device_t rtl8139_driver;
@@ -17,6 +25,18 @@ static uint32_t rx_buffer_offset;
 static uint8_t* tx_buffers[RTL8139_TX_BUF_COUNT];
 static uint32_t tx_current = 0;
 
+// Senders waiting for a transmit descriptor to free up
+static waitqueue_t tx_waiters = WAITQUEUE_INIT;
+
+// Packets taken off the ring per NET_RX run; the rest wait for the next
+#define RTL8139_RX_BUDGET 16
+
+// Device whose interrupts the softirqs finish
+static rtl8139_device_t* rtl8139_active;
+
+static void rtl8139_rx_softirq(void);
+static void rtl8139_tx_softirq(void);
+
 // Initialize RTL8139 device
 int rtl8139_init_device(rtl8139_device_t* rtl) {
     // Reset the device
@@ -60,13 +80,40 @@ int rtl8139_init_device(rtl8139_device_t* rtl) {
     return 0;
 }
 
+// Interrupt entry: the vector is the device's own when it uses MSI, or
+// its PCI interrupt line otherwise
+static void rtl8139_irq(registers_t* regs) {
+    (void)regs;
+    if (rtl8139_active) {
+        rtl8139_handle_interrupt(rtl8139_active);
+    }
+}
+
+// Give the device an MSI vector of its own, falling back to its INTx
+// line. Returns 0 on success.
+static int rtl8139_setup_irq(rtl8139_device_t* rtl) {
+    int vector = irq_setup_msi(rtl->bus, rtl->slot, rtl->func, "rtl8139");
+    if (vector >= 0) {
+        rtl->irq = vector;
+        register_interrupt_handler(vector, rtl8139_irq);
+        return 0;
+    }
+
+    uint8_t line = pci_read_config(rtl->bus, rtl->slot, rtl->func, PCI_INTERRUPT_LINE) & 0xFF;
+    if (line >= IRQ_LEGACY_COUNT) return -1;
+    rtl->irq = IRQ_LEGACY_BASE + line;
+    register_interrupt_handler(rtl->irq, rtl8139_irq);
+    irq_enable_pci(rtl->irq, "rtl8139");
+    return 0;
+}
+
 // Initialize RTL8139 driver
 int rtl8139_init(driver_t* driver) {
     rtl8139_device_t* rtl = (rtl8139_device_t*)driver;
 
     // Find RTL8139 PCI device
     uint8_t bus, slot, func;
-    if (pci_find_device_by_id(RTL8139_VENDOR_ID, RTL8139_DEVICE_ID, &bus, &slot, &func) != 0) {
+    if (!pci_find_device_by_id(RTL8139_VENDOR_ID, RTL8139_DEVICE_ID, &bus, &slot, &func)) {
         return -1;
     }
 
@@ -83,6 +130,16 @@ int rtl8139_init(driver_t* driver) {
     // Get I/O base address
     rtl->io_base = pci_read_config(bus, slot, func, PCI_BAR0) & ~0x3;
 
+    // Receive and transmit completions run as softirqs
+    rtl8139_active = rtl;
+    softirq_open(SOFTIRQ_NET_RX, rtl8139_rx_softirq);
+    softirq_open(SOFTIRQ_NET_TX, rtl8139_tx_softirq);
+
+    // Hook up the interrupt before the chip is told to raise it
+    if (rtl8139_setup_irq(rtl) != 0) {
+        kprintf("rtl8139: no usable interrupt\n");
+    }
+
     // Initialize the device
     return rtl8139_init_device(rtl);
 }
@@ -111,13 +168,16 @@ int rtl8139_cleanup(driver_t* driver) {
     return 0;
 }
 
-// Handle receive
-void rtl8139_handle_receive(rtl8139_device_t* rtl) {
+// Handle receive: take up to a budget of packets off the ring. Returns
+// true if more are waiting.
+bool rtl8139_handle_receive(rtl8139_device_t* rtl, int budget) {
     uint16_t rx_status;
     uint16_t rx_size;
     rtl8139_header_t* header;
 
-    while (!(inb(rtl->io_base + RTL8139_CMD) & RTL8139_CMD_RX_ENABLE)) {
+    while (!(inb(rtl->io_base + RTL8139_CMD) & RTL8139_CMD_BUFE)) {
+        if (budget-- <= 0) return true;
+
         header = (rtl8139_header_t*)(rx_buffer + rx_buffer_offset);
         rx_status = header->status;
         rx_size = header->size;
@@ -125,17 +185,18 @@ void rtl8139_handle_receive(rtl8139_device_t* rtl) {
         if (rx_status & RTL8139_INT_ROK) {
             // Process received packet
             // TODO: Forward packet to network stack
+        }
 
-            // Update buffer offset
-            rx_buffer_offset = (rx_buffer_offset + rx_size + sizeof(rtl8139_header_t) + 3) & ~3;
-            if (rx_buffer_offset >= RTL8139_RX_BUF_SIZE) {
-                rx_buffer_offset -= RTL8139_RX_BUF_SIZE;
-            }
-
-            // Update CAPR
-            outw(rtl->io_base + RTL8139_CAPR, rx_buffer_offset - 16);
+        // Update buffer offset
+        rx_buffer_offset = (rx_buffer_offset + rx_size + sizeof(rtl8139_header_t) + 3) & ~3;
+        if (rx_buffer_offset >= RTL8139_RX_BUF_SIZE) {
+            rx_buffer_offset -= RTL8139_RX_BUF_SIZE;
         }
+
+        // Update CAPR
+        outw(rtl->io_base + RTL8139_CAPR, rx_buffer_offset - 16);
     }
+    return false;
 }
 
 // Handle transmit
@@ -149,22 +210,45 @@ void rtl8139_handle_transmit(rtl8139_device_t* rtl) {
             // TODO: Notify network stack
         }
     }
+
+    // Descriptors are free again; let blocked senders retry
+    waitqueue_wake_all(&tx_waiters);
+}
+
+// Check whether the next transmit descriptor is free: the chip sets OWN
+// once it has copied the buffer out, and writing the size clears it
+static bool rtl8139_tx_free(rtl8139_device_t* rtl) {
+    return (inl(rtl->io_base + RTL8139_TSD0 + (tx_current * 4)) & 0x2000) != 0;
+}
+
+// NET_RX softirq: drain the receive ring a budget at a time
+static void rtl8139_rx_softirq(void) {
+    if (rtl8139_active && rtl8139_handle_receive(rtl8139_active, RTL8139_RX_BUDGET)) {
+        softirq_raise(SOFTIRQ_NET_RX);
+    }
 }
 
-// Interrupt handler
+// NET_TX softirq: reap transmit completions
+static void rtl8139_tx_softirq(void) {
+    if (rtl8139_active) {
+        rtl8139_handle_transmit(rtl8139_active);
+    }
+}
+
+// Interrupt handler: acknowledge the chip and leave the work to softirqs
 void rtl8139_handle_interrupt(rtl8139_device_t* rtl) {
     uint16_t status = inw(rtl->io_base + RTL8139_ISR);
 
+    // Clear interrupts
+    outw(rtl->io_base + RTL8139_ISR, status);
+
     if (status & RTL8139_INT_ROK) {
-        rtl8139_handle_receive(rtl);
+        softirq_raise(SOFTIRQ_NET_RX);
     }
 
     if (status & RTL8139_INT_TOK) {
-        rtl8139_handle_transmit(rtl);
+        softirq_raise(SOFTIRQ_NET_TX);
     }
-
-    // Clear interrupts
-    outw(rtl->io_base + RTL8139_ISR, status);
 }
 
 // Transmit packet
@@ -173,8 +257,10 @@ int rtl8139_transmit_packet(rtl8139_device_t* rtl, const void* data, size_t leng
         return -1;
     }
 
-    // Wait for current buffer to be free
-    while (inl(rtl->io_base + RTL8139_TSD0 + (tx_current * 4)) & 0x2000);
+    // Sleep until the transmit interrupt frees the current buffer
+    if (!wait_event_timeout(tx_waiters, rtl8139_tx_free(rtl), RTL8139_TX_TIMEOUT)) {
+        return -1;
+    }
 
     // Copy data to transmit buffer
     memcpy(tx_buffers[tx_current], data, length);
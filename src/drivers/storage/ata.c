@@ -2,17 +2,86 @@
 #include <io.h>
 #include <string.h>
 #include <hal.h>
+#include <isr.h>
+#include <waitqueue.h>
+#include <irq.h>
+#include <pci.h>
+#include <memory.h>
+#include <process.h>
+#include <terminal.h>
+#include <tsc.h>
+#include <spinlock.h>
+#include <blk.h>
+#include <bcache.h>
+
+// Ticks to wait for a completion interrupt before falling back to polling
+#define ATA_IRQ_TIMEOUT 50
+
+// atabench reads in commands of this many sectors, up to this many MB
+#define ATA_BENCH_CHUNK  128
+#define ATA_BENCH_MAX_MB 64
 
 // ATA driver instance
 static ata_driver_t ata_driver;
 
+// Bus master DMA resources of a channel. The drive reads and writes
+// frames through the identity mapping of low memory; callers' buffers
+// may be anywhere, so data is copied through them.
+typedef struct {
+    ata_prd_t* prdt;                 // PRD table, one frame
+    uint32_t pages[ATA_DMA_PAGES];   // Bounce buffer frames
+} ata_dma_t;
+
+static ata_dma_t ata_dma[2];
+
+// Cleared by atabench to time PIO on a DMA-capable drive
+static bool ata_dma_enabled = true;
+
+// Request queue of a channel. The request at the head is on the drive.
+typedef struct {
+    spinlock_t lock;
+    ata_request_t* head;
+    ata_request_t* tail;
+    waitqueue_t waiters;             // Callers of ata_submit_wait
+} ata_queue_t;
+
+static ata_queue_t ata_queues[2] = {
+    { SPINLOCK_INIT, NULL, NULL, WAITQUEUE_INIT },
+    { SPINLOCK_INIT, NULL, NULL, WAITQUEUE_INIT }
+};
+
+// Block layer requests a drive takes at once. With two, the next one is
+// already queued on the channel when the current one finishes.
+#define ATA_BLK_DEPTH   2
+
+// Block device of a drive. Each request of the block layer becomes an
+// ATA request with one segment per bio.
+typedef struct {
+    blk_device_t blk;
+    spinlock_t lock;
+    ata_request_t reqs[ATA_BLK_DEPTH];
+    ata_segment_t segs[ATA_BLK_DEPTH][BLK_MAX_SEGMENTS];
+    bool used[ATA_BLK_DEPTH];
+    bcache_ra_t ra;                  // Readahead of ata_read
+} ata_blk_t;
+
+static ata_blk_t ata_blk[ATA_MAX_DEVICES];
+
+// Request states
+#define ATA_STATE_DATA  0            // Moving sectors
+#define ATA_STATE_FLUSH 1            // Waiting for the cache flush after a write
+
 // Read a register
 static inline uint8_t ata_read_reg(ata_device_t* device, uint8_t reg) {
     return inb(device->base + reg);
 }
 
-// Write a register
+// Write a register. The high-order LBA48 registers share the ports of
+// the low-order ones and are written first.
 static inline void ata_write_reg(ata_device_t* device, uint8_t reg, uint8_t data) {
+    if (reg >= ATA_REG_SECCOUNT1 && reg <= ATA_REG_LBA5) {
+        reg -= ATA_REG_SECCOUNT1 - ATA_REG_SECCOUNT0;
+    }
     outb(device->base + reg, data);
 }
 
@@ -43,6 +112,35 @@ uint8_t ata_status_wait(ata_device_t* device, uint8_t mask, uint8_t value) {
     return status;
 }
 
+// Channel index of a device
+static inline int ata_channel(ata_device_t* device) {
+    return device->base == ATA_SECONDARY_BASE;
+}
+
+// Point the task file at an LBA28 range of the device (256 sectors is
+// written as 0)
+static void ata_setup_lba28(ata_device_t* device, uint32_t lba, uint32_t sectors) {
+    ata_write_reg(device, ATA_REG_HDDEVSEL, 0xE0 | (device->selected << 4) | ((lba >> 24) & 0x0F));
+    ata_write_reg(device, ATA_REG_SECCOUNT0, (uint8_t)sectors);
+    ata_write_reg(device, ATA_REG_LBA0, (uint8_t)lba);
+    ata_write_reg(device, ATA_REG_LBA1, (uint8_t)(lba >> 8));
+    ata_write_reg(device, ATA_REG_LBA2, (uint8_t)(lba >> 16));
+}
+
+// Point the task file at an LBA48 range of the device (65536 sectors is
+// written as 0)
+static void ata_setup_lba48(ata_device_t* device, uint64_t lba, uint32_t sectors) {
+    ata_write_reg(device, ATA_REG_HDDEVSEL, 0x40 | (device->selected << 4));
+    ata_write_reg(device, ATA_REG_SECCOUNT1, (uint8_t)(sectors >> 8));
+    ata_write_reg(device, ATA_REG_LBA3, (uint8_t)(lba >> 24));
+    ata_write_reg(device, ATA_REG_LBA4, (uint8_t)(lba >> 32));
+    ata_write_reg(device, ATA_REG_LBA5, (uint8_t)(lba >> 40));
+    ata_write_reg(device, ATA_REG_SECCOUNT0, (uint8_t)sectors);
+    ata_write_reg(device, ATA_REG_LBA0, (uint8_t)lba);
+    ata_write_reg(device, ATA_REG_LBA1, (uint8_t)(lba >> 8));
+    ata_write_reg(device, ATA_REG_LBA2, (uint8_t)(lba >> 16));
+}
+
 // Select device
 void ata_select_device(ata_driver_t* driver, uint8_t device) {
     if (device > 3) return;
@@ -62,6 +160,548 @@ void ata_soft_reset(ata_device_t* device) {
     outb(device->ctrl, 0x00);
 }
 
+// Fill in the PRD table for the first bytes of the bounce buffer,
+// merging physically contiguous frames up to the next 64 KiB boundary
+static void ata_dma_build_prdt(ata_dma_t* dma, uint32_t bytes) {
+    ata_prd_t* prd = NULL;
+    uint32_t run = 0;
+
+    for (int i = 0; bytes; i++) {
+        uint32_t addr = dma->pages[i];
+        uint32_t len = bytes < PAGE_SIZE ? bytes : PAGE_SIZE;
+
+        if (prd && prd->addr + run == addr && (addr & 0xFFFF) != 0) {
+            run += len;
+        } else {
+            prd = prd ? prd + 1 : dma->prdt;
+            prd->addr = addr;
+            prd->flags = 0;
+            run = len;
+        }
+        prd->count = (uint16_t)run;  // 64 KiB wraps to 0
+        bytes -= len;
+    }
+    prd->flags = ATA_PRD_EOT;
+}
+
+// Copy between memory and a request's segments at its cursor, and move
+// the cursor past the bytes copied
+static void ata_copy_request(ata_request_t* req, uint8_t* mem, uint32_t bytes, bool to_request) {
+    while (bytes) {
+        ata_segment_t* seg = &req->segs[req->seg];
+        uint32_t left = seg->sectors * 512 - req->seg_offset;
+        uint32_t len = bytes < left ? bytes : left;
+        uint8_t* p = (uint8_t*)seg->buffer + req->seg_offset;
+
+        if (to_request) {
+            memcpy(p, mem, len);
+        } else {
+            memcpy(mem, p, len);
+        }
+        mem += len;
+        bytes -= len;
+        req->seg_offset += len;
+        if (req->seg_offset == seg->sectors * 512) {
+            req->seg++;
+            req->seg_offset = 0;
+        }
+    }
+}
+
+// Next sector of a request's memory at its cursor; moves the cursor past it
+static void* ata_next_sector(ata_request_t* req) {
+    ata_segment_t* seg = &req->segs[req->seg];
+    void* p = (uint8_t*)seg->buffer + req->seg_offset;
+
+    req->seg_offset += 512;
+    if (req->seg_offset == seg->sectors * 512) {
+        req->seg++;
+        req->seg_offset = 0;
+    }
+    return p;
+}
+
+// Copy between a request and the bounce buffer
+static void ata_dma_copy(ata_dma_t* dma, ata_request_t* req, uint32_t bytes, bool to_device) {
+    for (int i = 0; bytes; i++) {
+        uint32_t len = bytes < PAGE_SIZE ? bytes : PAGE_SIZE;
+        ata_copy_request(req, (uint8_t*)dma->pages[i], len, !to_device);
+        bytes -= len;
+    }
+}
+
+// Check if a transfer goes by DMA
+static inline bool ata_use_dma(ata_device_t* device) {
+    return ata_dma_enabled && device->dma && device->bmide && ata_dma[ata_channel(device)].prdt;
+}
+
+// Load the current command's part of the request into the bounce buffer
+// and the bus master engine. The engine is started once the command has
+// been issued.
+static void ata_dma_prepare(ata_device_t* device, ata_request_t* req) {
+    ata_dma_t* dma = &ata_dma[ata_channel(device)];
+    uint32_t bytes = req->count * 512;
+    uint16_t bm = device->bmide;
+    bool write = req->op == ATA_REQ_WRITE;
+
+    if (write) {
+        ata_dma_copy(dma, req, bytes, true);
+    }
+    ata_dma_build_prdt(dma, bytes);
+
+    // Stop the engine, load the table and clear the old status
+    outb(bm + ATA_BM_COMMAND, 0);
+    outl(bm + ATA_BM_PRDT, (uint32_t)dma->prdt);
+    outb(bm + ATA_BM_STATUS, inb(bm + ATA_BM_STATUS) | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+    outb(bm + ATA_BM_COMMAND, write ? 0 : ATA_BM_CMD_READ);
+}
+
+// Stop the bus master engine; returns its final status
+static uint8_t ata_dma_stop(ata_device_t* device) {
+    uint16_t bm = device->bmide;
+    uint8_t bm_status = inb(bm + ATA_BM_STATUS);
+    outb(bm + ATA_BM_COMMAND, 0);
+    outb(bm + ATA_BM_STATUS, bm_status | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+    return bm_status;
+}
+
+// Move one DRQ block, a sector or a READ/WRITE MULTIPLE block, between
+// the data port and a request's buffer
+static void ata_pio_block(ata_device_t* device, ata_request_t* req) {
+    uint32_t sectors = device->multiple > 1 ? device->multiple : 1;
+    if (sectors > req->remaining) sectors = req->remaining;
+
+    for (uint32_t n = 0; n < sectors; n++) {
+        uint16_t* buf = ata_next_sector(req);
+        if (req->op == ATA_REQ_READ) {
+            for (int i = 0; i < 256; i++) {
+                buf[i] = ata_read_data(device);
+            }
+        } else {
+            for (int i = 0; i < 256; i++) {
+                ata_write_data(device, buf[i]);
+            }
+        }
+    }
+    req->remaining -= sectors;
+}
+
+// Command opcode for a transfer: [lba48][write] for DMA, PIO, MULTIPLE
+static const uint8_t ata_rw_commands[3][2][2] = {
+    { { ATA_CMD_READ_DMA, ATA_CMD_WRITE_DMA },
+      { ATA_CMD_READ_DMA_EXT, ATA_CMD_WRITE_DMA_EXT } },
+    { { ATA_CMD_READ_PIO, ATA_CMD_WRITE_PIO },
+      { ATA_CMD_READ_PIO_EXT, ATA_CMD_WRITE_PIO_EXT } },
+    { { ATA_CMD_READ_MULTIPLE, ATA_CMD_WRITE_MULTIPLE },
+      { ATA_CMD_READ_MULTIPLE_EXT, ATA_CMD_WRITE_MULTIPLE_EXT } }
+};
+
+// Issue the command for the next part of a request: as many sectors as
+// one command and the bounce buffer allow. LBA48 is used only when the
+// range or FUA needs it. Returns false, with req->status set, if the
+// drive cannot take it.
+static bool ata_issue(ata_device_t* device, ata_request_t* req) {
+    uint64_t lba = req->lba + req->issued;
+    uint32_t count = req->sectors - req->issued;
+    bool write = req->op == ATA_REQ_WRITE;
+
+    uint32_t max = req->dma ? ATA_DMA_PAGES * (PAGE_SIZE / 512)
+                            : device->lba48 ? ATA_LBA48_SECTORS : ATA_LBA28_SECTORS;
+    if (count > max) count = max;
+
+    bool lba48 = lba + count > ATA_LBA28_LIMIT || count > ATA_LBA28_SECTORS || req->fua;
+    if ((lba48 && !device->lba48) || lba + count > device->size) {
+        req->status = HAL_ERROR_INVALID_PARAMETER;
+        return false;
+    }
+
+    req->count = count;
+    req->remaining = count;
+    req->issued += count;
+
+    if (req->dma) {
+        ata_dma_prepare(device, req);
+    }
+    if (lba48) {
+        ata_setup_lba48(device, lba, count);
+    } else {
+        ata_setup_lba28(device, (uint32_t)lba, count);
+    }
+
+    if (req->fua) {
+        ata_write_reg(device, ATA_REG_COMMAND,
+                      req->dma ? ATA_CMD_WRITE_DMA_FUA_EXT : ATA_CMD_WRITE_MULTIPLE_FUA_EXT);
+    } else {
+        int kind = req->dma ? 0 : device->multiple > 1 ? 2 : 1;
+        ata_write_reg(device, ATA_REG_COMMAND, ata_rw_commands[kind][lba48][write]);
+    }
+
+    if (req->dma) {
+        outb(device->bmide + ATA_BM_COMMAND, (write ? 0 : ATA_BM_CMD_READ) | ATA_BM_CMD_START);
+        return true;
+    }
+
+    // The first block of a write is asked for without an interrupt;
+    // the drive is quick to do so
+    if (write) {
+        ata_400ns_delay(device);
+        uint8_t status = ata_status_wait(device, ATA_SR_BSY, 0);
+        if ((status & (ATA_SR_ERR | ATA_SR_DF)) || !(status & ATA_SR_DRQ)) {
+            req->status = HAL_ERROR_IO_ERROR;
+            return false;
+        }
+        ata_pio_block(device, req);
+    }
+    return true;
+}
+
+// Issue a request's first command. Returns false, with req->status set,
+// if the drive refused it. The queue lock is held.
+static bool ata_start(ata_request_t* req) {
+    ata_device_t* device = &ata_driver.devices[req->device];
+
+    req->status = 0;
+    req->issued = 0;
+    req->seg = 0;
+    req->seg_offset = 0;
+    if (!req->segs) {
+        req->flat.buffer = req->buffer;
+        req->flat.sectors = req->sectors;
+        req->segs = &req->flat;
+        req->nsegs = 1;
+    }
+
+    if (req->op == ATA_REQ_FLUSH) {
+        req->state = ATA_STATE_FLUSH;
+        ata_write_reg(device, ATA_REG_HDDEVSEL, 0xE0 | (device->selected << 4));
+        ata_write_reg(device, ATA_REG_COMMAND,
+                      device->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+        return true;
+    }
+    if (req->sectors == 0) {
+        req->status = HAL_ERROR_INVALID_PARAMETER;
+        return false;
+    }
+
+    // FUA exists only as LBA48 DMA and WRITE MULTIPLE commands; without
+    // them the write is followed by a flush
+    req->state = ATA_STATE_DATA;
+    req->dma = ata_use_dma(device);
+    req->fua = req->op == ATA_REQ_WRITE && (req->flags & ATA_REQ_FUA) && device->fua &&
+               device->lba48 && (req->dma || device->multiple > 1);
+    return ata_issue(device, req);
+}
+
+// A command's data has moved. The rest of the request is issued; a FUA
+// write the drive could not do as such then flushes its cache. Other
+// writes stay in the cache until someone asks for a flush. Returns true
+// if the request is finished.
+static bool ata_data_done(ata_device_t* device, ata_request_t* req) {
+    if (req->issued < req->sectors) {
+        return !ata_issue(device, req);
+    }
+    if (req->op != ATA_REQ_WRITE || !(req->flags & ATA_REQ_FUA) || req->fua) return true;
+
+    req->state = ATA_STATE_FLUSH;
+    ata_write_reg(device, ATA_REG_COMMAND,
+                  device->lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+    return false;
+}
+
+// Advance the request on the drive after an interrupt, given the status
+// read to acknowledge it. Returns true if the request is finished.
+static bool ata_step(ata_request_t* req, uint8_t status) {
+    ata_device_t* device = &ata_driver.devices[req->device];
+
+    if (status & ATA_SR_BSY) return false;
+
+    if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+        if (req->dma && req->state == ATA_STATE_DATA) ata_dma_stop(device);
+        req->status = HAL_ERROR_IO_ERROR;
+        return true;
+    }
+    if (req->state == ATA_STATE_FLUSH) return true;
+
+    if (req->dma) {
+        // The drive shows BSY clear, with DRQ, while the bus master is
+        // still moving data; a poll or stray interrupt then must not stop it
+        uint8_t bm_status = inb(device->bmide + ATA_BM_STATUS);
+        if ((bm_status & ATA_BM_SR_ACTIVE) && !(bm_status & (ATA_BM_SR_IRQ | ATA_BM_SR_ERR))) {
+            return false;
+        }
+        if (ata_dma_stop(device) & ATA_BM_SR_ERR) {
+            req->status = HAL_ERROR_IO_ERROR;
+            return true;
+        }
+        if (req->op == ATA_REQ_READ) {
+            ata_dma_copy(&ata_dma[ata_channel(device)], req, req->count * 512, false);
+        }
+        req->remaining = 0;
+        return ata_data_done(device, req);
+    }
+
+    // PIO: each interrupt offers the next block, or ends a write
+    if (req->remaining) {
+        if (!(status & ATA_SR_DRQ)) return false;
+        ata_pio_block(device, req);
+        if (req->op == ATA_REQ_WRITE || req->remaining) return false;
+    }
+    return ata_data_done(device, req);
+}
+
+// Take the finished request off the queue and start the next ones. A
+// request that fails to start is finished too. Returns the finished
+// requests linked through next. The queue lock is held.
+static ata_request_t* ata_queue_next(ata_queue_t* q) {
+    ata_request_t* done = NULL;
+    ata_request_t** last = &done;
+
+    for (;;) {
+        ata_request_t* req = q->head;
+        q->head = req->next;
+        if (!q->head) q->tail = NULL;
+
+        req->next = NULL;
+        *last = req;
+        last = &req->next;
+
+        if (!q->head || ata_start(q->head)) break;
+    }
+    return done;
+}
+
+// Call the completion callbacks of finished requests
+static void ata_complete(ata_request_t* done) {
+    while (done) {
+        ata_request_t* next = done->next;
+        done->done(done);
+        done = next;
+    }
+}
+
+// Check the drive of a channel and advance its current request
+static void ata_service(int channel) {
+    ata_queue_t* q = &ata_queues[channel];
+    ata_request_t* done = NULL;
+
+    uint32_t flags = spin_lock_irqsave(&q->lock);
+    uint8_t status = inb((channel ? ATA_SECONDARY_BASE : ATA_PRIMARY_BASE) + ATA_REG_STATUS);
+    if (q->head && ata_step(q->head, status)) {
+        done = ata_queue_next(q);
+    }
+    spin_unlock_irqrestore(&q->lock, flags);
+
+    ata_complete(done);
+}
+
+// Drive interrupt: reading the status register acknowledges it
+static void ata_irq(int channel) {
+    ata_service(channel);
+}
+
+// IRQ14: primary channel
+static void ata_primary_irq(registers_t* regs) {
+    (void)regs;
+    ata_irq(0);
+}
+
+// IRQ15: secondary channel
+static void ata_secondary_irq(registers_t* regs) {
+    (void)regs;
+    ata_irq(1);
+}
+
+// Queue a request. It starts at once if its channel is idle; done is
+// called from the interrupt handler when it finishes (or from here, if
+// the drive refuses it).
+void ata_submit(ata_request_t* req) {
+    ata_queue_t* q = &ata_queues[ata_channel(&ata_driver.devices[req->device])];
+    ata_request_t* done = NULL;
+
+    req->next = NULL;
+    uint32_t flags = spin_lock_irqsave(&q->lock);
+    if (q->tail) {
+        q->tail->next = req;
+        q->tail = req;
+    } else {
+        q->head = q->tail = req;
+        if (!ata_start(req)) {
+            done = ata_queue_next(q);
+        }
+    }
+    spin_unlock_irqrestore(&q->lock, flags);
+
+    ata_complete(done);
+}
+
+// Completion of a request made by ata_submit_wait. The request lives on
+// the waiter's stack and may be gone once the flag is set, so everything
+// needed from it is read first.
+static void ata_wait_done(ata_request_t* req) {
+    waitqueue_t* waiters = &ata_queues[ata_channel(&ata_driver.devices[req->device])].waiters;
+    volatile bool* finished = req->data;
+    __sync_synchronize();
+    *finished = true;
+    waitqueue_wake_all(waiters);
+}
+
+// Submit a request and sleep until it finishes. If the interrupt does
+// not come in time (e.g. it is masked) the drive is polled instead.
+int ata_submit_wait(ata_request_t* req) {
+    int channel = ata_channel(&ata_driver.devices[req->device]);
+    volatile bool finished = false;
+
+    req->done = ata_wait_done;
+    req->data = (void*)&finished;
+    ata_submit(req);
+
+    while (!wait_event_timeout(ata_queues[channel].waiters, finished, ATA_IRQ_TIMEOUT)) {
+        ata_service(channel);
+    }
+    return req->status;
+}
+
+// Read or write sectors of a device and wait for them
+static int ata_rw_sectors(ata_device_t* device, uint8_t op, uint8_t flags, uint64_t lba,
+                          uint32_t sectors, void* buffer) {
+    ata_request_t req;
+    memset(&req, 0, sizeof(req));
+    req.op = op;
+    req.flags = flags;
+    req.device = device - ata_driver.devices;
+    req.lba = lba;
+    req.sectors = sectors;
+    req.buffer = buffer;
+    return ata_submit_wait(&req);
+}
+
+// Read sectors
+static int ata_read_sectors(ata_device_t* device, uint64_t lba, uint32_t sectors, void* buffer) {
+    return ata_rw_sectors(device, ATA_REQ_READ, 0, lba, sectors, buffer);
+}
+
+// Write sectors
+static int ata_write_sectors(ata_device_t* device, uint64_t lba, uint32_t sectors, const void* buffer) {
+    return ata_rw_sectors(device, ATA_REQ_WRITE, 0, lba, sectors, (void*)buffer);
+}
+
+// Allocate a channel's PRD table and bounce buffer. Returns false if
+// memory ran out.
+static bool ata_dma_alloc(ata_dma_t* dma) {
+    if (dma->prdt) return true;
+
+    uint32_t prdt = alloc_frame();
+    if (!prdt) return false;
+    for (int i = 0; i < ATA_DMA_PAGES; i++) {
+        dma->pages[i] = alloc_frame();
+        if (!dma->pages[i]) {
+            while (i--) free_frame(dma->pages[i]);
+            free_frame(prdt);
+            return false;
+        }
+    }
+    dma->prdt = (ata_prd_t*)prdt;
+    return true;
+}
+
+// A block layer request finished on the drive
+static void ata_blk_done(ata_request_t* req) {
+    ata_blk_t* ab = &ata_blk[req->device];
+    blk_request_t* rq = req->data;
+    int status = req->status;
+
+    uint32_t flags = spin_lock_irqsave(&ab->lock);
+    ab->used[req - ab->reqs] = false;
+    spin_unlock_irqrestore(&ab->lock, flags);
+
+    blk_end_request(rq, status);
+}
+
+// Start a block layer request. The block layer never hands over more
+// than ATA_BLK_DEPTH at once, so a request slot is always free.
+static void ata_blk_submit(blk_device_t* dev, blk_request_t* rq) {
+    ata_blk_t* ab = dev->private;
+
+    uint32_t flags = spin_lock_irqsave(&ab->lock);
+    int slot = 0;
+    while (ab->used[slot]) slot++;
+    ab->used[slot] = true;
+    spin_unlock_irqrestore(&ab->lock, flags);
+
+    ata_request_t* req = &ab->reqs[slot];
+    memset(req, 0, sizeof(ata_request_t));
+    req->op = rq->op == BLK_READ ? ATA_REQ_READ :
+              rq->op == BLK_WRITE ? ATA_REQ_WRITE : ATA_REQ_FLUSH;
+    req->flags = (rq->flags & BLK_FUA) ? ATA_REQ_FUA : 0;
+    req->device = ab - ata_blk;
+    req->lba = rq->sector;
+    req->sectors = rq->count;
+    req->segs = ab->segs[slot];
+    for (bio_t* bio = rq->bios; bio; bio = bio->next) {
+        req->segs[req->nsegs].buffer = bio->buffer;
+        req->segs[req->nsegs].sectors = bio->count;
+        req->nsegs++;
+    }
+    req->done = ata_blk_done;
+    req->data = rq;
+    ata_submit(req);
+}
+
+// Check a drive's channel when its interrupts seem lost
+static void ata_blk_poll(blk_device_t* dev) {
+    ata_blk_t* ab = dev->private;
+    ata_service(ata_channel(&ata_driver.devices[ab - ata_blk]));
+}
+
+// Block device of a drive, or NULL if it has none
+static blk_device_t* ata_blk_device(ata_device_t* device) {
+    ata_blk_t* ab = &ata_blk[device - ata_driver.devices];
+    return ab->blk.submit ? &ab->blk : NULL;
+}
+
+// Register the drives found as block devices hda to hdd
+static void ata_blk_init(ata_driver_t* ata) {
+    for (int i = 0; i < ATA_MAX_DEVICES; i++) {
+        ata_device_t* dev = &ata->devices[i];
+        if (!dev->present || !dev->size) continue;
+
+        ata_blk_t* ab = &ata_blk[i];
+        memset(ab, 0, sizeof(ata_blk_t));
+        spin_init(&ab->lock);
+        memcpy(ab->blk.name, "hda", 4);
+        ab->blk.name[2] = 'a' + i;
+        ab->blk.nr_sectors = dev->size;
+        ab->blk.max_sectors = ATA_LBA28_SECTORS;
+        ab->blk.depth = ATA_BLK_DEPTH;
+        ab->blk.submit = ata_blk_submit;
+        ab->blk.poll = ata_blk_poll;
+        ab->blk.private = ab;
+        blk_register(&ab->blk);
+    }
+}
+
+// Find the IDE controller's bus master registers and switch the drives
+// that support it to DMA
+static void ata_dma_init(ata_driver_t* ata) {
+    uint8_t bus, slot, func;
+    if (!pci_find_device_by_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &bus, &slot, &func)) return;
+
+    uint32_t bar4 = pci_read_config(bus, slot, func, PCI_BAR4);
+    if (!(bar4 & PCI_BAR_TYPE_IO) || !(bar4 & PCI_BAR_IO_MASK)) return;
+
+    uint32_t command = pci_read_config(bus, slot, func, PCI_COMMAND);
+    pci_write_config(bus, slot, func, PCI_COMMAND, command | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+    for (int i = 0; i < ATA_MAX_DEVICES; i++) {
+        ata_device_t* dev = &ata->devices[i];
+        dev->bar4 = bar4;
+        dev->bmide = (bar4 & PCI_BAR_IO_MASK) + (ata_channel(dev) ? ATA_BM_SECONDARY : 0);
+        if (dev->present && dev->dma && !ata_dma_alloc(&ata_dma[ata_channel(dev)])) {
+            dev->dma = 0;
+        }
+    }
+}
+
 // Initialize ATA driver
 int ata_init(driver_t* driver) {
     ata_driver_t* ata = (ata_driver_t*)driver;
@@ -75,11 +715,24 @@ int ata_init(driver_t* driver) {
     ata->devices[2].ctrl = 0x376;
     ata->devices[3].base = 0x170;
     ata->devices[3].ctrl = 0x376;
+    for (int i = 0; i < 4; i++) {
+        ata->devices[i].selected = i & 1;
+    }
     
     // Detect and initialize devices
     for (int i = 0; i < 4; i++) {
-        ata_identify(ata, i);
+        ata->devices[i].present = ata_identify(ata, i) == 0;
     }
+    ata_dma_init(ata);
+
+    // Complete transfers by interrupt instead of polling
+    register_interrupt_handler(IRQ14, ata_primary_irq);
+    register_interrupt_handler(IRQ15, ata_secondary_irq);
+    irq_enable(IRQ14, "ata primary");
+    irq_enable(IRQ15, "ata secondary");
+    outb(ATA_PRIMARY_CONTROL, 0x00);
+    outb(ATA_SECONDARY_CONTROL, 0x00);
+    ata_blk_init(ata);
     
     return 0;
 }
@@ -90,6 +743,31 @@ int ata_cleanup(driver_t* driver) {
     return 0;
 }
 
+// Read a 32-bit field of the identification space
+static inline uint32_t ata_ident_dword(const uint16_t* ident, uint32_t offset) {
+    return ident[offset / 2] | ((uint32_t)ident[offset / 2 + 1] << 16);
+}
+
+// Have the drive move several sectors per interrupt in READ/WRITE
+// MULTIPLE, up to the most it allows. Polls, like IDENTIFY.
+static void ata_set_multiple(ata_device_t* dev, uint32_t max) {
+    uint32_t count = max < ATA_MULTIPLE_MAX ? max : ATA_MULTIPLE_MAX;
+    while (count & (count - 1)) {
+        count &= count - 1;          // Older drives take only powers of two
+    }
+
+    dev->multiple = 1;
+    if (count < 2) return;
+
+    ata_write_reg(dev, ATA_REG_HDDEVSEL, 0xE0 | (dev->selected << 4));
+    ata_write_reg(dev, ATA_REG_SECCOUNT0, count);
+    ata_write_reg(dev, ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+    ata_400ns_delay(dev);
+    if (!(ata_status_wait(dev, ATA_SR_BSY, 0) & (ATA_SR_ERR | ATA_SR_DF))) {
+        dev->multiple = count;
+    }
+}
+
 // Identify ATA device
 int ata_identify(ata_driver_t* driver, uint8_t device) {
     ata_device_t* dev = &driver->devices[device];
@@ -126,86 +804,28 @@ int ata_identify(ata_driver_t* driver, uint8_t device) {
     for (int i = 0; i < 256; i++) {
         buffer[i] = ata_read_data(dev);
     }
-    
-    return 0;
-}
-
-// Read sectors
-static int ata_read_sectors(ata_device_t* device, uint32_t lba, uint8_t sectors, void* buffer) {
-    // Select device and set up LBA
-    ata_write_reg(device, ATA_REG_HDDEVSEL, 0xE0 | ((lba >> 24) & 0x0F));
-    
-    // Write sector count and LBA
-    ata_write_reg(device, ATA_REG_SECCOUNT0, sectors);
-    ata_write_reg(device, ATA_REG_LBA0, (uint8_t)lba);
-    ata_write_reg(device, ATA_REG_LBA1, (uint8_t)(lba >> 8));
-    ata_write_reg(device, ATA_REG_LBA2, (uint8_t)(lba >> 16));
-    
-    // Send read command
-    ata_write_reg(device, ATA_REG_COMMAND, ATA_CMD_READ_PIO);
-    
-    uint16_t* buf = (uint16_t*)buffer;
-    
-    // Read data
-    for (int i = 0; i < sectors; i++) {
-        // Wait for data
-        if (ata_status_wait(device, ATA_SR_BSY | ATA_SR_DRQ, ATA_SR_DRQ) & ATA_SR_ERR) {
-            return HAL_ERROR_NOT_SUPPORTED;
-        }
-        
-        // Transfer data
-        for (int j = 0; j < 256; j++) {
-            buf[j] = ata_read_data(device);
-        }
-        
-        buf += 256;
-    }
-    
-    return 0;
-}
-
-// Write sectors
-static int ata_write_sectors(ata_device_t* device, uint32_t lba, uint8_t sectors, const void* buffer) {
-    // Select device and set up LBA
-    ata_write_reg(device, ATA_REG_HDDEVSEL, 0xE0 | ((lba >> 24) & 0x0F));
-    
-    // Write sector count and LBA
-    ata_write_reg(device, ATA_REG_SECCOUNT0, sectors);
-    ata_write_reg(device, ATA_REG_LBA0, (uint8_t)lba);
-    ata_write_reg(device, ATA_REG_LBA1, (uint8_t)(lba >> 8));
-    ata_write_reg(device, ATA_REG_LBA2, (uint8_t)(lba >> 16));
-    
-    // Send write command
-    ata_write_reg(device, ATA_REG_COMMAND, ATA_CMD_WRITE_PIO);
-    
-    const uint16_t* buf = (const uint16_t*)buffer;
-    
-    // Write data
-    for (int i = 0; i < sectors; i++) {
-        // Wait until ready
-        if (ata_status_wait(device, ATA_SR_BSY, 0) & ATA_SR_ERR) {
-            return HAL_ERROR_NOT_SUPPORTED;
-        }
-        
-        // Transfer data
-        for (int j = 0; j < 256; j++) {
-            ata_write_data(device, buf[j]);
-        }
-        
-        buf += 256;
-        
-        // Flush cache
-        ata_write_reg(device, ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
-        ata_status_wait(device, ATA_SR_BSY, 0);
+    dev->dma = (buffer[ATA_IDENT_CAPABILITIES / 2] & ATA_IDENT_DMA_SUPPORT) != 0;
+    dev->lba48 = (ata_ident_dword(buffer, ATA_IDENT_COMMANDSETS) & ATA_IDENT_LBA48) != 0;
+    dev->fua = (buffer[ATA_IDENT_FEATURES_EXT / 2] & ATA_IDENT_FUA) != 0;
+    if (dev->lba48) {
+        dev->size = ata_ident_dword(buffer, ATA_IDENT_MAX_LBA_EXT) |
+                    (uint64_t)ata_ident_dword(buffer, ATA_IDENT_MAX_LBA_EXT + 4) << 32;
+    } else {
+        dev->size = ata_ident_dword(buffer, ATA_IDENT_MAX_LBA);
     }
+    ata_set_multiple(dev, buffer[ATA_IDENT_MAX_MULTIPLE / 2] & 0xFF);
     
     return 0;
 }
 
-// Read from device
+// Read from device, through the buffer cache
 int ata_read(driver_t* driver, void* buffer, size_t size, uint32_t offset) {
     ata_driver_t* ata = (ata_driver_t*)driver;
     ata_device_t* device = &ata->devices[ata->current_device];
+    blk_device_t* blk = ata_blk_device(device);
+    if (blk) {
+        return bcache_read_ra(blk, &ata_blk[ata->current_device].ra, offset, buffer, size);
+    }
     
     // Calculate sectors
     uint32_t start_sector = offset / 512;
@@ -214,10 +834,15 @@ int ata_read(driver_t* driver, void* buffer, size_t size, uint32_t offset) {
     return ata_read_sectors(device, start_sector, sector_count, buffer);
 }
 
-// Write to device
+// Write to device. The data stays in the buffer cache, and then in the
+// drive's write cache, until written back or IOCTL_ATA_FLUSH_CACHE.
 int ata_write(driver_t* driver, const void* buffer, size_t size, uint32_t offset) {
     ata_driver_t* ata = (ata_driver_t*)driver;
     ata_device_t* device = &ata->devices[ata->current_device];
+    blk_device_t* blk = ata_blk_device(device);
+    if (blk) {
+        return bcache_write(blk, offset, buffer, size);
+    }
     
     // Calculate sectors
     uint32_t start_sector = offset / 512;
@@ -242,10 +867,21 @@ int ata_ioctl(driver_t* driver, uint32_t cmd, void* arg) {
             }
             return HAL_ERROR_NOT_SUPPORTED;
             
-        case IOCTL_ATA_FLUSH_CACHE:
-            ata_write_reg(device, ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
-            ata_status_wait(device, ATA_SR_BSY, 0);
+        case IOCTL_ATA_GET_SECTOR_COUNT:
+            if (!arg) return HAL_ERROR_INVALID_PARAMETER;
+            *(uint64_t*)arg = device->size;
+            return 0;
+
+        case IOCTL_ATA_GET_SECTOR_SIZE:
+            if (!arg) return HAL_ERROR_INVALID_PARAMETER;
+            *(uint32_t*)arg = 512;
             return 0;
+
+        case IOCTL_ATA_FLUSH_CACHE:
+            if (ata_blk_device(device)) {
+                return bcache_sync(ata_blk_device(device));
+            }
+            return ata_rw_sectors(device, ATA_REQ_FLUSH, 0, 0, 0, NULL);
             
         default:
             return HAL_ERROR_NOT_SUPPORTED;
@@ -282,4 +918,113 @@ driver_t* create_ata_driver(void) {
     }
     
     return &ata_driver.driver;
-}
\ No newline at end of file
+}
+
+// CPU time used so far by the calling process, including the current run
+static uint64_t ata_bench_cpu_cycles(void) {
+    uint32_t flags = irq_save();
+    proc_acct_t* acct = &current_process->acct;
+    uint64_t cycles = acct->user_cycles + acct->sys_cycles + (rdtsc() - acct->stamp);
+    irq_restore(flags);
+    return cycles;
+}
+
+// Sequential transfer of mb megabytes from sector start, timed.
+// Writes can flush after each command, flush once at the end, or be FUA.
+// CPU% is the time this shell spent on the CPU; sleeping for the
+// completion interrupt does not count.
+static void ata_bench_pass(const char* name, ata_device_t* device, uint8_t* buffer,
+                           uint32_t start_lba, uint32_t mb, uint8_t op, uint8_t flags,
+                           bool flush_each, bool flush_end) {
+    uint64_t cpu = ata_bench_cpu_cycles();
+    uint64_t start = rdtsc();
+    uint32_t sectors = mb * 2048;
+    uint32_t lba;
+    for (lba = 0; lba < sectors; lba += ATA_BENCH_CHUNK) {
+        if (ata_rw_sectors(device, op, flags, start_lba + lba, ATA_BENCH_CHUNK, buffer) != 0) break;
+        if (flush_each && ata_rw_sectors(device, ATA_REQ_FLUSH, 0, 0, 0, NULL) != 0) break;
+    }
+    if (lba == sectors && flush_end && ata_rw_sectors(device, ATA_REQ_FLUSH, 0, 0, 0, NULL) != 0) {
+        lba = 0;
+    }
+    uint32_t us = tsc_us_since(start);
+    uint32_t cpu_us = tsc_to_us(ata_bench_cpu_cycles() - cpu);
+
+    if (lba < sectors) {
+        kprintf("%s: I/O error at sector %u\n", name, start_lba + lba);
+        return;
+    }
+    if (us == 0) us = 1;
+    uint32_t tenths = mb * 1048576 * 10 / us;
+    kprintf("%s: %u MB in %u ms, %u.%u MB/s, CPU %u%%\n", name, mb, us / 1000,
+            tenths / 10, tenths % 10, cpu_us * 100 / us);
+}
+
+// Compare PIO and DMA reads, or ways of making sequential writes
+// durable, on the selected drive. Reads start at sector 0. The write test
+// destroys what it overwrites, so it needs an explicit scratch sector to
+// start at and refuses a drive holding a mounted file system.
+// atabench [read] [mb] | atabench write <lba> [mb]
+int ata_cmd_atabench(int argc, char* argv[]) {
+    ata_device_t* device = &ata_driver.devices[ata_driver.current_device];
+    bool write = argc > 1 && strcmp(argv[1], "write") == 0;
+    int arg = argc > 1 && (write || strcmp(argv[1], "read") == 0) ? 2 : 1;
+    bool have_lba = !write || argc > arg;
+    uint32_t start_lba = write && have_lba ? (uint32_t)atoi(argv[arg++]) : 0;
+    uint32_t mb = argc > arg ? (uint32_t)atoi(argv[arg]) : 8;
+
+    if (!have_lba || mb == 0 || mb > ATA_BENCH_MAX_MB || argc > arg + 1) {
+        kprintf("usage: atabench [read] [mb] | atabench write <lba> [mb] (1-%d MB)\n",
+                ATA_BENCH_MAX_MB);
+        return -1;
+    }
+    if (!device->present) {
+        kprintf("atabench: no drive selected\n");
+        return -1;
+    }
+    if (write) {
+        blk_device_t* blk = ata_blk_device(device);
+        if (blk && blk->mounted) {
+            kprintf("atabench: %s holds a mounted file system\n", blk->name);
+            return -1;
+        }
+        if ((uint64_t)start_lba + mb * 2048 > device->size) {
+            kprintf("atabench: sectors %u-%u are past the end of the drive\n",
+                    start_lba, start_lba + mb * 2048 - 1);
+            return -1;
+        }
+    }
+
+    uint8_t* buffer = kmalloc(ATA_BENCH_CHUNK * 512);
+    if (!buffer) return -1;
+
+    kprintf("Drive: %u MB, %s, %u sectors per PIO interrupt, %s\n",
+            (uint32_t)(device->size >> 11), device->lba48 ? "LBA48" : "LBA28",
+            device->multiple, device->fua ? "FUA" : "no FUA");
+
+    if (write) {
+        for (uint32_t i = 0; i < ATA_BENCH_CHUNK * 512; i++) {
+            buffer[i] = (uint8_t)i;
+        }
+        ata_bench_pass("flush each write", device, buffer, start_lba, mb, ATA_REQ_WRITE, 0,
+                       true, false);
+        ata_bench_pass("cached, one flush", device, buffer, start_lba, mb, ATA_REQ_WRITE, 0,
+                       false, true);
+        ata_bench_pass(device->fua ? "FUA writes" : "FUA writes (as flushes)", device, buffer,
+                       start_lba, mb, ATA_REQ_WRITE, ATA_REQ_FUA, false, false);
+    } else {
+        bool saved = ata_dma_enabled;
+        ata_dma_enabled = false;
+        ata_bench_pass("PIO", device, buffer, 0, mb, ATA_REQ_READ, 0, false, false);
+        ata_dma_enabled = true;
+        if (ata_use_dma(device)) {
+            ata_bench_pass("DMA", device, buffer, 0, mb, ATA_REQ_READ, 0, false, false);
+        } else {
+            kprintf("DMA: not supported by this drive or controller\n");
+        }
+        ata_dma_enabled = saved;
+    }
+
+    kfree(buffer);
+    return 0;
+}
@@ -40,6 +40,13 @@
 #define ATA_CMD_WRITE_PIO_EXT     0x34
 #define ATA_CMD_WRITE_DMA         0xCA
 #define ATA_CMD_WRITE_DMA_EXT     0x35
+#define ATA_CMD_READ_MULTIPLE     0xC4
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29
+#define ATA_CMD_WRITE_MULTIPLE    0xC5
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_SET_MULTIPLE      0xC6
+#define ATA_CMD_WRITE_DMA_FUA_EXT 0x3D
+#define ATA_CMD_WRITE_MULTIPLE_FUA_EXT 0xCE
 #define ATA_CMD_CACHE_FLUSH       0xE7
 #define ATA_CMD_CACHE_FLUSH_EXT   0xEA
 #define ATA_CMD_PACKET            0xA0
@@ -73,12 +80,54 @@
 #define ATA_IDENT_SECTORS      12
 #define ATA_IDENT_SERIAL       20
 #define ATA_IDENT_MODEL        54
+#define ATA_IDENT_MAX_MULTIPLE 94
 #define ATA_IDENT_CAPABILITIES 98
 #define ATA_IDENT_FIELDVALID  106
 #define ATA_IDENT_MAX_LBA     120
 #define ATA_IDENT_COMMANDSETS 164
+#define ATA_IDENT_FEATURES_EXT 168
 #define ATA_IDENT_MAX_LBA_EXT 200
 
+#define ATA_IDENT_DMA_SUPPORT 0x0100   // Capabilities: DMA supported
+#define ATA_IDENT_LBA48       (1 << 26) // Command sets: 48-bit addresses
+#define ATA_IDENT_FUA         0x0040    // Features: FUA writes
+
+// Largest LBA28 transfer and address
+#define ATA_LBA28_SECTORS   256
+#define ATA_LBA28_LIMIT     0x10000000
+#define ATA_LBA48_SECTORS   65536
+
+// Sectors per READ/WRITE MULTIPLE block asked of drives that allow more
+#define ATA_MULTIPLE_MAX    16
+
+// Bus master IDE registers (offsets from the channel's base in BAR4)
+#define ATA_BM_COMMAND      0x00
+#define ATA_BM_STATUS       0x02
+#define ATA_BM_PRDT         0x04
+#define ATA_BM_SECONDARY    0x08    // Secondary channel's registers
+
+// Bus master command
+#define ATA_BM_CMD_START    0x01
+#define ATA_BM_CMD_READ     0x08    // Device to memory
+
+// Bus master status
+#define ATA_BM_SR_ACTIVE    0x01
+#define ATA_BM_SR_ERR       0x02    // Write 1 to clear
+#define ATA_BM_SR_IRQ       0x04    // Write 1 to clear
+
+// Physical region descriptor: one physically contiguous piece of a DMA
+// transfer, not crossing a 64 KiB boundary (a count of 0 means 64 KiB)
+typedef struct {
+    uint32_t addr;
+    uint16_t count;
+    uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
+
+#define ATA_PRD_EOT         0x8000  // Last entry of the table
+
+// Largest DMA transfer: 256 sectors
+#define ATA_DMA_PAGES       32
+
 // ATA device structure
 typedef struct {
     uint16_t base;          // I/O base port
@@ -87,6 +136,12 @@ typedef struct {
     uint8_t  nIEN;          // nIEN (No Interrupt) bit
     uint8_t  selected;      // Currently selected drive
     uint8_t  lba;           // Using LBA?
+    uint8_t  present;       // Answered IDENTIFY
+    uint8_t  dma;           // Transfers by bus master DMA
+    uint8_t  lba48;         // Takes the _EXT commands
+    uint8_t  multiple;      // Sectors per PIO interrupt (READ/WRITE MULTIPLE)
+    uint8_t  fua;           // Takes the FUA write commands
+    uint64_t size;          // Sectors
     uint32_t bar0;          // BAR0
     uint32_t bar1;          // BAR1
     uint32_t bar2;          // BAR2
@@ -102,6 +157,49 @@ typedef struct {
     uint8_t current_device; // Currently selected device
 } ata_driver_t;
 
+// Request operations
+#define ATA_REQ_READ        0
+#define ATA_REQ_WRITE       1
+#define ATA_REQ_FLUSH       2
+
+// Request flags
+#define ATA_REQ_FUA         0x01    // Write through to the media before done
+
+// Piece of a request's memory, a whole number of sectors
+typedef struct {
+    void*    buffer;
+    uint32_t sectors;
+} ata_segment_t;
+
+// Block request. The caller fills in the first part and gets done called,
+// usually from the interrupt handler, once status is final. Requests
+// larger than one command allows are split by the driver.
+typedef struct ata_request {
+    uint8_t  op;            // ATA_REQ_*
+    uint8_t  flags;         // ATA_REQ_FUA
+    uint8_t  device;        // Index into ata_driver_t.devices
+    uint32_t sectors;
+    uint64_t lba;
+    void*    buffer;        // Memory for all the sectors, or NULL and:
+    ata_segment_t* segs;    // Pieces of memory, in order
+    uint32_t nsegs;
+    int      status;        // 0 or a HAL error
+    void (*done)(struct ata_request* req);
+    void*    data;          // For the caller
+
+    // Driver state
+    uint8_t  state;
+    uint8_t  dma;           // Commands use DMA
+    uint8_t  fua;           // Commands carry FUA
+    uint32_t issued;        // Sectors covered by commands so far
+    uint32_t count;         // Sectors of the current command
+    uint32_t remaining;     // Of those, still to move
+    ata_segment_t flat;     // The one segment of buffer
+    uint32_t seg;           // Where data moves next: segment
+    uint32_t seg_offset;    // and byte within it
+    struct ata_request* next;
+} ata_request_t;
+
 // ATA driver functions
 int ata_init(driver_t* driver);
 int ata_cleanup(driver_t* driver);
@@ -116,6 +214,10 @@ uint8_t ata_status_wait(ata_device_t* device, uint8_t mask, uint8_t value);
 int ata_identify(ata_driver_t* driver, uint8_t device);
 void ata_io_wait(ata_device_t* device);
 void ata_soft_reset(ata_device_t* device);
+driver_t* create_ata_driver(void);
+void ata_submit(ata_request_t* req);
+int ata_submit_wait(ata_request_t* req);
+int ata_cmd_atabench(int argc, char* argv[]);
 
 // ATA IOCTL commands
 #define IOCTL_ATA_GET_SECTOR_COUNT    0x1000
@@ -0,0 +1,196 @@
+#include "acct.h"
+#include "process.h"
+#include "keyboard.h"
+#include "terminal.h"
+#include "string.h"
+
+// Most processes "top" shows; the rest of the VGA screen is the header
+#define TOP_ROWS 20
+
+// Room for every process and every CPU's idle process
+#define TOP_ENTRIES (MAX_PROCESSES + MAX_CPUS)
+
+// One line of the display
+typedef struct {
+    process_info_t* info;            // Process as of the latest snapshot
+    proc_acct_t delta;               // Usage over the interval
+    uint32_t busy_us;                // CPU time over the interval
+} top_row_t;
+
+// Charge file or socket I/O to the calling process
+void acct_io(bool write, uint32_t bytes) {
+    process_t* current = current_process;
+    if (!current) return;
+
+    if (write) {
+        current->acct.write_bytes += bytes;
+    } else {
+        current->acct.read_bytes += bytes;
+    }
+}
+
+// Print a number right-aligned in a column
+static void top_column(uint32_t value, int width) {
+    char buf[12];
+    uint_to_string(value, buf);
+    for (int pad = width - (int)strlen(buf); pad > 0; pad--) {
+        terminal_putchar(' ');
+    }
+    terminal_writestring(buf);
+}
+
+// Print a string left-aligned in a column, cut to fit
+static void top_name(const char* name, int width) {
+    int len = 0;
+    for (; len < width - 1 && name[len]; len++) {
+        terminal_putchar(name[len]);
+    }
+    for (; len < width; len++) {
+        terminal_putchar(' ');
+    }
+}
+
+// One-letter process state
+static char top_state(uint8_t state) {
+    switch (state) {
+        case PROCESS_STATE_RUNNING:
+        case PROCESS_STATE_READY:    return 'R';
+        case PROCESS_STATE_BLOCKED:  return 'B';
+        case PROCESS_STATE_SLEEPING: return 'S';
+        case PROCESS_STATE_ZOMBIE:   return 'Z';
+        default:                     return '?';
+    }
+}
+
+// Find a process in an earlier snapshot. Idle processes share pid 0 and
+// are told apart by their CPU.
+static process_info_t* top_find(process_info_t* info, int count, process_info_t* want) {
+    for (int i = 0; i < count; i++) {
+        if (info[i].pid == want->pid && (want->pid != 0 || info[i].cpu == want->cpu)) {
+            return &info[i];
+        }
+    }
+    return NULL;
+}
+
+// Draw one screen: usage of each process over the interval between two
+// snapshots, busiest first
+static void top_draw(top_row_t* rows, process_info_t* prev, int prev_count,
+                     process_info_t* curr, int curr_count, uint32_t interval_us) {
+    proc_acct_t zero;
+    memset(&zero, 0, sizeof(zero));
+    uint32_t total_busy = 0;
+    uint32_t processes = 0;
+
+    for (int i = 0; i < curr_count; i++) {
+        process_info_t* before = top_find(prev, prev_count, &curr[i]);
+        proc_acct_t* now = &curr[i].acct;
+        proc_acct_t* then = before ? &before->acct : &zero;
+
+        top_row_t row;
+        row.info = &curr[i];
+        row.delta.user_cycles = now->user_cycles - then->user_cycles;
+        row.delta.sys_cycles = now->sys_cycles - then->sys_cycles;
+        row.delta.nvcsw = now->nvcsw - then->nvcsw;
+        row.delta.nivcsw = now->nivcsw - then->nivcsw;
+        row.delta.min_flt = now->min_flt - then->min_flt;
+        row.delta.maj_flt = now->maj_flt - then->maj_flt;
+        row.delta.syscalls = now->syscalls - then->syscalls;
+        row.delta.read_bytes = now->read_bytes - then->read_bytes;
+        row.delta.write_bytes = now->write_bytes - then->write_bytes;
+        row.busy_us = tsc_to_us(row.delta.user_cycles + row.delta.sys_cycles);
+
+        if (curr[i].pid != 0) {
+            total_busy += row.busy_us;
+            processes++;
+        }
+
+        // Insertion sort, busiest first
+        int j = i;
+        while (j > 0 && rows[j - 1].busy_us < row.busy_us) {
+            rows[j] = rows[j - 1];
+            j--;
+        }
+        rows[j] = row;
+    }
+
+    uint32_t cpus = smp_cpu_count();
+    terminal_clear();
+    kprintf("top: %u processes on %u CPUs, %u%% busy; q to quit\n",
+            processes, cpus, total_busy / cpus * 100 / interval_us);
+    kprintf("Usage over the last %u ms; I/O in KB\n", interval_us / 1000);
+    kprintf("  PID NAME       S CPU %%CPU %%SYS   CSW  ICSW  MINF MAJF  SYSC  RDKB  WRKB\n");
+
+    for (int i = 0; i < curr_count && i < TOP_ROWS; i++) {
+        top_row_t* row = &rows[i];
+        top_column(row->info->pid, 5);
+        terminal_putchar(' ');
+        top_name(row->info->name, 11);
+        terminal_putchar(top_state(row->info->state));
+        top_column(row->info->cpu, 4);
+        top_column(row->busy_us * 100 / interval_us, 5);
+        top_column(tsc_to_us(row->delta.sys_cycles) * 100 / interval_us, 5);
+        top_column(row->delta.nvcsw, 6);
+        top_column(row->delta.nivcsw, 6);
+        top_column(row->delta.min_flt, 6);
+        top_column(row->delta.maj_flt, 5);
+        top_column(row->delta.syscalls, 6);
+        top_column((uint32_t)(row->delta.read_bytes >> 10), 6);
+        top_column((uint32_t)(row->delta.write_bytes >> 10), 6);
+        terminal_putchar('\n');
+    }
+}
+
+// Wait for the next refresh; returns false if q was pressed
+static bool top_wait(uint32_t ms) {
+    for (uint32_t waited = 0; waited < ms; waited += 100) {
+        char c = keyboard_getchar();
+        if (c == 'q' || c == 'Q') return false;
+        sleep(100);
+    }
+    return true;
+}
+
+// Show per-process resource usage, refreshed in place:
+// top [seconds between refreshes] [number of refreshes]
+int acct_cmd_top(int argc, char* argv[]) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 1;
+    int rounds = argc > 2 ? atoi(argv[2]) : 0;
+    if (seconds < 1 || seconds > 10) {
+        kprintf("usage: top [1-10 seconds] [refreshes]\n");
+        return -1;
+    }
+
+    process_info_t* snap[2];
+    snap[0] = kmalloc(2 * TOP_ENTRIES * sizeof(process_info_t));
+    top_row_t* rows = kmalloc(TOP_ENTRIES * sizeof(top_row_t));
+    if (!snap[0] || !rows) {
+        kprintf("top: out of memory\n");
+        kfree(snap[0]);
+        kfree(rows);
+        return -1;
+    }
+    snap[1] = snap[0] + TOP_ENTRIES;
+
+    int count[2];
+    count[0] = process_snapshot(snap[0], TOP_ENTRIES);
+    uint64_t then = rdtsc();
+
+    for (int round = 0; rounds == 0 || round < rounds; round++) {
+        if (!top_wait(seconds * 1000)) break;
+
+        int curr = (round + 1) & 1;
+        int prev = round & 1;
+        count[curr] = process_snapshot(snap[curr], TOP_ENTRIES);
+        uint64_t now = rdtsc();
+        uint32_t interval_us = tsc_to_us(now - then);
+        then = now;
+
+        top_draw(rows, snap[prev], count[prev], snap[curr], count[curr],
+                 interval_us ? interval_us : 1);
+    }
+
+    kfree(rows);
+    kfree(snap[0]);
+    return 0;
+}
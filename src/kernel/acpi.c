@@ -5,6 +5,7 @@
 // ACPI Table Signatures
 #define ACPI_FACP_SIG "FACP"
 #define ACPI_DSDT_SIG "DSDT"
+#define ACPI_MADT_SIG "APIC"
 
 // ACPI PM1 Control Register Bits
 #define ACPI_PM1_SLP_TYP_OFFSET 10
@@ -15,6 +16,18 @@ static rsdp_descriptor_t* rsdp = NULL;
 static acpi_header_t* rsdt = NULL;
 static fadt_t* facp = NULL;
 static acpi_header_t* dsdt = NULL;
+static madt_t* madt = NULL;
+
+// Processors and local APIC discovered through the MADT
+static uint32_t lapic_address = 0;
+static uint8_t cpu_apic_ids[ACPI_MAX_CPUS];
+static int cpu_count = 0;
+
+// I/O APICs and ISA interrupt overrides discovered through the MADT
+static madt_ioapic_t ioapics[ACPI_MAX_IOAPICS];
+static int ioapic_count = 0;
+static madt_iso_t overrides[ACPI_MAX_OVERRIDES];
+static int override_count = 0;
 
 // ACPI PM1 Control Registers
 static uint32_t pm1a_control = 0;
@@ -42,6 +55,57 @@ static rsdp_descriptor_t* find_rsdp(void) {
     return NULL;
 }
 
+// Walk the MADT and record every enabled processor's local APIC, the
+// I/O APICs and the ISA interrupt overrides
+static void parse_madt(void) {
+    lapic_address = madt->lapic_address;
+    cpu_count = 0;
+    ioapic_count = 0;
+    override_count = 0;
+
+    uint8_t* entry = (uint8_t*)(madt + 1);
+    uint8_t* end = (uint8_t*)madt + madt->header.length;
+
+    while (entry + sizeof(madt_entry_t) <= end) {
+        madt_entry_t* header = (madt_entry_t*)entry;
+        if (header->length < sizeof(madt_entry_t)) {
+            break;  // Malformed table
+        }
+
+        switch (header->type) {
+            case MADT_TYPE_LAPIC: {
+                madt_lapic_t* lapic = (madt_lapic_t*)entry;
+                if ((lapic->flags & MADT_LAPIC_ENABLED) && cpu_count < ACPI_MAX_CPUS) {
+                    cpu_apic_ids[cpu_count++] = lapic->apic_id;
+                }
+                break;
+            }
+            case MADT_TYPE_IOAPIC: {
+                if (ioapic_count < ACPI_MAX_IOAPICS) {
+                    memcpy(&ioapics[ioapic_count++], entry, sizeof(madt_ioapic_t));
+                }
+                break;
+            }
+            case MADT_TYPE_ISO: {
+                madt_iso_t* iso = (madt_iso_t*)entry;
+                if (iso->bus == 0 && override_count < ACPI_MAX_OVERRIDES) {
+                    memcpy(&overrides[override_count++], iso, sizeof(madt_iso_t));
+                }
+                break;
+            }
+            case MADT_TYPE_LAPIC_OVERRIDE: {
+                madt_lapic_override_t* override = (madt_lapic_override_t*)entry;
+                lapic_address = (uint32_t)override->lapic_address;
+                break;
+            }
+            default:
+                break;
+        }
+
+        entry += header->length;
+    }
+}
+
 // Initialize ACPI subsystem
 void acpi_init(void) {
     // Find RSDP
@@ -56,7 +120,7 @@ void acpi_init(void) {
         return;
     }
     
-    // Find FACP (FADT)
+    // Find FACP (FADT) and MADT
     uint32_t entries = (rsdt->length - sizeof(acpi_header_t)) / 4;
     uint32_t* table_ptrs = (uint32_t*)(rsdt + 1);
     
@@ -64,10 +128,15 @@ void acpi_init(void) {
         acpi_header_t* header = (acpi_header_t*)(uint32_t)table_ptrs[i];
         if (memcmp(header->signature, ACPI_FACP_SIG, 4) == 0) {
             facp = (fadt_t*)header;
-            break;
+        } else if (memcmp(header->signature, ACPI_MADT_SIG, 4) == 0) {
+            madt = (madt_t*)header;
         }
     }
     
+    if (madt) {
+        parse_madt();
+    }
+    
     if (!facp) {
         return;
     }
@@ -93,3 +162,47 @@ void acpi_shutdown(void) {
         outw(pm1b_control, (1 << 13) | (5 << 10));
     }
 }
+
+// Get the physical address of the local APIC
+uint32_t acpi_get_lapic_address(void) {
+    return lapic_address;
+}
+
+// Get the number of enabled processors
+int acpi_get_cpu_count(void) {
+    return cpu_count;
+}
+
+// Get the local APIC ID of an enabled processor
+uint8_t acpi_get_cpu_apic_id(int index) {
+    if (index < 0 || index >= cpu_count) {
+        return 0xFF;
+    }
+    return cpu_apic_ids[index];
+}
+
+// Get the number of I/O APICs
+int acpi_get_ioapic_count(void) {
+    return ioapic_count;
+}
+
+// Get an I/O APIC entry, or NULL
+const madt_ioapic_t* acpi_get_ioapic(int index) {
+    if (index < 0 || index >= ioapic_count) {
+        return NULL;
+    }
+    return &ioapics[index];
+}
+
+// Translate an ISA IRQ to the global system interrupt it arrives on.
+// flags receives the override's polarity and trigger bits, 0 if none.
+uint32_t acpi_irq_to_gsi(uint8_t irq, uint16_t* flags) {
+    for (int i = 0; i < override_count; i++) {
+        if (overrides[i].source == irq) {
+            if (flags) *flags = overrides[i].flags;
+            return overrides[i].gsi;
+        }
+    }
+    if (flags) *flags = 0;
+    return irq;
+}
@@ -0,0 +1,693 @@
+#include "bcache.h"
+#include "process.h"
+#include "timer.h"
+#include "terminal.h"
+#include "string.h"
+#include "hal.h"
+
+// Ticks to wait for an I/O completion before polling the device
+#define BCACHE_POLL_TICKS 10
+
+// Writes a synchronous caller waits for
+typedef struct bcache_batch {
+    volatile uint32_t pending;
+    volatile uint32_t errors;
+} bcache_batch_t;
+
+// Buffer headers, the hash chains that find cached ones and the list of
+// unused ones. Cached buffers have dev set; their flags, refcount and
+// links change only under bcache_lock.
+static buffer_t bcache_buffers[BCACHE_BUFFERS];
+static buffer_t* bcache_hash[BCACHE_HASH_SIZE];
+static buffer_t* bcache_free = NULL;
+static spinlock_t bcache_lock = SPINLOCK_INIT;
+static uint32_t bcache_hand = 0;     // CLOCK hand over bcache_buffers
+static uint32_t bcache_cached = 0;
+static uint32_t bcache_dirty = 0;
+
+// Woken whenever a buffer's I/O ends
+static waitqueue_t bcache_wait = WAITQUEUE_INIT;
+
+// Writeback thread and the flag that wakes it early
+static waitqueue_t bcache_writeback_wait = WAITQUEUE_INIT;
+static volatile bool bcache_kicked = false;
+
+// Statistics
+static struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t reads;                  // Blocks read from devices
+    uint32_t writebacks;             // Blocks written to devices
+    uint32_t evictions;              // Clean buffers reused for other blocks
+    uint32_t reclaimed;              // Frames given back to the frame allocator
+    uint32_t errors;
+    uint32_t ra_blocks;              // Blocks prefetched
+    uint32_t ra_hits;                // Prefetched blocks later read
+    uint32_t ra_misses;              // Sequential reads that found nothing prefetched
+    uint32_t ra_wasted;              // Prefetched blocks evicted unread
+} bcache_stats;
+
+// Hash chain of a block
+static inline buffer_t** bcache_chain(blk_device_t* dev, uint64_t block) {
+    uint32_t h = (uint32_t)block ^ (uint32_t)(block >> 32) ^ ((uint32_t)dev >> 4);
+    return &bcache_hash[(h ^ (h >> 8)) & (BCACHE_HASH_SIZE - 1)];
+}
+
+// Find a cached block. bcache_lock is held.
+static buffer_t* bcache_lookup(blk_device_t* dev, uint64_t block) {
+    buffer_t* b = *bcache_chain(dev, block);
+    while (b && (b->dev != dev || b->block != block)) {
+        b = b->hash_next;
+    }
+    return b;
+}
+
+// Drop a buffer from its hash chain. bcache_lock is held.
+static void bcache_unhash(buffer_t* b) {
+    buffer_t** link = bcache_chain(b->dev, b->block);
+    while (*link && *link != b) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) *link = b->hash_next;
+    b->dev = NULL;
+    bcache_cached--;
+}
+
+// Take a clean, unused buffer away from its block with the CLOCK
+// algorithm: the hand passes over buffers used since its last visit
+// once, clearing BUF_REFERENCED. Returns NULL if none can be taken.
+// bcache_lock is held.
+static buffer_t* bcache_evict(void) {
+    for (uint32_t scanned = 0; scanned < 2 * BCACHE_BUFFERS; scanned++) {
+        buffer_t* b = &bcache_buffers[bcache_hand];
+        bcache_hand = (bcache_hand + 1) & (BCACHE_BUFFERS - 1);
+
+        if (!b->dev || b->refcount || (b->flags & (BUF_BUSY | BUF_DIRTY))) continue;
+        if (b->flags & BUF_REFERENCED) {
+            b->flags &= ~BUF_REFERENCED;
+            continue;
+        }
+        if (b->flags & BUF_READAHEAD) {
+            bcache_stats.ra_wasted++;
+        }
+        bcache_unhash(b);
+        return b;
+    }
+    return NULL;
+}
+
+// Wake the writeback thread now rather than at its next interval
+static void bcache_kick_writeback(void) {
+    bcache_kicked = true;
+    waitqueue_wake_all(&bcache_writeback_wait);
+}
+
+// Check if a buffer could be evicted
+static bool bcache_reclaimable(void) {
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    bool found = bcache_free != NULL;
+    for (uint32_t i = 0; i < BCACHE_BUFFERS && !found; i++) {
+        buffer_t* b = &bcache_buffers[i];
+        found = b->dev && !b->refcount && !(b->flags & (BUF_BUSY | BUF_DIRTY));
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    return found;
+}
+
+// Get a buffer for a new block: an unused header with a fresh frame, or
+// else the buffer the CLOCK hand evicts. If every buffer is dirty or in
+// use, waits for writeback. The buffer is not hashed.
+static buffer_t* bcache_alloc(void) {
+    for (;;) {
+        uint32_t flags = spin_lock_irqsave(&bcache_lock);
+        buffer_t* b = bcache_free;
+        if (b) {
+            bcache_free = b->free_next;
+        }
+        spin_unlock_irqrestore(&bcache_lock, flags);
+
+        // The frame is allocated without the lock; the allocator may call
+        // back into bcache_shrink
+        if (b) {
+            if (!b->data) {
+                b->data = (uint8_t*)alloc_frame();
+            }
+            if (b->data) return b;
+
+            flags = spin_lock_irqsave(&bcache_lock);
+            b->free_next = bcache_free;
+            bcache_free = b;
+        } else {
+            flags = spin_lock_irqsave(&bcache_lock);
+        }
+
+        b = bcache_evict();
+        if (b) bcache_stats.evictions++;
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        if (b) return b;
+
+        bcache_kick_writeback();
+        wait_event_timeout(bcache_wait, bcache_reclaimable(), BCACHE_POLL_TICKS);
+    }
+}
+
+// Count a use of a cached buffer. bcache_lock is held.
+static inline void bcache_use(buffer_t* b) {
+    b->flags |= BUF_REFERENCED;
+    bcache_stats.hits++;
+    if (b->flags & BUF_READAHEAD) {
+        b->flags &= ~BUF_READAHEAD;
+        bcache_stats.ra_hits++;
+    }
+}
+
+// Get the buffer of a block with a reference held, cached or new. A new
+// one is not valid yet. Unless use is false (readahead), the lookup
+// counts as a use.
+static buffer_t* bcache_get(blk_device_t* dev, uint64_t block, bool use) {
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    buffer_t* b = bcache_lookup(dev, block);
+    if (b) {
+        b->refcount++;
+        if (use) bcache_use(b);
+        spin_unlock_irqrestore(&bcache_lock, flags);
+        return b;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    buffer_t* fresh = bcache_alloc();
+
+    // Someone else may have brought the block in meanwhile
+    flags = spin_lock_irqsave(&bcache_lock);
+    b = bcache_lookup(dev, block);
+    if (b) {
+        b->refcount++;
+        if (use) bcache_use(b);
+        fresh->free_next = bcache_free;
+        bcache_free = fresh;
+    } else {
+        b = fresh;
+        b->dev = dev;
+        b->block = block;
+        b->flags = use ? BUF_REFERENCED : 0;
+        b->refcount = 1;
+        buffer_t** chain = bcache_chain(dev, block);
+        b->hash_next = *chain;
+        *chain = b;
+        bcache_cached++;
+        if (use) bcache_stats.misses++;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    return b;
+}
+
+// Poll a device whose completions seem lost
+static inline void bcache_poll(blk_device_t* dev) {
+    if (dev && dev->poll) dev->poll(dev);
+}
+
+// Become the one doing I/O on a buffer: wait until it is not busy, then
+// mark it busy
+static void bcache_start_io(buffer_t* b) {
+    for (;;) {
+        uint32_t flags = spin_lock_irqsave(&bcache_lock);
+        if (!(b->flags & BUF_BUSY)) {
+            b->flags |= BUF_BUSY;
+            spin_unlock_irqrestore(&bcache_lock, flags);
+            return;
+        }
+        spin_unlock_irqrestore(&bcache_lock, flags);
+
+        if (!wait_event_timeout(bcache_wait, !(b->flags & BUF_BUSY), BCACHE_POLL_TICKS)) {
+            bcache_poll(b->dev);
+        }
+    }
+}
+
+// I/O on a buffer ended: set and clear flags and wake waiters
+static void bcache_end_io(buffer_t* b, uint32_t set, uint32_t clear) {
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    b->flags = (b->flags | set) & ~(clear | BUF_BUSY);
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    waitqueue_wake_all(&bcache_wait);
+}
+
+// Read a block, from the cache if it is there. Returns the buffer with a
+// reference held, to be given back with brelse, or NULL if the block is
+// past the end of the device or could not be read.
+buffer_t* bread(blk_device_t* dev, uint64_t block) {
+    if (((block + 1) << (BCACHE_BLOCK_SHIFT - 9)) > dev->nr_sectors) return NULL;
+
+    buffer_t* b = bcache_get(dev, block, true);
+    if (b->flags & BUF_VALID) return b;
+
+    bcache_start_io(b);
+    if (b->flags & BUF_VALID) {
+        bcache_end_io(b, 0, 0);
+        return b;
+    }
+
+    int status = blk_rw(dev, BLK_READ, block << (BCACHE_BLOCK_SHIFT - 9),
+                        BCACHE_BLOCK_SECTORS, b->data);
+    if (status != 0) {
+        bcache_stats.errors++;
+        bcache_end_io(b, BUF_ERROR, 0);
+        brelse(b);
+        return NULL;
+    }
+    bcache_stats.reads++;
+    bcache_end_io(b, BUF_VALID, BUF_ERROR);
+    return b;
+}
+
+// Note that a buffer's data was changed. The writeback thread writes it
+// out later, sooner if too many buffers are dirty.
+void bdirty(buffer_t* b) {
+    bool kick = false;
+
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    if (!(b->flags & BUF_DIRTY)) {
+        b->dirtied = get_timer_ticks();
+        kick = ++bcache_dirty > BCACHE_DIRTY_LIMIT;
+    }
+    b->flags |= BUF_VALID | BUF_DIRTY | BUF_REFERENCED;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    if (kick) bcache_kick_writeback();
+}
+
+// Write a buffer to its device now and wait for it
+int bwrite(buffer_t* b) {
+    bcache_start_io(b);
+
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    if (b->flags & BUF_DIRTY) {
+        b->flags &= ~BUF_DIRTY;
+        bcache_dirty--;
+    }
+    b->flags |= BUF_VALID;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    int status = blk_rw(b->dev, BLK_WRITE, b->block << (BCACHE_BLOCK_SHIFT - 9),
+                        BCACHE_BLOCK_SECTORS, b->data);
+    if (status != 0) {
+        bcache_stats.errors++;
+        bcache_end_io(b, BUF_ERROR, 0);
+    } else {
+        bcache_stats.writebacks++;
+        bcache_end_io(b, 0, BUF_ERROR);
+    }
+    return status;
+}
+
+// Give back a reference from bread
+void brelse(buffer_t* b) {
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    b->refcount--;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+}
+
+// A readahead read ended
+static void bcache_read_done(bio_t* bio) {
+    buffer_t* b = bio->private;
+
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    if (bio->status != 0) {
+        bcache_stats.errors++;
+        b->flags = (b->flags | BUF_ERROR) & ~BUF_READAHEAD;
+    } else {
+        b->flags = (b->flags | BUF_VALID) & ~BUF_ERROR;
+    }
+    b->flags &= ~BUF_BUSY;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    waitqueue_wake_all(&bcache_wait);
+}
+
+// Start reading a block into the cache without waiting, unless it is
+// there already or past the end of the device. Readers of the block wait
+// for the read like for any other.
+void bcache_prefetch(blk_device_t* dev, uint64_t block) {
+    if (((block + 1) << (BCACHE_BLOCK_SHIFT - 9)) > dev->nr_sectors) return;
+
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    bool cached = bcache_lookup(dev, block) != NULL;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    if (cached) return;
+
+    // Unused prefetched buffers are first in line for eviction, so the
+    // reference is dropped at once; being busy keeps the buffer until
+    // the read ends
+    buffer_t* b = bcache_get(dev, block, false);
+    flags = spin_lock_irqsave(&bcache_lock);
+    b->refcount--;
+    bool start = !(b->flags & (BUF_VALID | BUF_BUSY));
+    if (start) {
+        b->flags |= BUF_BUSY | BUF_READAHEAD;
+        bcache_stats.ra_blocks++;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    if (!start) return;
+
+    memset(&b->bio, 0, sizeof(bio_t));
+    b->bio.op = BLK_READ;
+    b->bio.sector = block << (BCACHE_BLOCK_SHIFT - 9);
+    b->bio.count = BCACHE_BLOCK_SECTORS;
+    b->bio.buffer = b->data;
+    b->bio.end_io = bcache_read_done;
+    b->bio.private = b;
+    blk_submit_bio(dev, &b->bio);
+}
+
+// Move a stream's readahead window for a read of index. Sequential reads
+// start a window of BCACHE_RA_MIN blocks, including the one read; once
+// the reader is into the second half of what was prefetched, the next
+// window, twice as large up to BCACHE_RA_MAX, is started behind it. A
+// random read halves the window. Returns how many blocks to prefetch
+// from *start, and sets *sequential.
+static uint32_t bcache_ra_window(bcache_ra_t* ra, uint64_t index, uint64_t* start,
+                                 bool* sequential) {
+    // Another piece of the block just read
+    if (ra->next && index + 1 == ra->next) {
+        *sequential = ra->size != 0;
+        return 0;
+    }
+
+    *sequential = index == ra->next;
+    ra->next = index + 1;
+
+    if (!*sequential) {
+        ra->size >>= 1;
+        if (ra->size < BCACHE_RA_MIN) ra->size = 0;
+        ra->ahead = index + 1;
+        return 0;
+    }
+
+    if (ra->size == 0) {
+        ra->size = BCACHE_RA_MIN;
+        *start = index;
+    } else if (index >= ra->ahead) {
+        // Behind: the window was used up or never issued
+        ra->size = ra->size * 2 > BCACHE_RA_MAX ? BCACHE_RA_MAX : ra->size * 2;
+        *start = index;
+    } else if (ra->ahead - index <= ra->size / 2) {
+        ra->size = ra->size * 2 > BCACHE_RA_MAX ? BCACHE_RA_MAX : ra->size * 2;
+        *start = ra->ahead;
+    } else {
+        return 0;
+    }
+    ra->ahead = *start + ra->size;
+    return ra->size;
+}
+
+// Read block index of a stream, such as a file, with readahead. map
+// gives the device block of an index, or NULL if they are the same.
+// Returns NULL if the index has no block or it could not be read.
+buffer_t* bread_ra(blk_device_t* dev, bcache_ra_t* ra, uint64_t index,
+                   bcache_map_fn map, void* stream) {
+    uint64_t block = index;
+    if (map && !map(stream, index, &block)) return NULL;
+    if (!ra) return bread(dev, block);
+
+    uint64_t start = 0;
+    bool sequential;
+    uint32_t count = bcache_ra_window(ra, index, &start, &sequential);
+
+    if (sequential) {
+        uint32_t flags = spin_lock_irqsave(&bcache_lock);
+        buffer_t* b = bcache_lookup(dev, block);
+        if (!b || !(b->flags & (BUF_VALID | BUF_BUSY))) {
+            bcache_stats.ra_misses++;
+        }
+        spin_unlock_irqrestore(&bcache_lock, flags);
+    }
+
+    // The window goes out as one plug, so it merges into large requests;
+    // a block not yet cached is read with it
+    if (count) {
+        blk_plug_t plug;
+        blk_start_plug(&plug);
+        for (uint32_t i = 0; i < count; i++) {
+            uint64_t ra_block = start + i;
+            if (map && !map(stream, start + i, &ra_block)) break;
+            bcache_prefetch(dev, ra_block);
+        }
+        blk_finish_plug(&plug);
+    }
+    return bread(dev, block);
+}
+
+// Copy bytes of a device out through the cache, with readahead if ra is
+// given
+int bcache_read_ra(blk_device_t* dev, bcache_ra_t* ra, uint64_t offset, void* buffer,
+                   uint32_t size) {
+    uint8_t* out = buffer;
+
+    while (size) {
+        uint32_t in_block = (uint32_t)offset & (BCACHE_BLOCK_SIZE - 1);
+        uint32_t chunk = BCACHE_BLOCK_SIZE - in_block;
+        if (chunk > size) chunk = size;
+
+        buffer_t* b = bread_ra(dev, ra, offset >> BCACHE_BLOCK_SHIFT, NULL, NULL);
+        if (!b) return HAL_ERROR_IO_ERROR;
+        memcpy(out, b->data + in_block, chunk);
+        brelse(b);
+
+        out += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+// Copy bytes of a device out through the cache
+int bcache_read(blk_device_t* dev, uint64_t offset, void* buffer, uint32_t size) {
+    return bcache_read_ra(dev, NULL, offset, buffer, size);
+}
+
+// Copy bytes into the cache for writeback. Blocks written whole are not
+// read first.
+int bcache_write(blk_device_t* dev, uint64_t offset, const void* buffer, uint32_t size) {
+    const uint8_t* in = buffer;
+
+    while (size) {
+        uint32_t in_block = (uint32_t)offset & (BCACHE_BLOCK_SIZE - 1);
+        uint32_t chunk = BCACHE_BLOCK_SIZE - in_block;
+        if (chunk > size) chunk = size;
+
+        uint64_t block = offset >> BCACHE_BLOCK_SHIFT;
+        buffer_t* b;
+        if (chunk == BCACHE_BLOCK_SIZE &&
+            ((block + 1) << (BCACHE_BLOCK_SHIFT - 9)) <= dev->nr_sectors) {
+            b = bcache_get(dev, block, true);
+        } else {
+            b = bread(dev, block);
+        }
+        if (!b) return HAL_ERROR_IO_ERROR;
+
+        // Wait out a read or write of the block in flight
+        bcache_start_io(b);
+        memcpy(b->data + in_block, in, chunk);
+        bcache_end_io(b, BUF_VALID, BUF_ERROR);
+        bdirty(b);
+        brelse(b);
+
+        in += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+// A writeback write ended
+static void bcache_write_done(bio_t* bio) {
+    buffer_t* b = bio->private;
+    bcache_batch_t* batch = b->wb_batch;
+
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    if (bio->status != 0) {
+        bcache_stats.errors++;
+        b->flags |= BUF_ERROR;
+        if (batch) batch->errors++;
+    } else {
+        b->flags &= ~BUF_ERROR;
+    }
+    b->flags &= ~BUF_BUSY;
+    if (batch) batch->pending--;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    waitqueue_wake_all(&bcache_wait);
+}
+
+// Start writing dirty buffers of a device, or of every device if dev is
+// NULL: all of them, or only those dirty for BCACHE_DIRTY_EXPIRE. They
+// go out under one plug so neighbouring blocks merge. batch, if given,
+// counts them until they are written. Returns how many were started.
+static uint32_t bcache_writeback(blk_device_t* dev, bool all, bcache_batch_t* batch) {
+    buffer_t* list = NULL;
+    uint32_t count = 0;
+    uint32_t now = get_timer_ticks();
+
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    for (uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+        buffer_t* b = &bcache_buffers[i];
+        if (!b->dev || (dev && b->dev != dev)) continue;
+        if ((b->flags & (BUF_DIRTY | BUF_BUSY)) != BUF_DIRTY) continue;
+        if (!all && (int32_t)(now - b->dirtied) < BCACHE_DIRTY_EXPIRE) continue;
+
+        b->flags = (b->flags | BUF_BUSY) & ~BUF_DIRTY;
+        bcache_dirty--;
+        b->wb_next = list;
+        b->wb_batch = batch;
+        list = b;
+        count++;
+    }
+    bcache_stats.writebacks += count;
+    if (batch) batch->pending += count;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    blk_plug_t plug;
+    blk_start_plug(&plug);
+    while (list) {
+        buffer_t* b = list;
+        list = b->wb_next;
+
+        memset(&b->bio, 0, sizeof(bio_t));
+        b->bio.op = BLK_WRITE;
+        b->bio.sector = b->block << (BCACHE_BLOCK_SHIFT - 9);
+        b->bio.count = BCACHE_BLOCK_SECTORS;
+        b->bio.buffer = b->data;
+        b->bio.end_io = bcache_write_done;
+        b->bio.private = b;
+        blk_submit_bio(b->dev, &b->bio);
+    }
+    blk_finish_plug(&plug);
+    return count;
+}
+
+// Count a device's buffers whose flags under mask equal value
+static uint32_t bcache_count(blk_device_t* dev, uint32_t mask, uint32_t value) {
+    uint32_t count = 0;
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    for (uint32_t i = 0; i < BCACHE_BUFFERS; i++) {
+        buffer_t* b = &bcache_buffers[i];
+        if (b->dev == dev && (b->flags & mask) == value) count++;
+    }
+    spin_unlock_irqrestore(&bcache_lock, flags);
+    return count;
+}
+
+// Write every dirty buffer of a device, wait for them and flush the
+// device's write cache. With dev NULL, every device is synced.
+int bcache_sync(blk_device_t* dev) {
+    if (!dev) {
+        int status = 0;
+        for (blk_device_t* d = blk_next(NULL); d; d = blk_next(d)) {
+            if (bcache_sync(d) != 0) status = HAL_ERROR_IO_ERROR;
+        }
+        return status;
+    }
+
+    bcache_batch_t batch = { 0, 0 };
+    for (;;) {
+        bcache_writeback(dev, true, &batch);
+        while (!wait_event_timeout(bcache_wait, batch.pending == 0, BCACHE_POLL_TICKS)) {
+            bcache_poll(dev);
+        }
+
+        // Buffers dirtied again while being written are still to go
+        if (!bcache_count(dev, BUF_DIRTY, BUF_DIRTY)) break;
+        wait_event_timeout(bcache_wait,
+                           !bcache_count(dev, BUF_DIRTY | BUF_BUSY, BUF_DIRTY | BUF_BUSY),
+                           BCACHE_POLL_TICKS);
+    }
+
+    int status = blk_flush(dev);
+    return batch.errors ? HAL_ERROR_IO_ERROR : status;
+}
+
+// Give up to count clean, unused buffers' frames back to the frame
+// allocator. Called by it when memory runs out. Returns how many were
+// freed.
+uint32_t bcache_shrink(uint32_t count) {
+    uint32_t freed = 0;
+
+    uint32_t flags = spin_lock_irqsave(&bcache_lock);
+    while (freed < count) {
+        buffer_t* b = bcache_evict();
+        if (!b) break;
+        free_frame((uint32_t)b->data);
+        b->data = NULL;
+        b->free_next = bcache_free;
+        bcache_free = b;
+        freed++;
+    }
+    bcache_stats.reclaimed += freed;
+    spin_unlock_irqrestore(&bcache_lock, flags);
+
+    if (freed < count && bcache_dirty) {
+        bcache_kick_writeback();
+    }
+    return freed;
+}
+
+// Write back buffers that have been dirty too long, or all of them when
+// woken because too many are dirty or memory is short
+static void bcache_writeback_thread(void) {
+    for (;;) {
+        wait_event_timeout(bcache_writeback_wait, bcache_kicked, BCACHE_WRITEBACK_INTERVAL);
+        bool all = bcache_kicked;
+        bcache_kicked = false;
+        bcache_writeback(NULL, all, NULL);
+    }
+}
+
+// Set up the buffer headers, start the writeback thread and let the
+// frame allocator reclaim clean buffers
+void bcache_init(void) {
+    for (int i = BCACHE_BUFFERS - 1; i >= 0; i--) {
+        bcache_buffers[i].free_next = bcache_free;
+        bcache_free = &bcache_buffers[i];
+    }
+    memory_register_shrinker(bcache_shrink);
+
+    if (!kthread_create("bcache_writeback", bcache_writeback_thread)) {
+        kprintf("Failed to start buffer cache writeback\n");
+    }
+}
+
+// Buffer cache statistics, or write back or drop the cache:
+// bcache [sync|drop|reset]
+int bcache_cmd_bcache(int argc, char* argv[]) {
+    const char* cmd = argc > 1 ? argv[1] : "";
+
+    if (strcmp(cmd, "") == 0) {
+        uint32_t lookups = bcache_stats.hits + bcache_stats.misses;
+        kprintf("Buffers: %u cached (%u KB), %u dirty, %u max\n", bcache_cached,
+                bcache_cached * (BCACHE_BLOCK_SIZE / 1024), bcache_dirty, BCACHE_BUFFERS);
+        kprintf("Lookups: %u hits, %u misses (%u%% hit)\n", bcache_stats.hits,
+                bcache_stats.misses, lookups ? bcache_stats.hits * 100 / lookups : 0);
+        kprintf("Blocks: %u read, %u written back, %u errors\n", bcache_stats.reads,
+                bcache_stats.writebacks, bcache_stats.errors);
+        kprintf("Evicted: %u reused, %u frames reclaimed\n", bcache_stats.evictions,
+                bcache_stats.reclaimed);
+        kprintf("Readahead: %u prefetched, %u hits, %u misses, %u wasted\n",
+                bcache_stats.ra_blocks, bcache_stats.ra_hits, bcache_stats.ra_misses,
+                bcache_stats.ra_wasted);
+    } else if (strcmp(cmd, "sync") == 0) {
+        if (bcache_sync(NULL) != 0) {
+            kprintf("bcache: write errors during sync\n");
+            return -1;
+        }
+        kprintf("Buffer cache written back\n");
+    } else if (strcmp(cmd, "drop") == 0) {
+        kprintf("Dropped %u clean buffers\n", bcache_shrink(BCACHE_BUFFERS));
+    } else if (strcmp(cmd, "reset") == 0) {
+        memset(&bcache_stats, 0, sizeof(bcache_stats));
+        kprintf("Buffer cache statistics cleared\n");
+    } else {
+        kprintf("usage: bcache [sync|drop|reset]\n");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,477 @@
+#include "blk.h"
+#include "process.h"
+#include "timer.h"
+#include "terminal.h"
+#include "string.h"
+#include "hal.h"
+
+// Registered block devices
+static blk_device_t* blk_devices = NULL;
+static spinlock_t blk_devices_lock = SPINLOCK_INIT;
+
+// Ticks a synchronous caller waits before polling the device
+#define BLK_POLL_TICKS  10
+
+// Add a device. The driver fills in name, nr_sectors, max_sectors,
+// depth, submit and optionally poll and private beforehand.
+void blk_register(blk_device_t* dev) {
+    spin_init(&dev->lock);
+    waitqueue_init(&dev->free_wait);
+    waitqueue_init(&dev->done_wait);
+    dev->free = NULL;
+    for (int i = BLK_QUEUE_REQUESTS - 1; i >= 0; i--) {
+        dev->requests[i].next = dev->free;
+        dev->free = &dev->requests[i];
+    }
+    dev->sorted = NULL;
+    dev->fifo = dev->fifo_tail = NULL;
+    dev->seq = 0;
+    dev->barrier_seq = 0;
+    dev->head = 0;
+    dev->inflight = 0;
+    dev->flushing = false;
+    if (dev->max_sectors == 0) dev->max_sectors = 1;
+    if (dev->depth == 0) dev->depth = 1;
+
+    uint32_t flags = spin_lock_irqsave(&blk_devices_lock);
+    dev->next = blk_devices;
+    blk_devices = dev;
+    spin_unlock_irqrestore(&blk_devices_lock, flags);
+
+    kprintf("blk: %s, %u MB\n", dev->name, (uint32_t)(dev->nr_sectors >> 11));
+}
+
+// Find a device by name
+blk_device_t* blk_find(const char* name) {
+    uint32_t flags = spin_lock_irqsave(&blk_devices_lock);
+    blk_device_t* dev = blk_devices;
+    while (dev && strcmp(dev->name, name) != 0) {
+        dev = dev->next;
+    }
+    spin_unlock_irqrestore(&blk_devices_lock, flags);
+    return dev;
+}
+
+// Registered devices in turn: the first if dev is NULL, otherwise the
+// one after dev, or NULL at the end
+blk_device_t* blk_next(blk_device_t* dev) {
+    uint32_t flags = spin_lock_irqsave(&blk_devices_lock);
+    blk_device_t* next = dev ? dev->next : blk_devices;
+    spin_unlock_irqrestore(&blk_devices_lock, flags);
+    return next;
+}
+
+// Put a request in the sorted queue by sector. The lock is held.
+static void blk_sort_insert(blk_device_t* dev, blk_request_t* rq) {
+    blk_request_t** link = &dev->sorted;
+    while (*link && (*link)->sector <= rq->sector) {
+        link = &(*link)->next;
+    }
+    rq->next = *link;
+    *link = rq;
+}
+
+// Unlink a request from the sorted queue. The lock is held.
+static void blk_sort_remove(blk_device_t* dev, blk_request_t* rq) {
+    blk_request_t** link = &dev->sorted;
+    while (*link && *link != rq) {
+        link = &(*link)->next;
+    }
+    if (*link) *link = rq->next;
+}
+
+// Unlink a request from the arrival queue. The lock is held.
+static void blk_fifo_remove(blk_device_t* dev, blk_request_t* rq) {
+    blk_request_t* prev = NULL;
+    blk_request_t* r = dev->fifo;
+    while (r && r != rq) {
+        prev = r;
+        r = r->fifo_next;
+    }
+    if (!r) return;
+    if (prev) {
+        prev->fifo_next = rq->fifo_next;
+    } else {
+        dev->fifo = rq->fifo_next;
+    }
+    if (dev->fifo_tail == rq) dev->fifo_tail = prev;
+}
+
+// Return a request to the free list. The lock is held.
+static void blk_put_request(blk_device_t* dev, blk_request_t* rq) {
+    rq->next = dev->free;
+    dev->free = rq;
+}
+
+// Check if a bio or request could join a queued request. Only requests
+// that arrived after the latest flush take more I/O, so nothing moves
+// across a barrier. The lock is held.
+static inline bool blk_can_merge(blk_device_t* dev, blk_request_t* rq, uint8_t op,
+                                 uint8_t flags, uint32_t count, uint32_t nbios) {
+    return rq->op == op && rq->flags == flags && rq->seq > dev->barrier_seq &&
+           rq->count + count <= dev->max_sectors && rq->nbios + nbios <= BLK_MAX_SEGMENTS;
+}
+
+// Fold the request after rq in the sorted queue into rq if they are now
+// adjacent. The lock is held.
+static void blk_merge_next(blk_device_t* dev, blk_request_t* rq) {
+    blk_request_t* next = rq->next;
+    if (!next || rq->sector + rq->count != next->sector) return;
+    if (!blk_can_merge(dev, rq, next->op, next->flags, next->count, next->nbios)) return;
+    if (next->seq <= dev->barrier_seq) return;
+
+    rq->bio_tail->next = next->bios;
+    rq->bio_tail = next->bio_tail;
+    rq->nbios += next->nbios;
+    rq->count += next->count;
+    if ((int32_t)(next->deadline - rq->deadline) < 0) {
+        rq->deadline = next->deadline;
+    }
+    rq->next = next->next;
+    blk_fifo_remove(dev, next);
+    blk_put_request(dev, next);
+    dev->merges++;
+}
+
+// Add a read or write bio to a queued request that ends where it starts
+// (back merge) or starts where it ends (front merge). Returns false if
+// there is none. The lock is held.
+static bool blk_merge_bio(blk_device_t* dev, bio_t* bio) {
+    blk_request_t* prev = NULL;
+    for (blk_request_t* rq = dev->sorted; rq; prev = rq, rq = rq->next) {
+        if (!blk_can_merge(dev, rq, bio->op, bio->flags, bio->count, 1)) continue;
+
+        if (rq->sector + rq->count == bio->sector) {
+            bio->next = NULL;
+            rq->bio_tail->next = bio;
+            rq->bio_tail = bio;
+            rq->nbios++;
+            rq->count += bio->count;
+            dev->merges++;
+            blk_merge_next(dev, rq);
+            return true;
+        }
+        if (bio->sector + bio->count == rq->sector) {
+            bio->next = rq->bios;
+            rq->bios = bio;
+            rq->nbios++;
+            rq->sector = bio->sector;
+            rq->count += bio->count;
+            dev->merges++;
+            if (prev && prev->sector + prev->count == rq->sector) {
+                blk_merge_next(dev, prev);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// Queue a bio, merging it if it can be. Sleeps while every request of
+// the device is in use. Does not start any I/O.
+static void blk_queue_bio(blk_device_t* dev, bio_t* bio) {
+    uint32_t flags = spin_lock_irqsave(&dev->lock);
+    dev->bios++;
+    dev->sectors += bio->count;
+
+    if (bio->op != BLK_FLUSH && blk_merge_bio(dev, bio)) {
+        spin_unlock_irqrestore(&dev->lock, flags);
+        return;
+    }
+
+    while (!dev->free) {
+        spin_unlock_irqrestore(&dev->lock, flags);
+        wait_event(dev->free_wait, dev->free != NULL);
+        flags = spin_lock_irqsave(&dev->lock);
+    }
+
+    blk_request_t* rq = dev->free;
+    dev->free = rq->next;
+
+    bio->next = NULL;
+    rq->op = bio->op;
+    rq->flags = bio->flags;
+    rq->sector = bio->sector;
+    rq->count = bio->count;
+    rq->bios = rq->bio_tail = bio;
+    rq->nbios = 1;
+    rq->seq = ++dev->seq;
+    rq->deadline = get_timer_ticks() +
+                   (bio->op == BLK_READ ? BLK_READ_EXPIRE : BLK_WRITE_EXPIRE);
+    rq->dev = dev;
+    rq->next = NULL;
+    rq->fifo_next = NULL;
+
+    if (dev->fifo_tail) {
+        dev->fifo_tail->fifo_next = rq;
+    } else {
+        dev->fifo = rq;
+    }
+    dev->fifo_tail = rq;
+
+    // A flush waits in the arrival queue only; it marks the barrier
+    if (rq->op == BLK_FLUSH) {
+        dev->barrier_seq = rq->seq;
+    } else {
+        blk_sort_insert(dev, rq);
+    }
+    spin_unlock_irqrestore(&dev->lock, flags);
+}
+
+// Choose the next request to dispatch, or NULL if none may go now.
+// Reads and writes ahead of the oldest flush are served by a one-way
+// elevator (C-LOOK) from the last dispatched sector, unless the oldest
+// of them has passed its deadline. The flush itself goes once all of
+// them have completed, and nothing passes it while it runs. The lock
+// is held.
+static blk_request_t* blk_pick(blk_device_t* dev) {
+    if (dev->flushing || !dev->fifo) return NULL;
+
+    blk_request_t* barrier = dev->fifo;
+    while (barrier && barrier->op != BLK_FLUSH) {
+        barrier = barrier->fifo_next;
+    }
+
+    if (barrier == dev->fifo) {
+        if (dev->inflight) return NULL;
+        blk_fifo_remove(dev, barrier);
+        dev->flushing = true;
+        return barrier;
+    }
+
+    blk_request_t* rq = dev->fifo;
+    if ((int32_t)(get_timer_ticks() - rq->deadline) >= 0) {
+        dev->expired++;
+    } else {
+        blk_request_t* first = NULL;
+        rq = NULL;
+        for (blk_request_t* r = dev->sorted; r; r = r->next) {
+            if (barrier && r->seq > barrier->seq) continue;
+            if (!first) first = r;
+            if (r->sector >= dev->head) {
+                rq = r;
+                break;
+            }
+        }
+        if (!rq) rq = first;
+    }
+
+    blk_sort_remove(dev, rq);
+    blk_fifo_remove(dev, rq);
+    dev->head = rq->sector + rq->count;
+    return rq;
+}
+
+// Hand queued requests to the driver until it holds depth of them
+void blk_run_queue(blk_device_t* dev) {
+    for (;;) {
+        uint32_t flags = spin_lock_irqsave(&dev->lock);
+        blk_request_t* rq = dev->inflight < dev->depth ? blk_pick(dev) : NULL;
+        if (rq) {
+            dev->inflight++;
+            dev->dispatched++;
+        }
+        spin_unlock_irqrestore(&dev->lock, flags);
+
+        if (!rq) return;
+        dev->submit(dev, rq);
+    }
+}
+
+// The driver finished a request: end its bios, free it and dispatch more.
+// May be called from an interrupt.
+void blk_end_request(blk_request_t* rq, int status) {
+    blk_device_t* dev = rq->dev;
+
+    bio_t* bio = rq->bios;
+    while (bio) {
+        bio_t* next = bio->next;
+        bio->status = status;
+        bio->end_io(bio);
+        bio = next;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&dev->lock);
+    dev->inflight--;
+    if (rq->op == BLK_FLUSH) {
+        dev->flushing = false;
+    }
+    blk_put_request(dev, rq);
+    spin_unlock_irqrestore(&dev->lock, flags);
+
+    waitqueue_wake_all(&dev->free_wait);
+    blk_run_queue(dev);
+}
+
+// Queue the bios held in a plug and start them, leaving the plug empty
+static void blk_flush_plug(blk_plug_t* plug) {
+    while (plug->bios) {
+        bio_t* list = plug->bios;
+        plug->bios = plug->tail = NULL;
+
+        blk_device_t* last = NULL;
+        while (list) {
+            bio_t* bio = list;
+            list = bio->next;
+            blk_queue_bio(bio->dev, bio);
+            if (last && last != bio->dev) {
+                blk_run_queue(last);
+            }
+            last = bio->dev;
+        }
+        if (last) blk_run_queue(last);
+    }
+}
+
+// Submit a bio; bio->end_io is called when it is done. If the calling
+// process has a plug the bio is held there, otherwise it is queued and
+// dispatched at once. May sleep for a free request.
+void blk_submit_bio(blk_device_t* dev, bio_t* bio) {
+    process_t* proc = current_process;
+    blk_plug_t* plug = proc ? proc->plug : NULL;
+
+    bio->dev = dev;
+    bio->status = 0;
+    bio->next = NULL;
+
+    if (bio->count == 0 && bio->op != BLK_FLUSH) {
+        bio->status = HAL_ERROR_INVALID_PARAMETER;
+        bio->end_io(bio);
+        return;
+    }
+    if (bio->sector + bio->count > dev->nr_sectors) {
+        bio->status = HAL_ERROR_INVALID_PARAMETER;
+        bio->end_io(bio);
+        return;
+    }
+
+    // Flushes keep their place: what was plugged before them goes first
+    if (plug && bio->op == BLK_FLUSH) {
+        blk_flush_plug(plug);
+        plug = NULL;
+    }
+
+    if (plug) {
+        if (plug->tail) {
+            plug->tail->next = bio;
+        } else {
+            plug->bios = bio;
+        }
+        plug->tail = bio;
+        return;
+    }
+
+    blk_queue_bio(dev, bio);
+    blk_run_queue(dev);
+}
+
+// Hold the calling process's bios back so a batch of them can be merged
+// before any is dispatched. Plugs do not nest.
+void blk_start_plug(blk_plug_t* plug) {
+    plug->bios = plug->tail = NULL;
+    process_t* proc = current_process;
+    if (proc && !proc->plug) {
+        proc->plug = plug;
+    }
+}
+
+// Submit everything held since blk_start_plug
+void blk_finish_plug(blk_plug_t* plug) {
+    process_t* proc = current_process;
+    if (proc && proc->plug == plug) {
+        proc->plug = NULL;
+    }
+    blk_flush_plug(plug);
+}
+
+// Completion of a bio made by blk_wait_bio. The bio may belong to the
+// waiter and be gone once the flag is set, so the queue is looked up first.
+static void blk_wait_done(bio_t* bio) {
+    waitqueue_t* done_wait = &bio->dev->done_wait;
+    volatile bool* finished = bio->private;
+    __sync_synchronize();
+    *finished = true;
+    waitqueue_wake_all(done_wait);
+}
+
+// Submit a bio and sleep until it is done. Bios the caller holds in a
+// plug go first. If completions stop coming (e.g. the interrupt is
+// masked) the device is polled.
+static int blk_wait_bio(blk_device_t* dev, bio_t* bio) {
+    volatile bool finished = false;
+    process_t* proc = current_process;
+
+    if (proc && proc->plug) {
+        blk_flush_plug(proc->plug);
+    }
+
+    bio->end_io = blk_wait_done;
+    bio->private = (void*)&finished;
+    bio->dev = dev;
+    blk_queue_bio(dev, bio);
+    blk_run_queue(dev);
+
+    while (!wait_event_timeout(dev->done_wait, finished, BLK_POLL_TICKS)) {
+        if (dev->poll) dev->poll(dev);
+    }
+    return bio->status;
+}
+
+// Read or write sectors and wait for them
+int blk_rw(blk_device_t* dev, uint8_t op, uint64_t sector, uint32_t count, void* buffer) {
+    if (op != BLK_READ && op != BLK_WRITE) return HAL_ERROR_INVALID_PARAMETER;
+    if (count == 0 || sector + count > dev->nr_sectors) return HAL_ERROR_INVALID_PARAMETER;
+
+    bio_t bio;
+    memset(&bio, 0, sizeof(bio));
+    bio.op = op;
+    bio.sector = sector;
+    bio.count = count;
+    bio.buffer = buffer;
+    return blk_wait_bio(dev, &bio);
+}
+
+// Make every write completed so far durable, and wait for it
+int blk_flush(blk_device_t* dev) {
+    bio_t bio;
+    memset(&bio, 0, sizeof(bio));
+    bio.op = BLK_FLUSH;
+    return blk_wait_bio(dev, &bio);
+}
+
+// Queue statistics of every block device: blkstat [reset]
+int blk_cmd_blkstat(int argc, char* argv[]) {
+    bool reset = argc == 2 && strcmp(argv[1], "reset") == 0;
+    if (argc > 1 && !reset) {
+        kprintf("usage: blkstat [reset]\n");
+        return -1;
+    }
+
+    if (!reset) {
+        kprintf("DEV   BIOS      MERGES    REQUESTS  AVG KB  EXPIRED  QUEUED  INFLIGHT\n");
+    }
+    uint32_t flags = spin_lock_irqsave(&blk_devices_lock);
+    for (blk_device_t* dev = blk_devices; dev; dev = dev->next) {
+        uint32_t dev_flags = spin_lock_irqsave(&dev->lock);
+        if (reset) {
+            dev->bios = dev->merges = dev->dispatched = dev->expired = 0;
+            dev->sectors = 0;
+        } else {
+            uint32_t queued = 0;
+            for (blk_request_t* rq = dev->fifo; rq; rq = rq->fifo_next) {
+                queued++;
+            }
+            uint32_t kb = (uint32_t)(dev->sectors >> 1);
+            kprintf("%s  %u  %u  %u  %u  %u  %u  %u\n", dev->name, dev->bios, dev->merges,
+                    dev->dispatched, dev->dispatched ? kb / dev->dispatched : 0,
+                    dev->expired, queued, dev->inflight);
+        }
+        spin_unlock_irqrestore(&dev->lock, dev_flags);
+    }
+    spin_unlock_irqrestore(&blk_devices_lock, flags);
+
+    if (reset) {
+        kprintf("Block statistics cleared\n");
+    }
+    return 0;
+}
@@ -2,6 +2,23 @@
 #include "terminal.h"
 #include "string.h"
 #include "process.h"
+#include "smp.h"
+#include "sched.h"
+#include "syscall.h"
+#include "vm.h"
+#include "elf.h"
+#include "signal.h"
+#include "trace.h"
+#include "prof.h"
+#include "acct.h"
+#include "softirq.h"
+#include "workqueue.h"
+#include "irqstat.h"
+#include "irq.h"
+#include "blk.h"
+#include "bcache.h"
+#include "fs.h"
+#include "vfs.h"
 
 #define MAX_COMMANDS 32
 #define MAX_ARGS 16
@@ -18,10 +35,35 @@ static int num_commands = 0;
 int cmd_help(int argc, char* argv[]);
 int cmd_make(int argc, char* argv[]);
 
+// ATA benchmark (drivers/storage/ata.c)
+int ata_cmd_atabench(int argc, char* argv[]);
+
 // Initialize command system
 void command_init(void) {
     command_register("make", "Compile and build programs", cmd_make);
     command_register("help", "Display available commands", cmd_help);
+    command_register("cpus", "Show per-CPU scheduler state", smp_cmd_cpus);
+    command_register("schedbench", "Measure wakeup-to-run latency under load", sched_cmd_schedbench);
+    command_register("lockstat", "Show lock contention statistics", spin_cmd_lockstat);
+    command_register("syscalls", "Show system call counts and latency", syscall_cmd_syscalls);
+    command_register("syscallbench", "Compare int 0x80 and sysenter system call cost", syscall_cmd_syscallbench);
+    command_register("vmstat", "Show demand paging statistics", vm_cmd_vmstat);
+    command_register("spawn", "Run a program and wait for it", elf_cmd_spawn);
+    command_register("spawnbench", "Measure process spawn latency", elf_cmd_spawnbench);
+    command_register("kill", "Send a signal to a process", signal_cmd_kill);
+    command_register("trace", "Record scheduler and interrupt events", trace_cmd_trace);
+    command_register("prof", "Sample kernel hot spots from the timer", prof_cmd_prof);
+    command_register("top", "Show per-process CPU, faults, switches and I/O", acct_cmd_top);
+    command_register("softirqs", "Show softirq runs per CPU", softirq_cmd_softirqs);
+    command_register("workqueues", "Show queued and completed deferred work", workqueue_cmd_workqueues);
+    command_register("irqstat", "Show interrupt handler times and interrupts-off windows", irqstat_cmd_irqstat);
+    command_register("irqs", "Show interrupt routing; irqs affinity <vector> <cpu>", irq_cmd_irqs);
+    command_register("atabench", "Compare ATA PIO/DMA reads or write flush modes", ata_cmd_atabench);
+    command_register("blkstat", "Show block queue merges, request sizes and depth", blk_cmd_blkstat);
+    command_register("bcache", "Show buffer cache, readahead and writeback; bcache sync|drop", bcache_cmd_bcache);
+    command_register("ls", "List a directory: ls [path]", fs_cmd_ls);
+    command_register("mount", "Show mounts or mount one: mount [device|ramfs path]", vfs_cmd_mount);
+    command_register("dcache", "Show dentry cache hits and size; dcache drop", vfs_cmd_dcache);
 }
 
 // Register a new command
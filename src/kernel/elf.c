@@ -0,0 +1,562 @@
+#include "elf.h"
+#include "vm.h"
+#include "fs.h"
+#include "workqueue.h"
+#include "gdt.h"
+#include "process.h"
+#include "syscall.h"
+#include "terminal.h"
+#include "string.h"
+
+// Loaded images, one per executable file
+static elf_image_t* elf_images = NULL;
+static spinlock_t elf_images_lock = SPINLOCK_INIT;
+
+// Images whose last reference is gone. Letting go of the file sleeps on
+// vfs_lock, and the last reference may be dropped while switching away
+// from an exited process, so a worker does it.
+static elf_image_t* elf_images_dead = NULL;
+static void elf_image_release(work_t* work);
+static work_t elf_release_work = WORK_INIT(elf_image_release);
+
+// Read part of an image's file
+bool elf_image_read(elf_image_t* image, void* buffer, uint32_t size, uint32_t offset) {
+    return fs_pread_held(image->dentry, buffer, size, offset) == (int)size;
+}
+
+// Check the headers of an image and load its program headers
+static bool elf_image_validate(elf_image_t* image) {
+    Elf32_Ehdr ehdr;
+    if (!elf_image_read(image, &ehdr, sizeof(ehdr), 0)) return false;
+
+    if (*(uint32_t*)ehdr.e_ident != ELF_MAGIC ||
+        ehdr.e_ident[4] != ELFCLASS32 || ehdr.e_ident[5] != ELFDATA2LSB ||
+        ehdr.e_type != ET_EXEC || ehdr.e_machine != EM_386 ||
+        ehdr.e_version != EV_CURRENT) {
+        return false;
+    }
+    if (ehdr.e_phentsize != sizeof(Elf32_Phdr) || ehdr.e_phnum == 0 ||
+        ehdr.e_phnum > ELF_MAX_PHDRS) {
+        return false;
+    }
+    if (!elf_image_read(image, image->phdrs, ehdr.e_phnum * sizeof(Elf32_Phdr), ehdr.e_phoff)) {
+        return false;
+    }
+
+    for (int i = 0; i < ehdr.e_phnum; i++) {
+        Elf32_Phdr* ph = &image->phdrs[i];
+        if (ph->p_type != PT_LOAD) continue;
+
+        // Pages are read straight from the file, so file offsets and
+        // addresses must agree within a page
+        if (ph->p_filesz > ph->p_memsz ||
+            ph->p_offset > image->size || ph->p_filesz > image->size - ph->p_offset ||
+            ph->p_vaddr < USER_SPACE_START || ph->p_memsz > USER_STACK_TOP - ph->p_vaddr ||
+            (ph->p_vaddr & (PAGE_SIZE - 1)) != (ph->p_offset & (PAGE_SIZE - 1))) {
+            return false;
+        }
+    }
+
+    image->entry = ehdr.e_entry;
+    image->phnum = ehdr.e_phnum;
+    return true;
+}
+
+// Get the image of an executable, loading its headers on first use.
+// Returns a counted reference, or NULL if the file is missing or invalid.
+elf_image_t* elf_image_get(const char* path) {
+    uint32_t size;
+    struct dentry* dentry = fs_hold(path, &size);
+    if (!dentry) return NULL;
+
+    uint32_t flags = spin_lock_irqsave(&elf_images_lock);
+    for (elf_image_t* image = elf_images; image; image = image->next) {
+        if (image->dentry == dentry) {
+            image->refcount++;
+            spin_unlock_irqrestore(&elf_images_lock, flags);
+            fs_release(dentry);
+            return image;
+        }
+    }
+    spin_unlock_irqrestore(&elf_images_lock, flags);
+
+    elf_image_t* image = kmalloc(sizeof(elf_image_t));
+    if (!image) {
+        fs_release(dentry);
+        return NULL;
+    }
+
+    memset(image, 0, sizeof(elf_image_t));
+    image->dentry = dentry;
+    image->size = size;
+    image->refcount = 1;
+    spin_init(&image->lock);
+
+    uint32_t npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    image->text_frames = kmalloc(npages * sizeof(uint32_t));
+    if (!image->text_frames || !elf_image_validate(image)) {
+        kfree(image->text_frames);
+        kfree(image);
+        fs_release(dentry);
+        return NULL;
+    }
+    memset(image->text_frames, 0, npages * sizeof(uint32_t));
+
+    // Another process may have loaded it meanwhile; keep the first copy
+    flags = spin_lock_irqsave(&elf_images_lock);
+    for (elf_image_t* other = elf_images; other; other = other->next) {
+        if (other->dentry == dentry) {
+            other->refcount++;
+            spin_unlock_irqrestore(&elf_images_lock, flags);
+            kfree(image->text_frames);
+            kfree(image);
+            fs_release(dentry);
+            return other;
+        }
+    }
+    image->next = elf_images;
+    elf_images = image;
+    spin_unlock_irqrestore(&elf_images_lock, flags);
+
+    return image;
+}
+
+// Take another reference to an image
+void elf_image_ref(elf_image_t* image) {
+    uint32_t flags = spin_lock_irqsave(&elf_images_lock);
+    image->refcount++;
+    spin_unlock_irqrestore(&elf_images_lock, flags);
+}
+
+// Drop a reference; the last one frees the image and its shared pages
+void elf_image_put(elf_image_t* image) {
+    uint32_t flags = spin_lock_irqsave(&elf_images_lock);
+    if (--image->refcount) {
+        spin_unlock_irqrestore(&elf_images_lock, flags);
+        return;
+    }
+
+    for (elf_image_t** link = &elf_images; *link; link = &(*link)->next) {
+        if (*link == image) {
+            *link = image->next;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&elf_images_lock, flags);
+
+    uint32_t npages = (image->size + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (uint32_t i = 0; i < npages; i++) {
+        if (image->text_frames[i]) {
+            free_frame(image->text_frames[i]);
+        }
+    }
+    kfree(image->text_frames);
+
+    flags = spin_lock_irqsave(&elf_images_lock);
+    image->next = elf_images_dead;
+    elf_images_dead = image;
+    spin_unlock_irqrestore(&elf_images_lock, flags);
+    schedule_work(&elf_release_work);
+}
+
+// Worker: close the files of released images and free them
+static void elf_image_release(work_t* work) {
+    (void)work;
+
+    uint32_t flags = spin_lock_irqsave(&elf_images_lock);
+    elf_image_t* image = elf_images_dead;
+    elf_images_dead = NULL;
+    spin_unlock_irqrestore(&elf_images_lock, flags);
+
+    while (image) {
+        elf_image_t* next = image->next;
+        fs_release(image->dentry);
+        kfree(image);
+        image = next;
+    }
+}
+
+// Get the shared frame holding a page-aligned file offset, reading it on
+// first use; *loaded tells whether this call read it. Returns 0 if it
+// cannot be read. The read sleeps in the file system, so it runs without
+// the image lock; of two processes reading the same page, the first to
+// install its frame wins and the other frees its copy.
+uint32_t elf_image_shared_page(elf_image_t* image, uint32_t offset, bool* loaded) {
+    uint32_t index = offset / PAGE_SIZE;
+    *loaded = false;
+
+    uint32_t flags = spin_lock_irqsave(&image->lock);
+    uint32_t frame = image->text_frames[index];
+    spin_unlock_irqrestore(&image->lock, flags);
+    if (frame) return frame;
+
+    uint32_t copy = alloc_frame();
+    if (!copy) return 0;
+    if (!elf_image_read(image, (void*)copy, PAGE_SIZE, offset)) {
+        free_frame(copy);
+        return 0;
+    }
+
+    flags = spin_lock_irqsave(&image->lock);
+    frame = image->text_frames[index];
+    if (!frame) {
+        frame = image->text_frames[index] = copy;
+        *loaded = true;
+    }
+    spin_unlock_irqrestore(&image->lock, flags);
+
+    if (frame != copy) {
+        free_frame(copy);
+    }
+    return frame;
+}
+
+// A user address space built for exec or spawn
+typedef struct {
+    page_directory_t* dir;
+    vm_area_t* areas;
+    uint32_t entry;
+    uint32_t esp;
+} exec_space_t;
+
+// Count a NULL-terminated string vector and the bytes of its strings
+static int exec_count_strings(char* const vec[], uint32_t* bytes) {
+    int count = 0;
+    for (; vec && vec[count]; count++) {
+        *bytes += strlen(vec[count]) + 1;
+    }
+    return count;
+}
+
+// Copy a string vector onto a new stack: the strings go at *str, their
+// user addresses and a terminating NULL at *slot
+static bool exec_copy_vector(exec_space_t* space, char* const vec[], int count,
+                             uint32_t* str, uint32_t* slot) {
+    for (int i = 0; i <= count; i++) {
+        uint32_t ptr = 0;
+        if (i < count) {
+            uint32_t len = strlen(vec[i]) + 1;
+            if (!vm_copy_out(space->dir, space->areas, *str, vec[i], len)) return false;
+            ptr = *str;
+            *str += len;
+        }
+        if (!vm_copy_out(space->dir, space->areas, *slot, &ptr, sizeof(ptr))) return false;
+        *slot += sizeof(ptr);
+    }
+    return true;
+}
+
+// Build the initial user stack: argc, argv[], NULL, envp[], NULL, then the
+// strings. Only the stack pages written here are filled in.
+static bool exec_build_stack(exec_space_t* space, char* const argv[], char* const envp[]) {
+    uint32_t bytes = 0;
+    int argc = exec_count_strings(argv, &bytes);
+    int envc = exec_count_strings(envp, &bytes);
+    if (bytes > EXEC_ARG_MAX) return false;
+
+    uint32_t str = USER_STACK_TOP - bytes;
+    uint32_t slot = (str - (argc + envc + 3) * sizeof(uint32_t)) & ~0xF;
+    space->esp = slot;
+
+    uint32_t count = argc;
+    if (!vm_copy_out(space->dir, space->areas, slot, &count, sizeof(count))) return false;
+    slot += sizeof(count);
+
+    return exec_copy_vector(space, argv, argc, &str, &slot) &&
+           exec_copy_vector(space, envp, envc, &str, &slot);
+}
+
+// Free an address space that was never entered
+static void exec_free(exec_space_t* space) {
+    vm_release(space->dir, &space->areas);
+    free_page_directory(space->dir);
+}
+
+// Build the address space of an executable without touching the caller's.
+// Segments are only mapped; their pages are read from the file when first
+// touched. The arguments are read from the caller's address space.
+static bool exec_build(const char* path, char* const argv[], char* const envp[],
+                       exec_space_t* space) {
+    elf_image_t* image = elf_image_get(path);
+    if (!image) return false;
+
+    space->dir = create_page_directory();
+    space->areas = NULL;
+    space->entry = image->entry;
+    bool ok = space->dir != NULL;
+
+    for (int i = 0; ok && i < image->phnum; i++) {
+        Elf32_Phdr* ph = &image->phdrs[i];
+        if (ph->p_type != PT_LOAD || ph->p_memsz == 0) continue;
+
+        uint32_t start = ph->p_vaddr & ~(PAGE_SIZE - 1);
+        uint32_t end = (ph->p_vaddr + ph->p_memsz + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        uint32_t lead = ph->p_vaddr - start;
+        uint32_t flags = VM_READ;
+        if (ph->p_flags & PF_W) flags |= VM_WRITE;
+        if (ph->p_flags & PF_X) flags |= VM_EXEC;
+
+        ok = vm_map(&space->areas, start, end, flags, image, ph->p_offset - lead, ph->p_filesz + lead);
+    }
+    if (ok) {
+        ok = vm_map(&space->areas, USER_STACK_TOP - USER_STACK_PAGES * PAGE_SIZE, USER_STACK_TOP,
+                    VM_READ | VM_WRITE, NULL, 0, 0);
+    }
+
+    // The areas hold their own references now
+    elf_image_put(image);
+
+    if (ok) {
+        ok = exec_build_stack(space, argv, envp);
+    }
+    if (!ok && space->dir) {
+        exec_free(space);
+    }
+    return ok;
+}
+
+// Process name for an executable: the last component of its path
+static const char* exec_name(const char* path) {
+    const char* name = path;
+    for (const char* p = path; *p; p++) {
+        if (*p == '/') name = p + 1;
+    }
+    return name;
+}
+
+// Replace the calling process's program with an executable.
+// Does not return on success.
+int elf_exec(const char* path, char* const argv[], char* const envp[]) {
+    process_t* current = current_process;
+
+    // The idle process runs on a boot stack and must stay in the kernel
+    if (current == this_cpu()->idle) return -1;
+
+    exec_space_t space;
+    if (!exec_build(path, argv, envp, &space)) return -1;
+
+    // Point of no return: switch to the new address space and drop the old
+    page_directory_t* old_dir = current->page_directory;
+    vm_area_t* old_areas = current->vmas;
+    current->page_directory = space.dir;
+    current->vmas = space.areas;
+    switch_page_directory(space.dir);
+
+    vm_release(old_dir, &old_areas);
+    if (old_dir != get_kernel_page_directory()) {
+        free_page_directory(old_dir);
+    }
+
+    signal_exec(current);
+    strncpy(current->name, exec_name(path), MAX_PROCESS_NAME - 1);
+    current->name[MAX_PROCESS_NAME - 1] = '\0';
+
+    // Enter the program in user mode on top of a fresh kernel stack
+    uint32_t entry = space.entry;
+    uint32_t esp = space.esp;
+    current->flags = (current->flags & ~PROCESS_FLAG_KERNEL) | PROCESS_FLAG_USER;
+    current->kernel_stack_top = current->stack + current->stack_size;
+    current->user_stack_top = USER_STACK_TOP;
+    current->context.cs = GDT_USER_CODE_SEGMENT;
+    current->context.ds = GDT_USER_DATA_SEGMENT;
+    current->context.es = GDT_USER_DATA_SEGMENT;
+    current->context.fs = GDT_USER_DATA_SEGMENT;
+    current->context.gs = GDT_USER_DATA_SEGMENT;
+    current->context.ss = GDT_USER_DATA_SEGMENT;
+    current->context.eip = entry;
+    current->context.esp = esp;
+    current->context.eflags = 0x202;
+    tss_set_kernel_stack(current->kernel_stack_top);
+    acct_kernel_exit(&current->acct);
+
+    asm volatile(
+        "cli\n"
+        "mov %0, %%ax\n"
+        "mov %%ax, %%ds\n"
+        "mov %%ax, %%es\n"
+        "mov %%ax, %%fs\n"
+        "mov %%ax, %%gs\n"
+        "mov %5, %%esp\n"
+        "push %0\n"        // ss
+        "push %1\n"        // esp
+        "push %2\n"        // eflags
+        "push %3\n"        // cs
+        "push %4\n"        // eip
+        "iret\n"
+        :
+        : "i"(GDT_USER_DATA_SEGMENT),
+          "r"(esp),
+          "i"(0x202),
+          "i"(GDT_USER_CODE_SEGMENT),
+          "r"(entry),
+          "r"(current->kernel_stack_top)
+        : "eax", "memory"
+    );
+    __builtin_unreachable();
+}
+
+// Start an executable in a new child process. The child's address space is
+// built straight from the file; nothing of the caller's is copied. Returns
+// the child's pid, or -1.
+int elf_spawn(const char* path, char* const argv[], char* const envp[]) {
+    exec_space_t space;
+    if (!exec_build(path, argv, envp, &space)) return -1;
+
+    process_t* child = process_create_user(exec_name(path), space.dir, space.areas,
+                                           space.entry, space.esp);
+    if (!child) {
+        exec_free(&space);
+        return -1;
+    }
+    return child->pid;
+}
+
+// Wait for a particular child to exit; returns its exit status
+static int exec_wait_child(int pid) {
+    int status = -1;
+    int reaped;
+    do {
+        reaped = sys_wait(&status);
+    } while (reaped != pid && reaped >= 0);
+    return status;
+}
+
+// Run a program and wait for it: spawn <path> [args...]
+int elf_cmd_spawn(int argc, char* argv[]) {
+    if (argc < 2) {
+        kprintf("usage: spawn <path> [args...]\n");
+        return -1;
+    }
+
+    char* envp[] = { NULL };
+    int pid = sys_spawn(argv[1], &argv[1], envp);
+    if (pid < 0) {
+        kprintf("spawn: cannot run %s\n", argv[1]);
+        return -1;
+    }
+
+    kprintf("%s exited with status %d\n", argv[1], exec_wait_child(pid));
+    return 0;
+}
+
+// Run a program in a child and wait for it: *status gets its exit status.
+// Returns -1 if it could not be started.
+int elf_run(const char* path, int* status) {
+    char* argv[] = { (char*)path, NULL };
+    char* envp[] = { NULL };
+    int pid = sys_spawn(path, argv, envp);
+    if (pid < 0) return -1;
+
+    *status = exec_wait_child(pid);
+    return 0;
+}
+
+typedef struct {
+    Elf32_Ehdr ehdr;
+    Elf32_Phdr phdr;
+    uint8_t code[ELF_FLAT_CODE_MAX];
+} __attribute__((packed)) elf_flat_image_t;
+
+// Write a minimal executable: one read-only segment holding the headers
+// and size bytes of code, which starts at ELF_FLAT_ENTRY
+bool elf_install_flat(const char* path, const uint8_t* code, uint32_t size) {
+    if (size > ELF_FLAT_CODE_MAX) return false;
+
+    elf_flat_image_t image;
+    uint32_t length = offsetof(elf_flat_image_t, code) + size;
+    memset(&image, 0, sizeof(image));
+    *(uint32_t*)image.ehdr.e_ident = ELF_MAGIC;
+    image.ehdr.e_ident[4] = ELFCLASS32;
+    image.ehdr.e_ident[5] = ELFDATA2LSB;
+    image.ehdr.e_ident[6] = EV_CURRENT;
+    image.ehdr.e_type = ET_EXEC;
+    image.ehdr.e_machine = EM_386;
+    image.ehdr.e_version = EV_CURRENT;
+    image.ehdr.e_entry = ELF_FLAT_ENTRY;
+    image.ehdr.e_phoff = offsetof(elf_flat_image_t, phdr);
+    image.ehdr.e_ehsize = sizeof(Elf32_Ehdr);
+    image.ehdr.e_phentsize = sizeof(Elf32_Phdr);
+    image.ehdr.e_phnum = 1;
+    image.phdr.p_type = PT_LOAD;
+    image.phdr.p_vaddr = ELF_FLAT_BASE;
+    image.phdr.p_paddr = ELF_FLAT_BASE;
+    image.phdr.p_filesz = length;
+    image.phdr.p_memsz = length;
+    image.phdr.p_flags = PF_R | PF_X;
+    image.phdr.p_align = PAGE_SIZE;
+    memcpy(image.code, code, size);
+
+    fs_mkdir("/bin");
+    int fd = fs_create(path);
+    if (fd < 0) return false;
+
+    bool written = fs_write(fd, &image, length) == (int)length;
+    fs_close(fd);
+    return written;
+}
+
+// A minimal executable that exits at once: SYS_EXIT(0) through int 0x80
+#define SPAWN_BENCH_PATH  "/bin/true"
+#define SPAWN_BENCH_ITERATIONS 1000
+
+// Create the benchmark executable unless it already exists
+static bool spawn_bench_install(void) {
+    if (fs_exists(SPAWN_BENCH_PATH)) return true;
+
+    static const uint8_t code[] = {
+        0xB8, SYS_EXIT, 0x00, 0x00, 0x00,  // mov eax, SYS_EXIT
+        0x31, 0xDB,                        // xor ebx, ebx
+        0xCD, SYSCALL_VECTOR,              // int 0x80
+        0xEB, 0xFE,                        // jmp $
+    };
+    return elf_install_flat(SPAWN_BENCH_PATH, code, sizeof(code));
+}
+
+// Measure spawn latency: spawnbench [iterations] [path]
+int elf_cmd_spawnbench(int argc, char* argv[]) {
+    uint32_t iterations = SPAWN_BENCH_ITERATIONS;
+    if (argc > 1) {
+        iterations = 0;
+        for (const char* p = argv[1]; *p >= '0' && *p <= '9'; p++) {
+            iterations = iterations * 10 + (*p - '0');
+        }
+        if (!iterations) {
+            kprintf("usage: spawnbench [iterations] [path]\n");
+            return -1;
+        }
+    }
+
+    char* path = argc > 2 ? argv[2] : SPAWN_BENCH_PATH;
+    if (argc <= 2 && !spawn_bench_install()) {
+        kprintf("spawnbench: cannot create %s\n", SPAWN_BENCH_PATH);
+        return -1;
+    }
+
+    char* child_argv[] = { path, NULL };
+    char* envp[] = { NULL };
+    uint64_t spawn_total = 0, total = 0;
+    uint64_t best = ~0ULL, worst = 0;
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint64_t start = rdtsc();
+        int pid = sys_spawn(path, child_argv, envp);
+        uint64_t spawned = rdtsc();
+        if (pid < 0) {
+            kprintf("spawnbench: cannot run %s\n", path);
+            return -1;
+        }
+        exec_wait_child(pid);
+        uint64_t cycles = rdtsc() - start;
+
+        spawn_total += spawned - start;
+        total += cycles;
+        if (cycles < best) best = cycles;
+        if (cycles > worst) worst = cycles;
+    }
+
+    kprintf("%u spawns of %s\n", iterations, path);
+    kprintf("sys_spawn:      %u us avg\n", tsc_to_us(spawn_total) / iterations);
+    kprintf("spawn to reap:  %u us avg, %u us min, %u us max\n",
+            tsc_to_us(total) / iterations, tsc_to_us(best), tsc_to_us(worst));
+    return 0;
+}
@@ -1,17 +1,68 @@
- #include "fs.h"
-#include "kheap.h"
+#include "fs.h"
+#include "vfs.h"
+#include "myfs.h"
+#include "ramfs.h"
+#include "blk.h"
 #include "terminal.h"
 #include "string.h"
+#include "acct.h"
 
-#define MAX_FILES 256
-#define MAX_FILENAME 256
+fs_node_t* fs_root = NULL;
 
+// Open files; the table changes only under vfs_lock
 static file_t files[MAX_FILES];
 
+// Mount the root file system from the first block device holding one, or
+// a ramfs if none does, and a ramfs on /tmp
 void fs_init(void) {
     for (int i = 0; i < MAX_FILES; i++) {
         files[i].used = false;
     }
+
+    mutex_lock(&vfs_lock);
+    for (blk_device_t* dev = blk_next(NULL); dev && !fs_root; dev = blk_next(dev)) {
+        fs_node_t* root = myfs_mount(dev);
+        if (root) vfs_mount("/", root, dev->name, "myfs");
+    }
+    if (!fs_root) {
+        terminal_writestring("fs: no MyFS volume found, using a RAM root (see tools/mkfs_myfs.py)\n");
+        if (vfs_mount("/", ramfs_mount(), "ramfs", "ramfs") != 0) {
+            terminal_writestring("fs: cannot mount a RAM root either, no file system\n");
+        }
+    }
+    mutex_unlock(&vfs_lock);
+    if (!fs_root) return;
+
+    fs_mkdir("/tmp");
+    mutex_lock(&vfs_lock);
+    vfs_mount("/tmp", ramfs_mount(), "ramfs", "ramfs");
+    mutex_unlock(&vfs_lock);
+}
+
+uint32_t read_fs(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+    return node->read ? node->read(node, offset, size, buffer) : 0;
+}
+
+uint32_t write_fs(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+    return node->write ? node->write(node, offset, size, buffer) : 0;
+}
+
+void open_fs(fs_node_t* node) {
+    if (node->open) node->open(node);
+}
+
+void close_fs(fs_node_t* node) {
+    if (node->close) node->close(node);
+}
+
+struct dirent* readdir_fs(fs_node_t* node, uint32_t index) {
+    if (!(node->flags & FS_DIRECTORY) || !node->readdir) return NULL;
+    return node->readdir(node, index);
+}
+
+fs_node_t* finddir_fs(fs_node_t* node, char* name) {
+    if (!(node->flags & FS_DIRECTORY) || !node->finddir) return NULL;
+    return node->finddir(node, name);
 }
 
 static int find_unused_fd(void) {
@@ -23,92 +74,150 @@ static int find_unused_fd(void) {
     return -1;  // No free file descriptors
 }
 
-int fs_open(const char* filename, uint8_t flags) {
+static inline bool fs_valid_fd(int fd) {
+    return fd >= 0 && fd < MAX_FILES && files[fd].used;
+}
+
+// Node of an open descriptor
+static inline fs_node_t* fs_node(int fd) {
+    return files[fd].dentry->node;
+}
+
+// Give a dentry a descriptor, which takes over the caller's reference.
+// The caller holds vfs_lock.
+static int fs_open_dentry(dentry_t* dentry, uint8_t flags) {
     int fd = find_unused_fd();
     if (fd < 0) {
-        return -1;  // No free file descriptors
+        dput(dentry);
+        return -1;
     }
 
     files[fd].used = true;
-    files[fd].position = 0;
-    files[fd].size = 0;
-    strncpy(files[fd].name, filename, MAX_FILENAME - 1);
-    files[fd].name[MAX_FILENAME - 1] = '\0';
-
-    if (flags & FS_OPEN_CREATE) {
-        files[fd].data = kmalloc(MAX_FILE_SIZE);
-        if (!files[fd].data) {
-            files[fd].used = false;
-            return -1;
-        }
+    files[fd].dentry = dentry;
+    files[fd].flags = flags;
+    files[fd].position = (flags & FS_OPEN_APPEND) ? dentry->node->length : 0;
+    open_fs(dentry->node);
+    return fd;
+}
+
+// Dentry of a path, created as a file or directory of type if it is
+// missing and type is not 0. Returns it with a reference, or NULL.
+static dentry_t* fs_lookup_create(const char* path, uint32_t type) {
+    char name[VFS_NAME_MAX + 1];
+
+    dentry_t* dentry = vfs_lookup(path);
+    if (dentry || !type) return dentry;
+
+    dentry_t* dir = vfs_lookup_parent(path, name);
+    if (!dir) return NULL;
+    dentry = vfs_lookup_child(dir, name);
+    dput(dir);
+
+    if (dentry && !dentry->node && vfs_create(dentry, type) < 0) {
+        dput(dentry);
+        return NULL;
     }
+    return dentry;
+}
 
+int fs_open(const char* filename, uint8_t flags) {
+    mutex_lock(&vfs_lock);
+    dentry_t* dentry = fs_lookup_create(filename, (flags & FS_OPEN_CREATE) ? FS_FILE : 0);
+
+    // Directories are read with readdir, not through descriptors
+    int fd = -1;
+    if (dentry && !(dentry->node->flags & FS_DIRECTORY)) {
+        fd = fs_open_dentry(dentry, flags);
+    } else {
+        dput(dentry);
+    }
+    mutex_unlock(&vfs_lock);
     return fd;
 }
 
 int fs_write(int fd, const void* buffer, uint32_t size) {
-    if (fd < 0 || fd >= MAX_FILES || !files[fd].used || !files[fd].data) {
+    mutex_lock(&vfs_lock);
+    if (!fs_valid_fd(fd) || !(files[fd].flags & FS_OPEN_WRITE)) {
+        mutex_unlock(&vfs_lock);
         return -1;
     }
 
-    if (files[fd].position + size > MAX_FILE_SIZE) {
-        size = MAX_FILE_SIZE - files[fd].position;
-    }
-
-    memcpy((uint8_t*)files[fd].data + files[fd].position, buffer, size);
-    files[fd].position += size;
-
-    if (files[fd].position > files[fd].size) {
-        files[fd].size = files[fd].position;
+    file_t* file = &files[fd];
+    if (file->flags & FS_OPEN_APPEND) {
+        file->position = fs_node(fd)->length;
     }
+    size = write_fs(fs_node(fd), file->position, size, (uint8_t*)buffer);
+    file->position += size;
+    mutex_unlock(&vfs_lock);
 
+    acct_io(true, size);
     return size;
 }
 
 int fs_read(int fd, void* buffer, uint32_t size) {
-    if (fd < 0 || fd >= MAX_FILES || !files[fd].used || !files[fd].data) {
+    mutex_lock(&vfs_lock);
+    if (!fs_valid_fd(fd)) {
+        mutex_unlock(&vfs_lock);
         return -1;
     }
 
-    if (files[fd].position + size > files[fd].size) {
-        size = files[fd].size - files[fd].position;
+    file_t* file = &files[fd];
+    size = read_fs(fs_node(fd), file->position, size, buffer);
+    file->position += size;
+    mutex_unlock(&vfs_lock);
+
+    acct_io(false, size);
+    return size;
+}
+
+// Read at an offset without moving the file position
+int fs_pread(int fd, void* buffer, uint32_t size, uint32_t offset) {
+    mutex_lock(&vfs_lock);
+    if (!fs_valid_fd(fd)) {
+        mutex_unlock(&vfs_lock);
+        return -1;
     }
 
-    memcpy(buffer, (uint8_t*)files[fd].data + files[fd].position, size);
-    files[fd].position += size;
+    size = read_fs(fs_node(fd), offset, size, buffer);
+    mutex_unlock(&vfs_lock);
 
+    acct_io(false, size);
     return size;
 }
 
 int fs_close(int fd) {
-    if (fd < 0 || fd >= MAX_FILES || !files[fd].used) {
+    mutex_lock(&vfs_lock);
+    if (!fs_valid_fd(fd)) {
+        mutex_unlock(&vfs_lock);
         return -1;
     }
 
-    if (files[fd].data) {
-        kfree(files[fd].data);
-        files[fd].data = NULL;
-    }
-
     files[fd].used = false;
+    close_fs(fs_node(fd));
+    dput(files[fd].dentry);
+    files[fd].dentry = NULL;
+    mutex_unlock(&vfs_lock);
     return 0;
 }
 
 int fs_seek(int fd, uint32_t offset) {
-    if (fd < 0 || fd >= MAX_FILES || !files[fd].used) {
+    mutex_lock(&vfs_lock);
+    if (!fs_valid_fd(fd)) {
+        mutex_unlock(&vfs_lock);
         return -1;
     }
 
-    if (offset > files[fd].size) {
-        offset = files[fd].size;
+    if (offset > fs_node(fd)->length) {
+        offset = fs_node(fd)->length;
     }
 
     files[fd].position = offset;
+    mutex_unlock(&vfs_lock);
     return 0;
 }
 
 int fs_tell(int fd) {
-    if (fd < 0 || fd >= MAX_FILES || !files[fd].used) {
+    if (!fs_valid_fd(fd)) {
         return -1;
     }
 
@@ -116,43 +225,149 @@ int fs_tell(int fd) {
 }
 
 int fs_eof(int fd) {
-    if (fd < 0 || fd >= MAX_FILES || !files[fd].used) {
+    if (!fs_valid_fd(fd)) {
         return -1;
     }
 
-    return files[fd].position >= files[fd].size;
+    return files[fd].position >= fs_node(fd)->length;
 }
 
+// Open a file for writing, creating it or emptying it
 int fs_create(const char* filename) {
-    return fs_open(filename, FS_OPEN_CREATE | FS_OPEN_WRITE);
+    int fd = fs_open(filename, FS_OPEN_CREATE | FS_OPEN_WRITE | FS_OPEN_READ);
+    if (fd < 0) {
+        return -1;
+    }
+
+    mutex_lock(&vfs_lock);
+    fs_node_t* node = fs_node(fd);
+    int status = (node->length && node->truncate) ? node->truncate(node, 0) : 0;
+    mutex_unlock(&vfs_lock);
+
+    if (status < 0) {
+        fs_close(fd);
+        return -1;
+    }
+    return fd;
 }
 
+// Remove a file or empty directory. Open descriptors keep a removed file
+// readable until they are closed.
 int fs_delete(const char* filename) {
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (files[i].used && strcmp(files[i].name, filename) == 0) {
-            return fs_close(i);
-        }
-    }
-    return -1;
+    mutex_lock(&vfs_lock);
+    dentry_t* dentry = vfs_lookup(filename);
+    int status = dentry ? vfs_unlink(dentry) : -1;
+    dput(dentry);
+    mutex_unlock(&vfs_lock);
+    return status;
 }
 
 int fs_stat(const char* filename, uint32_t* size) {
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (files[i].used && strcmp(files[i].name, filename) == 0) {
-            if (size) {
-                *size = files[i].size;
-            }
-            return 0;
-        }
+    mutex_lock(&vfs_lock);
+    dentry_t* dentry = vfs_lookup(filename);
+    if (dentry && size) {
+        *size = dentry->node->length;
+    }
+    dput(dentry);
+    mutex_unlock(&vfs_lock);
+    return dentry ? 0 : -1;
+}
+
+// Hold an existing file open without a descriptor, for kernel code that
+// keeps reading it whatever happens to the descriptor table. Returns its
+// dentry with a reference of its own, or NULL; *size is its length.
+struct dentry* fs_hold(const char* filename, uint32_t* size) {
+    mutex_lock(&vfs_lock);
+    dentry_t* dentry = vfs_lookup(filename);
+    if (dentry && (dentry->node->flags & FS_DIRECTORY)) {
+        dput(dentry);
+        dentry = NULL;
+    }
+    if (dentry) {
+        *size = dentry->node->length;
+        open_fs(dentry->node);
     }
-    return -1;
+    mutex_unlock(&vfs_lock);
+    return dentry;
+}
+
+// Let go of a file held with fs_hold()
+void fs_release(struct dentry* dentry) {
+    mutex_lock(&vfs_lock);
+    close_fs(dentry->node);
+    dput(dentry);
+    mutex_unlock(&vfs_lock);
+}
+
+// Read part of a file held with fs_hold()
+int fs_pread_held(struct dentry* dentry, void* buffer, uint32_t size, uint32_t offset) {
+    mutex_lock(&vfs_lock);
+    size = read_fs(dentry->node, offset, size, buffer);
+    mutex_unlock(&vfs_lock);
+
+    acct_io(false, size);
+    return size;
 }
 
 int fs_exists(const char* filename) {
-    for (int i = 0; i < MAX_FILES; i++) {
-        if (files[i].used && strcmp(files[i].name, filename) == 0) {
-            return 1;
+    mutex_lock(&vfs_lock);
+    dentry_t* dentry = vfs_lookup(filename);
+    dput(dentry);
+    mutex_unlock(&vfs_lock);
+    return dentry != NULL;
+}
+
+// Create a directory
+int fs_mkdir(const char* path) {
+    char name[VFS_NAME_MAX + 1];
+    int status = -1;
+
+    mutex_lock(&vfs_lock);
+    dentry_t* dir = vfs_lookup_parent(path, name);
+    dentry_t* dentry = dir ? vfs_lookup_child(dir, name) : NULL;
+    if (dentry && !dentry->node) {
+        status = vfs_create(dentry, FS_DIRECTORY);
+    }
+    dput(dentry);
+    dput(dir);
+    mutex_unlock(&vfs_lock);
+    return status;
+}
+
+// List a directory: ls [path]
+int fs_cmd_ls(int argc, char* argv[]) {
+    const char* path = argc > 1 ? argv[1] : "/";
+
+    mutex_lock(&vfs_lock);
+    dentry_t* dir = vfs_lookup(path);
+    if (!dir || !(dir->node->flags & FS_DIRECTORY)) {
+        dput(dir);
+        mutex_unlock(&vfs_lock);
+        kprintf("ls: %s: not a directory\n", path);
+        return -1;
+    }
+
+    uint32_t count = 0;
+    struct dirent* entry;
+    while ((entry = readdir_fs(dir->node, count)) != NULL) {
+        char name[VFS_NAME_MAX + 1];
+        strncpy(name, entry->name, sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+
+        // Looking the child up may reuse the static entry
+        dentry_t* child = vfs_lookup_child(dir, name);
+        fs_node_t* node = child ? child->node : NULL;
+        if (node && (node->flags & FS_DIRECTORY)) {
+            kprintf("  %s/\n", name);
+        } else {
+            kprintf("  %s  %u\n", name, node ? node->length : 0);
         }
+        dput(child);
+        count++;
     }
+    dput(dir);
+    mutex_unlock(&vfs_lock);
+
+    kprintf("%u entries\n", count);
     return 0;
-}
\ No newline at end of file
+}
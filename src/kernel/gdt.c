@@ -1,6 +1,5 @@
 #include "gdt.h"
-
-#define GDT_ENTRIES 5
+#include "tss.h"
 
 // GDT entries
 static struct gdt_entry gdt[GDT_ENTRIES];
@@ -9,20 +8,25 @@ static struct gdt_ptr gp;
 // External assembly function
 extern void gdt_flush(uint32_t);
 
-// Set up a GDT entry
-void gdt_set_gate(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+// Fill in a GDT descriptor
+static void gdt_fill_entry(struct gdt_entry* entry, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
     // Set descriptor base address
-    gdt[num].base_low = (base & 0xFFFF);
-    gdt[num].base_middle = (base >> 16) & 0xFF;
-    gdt[num].base_high = (base >> 24) & 0xFF;
+    entry->base_low = (base & 0xFFFF);
+    entry->base_middle = (base >> 16) & 0xFF;
+    entry->base_high = (base >> 24) & 0xFF;
 
     // Set descriptor limits
-    gdt[num].limit_low = (limit & 0xFFFF);
-    gdt[num].granularity = ((limit >> 16) & 0x0F);
+    entry->limit_low = (limit & 0xFFFF);
+    entry->granularity = ((limit >> 16) & 0x0F);
 
     // Set granularity bits
-    gdt[num].granularity |= (gran & 0xF0);
-    gdt[num].access = access;
+    entry->granularity |= (gran & 0xF0);
+    entry->access = access;
+}
+
+// Set up a GDT entry
+void gdt_set_gate(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+    gdt_fill_entry(&gdt[num], base, limit, access, gran);
 }
 
 void gdt_install() {
@@ -45,6 +49,36 @@ void gdt_install() {
     // User Data Segment
     gdt_set_gate(4, 0, 0xFFFFFFFF, 0xF2, 0xCF);
 
+    // TSS, filled in by tss_init()
+    gdt_set_gate(5, 0, 0, 0, 0);
+
+    // Per-CPU data segment; flat until smp_init() gives each CPU its own GDT
+    gdt_set_gate(6, 0, 0xFFFFFFFF, 0x92, 0xCF);
+
     // Flush the GDT
     gdt_flush((uint32_t)&gp);
-}
\ No newline at end of file
+}
+
+// Build a GDT for one CPU. Each CPU gets its own copy so that the TSS and
+// the per-CPU segment (loaded into GS) can point at CPU-private data.
+void gdt_init_cpu(struct gdt_entry* table, struct gdt_ptr* ptr,
+                  uint32_t percpu_base, uint32_t percpu_size,
+                  uint32_t tss_base, uint32_t tss_size) {
+    gdt_fill_entry(&table[0], 0, 0, 0, 0);
+    gdt_fill_entry(&table[1], 0, 0xFFFFFFFF, 0x9A, 0xCF);
+    gdt_fill_entry(&table[2], 0, 0xFFFFFFFF, 0x92, 0xCF);
+    gdt_fill_entry(&table[3], 0, 0xFFFFFFFF, 0xFA, 0xCF);
+    gdt_fill_entry(&table[4], 0, 0xFFFFFFFF, 0xF2, 0xCF);
+    gdt_fill_entry(&table[5], tss_base, tss_size, 0xE9, 0x00);
+    gdt_fill_entry(&table[6], percpu_base, percpu_size - 1, 0x92, 0x40);
+
+    ptr->limit = (sizeof(struct gdt_entry) * GDT_ENTRIES) - 1;
+    ptr->base = (uint32_t)table;
+}
+
+// Load a per-CPU GDT, its TSS and the per-CPU segment
+void gdt_load_cpu(struct gdt_ptr* ptr) {
+    gdt_flush((uint32_t)ptr);
+    tss_flush();
+    asm volatile("mov %0, %%gs" : : "r"((uint16_t)GDT_PERCPU_SEGMENT));
+}
@@ -4,6 +4,11 @@
 #include "kheap.h"
 #include "isr.h"
 #include "idt.h"
+#include "timer.h"
+#include "irq.h"
+
+// IDT setup (interrupt.c; its header clashes with isr.h)
+void interrupt_init(void);
 
 // Forward declaration of timer interrupt handler
 static void timer_interrupt_handler(registers_t* regs);
@@ -61,11 +66,11 @@ void hal_mem_init(void) {
 
 // Memory allocation
 void* hal_mem_alloc_page(void) {
-    return kmalloc_aligned(PAGE_SIZE);
+    return (void*)alloc_frame();
 }
 
 void hal_mem_free_page(void* page) {
-    kfree(page);
+    free_frame((uint32_t)page);
 }
 
 uint32_t hal_mem_get_total(void) {
@@ -81,8 +86,8 @@ void hal_interrupt_init(void) {
     // Initialize PIC
     pic_init();
     
-    // Initialize IDT
-    idt_init();
+    // Initialize IDT (exceptions, IRQs and local APIC vectors)
+    interrupt_init();
     
     // Initialize timer
     hal_timer_init(100);  // 100 Hz timer
@@ -100,13 +105,6 @@ void hal_interrupt_unregister(uint8_t vector) {
     idt_set_gate(vector, 0, 0, 0);
 }
 
-void hal_pic_eoi(uint8_t irq) {
-    if (irq >= 8) {
-        outb(0xA0, 0x20);  // Send EOI to slave PIC
-    }
-    outb(0x20, 0x20);  // Send EOI to master PIC
-}
-
 // Timer management
 void hal_timer_init(uint32_t frequency) {
     uint32_t divisor = 1193180 / frequency;
@@ -120,6 +118,7 @@ void hal_timer_init(uint32_t frequency) {
     
     // Register our timer callback
     register_interrupt_handler(32, timer_interrupt_handler);
+    irq_enable(IRQ0, "timer");
 }
 
 uint32_t hal_timer_register(uint32_t interval_ms, timer_callback_t callback, void* data) {
@@ -157,7 +156,8 @@ static void timer_interrupt_handler(registers_t* regs) {
         }
     }
     
-    hal_pic_eoi(0);
+    // Drive the system tick and the scheduler
+    timer_tick();
 }
 
 // Power management
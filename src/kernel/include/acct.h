@@ -0,0 +1,57 @@
+#ifndef ACCT_H
+#define ACCT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tsc.h"
+
+// Resource usage of a process. Everything is charged to the process
+// running on the calling CPU, so no locking is needed.
+typedef struct {
+    uint64_t user_cycles;            // TSC cycles spent in user mode
+    uint64_t sys_cycles;             // TSC cycles spent in the kernel
+    uint64_t stamp;                  // TSC of the last switch-in or mode change
+    uint32_t nvcsw;                  // Switches away while blocking or sleeping
+    uint32_t nivcsw;                 // Switches away while still runnable
+    uint32_t min_flt;                // Page faults served without reading a file
+    uint32_t maj_flt;                // Page faults that read a file
+    uint32_t syscalls;               // System calls made
+    uint64_t read_bytes;             // Bytes read through fs and sockets
+    uint64_t write_bytes;            // Bytes written through fs and sockets
+} proc_acct_t;
+
+// Charge user time on entry to the kernel from user mode
+static inline void acct_kernel_enter(proc_acct_t* acct) {
+    uint64_t now = rdtsc();
+    acct->user_cycles += now - acct->stamp;
+    acct->stamp = now;
+}
+
+// Charge kernel time on the way back to user mode
+static inline void acct_kernel_exit(proc_acct_t* acct) {
+    uint64_t now = rdtsc();
+    acct->sys_cycles += now - acct->stamp;
+    acct->stamp = now;
+}
+
+// Charge the kernel time up to a context switch. Processes are always
+// switched from inside the kernel.
+static inline void acct_switch_out(proc_acct_t* acct, bool preempted) {
+    acct_kernel_exit(acct);
+    if (preempted) {
+        acct->nivcsw++;
+    } else {
+        acct->nvcsw++;
+    }
+}
+
+// Start the clock of a process being switched in
+static inline void acct_switch_in(proc_acct_t* acct) {
+    acct->stamp = rdtsc();
+}
+
+// Function declarations
+void acct_io(bool write, uint32_t bytes);
+int acct_cmd_top(int argc, char* argv[]);
+
+#endif /* ACCT_H */
@@ -68,8 +68,87 @@ typedef struct {
     uint8_t century;
 } __attribute__((packed)) fadt_t;
 
+// MADT (Multiple APIC Description Table) Structure
+typedef struct {
+    acpi_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) madt_t;
+
+// MADT entry types
+#define MADT_TYPE_LAPIC          0
+#define MADT_TYPE_IOAPIC         1
+#define MADT_TYPE_ISO            2
+#define MADT_TYPE_LAPIC_OVERRIDE 5
+
+// MADT entry header
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) madt_entry_t;
+
+// MADT processor local APIC entry
+typedef struct {
+    madt_entry_t header;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) madt_lapic_t;
+
+// MADT I/O APIC entry
+typedef struct {
+    madt_entry_t header;
+    uint8_t ioapic_id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;               // First global system interrupt it handles
+} __attribute__((packed)) madt_ioapic_t;
+
+// MADT interrupt source override: an ISA IRQ wired to another input
+typedef struct {
+    madt_entry_t header;
+    uint8_t bus;                     // Always 0 (ISA)
+    uint8_t source;                  // ISA IRQ
+    uint32_t gsi;                    // Global system interrupt it arrives on
+    uint16_t flags;                  // MADT_ISO_* polarity and trigger mode
+} __attribute__((packed)) madt_iso_t;
+
+// MADT local APIC address override entry
+typedef struct {
+    madt_entry_t header;
+    uint16_t reserved;
+    uint64_t lapic_address;
+} __attribute__((packed)) madt_lapic_override_t;
+
+// MADT local APIC flags
+#define MADT_LAPIC_ENABLED        0x01
+#define MADT_LAPIC_ONLINE_CAPABLE 0x02
+
+// Interrupt source override flags; "conforming" means the bus default
+#define MADT_ISO_POLARITY_MASK 0x0003
+#define MADT_ISO_ACTIVE_HIGH   0x0001
+#define MADT_ISO_ACTIVE_LOW    0x0003
+#define MADT_ISO_TRIGGER_MASK  0x000C
+#define MADT_ISO_EDGE          0x0004
+#define MADT_ISO_LEVEL         0x000C
+
+// Maximum number of processors reported by the MADT
+#define ACPI_MAX_CPUS 16
+
+// Maximum number of I/O APICs and interrupt source overrides kept
+#define ACPI_MAX_IOAPICS   4
+#define ACPI_MAX_OVERRIDES 16
+
 // ACPI functions
 void acpi_init(void);
 void acpi_shutdown(void);
 
+// MADT information
+uint32_t acpi_get_lapic_address(void);
+int acpi_get_cpu_count(void);
+uint8_t acpi_get_cpu_apic_id(int index);
+int acpi_get_ioapic_count(void);
+const madt_ioapic_t* acpi_get_ioapic(int index);
+uint32_t acpi_irq_to_gsi(uint8_t irq, uint16_t* flags);
+
 #endif /* ACPI_H */
@@ -0,0 +1,81 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "blk.h"
+#include "memory.h"
+
+// Blocks are one page of a device
+#define BCACHE_BLOCK_SIZE       PAGE_SIZE
+#define BCACHE_BLOCK_SECTORS    (BCACHE_BLOCK_SIZE / BLK_SECTOR_SIZE)
+#define BCACHE_BLOCK_SHIFT      12
+
+// Buffers the cache can hold, and hash chains to find them by
+#define BCACHE_BUFFERS          1024
+#define BCACHE_HASH_SIZE        256
+
+// Writeback: the thread wakes every BCACHE_WRITEBACK_INTERVAL ticks and
+// writes buffers dirty for BCACHE_DIRTY_EXPIRE ticks, or all of them once
+// more than BCACHE_DIRTY_LIMIT are dirty
+#define BCACHE_WRITEBACK_INTERVAL 100
+#define BCACHE_DIRTY_EXPIRE     300
+#define BCACHE_DIRTY_LIMIT      (BCACHE_BUFFERS / 4)
+
+// Readahead windows, in blocks: the first of a sequential stream, and the
+// most they grow to by doubling
+#define BCACHE_RA_MIN           4
+#define BCACHE_RA_MAX           64
+
+// Buffer flags
+#define BUF_VALID               0x01    // Data matches the device or is newer
+#define BUF_DIRTY               0x02    // Newer than the device
+#define BUF_BUSY                0x04    // Being read or written
+#define BUF_REFERENCED          0x08    // Used since the clock hand passed
+#define BUF_ERROR               0x10    // The last read or write failed
+#define BUF_READAHEAD           0x20    // Prefetched and not read since
+
+// One cached block
+typedef struct buffer {
+    blk_device_t* dev;
+    uint64_t block;
+    uint8_t* data;                   // One frame, NULL once reclaimed
+    volatile uint32_t flags;         // BUF_*
+    uint32_t refcount;               // Users between bread and brelse
+    uint32_t dirtied;                // Tick it became dirty
+    bio_t bio;
+    struct buffer* hash_next;
+    struct buffer* free_next;
+    struct buffer* wb_next;          // Batch being written back
+    struct bcache_batch* wb_batch;   // Caller waiting for the write, if any
+} buffer_t;
+
+// Readahead state of one stream of reads, such as an open file or a
+// device read directly. Zero it to start.
+typedef struct {
+    uint64_t next;                   // Index a sequential read would ask for
+    uint64_t ahead;                  // First index not prefetched yet
+    uint32_t size;                   // Current window, 0 if not sequential
+} bcache_ra_t;
+
+// Device block of index of a stream; false if there is none
+typedef bool (*bcache_map_fn)(void* stream, uint64_t index, uint64_t* block);
+
+// Function declarations
+void bcache_init(void);
+buffer_t* bread(blk_device_t* dev, uint64_t block);
+void bdirty(buffer_t* buf);
+int bwrite(buffer_t* buf);
+void brelse(buffer_t* buf);
+buffer_t* bread_ra(blk_device_t* dev, bcache_ra_t* ra, uint64_t index,
+                   bcache_map_fn map, void* stream);
+void bcache_prefetch(blk_device_t* dev, uint64_t block);
+int bcache_read(blk_device_t* dev, uint64_t offset, void* buffer, uint32_t size);
+int bcache_read_ra(blk_device_t* dev, bcache_ra_t* ra, uint64_t offset, void* buffer,
+                   uint32_t size);
+int bcache_write(blk_device_t* dev, uint64_t offset, const void* buffer, uint32_t size);
+int bcache_sync(blk_device_t* dev);
+uint32_t bcache_shrink(uint32_t count);
+int bcache_cmd_bcache(int argc, char* argv[]);
+
+#endif /* BCACHE_H */
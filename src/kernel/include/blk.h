@@ -0,0 +1,120 @@
+#ifndef BLK_H
+#define BLK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spinlock.h"
+#include "waitqueue.h"
+
+#define BLK_SECTOR_SIZE     512
+
+// Operations
+#define BLK_READ            0
+#define BLK_WRITE           1
+#define BLK_FLUSH           2       // Barrier: after every earlier write, before any later one
+
+// Flags
+#define BLK_FUA             0x01    // Write through to the media before completing
+
+// Requests a device queue can hold, and bios one request can carry
+#define BLK_QUEUE_REQUESTS  32
+#define BLK_MAX_SEGMENTS    32
+
+// Ticks a queued read or write may wait before it is served out of order
+#define BLK_READ_EXPIRE     50
+#define BLK_WRITE_EXPIRE    500
+
+struct blk_device;
+
+// One contiguous buffer of I/O for a range of sectors
+typedef struct bio {
+    uint8_t op;                      // BLK_*
+    uint8_t flags;
+    uint64_t sector;
+    uint32_t count;                  // Sectors
+    void* buffer;
+    int status;                      // 0 or a HAL error once ended
+    void (*end_io)(struct bio* bio); // Called, maybe from an interrupt, when done
+    void* private;                   // For the submitter
+    struct blk_device* dev;
+    struct bio* next;
+} bio_t;
+
+// Adjacent bios merged into one command for the driver
+typedef struct blk_request {
+    uint8_t op;
+    uint8_t flags;
+    uint64_t sector;
+    uint32_t count;
+    bio_t* bios;                     // In sector order
+    bio_t* bio_tail;
+    uint32_t nbios;
+    uint32_t seq;                    // Order of arrival
+    uint32_t deadline;               // Tick by which it should be dispatched
+    struct blk_device* dev;
+    struct blk_request* next;        // Sorted queue, or free list
+    struct blk_request* fifo_next;   // Arrival order
+} blk_request_t;
+
+// Start a request on the hardware; the driver calls blk_end_request when
+// it finishes. Called without locks held, possibly from an interrupt.
+typedef void (*blk_submit_fn)(struct blk_device* dev, blk_request_t* rq);
+
+// Check the hardware for finished requests when interrupts seem lost
+typedef void (*blk_poll_fn)(struct blk_device* dev);
+
+// Block device and its request queue
+typedef struct blk_device {
+    char name[16];
+    uint64_t nr_sectors;
+    uint32_t max_sectors;            // Largest merged request
+    uint32_t depth;                  // Requests the driver takes at once
+    blk_submit_fn submit;
+    blk_poll_fn poll;                // Optional
+    void* private;                   // For the driver
+    bool mounted;                    // Holds a mounted file system
+
+    spinlock_t lock;
+    blk_request_t requests[BLK_QUEUE_REQUESTS];
+    blk_request_t* free;
+    waitqueue_t free_wait;           // Submitters waiting for a free request
+    blk_request_t* sorted;           // Queued requests by sector
+    blk_request_t* fifo;             // Queued requests by arrival
+    blk_request_t* fifo_tail;
+    uint32_t seq;
+    uint32_t barrier_seq;            // seq of the latest queued flush, 0 if none
+    uint64_t head;                   // Sector after the last dispatched request
+    uint32_t inflight;
+    bool flushing;                   // A flush is in flight; nothing passes it
+    waitqueue_t done_wait;           // Synchronous callers waiting for their bio
+
+    // Statistics
+    uint32_t bios;
+    uint32_t merges;
+    uint32_t dispatched;
+    uint32_t expired;                // Dispatched out of order for their deadline
+    uint64_t sectors;
+
+    struct blk_device* next;
+} blk_device_t;
+
+// Bios held back by a process until it is done submitting a batch
+typedef struct blk_plug {
+    bio_t* bios;
+    bio_t* tail;
+} blk_plug_t;
+
+// Function declarations
+void blk_register(blk_device_t* dev);
+blk_device_t* blk_find(const char* name);
+blk_device_t* blk_next(blk_device_t* dev);
+void blk_submit_bio(blk_device_t* dev, bio_t* bio);
+void blk_run_queue(blk_device_t* dev);
+void blk_end_request(blk_request_t* rq, int status);
+void blk_start_plug(blk_plug_t* plug);
+void blk_finish_plug(blk_plug_t* plug);
+int blk_rw(blk_device_t* dev, uint8_t op, uint64_t sector, uint32_t count, void* buffer);
+int blk_flush(blk_device_t* dev);
+int blk_cmd_blkstat(int argc, char* argv[]);
+
+#endif /* BLK_H */
@@ -0,0 +1,89 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spinlock.h"
+
+// Identification
+#define ELF_MAGIC    0x464C457F  // "\x7FELF" read as a little-endian word
+#define ELFCLASS32   1
+#define ELFDATA2LSB  1
+#define EV_CURRENT   1
+#define ET_EXEC      2
+#define EM_386       3
+
+// Program header types and flags
+#define PT_LOAD      1
+#define PF_X         0x1
+#define PF_W         0x2
+#define PF_R         0x4
+
+// Most program headers an image may have
+#define ELF_MAX_PHDRS 16
+
+// Most bytes of argument and environment strings passed to exec
+#define EXEC_ARG_MAX (16 * 1024)
+
+typedef struct {
+    uint8_t  e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint32_t e_entry;
+    uint32_t e_phoff;
+    uint32_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} __attribute__((packed)) Elf32_Ehdr;
+
+typedef struct {
+    uint32_t p_type;
+    uint32_t p_offset;
+    uint32_t p_vaddr;
+    uint32_t p_paddr;
+    uint32_t p_filesz;
+    uint32_t p_memsz;
+    uint32_t p_flags;
+    uint32_t p_align;
+} __attribute__((packed)) Elf32_Phdr;
+
+// A validated executable, shared by every process running it. Read-only
+// pages are read from the file once and mapped into all of them.
+typedef struct elf_image {
+    struct dentry* dentry;           // The executable, held open by the image
+    uint32_t size;                   // File size in bytes
+    uint32_t refcount;               // Areas mapping the image
+    uint32_t entry;                  // Entry point
+    uint16_t phnum;                  // Program headers
+    Elf32_Phdr phdrs[ELF_MAX_PHDRS];
+    uint32_t* text_frames;           // Shared frame per file page, 0 if not read yet
+    spinlock_t lock;                 // Protects text_frames
+    struct elf_image* next;          // Loaded images, or images waiting to be released
+} elf_image_t;
+
+// Minimal executables the kernel writes itself, for benchmarks: headers
+// and code in one segment, the code starting at ELF_FLAT_ENTRY
+#define ELF_FLAT_BASE     0x08048000
+#define ELF_FLAT_CODE_MAX 64
+#define ELF_FLAT_ENTRY    (ELF_FLAT_BASE + sizeof(Elf32_Ehdr) + sizeof(Elf32_Phdr))
+
+// Function declarations
+elf_image_t* elf_image_get(const char* path);
+void elf_image_ref(elf_image_t* image);
+void elf_image_put(elf_image_t* image);
+bool elf_image_read(elf_image_t* image, void* buffer, uint32_t size, uint32_t offset);
+uint32_t elf_image_shared_page(elf_image_t* image, uint32_t offset, bool* loaded);
+int elf_exec(const char* path, char* const argv[], char* const envp[]);
+int elf_spawn(const char* path, char* const argv[], char* const envp[]);
+int elf_run(const char* path, int* status);
+bool elf_install_flat(const char* path, const uint8_t* code, uint32_t size);
+int elf_cmd_spawn(int argc, char* argv[]);
+int elf_cmd_spawnbench(int argc, char* argv[]);
+
+#endif /* ELF_H */
@@ -8,7 +8,6 @@
 // Maximum number of open files
 #define MAX_FILES 256
 #define MAX_FILENAME 256
-#define MAX_FILE_SIZE 1048576  // 1MB
 
 // File flags
 #define FS_OPEN_READ    0x01
@@ -36,13 +35,18 @@ typedef struct fs_node {
     uint32_t length;         // Size of the file, in bytes
     uint32_t impl;           // Implementation-dependent number
     
-    // File operations
+    // File operations. Nodes from finddir and create come back without a
+    // reference: the VFS takes one with open and drops it with close, and
+    // a node may go away with its last one.
     uint32_t (*read)(struct fs_node*, uint32_t, uint32_t, uint8_t*);
     uint32_t (*write)(struct fs_node*, uint32_t, uint32_t, uint8_t*);
     void (*open)(struct fs_node*);
     void (*close)(struct fs_node*);
     struct dirent* (*readdir)(struct fs_node*, uint32_t);
     struct fs_node* (*finddir)(struct fs_node*, char* name);
+    struct fs_node* (*create)(struct fs_node*, char* name, uint32_t type);
+    int (*unlink)(struct fs_node*, char* name);
+    int (*truncate)(struct fs_node*, uint32_t length);
 } fs_node_t;
 
 // Directory entry structure
@@ -51,19 +55,19 @@ struct dirent {
     uint32_t ino;           // Inode number
 };
 
-// File structure
+struct dentry;
+
+// Open file descriptor
 typedef struct {
-    char name[MAX_FILENAME];
-    uint8_t type;
-    uint32_t size;
+    struct dentry* dentry;   // Holds the node open
     uint32_t position;
-    void* data;
+    uint8_t flags;           // FS_OPEN_*
     bool used;
 } file_t;
 
 // File system functions
 void fs_init(void);
-fs_node_t* fs_root;         // The root of the filesystem
+extern fs_node_t* fs_root;  // The root of the filesystem
 
 // Standard file operations
 uint32_t read_fs(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer);
@@ -78,12 +82,18 @@ int fs_open(const char* filename, uint8_t flags);
 int fs_close(int fd);
 int fs_read(int fd, void* buffer, uint32_t size);
 int fs_write(int fd, const void* buffer, uint32_t size);
+int fs_pread(int fd, void* buffer, uint32_t size, uint32_t offset);
 int fs_seek(int fd, uint32_t offset);
 int fs_tell(int fd);
 int fs_eof(int fd);
 int fs_create(const char* filename);
 int fs_delete(const char* filename);
 int fs_stat(const char* filename, uint32_t* size);
+struct dentry* fs_hold(const char* filename, uint32_t* size);
+void fs_release(struct dentry* dentry);
+int fs_pread_held(struct dentry* dentry, void* buffer, uint32_t size, uint32_t offset);
 int fs_exists(const char* filename);
+int fs_mkdir(const char* path);
+int fs_cmd_ls(int argc, char* argv[]);
 
 #endif // FS_H
@@ -19,9 +19,16 @@ struct gdt_ptr {
     uint32_t base;                // The address of the first gdt_entry
 } __attribute__((packed));
 
+// Number of GDT entries: null, kernel code/data, user code/data, TSS, per-CPU
+#define GDT_ENTRIES 7
+
 // GDT segment selectors
-#define GDT_CODE_SEGMENT 0x08
-#define GDT_DATA_SEGMENT 0x10
+#define GDT_CODE_SEGMENT   0x08
+#define GDT_DATA_SEGMENT   0x10
+#define GDT_USER_CODE_SEGMENT 0x1B  // Entry 3, RPL 3
+#define GDT_USER_DATA_SEGMENT 0x23  // Entry 4, RPL 3
+#define GDT_TSS_SEGMENT    0x28
+#define GDT_PERCPU_SEGMENT 0x30
 
 // GDT access flags
 #define GDT_PRESENT        0x80
@@ -40,6 +47,10 @@ struct gdt_ptr {
 // Function declarations
 void gdt_init(void);
 void gdt_set_gate(int32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran);
+void gdt_init_cpu(struct gdt_entry* table, struct gdt_ptr* ptr,
+                  uint32_t percpu_base, uint32_t percpu_size,
+                  uint32_t tss_base, uint32_t tss_size);
+void gdt_load_cpu(struct gdt_ptr* ptr);
 extern void gdt_flush(uint32_t);
 
 #endif // GDT_H
@@ -117,7 +117,6 @@ void hal_dma_stop_channel(uint8_t channel);
 
 // Interrupt controller functions
 void hal_pic_remap(uint32_t master_offset, uint32_t slave_offset);
-void hal_pic_eoi(uint8_t irq);
 void hal_pic_mask_irq(uint8_t irq);
 void hal_pic_unmask_irq(uint8_t irq);
 void hal_interrupt_init(void);
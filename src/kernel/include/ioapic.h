@@ -0,0 +1,29 @@
+#ifndef IOAPIC_H
+#define IOAPIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Register window (offsets from the MMIO base)
+#define IOAPIC_REGSEL         0x00
+#define IOAPIC_WINDOW         0x10
+
+// Registers selected through IOAPIC_REGSEL
+#define IOAPIC_REG_ID         0x00
+#define IOAPIC_REG_VERSION    0x01
+#define IOAPIC_REG_REDIR      0x10   // Two registers per input
+
+// Redirection entry bits (low half; the destination APIC ID is in bits
+// 24-31 of the high half)
+#define IOAPIC_REDIR_ACTIVE_LOW 0x00002000
+#define IOAPIC_REDIR_LEVEL      0x00008000
+#define IOAPIC_REDIR_MASKED     0x00010000
+
+// Function declarations
+int ioapic_init(void);
+bool ioapic_available(void);
+bool ioapic_route(uint32_t gsi, uint8_t vector, uint8_t apic_id, uint32_t flags);
+void ioapic_mask(uint32_t gsi, bool masked);
+bool ioapic_set_dest(uint32_t gsi, uint8_t apic_id);
+
+#endif /* IOAPIC_H */
@@ -0,0 +1,45 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Legacy IRQs arrive on vectors 32-47 whichever controller delivers them
+#define IRQ_LEGACY_BASE     32
+#define IRQ_LEGACY_COUNT    16
+
+// Vectors handed out to MSI and MSI-X devices
+#define IRQ_MSI_VECTOR_BASE 0x50
+#define IRQ_MSI_VECTORS     8
+
+// How a vector's interrupt reaches the CPUs
+#define IRQ_ROUTE_NONE      0
+#define IRQ_ROUTE_PIC       1   // 8259 PIC, always to the BSP
+#define IRQ_ROUTE_IOAPIC    2   // I/O APIC input
+#define IRQ_ROUTE_MSI       3   // Message from a PCI function
+#define IRQ_ROUTE_MSIX      4
+
+// Routing of one vector
+typedef struct {
+    uint8_t route;                   // IRQ_ROUTE_*
+    uint8_t cpu;                     // CPU it is delivered to
+    bool level;                      // Level-triggered
+    bool pci;                        // PCI INTx line rather than an ISA IRQ
+    uint8_t bus, slot, func;         // PCI function, for MSI routes
+    uint32_t gsi;                    // I/O APIC input, for IOAPIC routes
+    const char* name;
+} irq_route_t;
+
+// Function declarations
+void irq_init(void);
+bool irq_apic_mode(void);
+void irq_enable(uint8_t vector, const char* name);
+void irq_enable_pci(uint8_t vector, const char* name);
+void irq_disable(uint8_t vector);
+int irq_setup_msi(uint8_t bus, uint8_t slot, uint8_t func, const char* name);
+int irq_set_affinity(uint8_t vector, uint32_t cpu);
+void irq_eoi(uint8_t vector);
+const char* irq_name(uint8_t vector);
+int irq_cmd_irqs(int argc, char* argv[]);
+
+#endif /* IRQ_H */
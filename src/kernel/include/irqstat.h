@@ -0,0 +1,51 @@
+#ifndef IRQSTAT_H
+#define IRQSTAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Histogram buckets: under 1us, then powers of two up to 1024us and over
+#define IRQSTAT_BUCKETS 12
+
+// Interrupts-off call sites remembered per CPU; the shortest is dropped
+// when a longer one comes along
+#define IRQSTAT_SITES 32
+
+// Handler statistics of one vector on one CPU
+typedef struct {
+    uint32_t count;                  // Interrupts taken
+    uint32_t switched;               // Handler switched processes; not timed
+    uint64_t cycles;                 // Time in the handler, in TSC cycles
+    uint32_t max_us;                 // Longest handler run
+    uint32_t max_latency_us;         // Longest delay before the handler ran
+    uint32_t hist[IRQSTAT_BUCKETS];  // Handler run times
+} irqstat_vector_t;
+
+// Interrupts-off windows that began at one place
+typedef struct {
+    uint32_t site;                   // Code address that disabled interrupts
+    uint32_t count;
+    uint64_t cycles;
+    uint32_t max_us;
+} irqstat_site_t;
+
+// Taken when a handler starts, to time it
+typedef struct {
+    uint64_t start;                  // TSC when the handler was called
+    struct cpu* cpu;                 // CPU it was called on
+    uint32_t switches;               // That CPU's context switches so far
+} irqstat_stamp_t;
+
+// Set while interrupts-off windows are measured; the lock hooks check it
+// before doing anything else
+extern volatile bool irqstat_cli_enabled;
+
+// Function declarations
+void irqstat_cli_begin(void);
+void irqstat_cli_begin_at(void* site);
+void irqstat_cli_end(void);
+void irqstat_irq_enter(uint8_t vector, irqstat_stamp_t* stamp);
+void irqstat_irq_exit(uint8_t vector, irqstat_stamp_t* stamp);
+int irqstat_cmd_irqstat(int argc, char* argv[]);
+
+#endif /* IRQSTAT_H */
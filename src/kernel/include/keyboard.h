@@ -60,6 +60,7 @@
 void keyboard_init(void);
 bool keyboard_buffer_empty(void);
 char keyboard_getchar(void);
+char keyboard_wait_char(void);
 void keyboard_handler(registers_t* regs);
 void keyboard_send_command(uint8_t command);
 uint8_t keyboard_read_status(void);
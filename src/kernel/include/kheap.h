@@ -4,12 +4,12 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-// Heap constants
-#define KHEAP_START         0xC0000000
-#define KHEAP_INITIAL_SIZE  0x100000
-#define HEAP_INDEX_SIZE     0x20000
+// Heap constants. The kernel heap is a fixed physical range above the
+// kernel image, reserved from the frame allocator up to KHEAP_MAX.
+#define KHEAP_BASE          0x400000
+#define KHEAP_INITIAL_END   0x500000
+#define KHEAP_MAX           0x800000
 #define HEAP_MAGIC          0x123890AB
-#define HEAP_MIN_SIZE       0x70000
 
 // Block header structure
 typedef struct header_t {
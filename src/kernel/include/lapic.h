@@ -0,0 +1,62 @@
+#ifndef LAPIC_H
+#define LAPIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Default local APIC physical base
+#define LAPIC_DEFAULT_BASE    0xFEE00000
+
+// Local APIC registers (offsets from base)
+#define LAPIC_REG_ID          0x020
+#define LAPIC_REG_VERSION     0x030
+#define LAPIC_REG_TPR         0x080
+#define LAPIC_REG_EOI         0x0B0
+#define LAPIC_REG_LDR         0x0D0
+#define LAPIC_REG_DFR         0x0E0
+#define LAPIC_REG_SVR         0x0F0
+#define LAPIC_REG_ESR         0x280
+#define LAPIC_REG_ICR_LOW     0x300
+#define LAPIC_REG_ICR_HIGH    0x310
+#define LAPIC_REG_LVT_TIMER   0x320
+#define LAPIC_REG_LVT_LINT0   0x350
+#define LAPIC_REG_LVT_LINT1   0x360
+#define LAPIC_REG_LVT_ERROR   0x370
+#define LAPIC_REG_TIMER_INIT  0x380
+#define LAPIC_REG_TIMER_CUR   0x390
+#define LAPIC_REG_TIMER_DIV   0x3E0
+
+// Spurious interrupt vector register bits
+#define LAPIC_SVR_ENABLE      0x100
+
+// Interrupt command register bits
+#define LAPIC_ICR_INIT        0x00000500
+#define LAPIC_ICR_STARTUP     0x00000600
+#define LAPIC_ICR_PENDING     0x00001000
+#define LAPIC_ICR_ASSERT      0x00004000
+#define LAPIC_ICR_LEVEL       0x00008000
+#define LAPIC_ICR_ALL_BUT_SELF 0x000C0000
+
+// LVT bits
+#define LAPIC_LVT_MASKED      0x00010000
+#define LAPIC_TIMER_PERIODIC  0x00020000
+
+// Interrupt vectors owned by the local APIC
+#define LAPIC_TIMER_VECTOR    0x40
+#define LAPIC_RESCHED_VECTOR  0x41
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+// Local APIC functions
+void lapic_init(uint32_t base);
+void lapic_enable(void);
+bool lapic_available(void);
+uint8_t lapic_id(void);
+void lapic_eoi(void);
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector);
+void lapic_send_init(uint8_t apic_id);
+void lapic_send_startup(uint8_t apic_id, uint8_t page);
+void lapic_timer_calibrate(void);
+void lapic_timer_init(uint32_t frequency);
+uint32_t lapic_timer_elapsed_us(void);
+
+#endif /* LAPIC_H */
@@ -8,12 +8,30 @@
 // Page size
 #define PAGE_SIZE 4096
 
+// Physical memory the kernel manages (fixed for now). Frames are handed
+// out from all of it except low memory, the kernel image and the kernel
+// heap's range (KHEAP_BASE to KHEAP_MAX).
+#define MEMORY_SIZE 0x1000000
+
+// Caches that can give frames back under memory pressure
+#define MEMORY_MAX_SHRINKERS 4
+#define MEMORY_SHRINK_BATCH  32
+
+// Free up to count cached frames; returns how many were freed
+typedef uint32_t (*shrinker_fn)(uint32_t count);
+
 // Page flags
 #define PAGE_PRESENT  0x1
 #define PAGE_WRITE    0x2
 #define PAGE_USER     0x4
 #define PAGE_ACCESSED 0x20
 #define PAGE_DIRTY    0x40
+#define PAGE_LARGE    0x80   // 4 MB page (directory entries only)
+
+// Control register bits
+#define CR0_WP  0x00010000   // Supervisor writes honour read-only pages
+#define CR0_PG  0x80000000
+#define CR4_PSE 0x00000010   // 4 MB pages
 
 // Page directory and table structures
 typedef struct page {
@@ -31,9 +49,9 @@ typedef struct page_table {
 } page_table_t;
 
 typedef struct page_directory {
-    page_table_t* tables[1024];    // Array of pointers to page tables
-    uint32_t tables_physical[1024]; // Array of physical addresses of page tables
-    uint32_t physical_addr;         // Physical address of tables_physical
+    page_table_t* tables[1024];    // User page tables, NULL where absent
+    uint32_t* tables_physical;     // The directory the CPU walks, a frame of its own
+    uint32_t physical_addr;        // Physical address of tables_physical
 } page_directory_t;
 
 // Memory operations
@@ -59,6 +77,11 @@ page_directory_t* get_kernel_page_directory(void);
 void switch_page_directory(page_directory_t* dir);
 
 // Page and region management
+uint32_t alloc_frame(void);
+void free_frame(uint32_t addr);
+void memory_register_shrinker(shrinker_fn fn);
+page_t* get_page(page_directory_t* dir, uint32_t address, bool create);
+void map_frame(page_directory_t* dir, uint32_t address, uint32_t frame, uint32_t flags);
 page_t* alloc_page(void);
 void free_page(page_t* page);
 bool allocate_region(page_directory_t* dir, uint32_t start, uint32_t size, uint32_t flags);
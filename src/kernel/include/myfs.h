@@ -0,0 +1,88 @@
+#ifndef MYFS_H
+#define MYFS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fs.h"
+#include "blk.h"
+
+// On-disk format. tools/myfs.py, used by the mkfs and fsck tools, has the
+// same layout; change them together.
+//
+//   block 0                  superblock
+//   bitmap_start..           block bitmap, one bit per block, 1 = used
+//   inode_start..            inode table, MYFS_INODES_PER_BLOCK per block
+//   data_start..             file and directory data
+//
+// All numbers are little-endian. Inode 0 is never used, so a directory
+// entry naming it is free; the root directory is inode 1.
+
+#define MYFS_MAGIC              0x5346594D  // "MYFS" read as a little-endian word
+#define MYFS_VERSION            1
+#define MYFS_BLOCK_SIZE         4096
+#define MYFS_BLOCK_SHIFT        12
+#define MYFS_ROOT_INODE         1
+
+#define MYFS_INODE_SIZE         128
+#define MYFS_INODES_PER_BLOCK   (MYFS_BLOCK_SIZE / MYFS_INODE_SIZE)
+#define MYFS_BITS_PER_BLOCK     (MYFS_BLOCK_SIZE * 8)
+
+// Extents kept in the inode, and in its indirect block once those run out
+#define MYFS_INLINE_EXTENTS     13
+#define MYFS_INDIRECT_EXTENTS   (MYFS_BLOCK_SIZE / 8)
+#define MYFS_MAX_EXTENTS        (MYFS_INLINE_EXTENTS + MYFS_INDIRECT_EXTENTS)
+
+// Directory entries
+#define MYFS_DIRENT_SIZE        64
+#define MYFS_DIRENTS_PER_BLOCK  (MYFS_BLOCK_SIZE / MYFS_DIRENT_SIZE)
+#define MYFS_NAME_MAX           59
+
+// Inode types
+#define MYFS_TYPE_FREE          0
+#define MYFS_TYPE_FILE          1
+#define MYFS_TYPE_DIR           2
+
+// Superblock, at the start of block 0
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t blocks;                 // Blocks in the file system
+    uint32_t inodes;                 // Inodes, including unused inode 0
+    uint32_t bitmap_start;
+    uint32_t bitmap_blocks;
+    uint32_t inode_start;
+    uint32_t inode_blocks;
+    uint32_t data_start;
+    uint32_t free_blocks;
+    uint32_t free_inodes;
+} myfs_super_t;
+
+// A run of blocks holding consecutive blocks of a file
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+} myfs_extent_t;
+
+// Inode. Its extents map the file's blocks in order; a file has no holes.
+typedef struct {
+    uint16_t type;                   // MYFS_TYPE_*
+    uint16_t links;                  // Directory entries naming it
+    uint32_t size;                   // Bytes
+    uint32_t blocks;                 // Blocks held by the extents
+    uint32_t nextents;
+    uint32_t indirect;               // Block of extents past the inline ones, or 0
+    uint32_t reserved;
+    myfs_extent_t extents[MYFS_INLINE_EXTENTS];
+} myfs_inode_t;
+
+// Directory entry; a directory's size covers whole entries
+typedef struct {
+    uint32_t inode;                  // 0 if the slot is free
+    char name[MYFS_NAME_MAX + 1];    // NUL-terminated
+} myfs_dirent_t;
+
+// Function declarations
+fs_node_t* myfs_mount(blk_device_t* dev);
+
+#endif /* MYFS_H */
@@ -3,6 +3,7 @@
 
 #include "io.h"
 #include <stdint.h>
+#include <stdbool.h>
 
 // PCI configuration space registers
 #define PCI_CONFIG_ADDRESS 0xCF8
@@ -27,9 +28,32 @@
 #define PCI_BAR3           0x1C
 #define PCI_BAR4           0x20
 #define PCI_BAR5           0x24
+#define PCI_CAPABILITY_LIST 0x34
 #define PCI_INTERRUPT_LINE 0x3C
 #define PCI_INTERRUPT_PIN  0x3D
 
+// Status register bits
+#define PCI_STATUS_CAP_LIST     0x0010
+
+// Capability IDs
+#define PCI_CAP_ID_MSI          0x05
+#define PCI_CAP_ID_MSIX         0x11
+
+// MSI message control bits
+#define PCI_MSI_CTRL_ENABLE     0x0001
+#define PCI_MSI_CTRL_MME_MASK   0x0070   // Messages enabled (log2)
+#define PCI_MSI_CTRL_64BIT      0x0080
+
+// MSI-X message control bits and table layout
+#define PCI_MSIX_CTRL_ENABLE    0x8000
+#define PCI_MSIX_CTRL_MASKALL   0x4000
+#define PCI_MSIX_TABLE_BIR      0x00000007
+#define PCI_MSIX_ENTRY_SIZE     16
+#define PCI_MSIX_VECTOR_MASKED  0x00000001
+
+// Message address of a fixed, edge-triggered interrupt to one local APIC
+#define PCI_MSI_ADDRESS(apic_id) (0xFEE00000 | ((uint32_t)(apic_id) << 12))
+
 // PCI Command Register bits
 #define PCI_COMMAND_IO          0x0001
 #define PCI_COMMAND_MEMORY      0x0002
@@ -64,6 +88,9 @@
 #define PCI_CLASS_SIGNAL          0x11
 #define PCI_CLASS_OTHER          0xFF
 
+// Storage subclasses
+#define PCI_SUBCLASS_IDE          0x01
+
 // PCI BAR types
 #define PCI_BAR_TYPE_IO          0x01
 #define PCI_BAR_TYPE_MEMORY      0x00
@@ -100,6 +127,7 @@ void pci_write_config(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, u
 void pci_get_device_info(uint8_t bus, uint8_t slot, uint8_t func, pci_device_t* dev);
 int pci_device_exists(uint8_t bus, uint8_t slot, uint8_t func);
 int pci_find_device_by_id(uint16_t vendor_id, uint16_t device_id, uint8_t* bus, uint8_t* slot, uint8_t* func);
+int pci_find_device_by_class(uint8_t class_code, uint8_t subclass, uint8_t* bus, uint8_t* slot, uint8_t* func);
 void pci_scan_bus(void);
 void pci_scan_device(uint8_t bus, uint8_t device);
 void pci_scan_function(uint8_t bus, uint8_t device, uint8_t function);
@@ -108,6 +136,9 @@ uint32_t pci_get_bar_address(pci_device_t* dev, int bar);
 uint32_t pci_get_bar_size(pci_device_t* dev, int bar);
 void pci_enable_interrupts(pci_device_t* dev);
 void pci_disable_interrupts(pci_device_t* dev);
+uint8_t pci_find_capability(uint8_t bus, uint8_t slot, uint8_t func, uint8_t id);
+bool pci_enable_msi(uint8_t bus, uint8_t slot, uint8_t func, uint8_t vector, uint8_t apic_id);
+bool pci_enable_msix(uint8_t bus, uint8_t slot, uint8_t func, uint8_t vector, uint8_t apic_id);
 const char* pci_class_string(uint8_t class_code);
 void pci_dump_device(pci_device_t* dev);
 
@@ -8,6 +8,11 @@
 #include "memory.h"
 #include "timer.h"
 #include "tss.h"
+#include "smp.h"
+#include "waitqueue.h"
+#include "vm.h"
+#include "signal.h"
+#include "acct.h"
 
 // Process states
 #define PROCESS_STATE_RUNNING 1
@@ -25,6 +30,7 @@
 #define PROCESS_FLAG_KERNEL     0x00000001
 #define PROCESS_FLAG_USER       0x00000002
 #define PROCESS_FLAG_FPU        0x00000004
+#define PROCESS_FLAG_PINNED     0x00000008  // Never migrated to another CPU
 
 // Maximum process name length
 #define MAX_PROCESS_NAME 32
@@ -65,34 +71,81 @@ typedef struct process {
     uint32_t flags;                        // Process flags
     process_context_t context;             // CPU context
     void* page_directory;                  // Page directory
+    vm_area_t* vmas;                       // Demand-paged user memory
     uint32_t stack;                        // Kernel stack location (for compatibility)
     uint32_t stack_size;                   // Size of kernel stack
     uint32_t stack_base;                   // Base of kernel stack
     uint32_t kernel_stack_top;             // Top of kernel stack
+    uint32_t kernel_esp;                   // Saved kernel stack pointer while switched out
+    volatile bool on_cpu;                  // Running, or not yet done switching out
+    uint32_t interrupt_depth;              // Handlers it was switched out inside
     uint32_t user_stack_top;               // Top of user stack
     uint32_t heap_start;                   // Start of process heap
     uint32_t heap_end;                     // End of process heap
     uint32_t cpu_time;                     // CPU time used
+    proc_acct_t acct;                      // Resource usage
     uint32_t last_switch;                  // Last context switch time
     uint32_t sleep_until;                  // Wake up time for sleeping processes
+    uint32_t cpu;                          // CPU whose run queue holds the process
+    bool on_rq;                            // Linked into that run queue
+    const sched_class_t* sched_class;      // Scheduling class
+    int8_t nice;                           // Nice level (fair class)
+    uint32_t weight;                       // Load weight derived from nice
+    uint64_t vruntime;                     // Weighted runtime in microseconds (fair class)
+    int32_t heap_index;                    // Slot in the fair heap, -1 if not queued
+    uint32_t wait_start;                   // Tick the process became ready (RR aging)
+    uint64_t exec_start;                   // TSC when the process last started running
+    uint64_t sum_exec_us;                  // Total runtime in microseconds
+    uint64_t slice_start_us;               // sum_exec_us when the current slice began
+    uint64_t wake_stamp;                   // TSC at wakeup, 0 once the process has run
+    uint8_t rt_priority;                   // FIFO priority (real-time class)
+    uint32_t dl_runtime_us;                // Budget per period (deadline class)
+    uint32_t dl_period_us;                 // Period and relative deadline (deadline class)
+    uint64_t dl_deadline;                  // Absolute deadline in microseconds
+    int32_t dl_remaining;                  // Budget left in the current period
+    bool dl_throttled;                     // Budget exhausted until the next period
+    waitqueue_t child_exit;                // Woken when a child exits (sys_wait)
+    void* kthread_data;                    // Argument of a kernel thread
+    struct blk_plug* plug;                 // Block I/O held back until blk_finish_plug
+    signal_state_t signals;                // Pending, blocked and handled signals
     uint8_t fpu_state[512] __attribute__((aligned(16))); // FPU state
     struct process* parent;                // Parent process
     struct process* next;                  // Next process in list
     struct process* prev;                  // Previous process in list
 } process_t;
 
-// External declarations
-extern process_t* current_process;
+// Copy of a process's accounting, taken for "top"
+typedef struct {
+    uint32_t pid;
+    char name[MAX_PROCESS_NAME];
+    uint8_t state;
+    uint32_t cpu;
+    proc_acct_t acct;
+} process_info_t;
+
+// Process running on the calling CPU
+#define current_process (this_cpu()->current)
 
 // Function declarations
 void process_init(void);
+void process_init_ap(cpu_t* cpu);
 process_t* process_create(const char* name, void (*entry)(void));
+process_t* kthread_create(const char* name, void (*entry)(void));
+process_t* kthread_create_on(const char* name, void (*entry)(void), int cpu, void* data);
+process_t* process_create_user(const char* name, page_directory_t* dir, vm_area_t* vmas,
+                               uint32_t entry, uint32_t esp);
 void process_destroy(process_t* process);
 void process_switch(process_t* next);
+void process_switch_finish(void);
+void switch_to(uint32_t* prev_esp, uint32_t next_esp);
 void process_yield(void);
-void process_sleep(uint32_t ticks);
+int process_sleep(uint32_t ticks);
 void process_wake(process_t* process);
+void process_interrupt(process_t* process);
 process_t* process_get_by_pid(uint32_t pid);
+int process_snapshot(process_info_t* info, int max);
+int process_set_nice(process_t* process, int nice);
+int process_set_sched_class(process_t* process, const sched_class_t* sched_class);
 
 // Scheduler functions
 void scheduler_init(void);
@@ -100,10 +153,12 @@ void scheduler_add_process(process_t* process);
 void scheduler_remove_process(process_t* process);
 process_t* scheduler_next_process(void);
 void process_schedule(void);
+void scheduler_wake_sleepers(void);
 
 // System calls
-int sys_fork(void);
-int sys_exec(const char* path, char* const argv[]);
+int sys_fork(const void* user_frame);
+int sys_exec(const char* path, char* const argv[], char* const envp[]);
+int sys_spawn(const char* path, char* const argv[], char* const envp[]);
 void sys_exit(int status);
 int sys_wait(int* status);
 int sys_getpid(void);
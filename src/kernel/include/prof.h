@@ -0,0 +1,55 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Samples kept per CPU; sampling stops on a CPU once its buffer is full
+#define PROF_SAMPLES 4096
+
+// Frames recorded per sample: the interrupted EIP and its callers
+#define PROF_DEPTH 8
+
+// Furthest a frame pointer may lie above the sampling code's own stack.
+// Kernel stacks are 8KB, so a chain leaving this window is not a stack.
+#define PROF_STACK_SPAN 8192
+
+// Entries in the table "prof top" aggregates into (power of two)
+#define PROF_TOP_SLOTS 4096
+
+// One sample
+typedef struct {
+    uint16_t pid;                    // Process that was interrupted
+    uint8_t user;                    // Interrupted in user mode
+    uint8_t depth;                   // Entries used in pc[]
+    uint32_t pc[PROF_DEPTH];         // pc[0] is the interrupted EIP
+} prof_sample_t;
+
+// Per-CPU sample buffer, written only by its own CPU's timer interrupt
+typedef struct {
+    prof_sample_t* samples;          // PROF_SAMPLES entries, NULL until profiling starts
+    uint32_t count;                  // Samples recorded
+    uint32_t dropped;                // Ticks lost to a full buffer
+} prof_buffer_t;
+
+// Set while profiling
+extern volatile bool prof_enabled;
+
+void prof_sample(uint32_t eip, uint32_t ebp, bool user);
+
+// Take a sample if profiling is on. Called from the timer interrupt of
+// every CPU with the interrupted EIP and frame pointer.
+static inline void prof_tick(uint32_t eip, uint32_t ebp, bool user) {
+    if (prof_enabled) {
+        prof_sample(eip, ebp, user);
+    }
+}
+
+// Function declarations
+bool prof_start(void);
+void prof_stop(void);
+void prof_clear(void);
+void prof_export(uint16_t port);
+int prof_cmd_prof(int argc, char* argv[]);
+
+#endif /* PROF_H */
@@ -0,0 +1,28 @@
+#ifndef RADIX_H
+#define RADIX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Each node is one frame of slots, indexed by RADIX_BITS of the index
+#define RADIX_BITS              10
+#define RADIX_SLOTS             (1 << RADIX_BITS)
+
+// Radix tree mapping 32-bit indexes to pointers. It is only as tall as
+// its largest index needs: at height 0 the root is the item at index 0.
+// Zero it to start. Callers serialize access.
+typedef struct {
+    void* root;
+    uint32_t height;
+    uint32_t nodes;                  // Frames used by nodes
+} radix_tree_t;
+
+// Called on each item a truncate removes
+typedef void (*radix_release_fn)(void* item);
+
+// Function declarations
+void* radix_lookup(radix_tree_t* tree, uint32_t index);
+bool radix_insert(radix_tree_t* tree, uint32_t index, void* item);
+void radix_truncate(radix_tree_t* tree, uint32_t first, radix_release_fn release);
+
+#endif /* RADIX_H */
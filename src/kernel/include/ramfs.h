@@ -0,0 +1,11 @@
+#ifndef RAMFS_H
+#define RAMFS_H
+
+#include <stdint.h>
+#include "fs.h"
+
+// Function declarations
+fs_node_t* ramfs_mount(void);
+uint32_t ramfs_used_pages(void);
+
+#endif /* RAMFS_H */
@@ -0,0 +1,124 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spinlock.h"
+
+struct process;
+struct runqueue;
+
+// Nice levels of the fair class
+#define NICE_MIN       -20
+#define NICE_MAX        19
+#define NICE_0_WEIGHT 1024
+
+// Fair class tunables (microseconds)
+#define SCHED_LATENCY_US            20000  // Period in which every runnable process runs once
+#define SCHED_MIN_GRANULARITY_US     4000  // Shortest slice handed out
+#define SCHED_WAKEUP_GRANULARITY_US  2000  // vruntime lead needed to preempt on wakeup
+
+// Capacity of a fair run queue: every process the table can hold
+// (MAX_PROCESSES, checked in process.c)
+#define SCHED_FAIR_MAX 64
+
+// Real-time FIFO priorities (higher runs first)
+#define RT_PRIO_LEVELS 32
+
+// Deadline class admission limit: share of one CPU, in 1/1024 units
+#define SCHED_DL_BW_LIMIT ((1024 * 95) / 100)
+
+// Scheduler class. Classes are consulted from highest to lowest priority
+// through the next pointer; the first one with a runnable process wins.
+// All hooks run with the run queue lock held.
+typedef struct sched_class {
+    const char* name;
+    const struct sched_class* next;
+
+    // Make a process runnable on, or remove it from, the run queue.
+    // dequeue returns false if the process was not queued.
+    void (*enqueue)(struct runqueue* rq, struct process* process);
+    bool (*dequeue)(struct runqueue* rq, struct process* process);
+
+    // Best process to run, possibly curr itself; NULL if none
+    struct process* (*pick_next)(struct runqueue* rq, struct process* curr);
+
+    // A queued process that may move to another CPU; NULL if none
+    struct process* (*steal)(struct runqueue* rq, struct process* curr);
+
+    // Charge delta_us of CPU time to the running process
+    void (*update_curr)(struct runqueue* rq, struct process* curr, uint32_t delta_us);
+
+    // Timer tick; true if curr should be preempted
+    bool (*tick)(struct runqueue* rq, struct process* curr);
+
+    // True if a newly woken process of this class should preempt curr
+    bool (*check_preempt)(struct runqueue* rq, struct process* curr, struct process* process);
+
+    // Optional per-tick housekeeping, run whatever class is current;
+    // true if the CPU should reschedule
+    bool (*rq_tick)(struct runqueue* rq);
+} sched_class_t;
+
+// Real-time FIFO class state: one queue per priority, bitmap of non-empty ones
+typedef struct rt_rq {
+    struct process* queues[RT_PRIO_LEVELS];
+    uint32_t bitmap;
+} rt_rq_t;
+
+// Deadline class state
+typedef struct dl_rq {
+    struct process* ready;           // Runnable, sorted by absolute deadline
+    struct process* throttled;       // Budget exhausted, waiting for replenishment
+} dl_rq_t;
+
+// Round-robin class state: three priority levels with aging
+typedef struct rr_rq {
+    struct process* queues[3];       // Ready queues: low, normal, high
+} rr_rq_t;
+
+// Fair class state: min-heap of processes ordered by vruntime
+typedef struct fair_rq {
+    struct process* heap[SCHED_FAIR_MAX];
+    uint32_t nr;                     // Processes in the heap
+    uint32_t total_weight;           // Sum of queued weights
+    uint64_t min_vruntime;           // Monotonic floor of queued vruntimes
+} fair_rq_t;
+
+// Per-CPU run queue
+typedef struct runqueue {
+    spinlock_t lock;                 // Protects everything below
+    uint32_t nr_running;             // Queued processes over all classes
+    dl_rq_t dl;
+    rt_rq_t rt;
+    rr_rq_t rr;
+    fair_rq_t fair;
+} runqueue_t;
+
+// Scheduler classes, highest priority first
+extern const sched_class_t dl_sched_class;
+extern const sched_class_t rt_sched_class;
+extern const sched_class_t rr_sched_class;
+extern const sched_class_t fair_sched_class;
+extern const sched_class_t idle_sched_class;
+
+#define sched_class_highest (&dl_sched_class)
+
+// Fair class helpers
+uint32_t sched_nice_to_weight(int nice);
+void sched_fair_detach(struct runqueue* rq, struct process* process);
+void sched_fair_attach(struct runqueue* rq, struct process* process);
+
+// Real-time helpers
+int sched_set_fifo(struct process* process, int rt_priority);
+int sched_set_deadline(struct process* process, uint32_t runtime_us, uint32_t period_us);
+void sched_dl_yield(void);
+void sched_dl_release(struct process* process);
+
+// Wakeup latency sampling (used by schedbench)
+void sched_latency_record(uint32_t us);
+
+// Shell commands
+int sched_cmd_schedbench(int argc, char* argv[]);
+
+#endif /* SCHED_H */
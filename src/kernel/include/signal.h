@@ -3,23 +3,132 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "spinlock.h"
+#include "waitqueue.h"
 
-// Signal types
+// Signal numbers. Bit n of a sigset_t stands for signal n.
+#define SIGHUP      1
+#define SIGINT      2   // Interrupt signal
+#define SIGQUIT     3
+#define SIGILL      4
+#define SIGTRAP     5
+#define SIGABRT     6
+#define SIGBUS      7
+#define SIGFPE      8
 #define SIGKILL     9   // Kill signal
+#define SIGUSR1    10
+#define SIGSEGV    11
+#define SIGUSR2    12
+#define SIGPIPE    13
+#define SIGALRM    14
 #define SIGTERM    15   // Termination request
-#define SIGINT      2   // Interrupt signal
-#define SIGSTOP    19   // Stop process
+#define SIGCHLD    17
 #define SIGCONT    18   // Continue process if stopped
+#define SIGSTOP    19   // Stop process
+#define SIGTSTP    20
+#define SIGTTIN    21
+#define SIGTTOU    22
+#define SIGURG     23
+#define SIGWINCH   28
+
+// Real-time signals are queued, each instance with its own payload
+#define SIGRTMIN   32
+#define SIGRTMAX   63
+#define NSIG       64
 
-// Signal handler type
+// Most real-time signals queued to one process
+#define SIGQUEUE_MAX 32
+
+typedef uint64_t sigset_t;
+
+#define SIGMASK(sig) ((sigset_t)1 << (sig))
+
+// User signal handler: handler(signo, siginfo_t*, sigcontext_t*)
 typedef void (*signal_handler_t)(int);
 
+#define SIG_DFL ((signal_handler_t)0)
+#define SIG_IGN ((signal_handler_t)1)
+
+// sigaction flags
+#define SA_NODEFER   0x40000000  // Do not block the signal in its handler
+#define SA_RESETHAND 0x80000000  // Reset to SIG_DFL once delivered
+
+// sigprocmask operations
+#define SIG_BLOCK   0
+#define SIG_UNBLOCK 1
+#define SIG_SETMASK 2
+
+// si_code values
+#define SI_USER     0    // kill()
+#define SI_KERNEL   0x80 // Raised by the kernel (faults)
+#define SI_QUEUE    -1   // sigqueue()
+
+typedef struct {
+    int si_signo;
+    int si_code;
+    uint32_t si_pid;                 // Sender
+    uint32_t si_value;               // Payload from sigqueue
+} siginfo_t;
+
+typedef struct {
+    signal_handler_t handler;
+    sigset_t mask;                   // Blocked while the handler runs
+    uint32_t flags;
+} sigaction_t;
+
+// User registers at the point a signal interrupted the process
+typedef struct {
+    uint32_t edi, esi, ebp, ebx, edx, ecx, eax;
+    uint32_t eip, eflags, esp;
+} sigcontext_t;
+
+// Frame pushed on the user stack to run a handler. The handler returns
+// into the trampoline, which calls SYS_SIGRETURN to restore the context.
+typedef struct {
+    uint32_t ret;                    // Return address: trampoline
+    int signo;                       // Handler arguments
+    uint32_t info;
+    uint32_t context;
+    siginfo_t siginfo;
+    sigcontext_t sigcontext;
+    sigset_t blocked;                // Mask to restore
+    uint8_t trampoline[8];
+} sigframe_t;
+
+// A queued real-time signal
+typedef struct sigqueue_entry {
+    siginfo_t info;
+    struct sigqueue_entry* next;
+} sigqueue_entry_t;
+
+// Signal state of a process
+typedef struct {
+    spinlock_t lock;
+    sigset_t pending;                // Signals waiting for delivery
+    sigset_t blocked;                // Signals held back
+    bool stopped;                    // Stopped until SIGCONT
+    waitqueue_t cont;                // Woken by SIGCONT
+    uint32_t queued;                 // Entries in the real-time queues
+    sigaction_t actions[NSIG];
+    siginfo_t info[SIGRTMIN];        // Sender of each pending standard signal
+    sigqueue_entry_t* rt_head[NSIG - SIGRTMIN];  // FIFO per real-time signal
+    sigqueue_entry_t* rt_tail[NSIG - SIGRTMIN];
+} signal_state_t;
+
+struct process;
+
 // Signal handling functions
-void signal_init(void);
-void register_signal_handler(int signum, signal_handler_t handler);
 int send_signal(uint32_t pid, int signum);
-void check_pending_signals(void);
-bool has_pending_signals(void);
-void default_signal_handler(int signum);
+int signal_queue(uint32_t pid, int signum, uint32_t value);
+void signal_force(struct process* process, int signum);
+bool signal_deliver(sigcontext_t* ctx);
+bool signal_return(sigcontext_t* ctx);
+bool signal_deliverable(struct process* process);
+void signal_fork(struct process* child);
+void signal_exec(struct process* process);
+void signal_release(struct process* process);
+int sys_sigaction(int signum, const sigaction_t* act, sigaction_t* oldact);
+int sys_sigprocmask(int how, const sigset_t* set, sigset_t* oldset);
+int signal_cmd_kill(int argc, char* argv[]);
 
 #endif /* _SIGNAL_H */
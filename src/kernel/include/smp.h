@@ -0,0 +1,60 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "gdt.h"
+#include "tss.h"
+#include "spinlock.h"
+#include "sched.h"
+
+// SMP limits
+#define MAX_CPUS             8
+#define SMP_TRAMPOLINE_ADDR  0x8000   // AP real-mode entry (must be page aligned, below 1MB)
+#define SMP_AP_STACK_SIZE    8192
+
+struct process;
+
+// Per-CPU data, reached through the GS segment
+typedef struct cpu {
+    struct cpu* self;                // Must stay first: this_cpu() reads %gs:0
+    uint32_t id;                     // Logical CPU number
+    uint8_t apic_id;                 // Local APIC ID
+    volatile bool online;            // CPU finished bring-up
+    struct process* current;         // Process running on this CPU
+    struct process* idle;            // Process run when the queue is empty
+    struct process* prev;            // Process being switched away from
+    volatile bool need_resched;      // Reschedule at the next opportunity
+    bool in_softirq;                 // Running softirqs; switches are deferred
+    uint32_t interrupt_depth;        // Interrupt handlers running on this CPU
+    runqueue_t rq;                   // Local run queue
+    lock_stats_t rq_lock_stats;      // Contention on rq.lock
+    uint32_t kernel_stack;           // Boot stack for APs
+    uint32_t ticks;                  // Local timer ticks
+    uint32_t idle_ticks;             // Ticks spent running the idle process
+    uint32_t nr_switches;            // Context switches
+    uint32_t nr_steals;              // Processes pulled from other CPUs
+    struct gdt_entry gdt[GDT_ENTRIES];
+    struct gdt_ptr gdt_ptr;
+    tss_t tss;
+} cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+
+// Get the calling CPU's data
+static inline cpu_t* this_cpu(void) {
+    cpu_t* cpu;
+    asm volatile("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+// Function declarations
+void smp_bsp_init(void);
+void smp_init(void);
+uint32_t smp_cpu_count(void);
+cpu_t* smp_get_cpu(uint32_t id);
+void smp_send_reschedule(uint32_t id);
+void smp_idle_loop(void) __attribute__((noreturn));
+int smp_cmd_cpus(int argc, char* argv[]);
+
+#endif /* SMP_H */
@@ -0,0 +1,48 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Softirq numbers, run in this order. Softirqs run on the CPU that
+// raised them, with interrupts enabled, once the outermost interrupt
+// handler is done. They must not sleep.
+#define SOFTIRQ_HI      0   // High-priority tasklets
+#define SOFTIRQ_NET_TX  1   // Transmit completions
+#define SOFTIRQ_NET_RX  2   // Received packets
+#define SOFTIRQ_BLOCK   3   // Disk request completions
+#define SOFTIRQ_TASKLET 4   // Ordinary tasklets
+#define NR_SOFTIRQS     5
+
+// Rounds of newly raised softirqs handled before the rest is handed to
+// ksoftirqd, so a flood of interrupts cannot starve processes
+#define SOFTIRQ_MAX_RESTART 10
+
+typedef void (*softirq_handler_t)(void);
+
+// Tasklet states
+#define TASKLET_SCHEDULED 0x1        // Queued on some CPU
+#define TASKLET_RUNNING   0x2        // Running; the same tasklet never runs twice at once
+
+// Deferred function run from a softirq. Scheduling a tasklet that is
+// already queued does nothing, so one run may cover several interrupts.
+typedef struct tasklet {
+    struct tasklet* next;
+    volatile uint32_t state;
+    void (*func)(uint32_t data);
+    uint32_t data;
+} tasklet_t;
+
+#define TASKLET_INIT(func, data) { NULL, 0, (func), (data) }
+
+// Function declarations
+void softirq_init(void);
+void softirq_open(uint32_t nr, softirq_handler_t handler);
+void softirq_raise(uint32_t nr);
+void softirq_run(void);
+void tasklet_init(tasklet_t* tasklet, void (*func)(uint32_t data), uint32_t data);
+void tasklet_schedule(tasklet_t* tasklet);
+void tasklet_hi_schedule(tasklet_t* tasklet);
+int softirq_cmd_softirqs(int argc, char* argv[]);
+
+#endif /* SOFTIRQ_H */
@@ -10,6 +10,11 @@
 #define MAX_SAMPLE_RATE 48000
 #define DEFAULT_BUFFER_SIZE 4096
 
+// Mixer thread reservation (deadline class)
+#define SOUND_MIXER_PERIOD_US   10000  // Mix every 10ms
+#define SOUND_MIXER_RUNTIME_US   2000  // Worst-case mixing time per period
+#define SOUND_MIXER_FIFO_PRIO      16  // Fallback if the reservation is refused
+
 // Sound buffer states
 #define BUFFER_STATE_FREE     0
 #define BUFFER_STATE_STOPPED  1
@@ -54,6 +59,7 @@ typedef struct sound_device {
 
 // Sound system initialization
 void sound_init(void);
+void sound_start_mixer(void);
 
 // Sound device management
 int sound_device_register(sound_device_t* device);
@@ -0,0 +1,246 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tsc.h"
+#include "irqstat.h"
+
+// Contention statistics of a lock, shown by the lockstat command.
+// Updated only by the lock holder, so no atomics are needed.
+typedef struct lock_stats {
+    const char* name;
+    uint32_t acquisitions;           // Times the lock was taken
+    uint32_t contended;              // Acquisitions that had to wait
+    uint32_t spins;                  // Total wait iterations
+    uint64_t max_hold;               // Longest hold time in TSC cycles
+    uint64_t acquired_at;            // TSC when the current holder took it
+    struct lock_stats* next;         // Registered locks
+} lock_stats_t;
+
+// Ticket spinlock: waiters are served in arrival order
+typedef struct {
+    union {
+        volatile uint32_t ticket;
+        struct {
+            volatile uint16_t owner;  // Ticket being served
+            volatile uint16_t next;   // Next ticket to hand out
+        } half;
+    };
+    lock_stats_t* stats;             // NULL if statistics are off
+} spinlock_t;
+
+#define SPINLOCK_INIT { { 0 }, NULL }
+
+// Reader-writer lock. Readers share it; a writer waits for the readers to
+// drain while holding the inner lock, so new readers queue behind it.
+typedef struct {
+    spinlock_t lock;
+    volatile uint32_t readers;       // Readers inside the critical section
+} rwlock_t;
+
+#define RWLOCK_INIT { SPINLOCK_INIT, 0 }
+
+// Initialize a spinlock
+static inline void spin_init(spinlock_t* lock) {
+    lock->ticket = 0;
+    lock->stats = NULL;
+}
+
+// Record an acquisition that waited for the given number of spins
+static inline void spin_stats_acquire(spinlock_t* lock, uint32_t spins) {
+    lock_stats_t* stats = lock->stats;
+    stats->acquisitions++;
+    if (spins) {
+        stats->contended++;
+        stats->spins += spins;
+    }
+    stats->acquired_at = rdtsc();
+}
+
+// Record the hold time of a release
+static inline void spin_stats_release(spinlock_t* lock) {
+    lock_stats_t* stats = lock->stats;
+    uint64_t held = rdtsc() - stats->acquired_at;
+    if (held > stats->max_hold) {
+        stats->max_hold = held;
+    }
+}
+
+// Acquire a spinlock
+static inline void spin_lock(spinlock_t* lock) {
+    uint16_t ticket = __sync_fetch_and_add(&lock->ticket, 1u << 16) >> 16;
+    uint32_t spins = 0;
+
+    while (lock->half.owner != ticket) {
+        asm volatile("pause");
+        spins++;
+    }
+    asm volatile("" : : : "memory");
+
+    if (lock->stats) {
+        spin_stats_acquire(lock, spins);
+    }
+}
+
+// Try to acquire a spinlock without spinning
+static inline int spin_trylock(spinlock_t* lock) {
+    uint32_t ticket = lock->ticket;
+    if ((uint16_t)ticket != (uint16_t)(ticket >> 16)) return 0;
+    if (!__sync_bool_compare_and_swap(&lock->ticket, ticket, ticket + (1u << 16))) return 0;
+
+    if (lock->stats) {
+        spin_stats_acquire(lock, 0);
+    }
+    return 1;
+}
+
+// Release a spinlock, handing it to the next ticket
+static inline void spin_unlock(spinlock_t* lock) {
+    if (lock->stats) {
+        spin_stats_release(lock);
+    }
+    asm volatile("" : : : "memory");
+    lock->half.owner++;
+}
+
+// Check whether a spinlock is held
+static inline int spin_is_locked(spinlock_t* lock) {
+    uint32_t ticket = lock->ticket;
+    return (uint16_t)ticket != (uint16_t)(ticket >> 16);
+}
+
+// Disable interrupts on the calling CPU, returning the old EFLAGS
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushf\n"
+                 "pop %0\n"
+                 "cli"
+                 : "=r"(flags) : : "memory");
+    if ((flags & 0x200) && irqstat_cli_enabled) {
+        irqstat_cli_begin();
+    }
+    return flags;
+}
+
+// Restore the interrupt state saved by irq_save()
+static inline void irq_restore(uint32_t flags) {
+    if (flags & 0x200) {
+        if (irqstat_cli_enabled) {
+            irqstat_cli_end();
+        }
+        asm volatile("sti" : : : "memory");
+    }
+}
+
+// Acquire a spinlock with interrupts disabled, returning the old EFLAGS
+static inline uint32_t spin_lock_irqsave(spinlock_t* lock) {
+    uint32_t flags;
+    asm volatile("pushf\n"
+                 "pop %0\n"
+                 "cli"
+                 : "=r"(flags) : : "memory");
+    if ((flags & 0x200) && irqstat_cli_enabled) {
+        irqstat_cli_begin();
+    }
+    spin_lock(lock);
+    return flags;
+}
+
+// Release a spinlock and restore the saved interrupt state
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags) {
+    spin_unlock(lock);
+    if (flags & 0x200) {
+        if (irqstat_cli_enabled) {
+            irqstat_cli_end();
+        }
+        asm volatile("sti" : : : "memory");
+    }
+}
+
+// Acquire a spinlock with interrupts disabled, for callers that know
+// interrupts were enabled
+static inline void spin_lock_irq(spinlock_t* lock) {
+    asm volatile("cli" : : : "memory");
+    if (irqstat_cli_enabled) {
+        irqstat_cli_begin();
+    }
+    spin_lock(lock);
+}
+
+// Release a spinlock and enable interrupts
+static inline void spin_unlock_irq(spinlock_t* lock) {
+    spin_unlock(lock);
+    if (irqstat_cli_enabled) {
+        irqstat_cli_end();
+    }
+    asm volatile("sti" : : : "memory");
+}
+
+// Initialize a reader-writer lock
+static inline void rwlock_init(rwlock_t* rw) {
+    spin_init(&rw->lock);
+    rw->readers = 0;
+}
+
+// Enter as a reader
+static inline void read_lock(rwlock_t* rw) {
+    spin_lock(&rw->lock);
+    __sync_fetch_and_add(&rw->readers, 1);
+    spin_unlock(&rw->lock);
+}
+
+// Leave as a reader
+static inline void read_unlock(rwlock_t* rw) {
+    __sync_fetch_and_sub(&rw->readers, 1);
+}
+
+// Enter as the only writer
+static inline void write_lock(rwlock_t* rw) {
+    spin_lock(&rw->lock);
+    while (rw->readers) {
+        asm volatile("pause");
+    }
+}
+
+// Leave as the writer
+static inline void write_unlock(rwlock_t* rw) {
+    spin_unlock(&rw->lock);
+}
+
+// Interrupt-safe reader and writer variants
+static inline uint32_t read_lock_irqsave(rwlock_t* rw) {
+    uint32_t flags = spin_lock_irqsave(&rw->lock);
+    __sync_fetch_and_add(&rw->readers, 1);
+    spin_unlock(&rw->lock);
+    return flags;
+}
+
+static inline void read_unlock_irqrestore(rwlock_t* rw, uint32_t flags) {
+    __sync_fetch_and_sub(&rw->readers, 1);
+    if (flags & 0x200) {
+        if (irqstat_cli_enabled) {
+            irqstat_cli_end();
+        }
+        asm volatile("sti" : : : "memory");
+    }
+}
+
+static inline uint32_t write_lock_irqsave(rwlock_t* rw) {
+    uint32_t flags = spin_lock_irqsave(&rw->lock);
+    while (rw->readers) {
+        asm volatile("pause");
+    }
+    return flags;
+}
+
+static inline void write_unlock_irqrestore(rwlock_t* rw, uint32_t flags) {
+    spin_unlock_irqrestore(&rw->lock, flags);
+}
+
+// Statistics (spinlock.c)
+void spin_lock_stats_init(spinlock_t* lock, lock_stats_t* stats, const char* name);
+void rwlock_stats_init(rwlock_t* rw, lock_stats_t* stats, const char* name);
+int spin_cmd_lockstat(int argc, char* argv[]);
+
+#endif /* SPINLOCK_H */
@@ -0,0 +1,51 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "waitqueue.h"
+
+struct process;
+
+// Sleeping lock; the holder may block while holding it
+typedef struct mutex {
+    volatile uint32_t locked;
+    struct process* owner;           // Holder, for debugging
+    waitqueue_t waiters;
+} mutex_t;
+
+// Counting semaphore
+typedef struct semaphore {
+    volatile int32_t count;
+    waitqueue_t waiters;
+} semaphore_t;
+
+// Condition variable, used together with a mutex
+typedef struct condvar {
+    waitqueue_t waiters;
+} condvar_t;
+
+#define MUTEX_INIT        { 0, NULL, WAITQUEUE_INIT }
+#define SEMAPHORE_INIT(n) { (n), WAITQUEUE_INIT }
+#define CONDVAR_INIT      { WAITQUEUE_INIT }
+
+// Mutexes
+void mutex_init(mutex_t* mutex);
+void mutex_lock(mutex_t* mutex);
+bool mutex_trylock(mutex_t* mutex);
+void mutex_unlock(mutex_t* mutex);
+
+// Semaphores
+void semaphore_init(semaphore_t* sem, int32_t count);
+void semaphore_down(semaphore_t* sem);
+bool semaphore_trydown(semaphore_t* sem);
+bool semaphore_down_timeout(semaphore_t* sem, uint32_t ticks);
+void semaphore_up(semaphore_t* sem);
+
+// Condition variables
+void condvar_init(condvar_t* cv);
+void condvar_wait(condvar_t* cv, mutex_t* mutex);
+void condvar_signal(condvar_t* cv);
+void condvar_broadcast(condvar_t* cv);
+
+#endif /* SYNC_H */
@@ -0,0 +1,100 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Software interrupt used when SYSENTER is unavailable
+#define SYSCALL_VECTOR 0x80
+
+// SYSENTER model-specific registers
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+// System call numbers. Arguments go in EBX, ESI and EDI; the number in EAX,
+// which also carries the result back. SYSENTER callers additionally pass
+// their return address in EDX and their stack pointer in ECX.
+#define SYS_NULL    0   // Does nothing; measures entry overhead
+#define SYS_EXIT    1
+#define SYS_FORK    2
+#define SYS_WAIT    3
+#define SYS_GETPID  4
+#define SYS_KILL    5
+#define SYS_EXEC    6
+#define SYS_SLEEP   7
+#define SYS_YIELD   8
+#define SYS_SPAWN   9
+#define SYS_SIGRETURN   10  // Only through int 0x80, from the signal trampoline
+#define SYS_SIGACTION   11
+#define SYS_SIGPROCMASK 12
+#define SYS_SIGQUEUE    13
+#define NR_SYSCALLS 14
+
+// Returned, negated, when a pointer argument is outside the caller's
+// address space or lacks the access the call needs
+#define EFAULT 14
+
+// Returned, negated, when a signal arrived before a blocking call finished
+#define EINTR 4
+
+// Entry path recorded in syscall_frame_t
+#define SYSCALL_ENTRY_INT80    0
+#define SYSCALL_ENTRY_SYSENTER 1
+
+// Latency histogram: bucket i counts calls of [2^i, 2^(i+1)) TSC cycles
+#define SYSCALL_HIST_BUCKETS 24
+
+// Registers saved by both entry stubs, lowest address first, after the
+// entry path. The return state is right above: the int 0x80 iret frame
+// (EIP, CS, EFLAGS, and ESP, SS from user mode) or the SYSENTER return EIP
+// and ESP.
+typedef struct {
+    uint32_t entry;
+    uint32_t gs, fs, es, ds;
+    uint32_t eax, ebx, ecx, edx, esi, edi, ebp;
+} syscall_frame_t;
+
+// Per-syscall statistics
+typedef struct {
+    uint32_t count;
+    uint64_t total_cycles;
+    uint32_t hist[SYSCALL_HIST_BUCKETS];
+} syscall_stats_t;
+
+// System call handler: up to three register arguments
+typedef int (*syscall_fn_t)(uint32_t arg1, uint32_t arg2, uint32_t arg3);
+
+// Enter the kernel through int 0x80
+static inline int syscall_int80(uint32_t num, uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    int ret;
+    asm volatile("int $0x80"
+                 : "=a"(ret)
+                 : "a"(num), "b"(arg1), "S"(arg2), "D"(arg3)
+                 : "memory", "cc");
+    return ret;
+}
+
+// Enter the kernel through SYSENTER from user mode (check
+// syscall_has_sysenter() first). SYSEXIT always returns to ring 3.
+static inline int syscall_sysenter(uint32_t num, uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    int ret;
+    asm volatile("mov %%esp, %%ecx\n"
+                 "mov $1f, %%edx\n"
+                 "sysenter\n"
+                 "1:"
+                 : "=a"(ret)
+                 : "a"(num), "b"(arg1), "S"(arg2), "D"(arg3)
+                 : "ecx", "edx", "memory", "cc");
+    return ret;
+}
+
+// Function declarations
+void syscall_init_cpu(void);
+bool syscall_has_sysenter(void);
+void syscall_dispatch(syscall_frame_t* frame);
+void syscall_fork_return(void);
+int syscall_cmd_syscalls(int argc, char* argv[]);
+int syscall_cmd_syscallbench(int argc, char* argv[]);
+
+#endif /* SYSCALL_H */
@@ -6,7 +6,9 @@
 // Timer functions
 void timer_init(uint32_t frequency);
 void timer_wait(uint32_t ticks);
+void timer_tick(void);
 uint32_t get_timer_ticks(void);
+void timer_udelay(uint32_t us);
 void sleep(uint32_t ms);
 
 #endif /* TIMER_H */
@@ -0,0 +1,68 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Events per CPU ring (power of two). Older events are overwritten.
+#define TRACE_RING_SIZE 4096
+
+// Event types and their arguments
+#define TRACE_SWITCH        1   // next pid, state the previous process left in
+#define TRACE_WAKEUP        2   // woken pid, CPU whose queue it joins
+#define TRACE_IRQ_ENTRY     3   // vector
+#define TRACE_IRQ_EXIT      4   // vector
+#define TRACE_PAGE_FAULT    5   // address, error code
+#define TRACE_SYSCALL_ENTRY 6   // number, first argument
+#define TRACE_SYSCALL_EXIT  7   // number, result
+#define TRACE_TICK          8   // timer tick count
+
+// Export ports
+#define TRACE_SERIAL_PORT   0x3F8  // COM1
+#define TRACE_DEBUGCON_PORT 0xE9   // QEMU/Bochs debug console
+
+// One trace record. The CPU is implied by the ring holding it.
+typedef struct {
+    uint64_t tsc;                    // Time stamp counter
+    uint16_t pid;                    // Process running when it was recorded
+    uint8_t type;                    // TRACE_*
+    uint8_t reserved;
+    uint32_t arg0;
+    uint32_t arg1;
+} trace_event_t;
+
+// Per-CPU ring. Only its own CPU writes it; interrupts nesting on that
+// CPU reserve their slot with an atomic add, so no lock is taken.
+typedef struct {
+    trace_event_t* events;           // TRACE_RING_SIZE entries, NULL until tracing starts
+    volatile uint32_t head;          // Events recorded; the next slot is head % size
+} trace_ring_t;
+
+// Set while tracing; hooks check it before doing anything else
+extern volatile bool trace_enabled;
+
+void trace_record(uint8_t type, uint32_t arg0, uint32_t arg1);
+
+// Record an event if tracing is on
+static inline void trace_event(uint8_t type, uint32_t arg0, uint32_t arg1) {
+    if (trace_enabled) {
+        trace_record(type, arg0, arg1);
+    }
+}
+
+// Function declarations
+bool trace_start(void);
+void trace_stop(void);
+void trace_clear(void);
+void trace_export(uint16_t port);
+int trace_cmd_trace(int argc, char* argv[]);
+
+// Text output on an export port, shared with the profiler
+void trace_port_init(uint16_t port);
+void trace_putc(uint16_t port, char c);
+void trace_puts(uint16_t port, const char* s);
+void trace_puthex(uint16_t port, uint32_t value, int digits);
+void trace_putdec(uint16_t port, uint32_t value);
+void trace_put_process(uint16_t port, uint32_t pid);
+
+#endif /* TRACE_H */
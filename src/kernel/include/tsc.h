@@ -0,0 +1,51 @@
+#ifndef TSC_H
+#define TSC_H
+
+#include <stdint.h>
+
+// TSC frequency in MHz, set by tsc_calibrate()
+extern uint32_t tsc_mhz;
+
+// Read the time stamp counter
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Convert a TSC interval to microseconds, saturating on overflow.
+// Uses a single 64/32 divl so no libgcc helpers are needed.
+static inline uint32_t tsc_to_us(uint64_t cycles) {
+    uint32_t lo = (uint32_t)cycles;
+    uint32_t hi = (uint32_t)(cycles >> 32);
+    uint32_t us;
+
+    if (hi >= tsc_mhz) return 0xFFFFFFFF;
+    asm("divl %3" : "=a"(us), "=d"(lo) : "a"(lo), "r"(tsc_mhz), "d"(hi));
+    return us;
+}
+
+// Convert a TSC value to microseconds without saturating
+static inline uint64_t tsc_to_us64(uint64_t cycles) {
+    uint32_t hi = (uint32_t)(cycles >> 32);
+    uint32_t q_hi = hi / tsc_mhz;
+    uint32_t rem = hi % tsc_mhz;
+    uint32_t q_lo;
+
+    asm("divl %3" : "=a"(q_lo), "=d"(rem) : "a"((uint32_t)cycles), "r"(tsc_mhz), "d"(rem));
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
+// Monotonic microsecond clock
+static inline uint64_t tsc_now_us(void) {
+    return tsc_to_us64(rdtsc());
+}
+
+// Microseconds since a TSC reading
+static inline uint32_t tsc_us_since(uint64_t start) {
+    return tsc_to_us(rdtsc() - start);
+}
+
+void tsc_calibrate(void);
+
+#endif /* TSC_H */
@@ -35,6 +35,7 @@ typedef struct {
 } __attribute__((packed)) tss_t;
 
 // TSS functions
+void tss_setup(tss_t* tss);
 void tss_init(uint32_t gdt_entry);
 void tss_set_kernel_stack(uint32_t stack);
 void tss_flush(void);
@@ -0,0 +1,68 @@
+#ifndef VFS_H
+#define VFS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "fs.h"
+#include "sync.h"
+
+// Longest name a path component may have
+#define VFS_NAME_MAX            63
+
+// Dentry cache: entries kept, and hash chains to find them by
+#define DCACHE_ENTRIES          512
+#define DCACHE_HASH_SIZE        256
+
+#define VFS_MAX_MOUNTS          8
+
+// Dentry flags
+#define DENTRY_HASHED           0x01    // Found by lookups
+#define DENTRY_USED             0x02    // Allocated from the pool
+
+struct vfs_mount;
+
+// A name in a directory, and the node it names; a negative dentry records
+// that the name does not exist. Cached dentries hold a reference to their
+// node and pin their parent.
+typedef struct dentry {
+    char name[VFS_NAME_MAX + 1];
+    uint32_t hash;
+    struct dentry* parent;           // NULL for the root of a mount
+    fs_node_t* node;                 // NULL if negative
+    struct vfs_mount* mounted;       // Mount covering this directory, if any
+    struct vfs_mount* mount_root;    // Mount this is the root of, if any
+    uint32_t refs;
+    uint32_t children;               // Cached dentries below this one
+    uint8_t flags;                   // DENTRY_*
+    struct dentry* hash_next;
+    struct dentry* lru_prev;         // Least recently used first
+    struct dentry* lru_next;
+} dentry_t;
+
+// A file system mounted on a directory
+typedef struct vfs_mount {
+    dentry_t* mountpoint;            // NULL for the root file system
+    dentry_t* root;
+    char source[16];
+    char type[8];
+    bool used;
+} vfs_mount_t;
+
+// Held around every VFS and file system call
+extern mutex_t vfs_lock;
+
+// Function declarations; the caller holds vfs_lock
+dentry_t* dget(dentry_t* dentry);
+void dput(dentry_t* dentry);
+dentry_t* vfs_lookup(const char* path);
+dentry_t* vfs_lookup_parent(const char* path, char* name);
+dentry_t* vfs_lookup_child(dentry_t* dir, const char* name);
+int vfs_create(dentry_t* dentry, uint32_t type);
+int vfs_unlink(dentry_t* dentry);
+int vfs_mount(const char* path, fs_node_t* root, const char* source, const char* type);
+
+// Commands; these take vfs_lock themselves
+int vfs_cmd_mount(int argc, char* argv[]);
+int vfs_cmd_dcache(int argc, char* argv[]);
+
+#endif /* VFS_H */
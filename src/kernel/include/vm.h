@@ -0,0 +1,65 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "memory.h"
+
+// Area permissions
+#define VM_READ  0x1
+#define VM_WRITE 0x2
+#define VM_EXEC  0x4
+
+// User address space layout. Below USER_SPACE_START the kernel
+// identity-maps physical memory (the image, the heap, every frame and the
+// ACPI tables); from USER_SPACE_END up it identity-maps device memory.
+// Both are supervisor-only and shared by all page directories.
+#define USER_SPACE_START 0x08000000
+#define USER_SPACE_END   0xC0000000
+#define USER_STACK_TOP   USER_SPACE_END
+#define USER_STACK_PAGES 32
+
+// Page fault error code bits
+#define PF_ERR_PRESENT 0x1
+#define PF_ERR_WRITE   0x2
+#define PF_ERR_USER    0x4
+
+struct elf_image;
+
+// A range of user virtual memory whose pages are filled in on first
+// access. File-backed areas read from an executable; the part of the area
+// past filesz, and areas without an image, are zero-filled.
+typedef struct vm_area {
+    uint32_t start;                 // Page-aligned first address
+    uint32_t end;                   // Page-aligned end (exclusive)
+    uint32_t flags;                 // VM_READ, VM_WRITE, VM_EXEC
+    struct elf_image* image;        // Backing executable, NULL if anonymous
+    uint32_t offset;                // File offset of start (page-aligned)
+    uint32_t filesz;                // Bytes from start backed by the file
+    struct vm_area* next;           // Areas of the process, unordered
+} vm_area_t;
+
+// Page fault counters, shown by the vmstat command
+typedef struct {
+    uint32_t faults;                // Page faults taken
+    uint32_t file_pages;            // Private pages read from a file
+    uint32_t shared_pages;          // Read-only pages mapped from an image
+    uint32_t zero_pages;            // Pages zero-filled
+    uint32_t segv;                  // Faults outside any area
+} vm_stats_t;
+
+// Function declarations
+void vm_init(void);
+vm_area_t* vm_find(vm_area_t* areas, uint32_t address);
+bool vm_access_ok(vm_area_t* areas, uint32_t start, uint32_t len, bool write);
+int vm_string_ok(vm_area_t* areas, uint32_t start, uint32_t max);
+bool vm_map(vm_area_t** areas, uint32_t start, uint32_t end, uint32_t flags,
+            struct elf_image* image, uint32_t offset, uint32_t filesz);
+bool vm_fork(page_directory_t* child_dir, vm_area_t** child_areas,
+             page_directory_t* parent_dir, vm_area_t* parent_areas);
+void vm_release(page_directory_t* dir, vm_area_t** areas);
+bool vm_copy_out(page_directory_t* dir, vm_area_t* areas, uint32_t address,
+                 const void* src, uint32_t len);
+int vm_cmd_vmstat(int argc, char* argv[]);
+
+#endif /* VM_H */
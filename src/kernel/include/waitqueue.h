@@ -0,0 +1,92 @@
+#ifndef WAITQUEUE_H
+#define WAITQUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "spinlock.h"
+#include "timer.h"
+
+struct process;
+
+// A process waiting on a queue. Lives on the waiter's stack.
+typedef struct wait_entry {
+    struct process* process;
+    struct wait_entry* next;
+    bool queued;                     // Still linked into the queue
+} wait_entry_t;
+
+// Queue of processes waiting for an event
+typedef struct waitqueue {
+    spinlock_t lock;
+    wait_entry_t* head;
+} waitqueue_t;
+
+#define WAITQUEUE_INIT { SPINLOCK_INIT, NULL }
+
+// Function declarations
+void waitqueue_init(waitqueue_t* wq);
+void waitqueue_prepare(waitqueue_t* wq, wait_entry_t* entry);
+void waitqueue_finish(waitqueue_t* wq, wait_entry_t* entry);
+void waitqueue_sleep(uint32_t deadline);
+bool waitqueue_wake_one(waitqueue_t* wq);
+void waitqueue_wake_all(waitqueue_t* wq);
+bool waitqueue_interrupted(void);
+
+// Block the calling process until condition is true. The condition is
+// re-checked after queueing, so a wakeup between the check and the
+// sleep is never lost.
+#define wait_event(wq, condition)                                   \
+    do {                                                            \
+        wait_entry_t __entry;                                       \
+        while (!(condition)) {                                      \
+            waitqueue_prepare(&(wq), &__entry);                     \
+            if (condition) {                                        \
+                waitqueue_finish(&(wq), &__entry);                  \
+                break;                                              \
+            }                                                       \
+            waitqueue_sleep(0);                                     \
+            waitqueue_finish(&(wq), &__entry);                      \
+        }                                                           \
+    } while (0)
+
+// Like wait_event, but give up after a number of timer ticks.
+// Evaluates to true if the condition became true.
+#define wait_event_timeout(wq, condition, ticks)                    \
+    ({                                                              \
+        uint32_t __deadline = get_timer_ticks() + (ticks);          \
+        wait_entry_t __entry;                                       \
+        bool __done;                                                \
+        while (!(__done = (condition)) &&                           \
+               (int32_t)(get_timer_ticks() - __deadline) < 0) {     \
+            waitqueue_prepare(&(wq), &__entry);                     \
+            if ((__done = (condition))) {                           \
+                waitqueue_finish(&(wq), &__entry);                  \
+                break;                                              \
+            }                                                       \
+            waitqueue_sleep(__deadline);                            \
+            waitqueue_finish(&(wq), &__entry);                      \
+        }                                                           \
+        __done;                                                     \
+    })
+
+// Like wait_event, but give up if a signal arrives for the calling
+// process. Evaluates to true if the condition became true, false if the
+// wait was interrupted.
+#define wait_event_interruptible(wq, condition)                     \
+    ({                                                              \
+        wait_entry_t __entry;                                       \
+        bool __done;                                                \
+        while (!(__done = (condition)) && !waitqueue_interrupted()) { \
+            waitqueue_prepare(&(wq), &__entry);                     \
+            if ((__done = (condition)) || waitqueue_interrupted()) { \
+                waitqueue_finish(&(wq), &__entry);                  \
+                break;                                              \
+            }                                                       \
+            waitqueue_sleep(0);                                     \
+            waitqueue_finish(&(wq), &__entry);                      \
+        }                                                           \
+        __done;                                                     \
+    })
+
+#endif /* WAITQUEUE_H */
@@ -0,0 +1,56 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spinlock.h"
+#include "waitqueue.h"
+#include "smp.h"
+
+// Worker threads each CPU gives a workqueue. More than one lets a work
+// item that sleeps leave the others running.
+#define WORKQUEUE_WORKERS 2
+
+// A function to run later in a worker thread, where it may sleep
+typedef struct work {
+    struct work* next;
+    void (*func)(struct work* work);
+    volatile bool pending;           // Queued and not yet started
+} work_t;
+
+#define WORK_INIT(func) { NULL, (func), false }
+
+// Work queued on one CPU, and the workers that run it
+typedef struct {
+    spinlock_t lock;
+    work_t* head;
+    work_t* tail;
+    uint32_t running;                // Items being run
+    waitqueue_t more;                // Workers wait here for work
+    waitqueue_t idle;                // Flushers wait here for the pool to drain
+    uint32_t processed;              // Items run so far
+    struct workqueue* wq;
+    uint32_t cpu;
+} worker_pool_t;
+
+// A named set of per-CPU pools
+typedef struct workqueue {
+    const char* name;
+    worker_pool_t pools[MAX_CPUS];
+    struct workqueue* next;
+} workqueue_t;
+
+// Shared queue for work that does not need its own
+extern workqueue_t* system_wq;
+
+// Function declarations
+void workqueue_init(void);
+workqueue_t* workqueue_create(const char* name);
+void work_init(work_t* work, void (*func)(work_t* work));
+bool queue_work(workqueue_t* wq, work_t* work);
+bool queue_work_on(uint32_t cpu, workqueue_t* wq, work_t* work);
+bool schedule_work(work_t* work);
+void workqueue_flush(workqueue_t* wq);
+int workqueue_cmd_workqueues(int argc, char* argv[]);
+
+#endif /* WORKQUEUE_H */
@@ -6,6 +6,13 @@
 #include "terminal.h"
 #include "pic.h"
 #include "signal.h"
+#include "process.h"
+#include "trace.h"
+#include "prof.h"
+#include "softirq.h"
+#include "irqstat.h"
+#include "irq.h"
+#include "syscall.h"
 
 // IDT entry structure
 struct idt_entry {
@@ -63,8 +70,38 @@ extern void isr29(void);
 extern void isr30(void);
 extern void isr31(void);
 
-// Interrupt nesting level
-static volatile int interrupt_depth = 0;
+// IRQ handlers from assembly
+extern void irq0(void);
+extern void irq1(void);
+extern void irq2(void);
+extern void irq3(void);
+extern void irq4(void);
+extern void irq5(void);
+extern void irq6(void);
+extern void irq7(void);
+extern void irq8(void);
+extern void irq9(void);
+extern void irq10(void);
+extern void irq11(void);
+extern void irq12(void);
+extern void irq13(void);
+extern void irq14(void);
+extern void irq15(void);
+
+// Local APIC handlers from assembly
+extern void isr64(void);
+extern void isr65(void);
+extern void isr80(void);
+extern void isr81(void);
+extern void isr82(void);
+extern void isr83(void);
+extern void isr84(void);
+extern void isr85(void);
+extern void isr86(void);
+extern void isr87(void);
+extern void isr_spurious(void);
+extern void syscall_int80_entry(void);
+
 static volatile int in_critical_section = 0;
 
 // Interrupt handlers
@@ -159,6 +196,42 @@ void interrupt_init(void) {
     idt_set_gate(30, (uint32_t)isr30, 0x08, 0x8E);
     idt_set_gate(31, (uint32_t)isr31, 0x08, 0x8E);
 
+    // Install IRQ handlers
+    idt_set_gate(32, (uint32_t)irq0, 0x08, 0x8E);
+    idt_set_gate(33, (uint32_t)irq1, 0x08, 0x8E);
+    idt_set_gate(34, (uint32_t)irq2, 0x08, 0x8E);
+    idt_set_gate(35, (uint32_t)irq3, 0x08, 0x8E);
+    idt_set_gate(36, (uint32_t)irq4, 0x08, 0x8E);
+    idt_set_gate(37, (uint32_t)irq5, 0x08, 0x8E);
+    idt_set_gate(38, (uint32_t)irq6, 0x08, 0x8E);
+    idt_set_gate(39, (uint32_t)irq7, 0x08, 0x8E);
+    idt_set_gate(40, (uint32_t)irq8, 0x08, 0x8E);
+    idt_set_gate(41, (uint32_t)irq9, 0x08, 0x8E);
+    idt_set_gate(42, (uint32_t)irq10, 0x08, 0x8E);
+    idt_set_gate(43, (uint32_t)irq11, 0x08, 0x8E);
+    idt_set_gate(44, (uint32_t)irq12, 0x08, 0x8E);
+    idt_set_gate(45, (uint32_t)irq13, 0x08, 0x8E);
+    idt_set_gate(46, (uint32_t)irq14, 0x08, 0x8E);
+    idt_set_gate(47, (uint32_t)irq15, 0x08, 0x8E);
+
+    // Install local APIC handlers
+    idt_set_gate(64, (uint32_t)isr64, 0x08, 0x8E);
+    idt_set_gate(65, (uint32_t)isr65, 0x08, 0x8E);
+
+    // Install MSI handlers
+    idt_set_gate(80, (uint32_t)isr80, 0x08, 0x8E);
+    idt_set_gate(81, (uint32_t)isr81, 0x08, 0x8E);
+    idt_set_gate(82, (uint32_t)isr82, 0x08, 0x8E);
+    idt_set_gate(83, (uint32_t)isr83, 0x08, 0x8E);
+    idt_set_gate(84, (uint32_t)isr84, 0x08, 0x8E);
+    idt_set_gate(85, (uint32_t)isr85, 0x08, 0x8E);
+    idt_set_gate(86, (uint32_t)isr86, 0x08, 0x8E);
+    idt_set_gate(87, (uint32_t)isr87, 0x08, 0x8E);
+    idt_set_gate(255, (uint32_t)isr_spurious, 0x08, 0x8E);
+
+    // System calls: trap gate reachable from ring 3
+    idt_set_gate(SYSCALL_VECTOR, (uint32_t)syscall_int80_entry, 0x08, 0xEF);
+
     // Remap PIC
     pic_remap(0x20, 0x28);
 
@@ -169,6 +242,11 @@ void interrupt_init(void) {
     __asm__ volatile("sti");
 }
 
+// Load the shared IDT on the calling CPU
+void interrupt_load_idt(void) {
+    idt_load(&idtp);
+}
+
 // Register an interrupt handler
 void register_interrupt_handler(uint8_t n, interrupt_handler_t handler) {
     if (handler) {
@@ -179,22 +257,61 @@ void register_interrupt_handler(uint8_t n, interrupt_handler_t handler) {
 // Enter critical section
 void enter_critical_section(void) {
     __asm__ volatile("cli");
-    in_critical_section++;
+    if (in_critical_section++ == 0 && irqstat_cli_enabled) {
+        irqstat_cli_begin_at(__builtin_return_address(0));
+    }
 }
 
 // Exit critical section
 void exit_critical_section(void) {
     if (--in_critical_section == 0) {
+        if (irqstat_cli_enabled) {
+            irqstat_cli_end();
+        }
         __asm__ volatile("sti");
     }
 }
 
+// Deliver pending signals to the process an interrupt returns to. regs is
+// the frame the entry stub restores, so a handler frame set up here is
+// where iret lands.
+static void interrupt_deliver_signals(registers_t* regs) {
+    process_t* current = current_process;
+    if (!current || !signal_deliverable(current)) return;
+
+    sigcontext_t ctx = {
+        regs->edi, regs->esi, regs->ebp, regs->ebx, regs->edx, regs->ecx, regs->eax,
+        regs->eip, regs->eflags, regs->useresp,
+    };
+    if (!signal_deliver(&ctx)) return;
+
+    regs->edi = ctx.edi;
+    regs->esi = ctx.esi;
+    regs->ebp = ctx.ebp;
+    regs->ebx = ctx.ebx;
+    regs->edx = ctx.edx;
+    regs->ecx = ctx.ecx;
+    regs->eax = ctx.eax;
+    regs->eip = ctx.eip;
+    regs->eflags = ctx.eflags;
+    regs->useresp = ctx.esp;
+}
+
 // Common interrupt handler
 void isr_handler(registers_t regs) {
-    interrupt_depth++;
+    // Time up to here belongs to the interrupted user code
+    bool from_user = (regs.cs & 0x3) == 3;
+    if (from_user && current_process) {
+        acct_kernel_enter(&current_process->acct);
+    }
+
+    // Interrupt nesting level, per CPU: a handler may switch processes,
+    // so the CPU is looked up again on the way out
+    this_cpu()->interrupt_depth++;
+    trace_event(TRACE_IRQ_ENTRY, regs.int_no, 0);
 
-    // Handle CPU exceptions (interrupts 0-31)
-    if (regs.int_no < 32) {
+    // Handle CPU exceptions (interrupts 0-31) nobody has claimed
+    if (regs.int_no < 32 && !interrupt_handlers[regs.int_no]) {
         if (regs.int_no < sizeof(exception_messages) / sizeof(char*)) {
             kprintf("Exception: %s\n", exception_messages[regs.int_no]);
         } else {
@@ -219,54 +336,56 @@ void isr_handler(registers_t regs) {
         }
     }
 
-    // Call registered handler if available
-    if (interrupt_handlers[regs.int_no]) {
-        interrupt_handlers[regs.int_no](regs);
-    } else if (regs.int_no >= 32) {
-        kprintf("Unhandled interrupt: %d\n", regs.int_no);
-    }
-
-    interrupt_depth--;
-
-    // If we're returning to user mode and there are pending signals,
-    // handle them now
-    if (interrupt_depth == 0 && (regs.cs & 0x3) == 3) {
-        check_pending_signals();
+    // Device and local APIC interrupts are acknowledged here, before the
+    // handler and nowhere else: a handler may switch to another process,
+    // and the controller must not wait for that process to come back
+    if (regs.int_no >= 32) {
+        irq_eoi(regs.int_no);
     }
-}
 
-// IRQ handler
-void irq_handler(registers_t regs) {
-    interrupt_depth++;
-
-    // Send an EOI (end of interrupt) signal to the PICs
-    if (regs.int_no >= 40) {
-        outb(0xA0, 0x20); // Send reset signal to slave
+    // IRQ0, the PIT, is the bootstrap processor's tick
+    if (regs.int_no == 32) {
+        prof_tick(regs.eip, regs.ebp, (regs.cs & 0x3) == 3);
     }
-    outb(0x20, 0x20); // Send reset signal to master
 
-    // Call the registered handler if available
+    // Call registered handler if available, timing it
     if (interrupt_handlers[regs.int_no]) {
+        irqstat_stamp_t stamp;
+        irqstat_irq_enter(regs.int_no, &stamp);
         interrupt_handlers[regs.int_no](regs);
+        irqstat_irq_exit(regs.int_no, &stamp);
+    } else if (regs.int_no >= 32) {
+        kprintf("Unhandled interrupt: %d\n", regs.int_no);
     }
 
-    interrupt_depth--;
+    trace_event(TRACE_IRQ_EXIT, regs.int_no, 0);
+    this_cpu()->interrupt_depth--;
+
+    // Deferred work raised by a device handler runs now, unless the
+    // interrupt arrived inside another handler
+    if (regs.int_no >= 32 && (regs.eflags & 0x200)) {
+        softirq_run();
+    }
 
     // If we're returning to user mode and there are pending signals,
     // handle them now
-    if (interrupt_depth == 0 && (regs.cs & 0x3) == 3) {
-        check_pending_signals();
+    if (this_cpu()->interrupt_depth == 0 && (regs.cs & 0x3) == 3) {
+        interrupt_deliver_signals(&regs);
+    }
+
+    if (from_user && current_process) {
+        acct_kernel_exit(&current_process->acct);
     }
 }
 
 // Get current interrupt depth
 int get_interrupt_depth(void) {
-    return interrupt_depth;
+    return this_cpu()->interrupt_depth;
 }
 
 // Check if we're in an interrupt context
 bool is_interrupt_context(void) {
-    return interrupt_depth > 0;
+    return this_cpu()->interrupt_depth > 0;
 }
 
 // Disable interrupts
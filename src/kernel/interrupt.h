@@ -16,8 +16,8 @@ typedef void (*interrupt_handler_t)(registers_t);
 
 // Function declarations
 void interrupt_init(void);
+void interrupt_load_idt(void);
 void register_interrupt_handler(uint8_t n, interrupt_handler_t handler);
 void isr_handler(registers_t regs);
-void irq_handler(registers_t regs);
 
 #endif
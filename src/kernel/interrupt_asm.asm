@@ -13,27 +13,34 @@ idt_load:
 isr_common_stub:
     pusha               ; Push all registers
     
-    mov ax, ds         ; Save data segment
-    push eax
+    push ds             ; Save segment registers
+    push es
+    push fs
+    push gs
     
     mov ax, 0x10       ; Load kernel data segment
     mov ds, ax
     mov es, ax
     mov fs, ax
+    mov ax, 0x30       ; Load per-CPU data segment
     mov gs, ax
     
     call isr_handler
     
-    pop eax            ; Restore data segment
-    mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
+    pop gs             ; Restore segment registers
+    pop fs
+    pop es
+    pop ds
     
     popa               ; Restore registers
     add esp, 8         ; Clean up error code and ISR number
     iret               ; Return from interrupt
 
+; Spurious local APIC interrupts must not be acknowledged
+global isr_spurious
+isr_spurious:
+    iret
+
 ; Define ISR handlers
 %macro ISR_NOERRCODE 1
 global isr%1
@@ -43,6 +50,14 @@ isr%1:
     jmp isr_common_stub
 %endmacro
 
+%macro IRQ 2
+global irq%1
+irq%1:
+    push byte 0        ; Push dummy error code
+    push byte %2       ; Push interrupt number
+    jmp isr_common_stub
+%endmacro
+
 %macro ISR_ERRCODE 1
 global isr%1
 isr%1:
@@ -82,4 +97,36 @@ ISR_NOERRCODE 27   ; Reserved
 ISR_NOERRCODE 28   ; Reserved
 ISR_NOERRCODE 29   ; Reserved
 ISR_NOERRCODE 30   ; Reserved
-ISR_NOERRCODE 31   ; Reserved 
\ No newline at end of file
+ISR_NOERRCODE 31   ; Reserved
+
+; Hardware IRQs (remapped to 32-47)
+IRQ 0, 32
+IRQ 1, 33
+IRQ 2, 34
+IRQ 3, 35
+IRQ 4, 36
+IRQ 5, 37
+IRQ 6, 38
+IRQ 7, 39
+IRQ 8, 40
+IRQ 9, 41
+IRQ 10, 42
+IRQ 11, 43
+IRQ 12, 44
+IRQ 13, 45
+IRQ 14, 46
+IRQ 15, 47
+
+; Local APIC vectors
+ISR_NOERRCODE 64   ; Local APIC timer
+ISR_NOERRCODE 65   ; Reschedule IPI
+
+; Message-signalled interrupts (IRQ_MSI_VECTOR_BASE onwards)
+ISR_NOERRCODE 80
+ISR_NOERRCODE 81
+ISR_NOERRCODE 82
+ISR_NOERRCODE 83
+ISR_NOERRCODE 84
+ISR_NOERRCODE 85
+ISR_NOERRCODE 86
+ISR_NOERRCODE 87
@@ -0,0 +1,110 @@
+#include "ioapic.h"
+#include "acpi.h"
+#include "spinlock.h"
+
+// One I/O APIC and the global system interrupts it handles
+typedef struct {
+    volatile uint32_t* base;         // MMIO base (identity mapped)
+    uint8_t id;
+    uint32_t gsi_base;
+    uint32_t inputs;                 // Redirection entries
+} ioapic_t;
+
+static ioapic_t ioapics[ACPI_MAX_IOAPICS];
+static int ioapic_count = 0;
+
+// IOAPIC_REGSEL and IOAPIC_WINDOW are a pair; one user at a time
+static spinlock_t ioapic_lock = SPINLOCK_INIT;
+
+// Read a register. ioapic_lock is held.
+static uint32_t ioapic_read(ioapic_t* io, uint8_t reg) {
+    io->base[IOAPIC_REGSEL / 4] = reg;
+    return io->base[IOAPIC_WINDOW / 4];
+}
+
+// Write a register. ioapic_lock is held.
+static void ioapic_write(ioapic_t* io, uint8_t reg, uint32_t value) {
+    io->base[IOAPIC_REGSEL / 4] = reg;
+    io->base[IOAPIC_WINDOW / 4] = value;
+}
+
+// Find the I/O APIC handling a global system interrupt
+static ioapic_t* ioapic_for(uint32_t gsi) {
+    for (int i = 0; i < ioapic_count; i++) {
+        ioapic_t* io = &ioapics[i];
+        if (gsi >= io->gsi_base && gsi < io->gsi_base + io->inputs) {
+            return io;
+        }
+    }
+    return NULL;
+}
+
+// Set up the I/O APICs listed in the ACPI MADT with every input masked.
+// Returns how many were found.
+int ioapic_init(void) {
+    ioapic_count = 0;
+
+    for (int i = 0; i < acpi_get_ioapic_count() && i < ACPI_MAX_IOAPICS; i++) {
+        const madt_ioapic_t* entry = acpi_get_ioapic(i);
+        ioapic_t* io = &ioapics[ioapic_count++];
+        io->base = (volatile uint32_t*)entry->address;
+        io->id = entry->ioapic_id;
+        io->gsi_base = entry->gsi_base;
+
+        uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+        io->inputs = ((ioapic_read(io, IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+        for (uint32_t pin = 0; pin < io->inputs; pin++) {
+            ioapic_write(io, IOAPIC_REG_REDIR + pin * 2, IOAPIC_REDIR_MASKED);
+            ioapic_write(io, IOAPIC_REG_REDIR + pin * 2 + 1, 0);
+        }
+        spin_unlock_irqrestore(&ioapic_lock, flags);
+    }
+
+    return ioapic_count;
+}
+
+// Check if an I/O APIC has been set up
+bool ioapic_available(void) {
+    return ioapic_count > 0;
+}
+
+// Deliver a global system interrupt as a vector to one CPU, unmasked.
+// flags holds IOAPIC_REDIR_LEVEL and IOAPIC_REDIR_ACTIVE_LOW as needed.
+bool ioapic_route(uint32_t gsi, uint8_t vector, uint8_t apic_id, uint32_t flags) {
+    ioapic_t* io = ioapic_for(gsi);
+    if (!io) return false;
+
+    uint32_t pin = gsi - io->gsi_base;
+    uint32_t low = vector | (flags & (IOAPIC_REDIR_LEVEL | IOAPIC_REDIR_ACTIVE_LOW));
+
+    uint32_t irq_flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_write(io, IOAPIC_REG_REDIR + pin * 2, IOAPIC_REDIR_MASKED);
+    ioapic_write(io, IOAPIC_REG_REDIR + pin * 2 + 1, (uint32_t)apic_id << 24);
+    ioapic_write(io, IOAPIC_REG_REDIR + pin * 2, low);
+    spin_unlock_irqrestore(&ioapic_lock, irq_flags);
+    return true;
+}
+
+// Mask or unmask a global system interrupt
+void ioapic_mask(uint32_t gsi, bool masked) {
+    ioapic_t* io = ioapic_for(gsi);
+    if (!io) return;
+
+    uint8_t reg = IOAPIC_REG_REDIR + (gsi - io->gsi_base) * 2;
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+    uint32_t low = ioapic_read(io, reg);
+    ioapic_write(io, reg, masked ? low | IOAPIC_REDIR_MASKED : low & ~IOAPIC_REDIR_MASKED);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+// Send a global system interrupt to another CPU
+bool ioapic_set_dest(uint32_t gsi, uint8_t apic_id) {
+    ioapic_t* io = ioapic_for(gsi);
+    if (!io) return false;
+
+    uint8_t reg = IOAPIC_REG_REDIR + (gsi - io->gsi_base) * 2 + 1;
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_write(io, reg, (uint32_t)apic_id << 24);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+    return true;
+}
@@ -0,0 +1,254 @@
+#include "irq.h"
+#include "acpi.h"
+#include "ioapic.h"
+#include "lapic.h"
+#include "pic.h"
+#include "pci.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "terminal.h"
+#include "string.h"
+
+// Routing of every vector; legacy IRQs keep theirs across the switch
+// from the PIC to the I/O APIC
+static irq_route_t irq_routes[256];
+static spinlock_t irq_lock = SPINLOCK_INIT;
+
+// Set once the I/O APIC delivers the legacy IRQs and the local APIC
+// takes every EOI
+static bool irq_use_apic = false;
+
+static const char* irq_route_names[] = { "none", "PIC", "IOAPIC", "MSI", "MSI-X" };
+
+// Check if interrupts go through the I/O APIC and local APICs
+bool irq_apic_mode(void) {
+    return irq_use_apic;
+}
+
+// Program the I/O APIC input of a legacy vector. ISA IRQs default to
+// edge-triggered active high and PCI lines to level-triggered active
+// low, unless the MADT overrides them. irq_lock is held.
+static void irq_route_ioapic(uint8_t vector, irq_route_t* r, bool pci) {
+    uint16_t iso;
+    r->gsi = acpi_irq_to_gsi(vector - IRQ_LEGACY_BASE, &iso);
+
+    bool level = pci;
+    bool low = pci;
+    if ((iso & MADT_ISO_TRIGGER_MASK) == MADT_ISO_EDGE) level = false;
+    if ((iso & MADT_ISO_TRIGGER_MASK) == MADT_ISO_LEVEL) level = true;
+    if ((iso & MADT_ISO_POLARITY_MASK) == MADT_ISO_ACTIVE_HIGH) low = false;
+    if ((iso & MADT_ISO_POLARITY_MASK) == MADT_ISO_ACTIVE_LOW) low = true;
+
+    uint32_t flags = (level ? IOAPIC_REDIR_LEVEL : 0) | (low ? IOAPIC_REDIR_ACTIVE_LOW : 0);
+    if (ioapic_route(r->gsi, vector, smp_get_cpu(r->cpu)->apic_id, flags)) {
+        r->route = IRQ_ROUTE_IOAPIC;
+        r->level = level;
+    } else {
+        kprintf("IRQ: no I/O APIC input for GSI %u\n", r->gsi);
+        r->route = IRQ_ROUTE_NONE;
+    }
+}
+
+// Enable a legacy IRQ on whichever controller is in use
+static void irq_enable_legacy(uint8_t vector, const char* name, bool pci) {
+    if (vector < IRQ_LEGACY_BASE || vector >= IRQ_LEGACY_BASE + IRQ_LEGACY_COUNT) return;
+    uint8_t irq = vector - IRQ_LEGACY_BASE;
+
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    irq_route_t* r = &irq_routes[vector];
+    r->name = name;
+    r->cpu = 0;
+    r->pci = pci;
+
+    if (irq_use_apic) {
+        irq_route_ioapic(vector, r, pci);
+    } else {
+        r->route = IRQ_ROUTE_PIC;
+        r->level = pci;
+        pic_enable_irq(irq);
+        if (irq >= 8) {
+            pic_enable_irq(2);  // Cascade from the slave
+        }
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+}
+
+// Enable an ISA IRQ, given its vector
+void irq_enable(uint8_t vector, const char* name) {
+    irq_enable_legacy(vector, name, false);
+}
+
+// Enable the INTx line of a PCI function, given the vector of its
+// interrupt line
+void irq_enable_pci(uint8_t vector, const char* name) {
+    irq_enable_legacy(vector, name, true);
+}
+
+// Stop a legacy IRQ from being delivered. Message-signalled interrupts
+// are left alone; their device decides.
+void irq_disable(uint8_t vector) {
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    irq_route_t* r = &irq_routes[vector];
+    if (r->route == IRQ_ROUTE_PIC) {
+        pic_disable_irq(vector - IRQ_LEGACY_BASE);
+        r->route = IRQ_ROUTE_NONE;
+    } else if (r->route == IRQ_ROUTE_IOAPIC) {
+        ioapic_mask(r->gsi, true);
+        r->route = IRQ_ROUTE_NONE;
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+}
+
+// Give a PCI function a vector of its own through MSI, or MSI-X if it
+// only has that. Returns the vector, or -1 if the function has neither,
+// the local APICs are not in use or no vector is free. Register the
+// handler before the device is told to interrupt.
+int irq_setup_msi(uint8_t bus, uint8_t slot, uint8_t func, const char* name) {
+    if (!irq_use_apic) return -1;
+
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    int vector = -1;
+    for (int v = IRQ_MSI_VECTOR_BASE; v < IRQ_MSI_VECTOR_BASE + IRQ_MSI_VECTORS; v++) {
+        if (irq_routes[v].route == IRQ_ROUTE_NONE) {
+            vector = v;
+            break;
+        }
+    }
+
+    if (vector >= 0) {
+        irq_route_t* r = &irq_routes[vector];
+        uint8_t apic_id = smp_get_cpu(0)->apic_id;
+        if (pci_enable_msi(bus, slot, func, vector, apic_id)) {
+            r->route = IRQ_ROUTE_MSI;
+        } else if (pci_enable_msix(bus, slot, func, vector, apic_id)) {
+            r->route = IRQ_ROUTE_MSIX;
+        } else {
+            vector = -1;
+        }
+
+        if (vector >= 0) {
+            r->cpu = 0;
+            r->level = false;
+            r->pci = true;
+            r->bus = bus;
+            r->slot = slot;
+            r->func = func;
+            r->name = name;
+        }
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+    return vector;
+}
+
+// Deliver a vector to another CPU. The PIT tick stays on the BSP, which
+// keeps the system time, and the PIC can only reach the BSP.
+int irq_set_affinity(uint8_t vector, uint32_t cpu) {
+    cpu_t* target = smp_get_cpu(cpu);
+    if (!target || !target->online) return -1;
+    if (vector == IRQ_LEGACY_BASE && cpu != 0) return -1;
+
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    irq_route_t* r = &irq_routes[vector];
+    bool moved = false;
+    switch (r->route) {
+        case IRQ_ROUTE_IOAPIC:
+            moved = ioapic_set_dest(r->gsi, target->apic_id);
+            break;
+        case IRQ_ROUTE_MSI:
+            moved = pci_enable_msi(r->bus, r->slot, r->func, vector, target->apic_id);
+            break;
+        case IRQ_ROUTE_MSIX:
+            moved = pci_enable_msix(r->bus, r->slot, r->func, vector, target->apic_id);
+            break;
+        default:
+            break;
+    }
+    if (moved) {
+        r->cpu = cpu;
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+    return moved ? 0 : -1;
+}
+
+// Acknowledge an interrupt: the PIC(s) a legacy IRQ came through while
+// the 8259 is in use, otherwise one local APIC write. Only isr_handler()
+// calls this.
+void irq_eoi(uint8_t vector) {
+    if (!irq_use_apic && vector >= IRQ_LEGACY_BASE &&
+        vector < IRQ_LEGACY_BASE + IRQ_LEGACY_COUNT) {
+        pic_send_eoi(vector - IRQ_LEGACY_BASE);
+    } else {
+        lapic_eoi();
+    }
+}
+
+// Name of a routed vector, or NULL
+const char* irq_name(uint8_t vector) {
+    return irq_routes[vector].route != IRQ_ROUTE_NONE ? irq_routes[vector].name : NULL;
+}
+
+// Move interrupt delivery to the I/O APICs found in the MADT, if any.
+// Legacy IRQs already enabled on the PIC are rerouted to the BSP and the
+// PIC is masked for good.
+void irq_init(void) {
+    if (!acpi_get_lapic_address() || acpi_get_ioapic_count() == 0) {
+        kprintf("IRQ: no I/O APIC, using the 8259 PIC\n");
+        return;
+    }
+
+    lapic_init(acpi_get_lapic_address());
+    lapic_enable();
+    this_cpu()->apic_id = lapic_id();
+    int count = ioapic_init();
+    if (!count) return;
+
+    uint32_t flags = spin_lock_irqsave(&irq_lock);
+    pic_disable();
+    irq_use_apic = true;
+    for (int v = IRQ_LEGACY_BASE; v < IRQ_LEGACY_BASE + IRQ_LEGACY_COUNT; v++) {
+        irq_route_t* r = &irq_routes[v];
+        if (r->route == IRQ_ROUTE_PIC) {
+            irq_route_ioapic(v, r, r->pci);
+        }
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+
+    kprintf("IRQ: %d I/O APIC(s) in use, 8259 PIC masked\n", count);
+}
+
+// Show how each vector is routed, or move one: irqs [affinity <vector> <cpu>]
+int irq_cmd_irqs(int argc, char* argv[]) {
+    if (argc == 4 && strcmp(argv[1], "affinity") == 0) {
+        int vector = atoi(argv[2]);
+        int cpu = atoi(argv[3]);
+        if (vector < 0 || vector > 255 || cpu < 0 ||
+            irq_set_affinity(vector, cpu) != 0) {
+            kprintf("irqs: cannot move vector %s to CPU %s\n", argv[2], argv[3]);
+            return -1;
+        }
+        kprintf("Vector %d now goes to CPU %d\n", vector, cpu);
+        return 0;
+    }
+    if (argc != 1) {
+        kprintf("usage: irqs [affinity <vector> <cpu>]\n");
+        return -1;
+    }
+
+    kprintf("Delivery: %s\n", irq_use_apic ? "I/O APIC and local APICs" : "8259 PIC");
+    kprintf("VEC  ROUTE   CPU  SOURCE     TRIGGER  NAME\n");
+    for (int v = 0; v < 256; v++) {
+        irq_route_t* r = &irq_routes[v];
+        if (r->route == IRQ_ROUTE_NONE) continue;
+
+        kprintf("%d  %s  %u  ", v, irq_route_names[r->route], r->cpu);
+        if (r->route == IRQ_ROUTE_IOAPIC) {
+            kprintf("GSI %u", r->gsi);
+        } else if (r->route == IRQ_ROUTE_PIC) {
+            kprintf("IRQ %d", v - IRQ_LEGACY_BASE);
+        } else {
+            kprintf("PCI %u:%u.%u", r->bus, r->slot, r->func);
+        }
+        kprintf("  %s  %s\n", r->level ? "level" : "edge", r->name ? r->name : "");
+    }
+    return 0;
+}
@@ -0,0 +1,274 @@
+#include "irqstat.h"
+#include "smp.h"
+#include "lapic.h"
+#include "irq.h"
+#include "tsc.h"
+#include "terminal.h"
+#include "string.h"
+
+// Interrupt statistics of one CPU. Only that CPU writes them, with
+// interrupts disabled, so no lock is taken.
+typedef struct {
+    irqstat_vector_t vectors[256];
+    uint64_t cli_start;              // TSC when interrupts went off, 0 if on
+    uint32_t cli_site;               // Where they went off
+    uint32_t cli_hist[IRQSTAT_BUCKETS];
+    uint32_t cli_max_us;
+    uint32_t cli_max_site;
+    irqstat_site_t sites[IRQSTAT_SITES];
+} irqstat_cpu_t;
+
+static irqstat_cpu_t irqstat_cpus[MAX_CPUS];
+
+volatile bool irqstat_cli_enabled = false;
+
+// Histogram bucket of a duration
+static inline uint32_t irqstat_bucket(uint32_t us) {
+    if (us == 0) return 0;
+    uint32_t bucket = 32 - __builtin_clz(us);
+    return bucket < IRQSTAT_BUCKETS ? bucket : IRQSTAT_BUCKETS - 1;
+}
+
+// Charge an interrupts-off window to the site that began it, replacing
+// the site with the shortest worst case once the table is full
+static void irqstat_site_record(irqstat_cpu_t* st, uint32_t site, uint64_t cycles, uint32_t us) {
+    irqstat_site_t* slot = NULL;
+    irqstat_site_t* shortest = &st->sites[0];
+
+    for (int i = 0; i < IRQSTAT_SITES; i++) {
+        irqstat_site_t* s = &st->sites[i];
+        if (s->site == site) {
+            slot = s;
+            break;
+        }
+        if (s->max_us < shortest->max_us || (s->site == 0 && shortest->site != 0)) {
+            shortest = s;
+        }
+    }
+
+    if (!slot) {
+        if (shortest->site != 0 && shortest->max_us >= us) return;
+        slot = shortest;
+        memset(slot, 0, sizeof(irqstat_site_t));
+        slot->site = site;
+    }
+
+    slot->count++;
+    slot->cycles += cycles;
+    if (us > slot->max_us) {
+        slot->max_us = us;
+    }
+}
+
+// Interrupts were just disabled at site
+void irqstat_cli_begin_at(void* site) {
+    irqstat_cpu_t* st = &irqstat_cpus[this_cpu()->id];
+    st->cli_start = rdtsc();
+    st->cli_site = (uint32_t)site;
+}
+
+// Interrupts were just disabled by the caller
+void irqstat_cli_begin(void) {
+    irqstat_cli_begin_at(__builtin_return_address(0));
+}
+
+// Interrupts are about to be enabled again. A window whose start was not
+// seen, because measuring began inside it, is ignored.
+void irqstat_cli_end(void) {
+    irqstat_cpu_t* st = &irqstat_cpus[this_cpu()->id];
+    if (!st->cli_start) return;
+
+    uint64_t cycles = rdtsc() - st->cli_start;
+    uint32_t us = tsc_to_us(cycles);
+    st->cli_start = 0;
+
+    st->cli_hist[irqstat_bucket(us)]++;
+    if (us > st->cli_max_us) {
+        st->cli_max_us = us;
+        st->cli_max_site = st->cli_site;
+    }
+    irqstat_site_record(st, st->cli_site, cycles, us);
+}
+
+// A handler is about to run
+void irqstat_irq_enter(uint8_t vector, irqstat_stamp_t* stamp) {
+    cpu_t* cpu = this_cpu();
+    irqstat_cpu_t* st = &irqstat_cpus[cpu->id];
+
+    // An interrupt means they were on; any window still open was left by
+    // a switch that returned with iret
+    st->cli_start = 0;
+
+    // The local APIC timer says how long ago it fired
+    if (vector == LAPIC_TIMER_VECTOR) {
+        uint32_t latency = lapic_timer_elapsed_us();
+        if (latency > st->vectors[vector].max_latency_us) {
+            st->vectors[vector].max_latency_us = latency;
+        }
+    }
+
+    stamp->cpu = cpu;
+    stamp->switches = cpu->nr_switches;
+    stamp->start = rdtsc();
+}
+
+// A handler returned. If it switched processes, the time since it began
+// includes other processes and is not recorded.
+void irqstat_irq_exit(uint8_t vector, irqstat_stamp_t* stamp) {
+    uint64_t cycles = rdtsc() - stamp->start;
+    irqstat_vector_t* v = &irqstat_cpus[stamp->cpu->id].vectors[vector];
+
+    v->count++;
+    if (stamp->cpu->nr_switches != stamp->switches) {
+        v->switched++;
+        return;
+    }
+
+    uint32_t us = tsc_to_us(cycles);
+    v->cycles += cycles;
+    v->hist[irqstat_bucket(us)]++;
+    if (us > v->max_us) {
+        v->max_us = us;
+    }
+}
+
+// Name of a vector
+static const char* irqstat_vector_name(uint32_t vector) {
+    static const char* irq_names[16] = {
+        "timer", "keyboard", "cascade", "COM2", "COM1", "LPT2", "floppy", "LPT1",
+        "RTC", "IRQ9", "IRQ10", "IRQ11", "mouse", "FPU", "ATA primary", "ATA secondary"
+    };
+
+    if (vector >= 32 && vector < 48) return irq_names[vector - 32];
+    if (vector == 14) return "page fault";
+    if (vector == LAPIC_TIMER_VECTOR) return "LAPIC timer";
+    if (vector == LAPIC_RESCHED_VECTOR) return "reschedule IPI";
+    const char* name = irq_name(vector);
+    return name ? name : "";
+}
+
+// Print a histogram, skipping empty buckets
+static void irqstat_print_hist(uint32_t* hist) {
+    for (uint32_t b = 0; b < IRQSTAT_BUCKETS; b++) {
+        if (!hist[b]) continue;
+        if (b == 0) {
+            kprintf(" <1us:%u", hist[b]);
+        } else if (b == IRQSTAT_BUCKETS - 1) {
+            kprintf(" %uus+:%u", 1u << (b - 1), hist[b]);
+        } else {
+            kprintf(" %uus:%u", 1u << (b - 1), hist[b]);
+        }
+    }
+    kprintf("\n");
+}
+
+// Handler statistics of every vector taken so far, all CPUs together
+static void irqstat_show_vectors(bool hist) {
+    kprintf("VEC  COUNT     AVG us  MAX us  MAX LAT us  SWITCHED  NAME\n");
+
+    for (uint32_t vector = 0; vector < 256; vector++) {
+        irqstat_vector_t sum;
+        memset(&sum, 0, sizeof(sum));
+
+        for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+            irqstat_vector_t* v = &irqstat_cpus[i].vectors[vector];
+            sum.count += v->count;
+            sum.switched += v->switched;
+            sum.cycles += v->cycles;
+            if (v->max_us > sum.max_us) sum.max_us = v->max_us;
+            if (v->max_latency_us > sum.max_latency_us) sum.max_latency_us = v->max_latency_us;
+            for (uint32_t b = 0; b < IRQSTAT_BUCKETS; b++) {
+                sum.hist[b] += v->hist[b];
+            }
+        }
+        if (!sum.count) continue;
+
+        uint32_t timed = sum.count - sum.switched;
+        uint32_t avg = timed ? tsc_to_us(sum.cycles) / timed : 0;
+        kprintf("%u  %u  %u  %u  %u  %u  %s\n", vector, sum.count, avg, sum.max_us,
+                sum.max_latency_us, sum.switched, irqstat_vector_name(vector));
+        if (hist) {
+            kprintf("    ");
+            irqstat_print_hist(sum.hist);
+        }
+    }
+}
+
+// Interrupts-off windows per CPU and the sites with the longest ones
+static void irqstat_show_cli(void) {
+    kprintf("Interrupts-off windows (%s):\n", irqstat_cli_enabled ? "measuring" : "off");
+
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        irqstat_cpu_t* st = &irqstat_cpus[i];
+        kprintf("CPU %u: longest %u us at 0x%x\n   ", i, st->cli_max_us, st->cli_max_site);
+        irqstat_print_hist(st->cli_hist);
+    }
+
+    // Merge the per-CPU site tables and list them longest first
+    irqstat_site_t sites[IRQSTAT_SITES];
+    int count = 0;
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        for (int j = 0; j < IRQSTAT_SITES; j++) {
+            irqstat_site_t* s = &irqstat_cpus[i].sites[j];
+            if (!s->site) continue;
+
+            int k = 0;
+            while (k < count && sites[k].site != s->site) k++;
+            if (k == count) {
+                if (count == IRQSTAT_SITES) continue;
+                memset(&sites[k], 0, sizeof(irqstat_site_t));
+                sites[k].site = s->site;
+                count++;
+            }
+            sites[k].count += s->count;
+            sites[k].cycles += s->cycles;
+            if (s->max_us > sites[k].max_us) sites[k].max_us = s->max_us;
+        }
+    }
+    for (int i = 1; i < count; i++) {
+        irqstat_site_t s = sites[i];
+        int j = i;
+        while (j > 0 && sites[j - 1].max_us < s.max_us) {
+            sites[j] = sites[j - 1];
+            j--;
+        }
+        sites[j] = s;
+    }
+
+    if (count) {
+        kprintf("SITE        COUNT     AVG us  MAX us\n");
+    }
+    for (int i = 0; i < count; i++) {
+        kprintf("0x%x  %u  %u  %u\n", sites[i].site, sites[i].count,
+                tsc_to_us(sites[i].cycles) / sites[i].count, sites[i].max_us);
+    }
+}
+
+// Interrupt handler times and latency, and interrupts-off windows:
+// irqstat [hist|cli|on|off|reset]
+int irqstat_cmd_irqstat(int argc, char* argv[]) {
+    const char* cmd = argc > 1 ? argv[1] : "";
+
+    if (strcmp(cmd, "") == 0) {
+        irqstat_show_vectors(false);
+    } else if (strcmp(cmd, "hist") == 0) {
+        irqstat_show_vectors(true);
+    } else if (strcmp(cmd, "cli") == 0) {
+        irqstat_show_cli();
+    } else if (strcmp(cmd, "on") == 0) {
+        irqstat_cli_enabled = true;
+        kprintf("Measuring interrupts-off windows\n");
+    } else if (strcmp(cmd, "off") == 0) {
+        irqstat_cli_enabled = false;
+        kprintf("Stopped measuring interrupts-off windows\n");
+    } else if (strcmp(cmd, "reset") == 0) {
+        uint32_t flags = irq_save();
+        memset(irqstat_cpus, 0, sizeof(irqstat_cpus));
+        irq_restore(flags);
+        kprintf("Interrupt statistics cleared\n");
+    } else {
+        kprintf("usage: irqstat [hist|cli|on|off|reset]\n");
+        return -1;
+    }
+    return 0;
+}
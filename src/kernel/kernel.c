@@ -3,6 +3,7 @@
 #include "terminal.h"
 #include "keyboard.h"
 #include "memory.h"
+#include "vm.h"
 #include "process.h"
 #include "fs.h"
 #include "mouse.h"
@@ -16,6 +17,13 @@
 #include "test_process.h"
 #include "sound_buffer.h"
 #include "command.h"
+#include "acpi.h"
+#include "smp.h"
+#include "irq.h"
+#include "tsc.h"
+#include "softirq.h"
+#include "workqueue.h"
+#include "bcache.h"
 #include "../apps/shell.h"
 
 // Function declarations
@@ -25,6 +33,9 @@ void handle_sound_callback(void* buffer, uint32_t size);
 void irq12_handler(registers_t* regs);
 void test_process_entry(void);  // Test process entry point
 
+// ATA driver (drivers/storage/ata.c; storage/ata.h is an older interface)
+driver_t* create_ata_driver(void);
+
 // Global variables
 static int sound_playing = 0;
 
@@ -56,18 +67,28 @@ void kernel_main(void) {
     // Initialize drivers
     init_drivers();
     
-    // Initialize file system
-    fs_init();
-    
     // Initialize sound system
     sound_init();
     
     // Initialize process management
     process_init();
     
+    // Deferred work: softirqs, tasklets and worker threads
+    softirq_init();
+    workqueue_init();
+    
+    // Cache disk blocks and write them back from a kernel thread
+    bcache_init();
+    
+    // Mount the root file system; its reads go through the cache
+    fs_init();
+    
     // Set up sound callback
     sound_buffer_set_callback(0, handle_sound_callback);
     
+    // Mix audio from a real-time thread instead of the main loop
+    sound_start_mixer();
+    
     // Initialize mouse
     mouse_init();
     
@@ -120,9 +141,6 @@ void kernel_main(void) {
             }
         }
         
-        // Update sound system
-        sound_update();
-        
         // Halt CPU until next interrupt
         __asm__ volatile("hlt");
     }
@@ -133,8 +151,12 @@ void init_kernel(void) {
     // Initialize terminal
     terminal_initialize();
     
-    // Initialize memory management
+    // Initialize memory management and turn paging on
     memory_init();
+    paging_init();
+    
+    // Set up per-CPU data for the boot processor
+    smp_bsp_init();
     
     // Initialize process management
     process_init();
@@ -148,6 +170,17 @@ void init_drivers(void) {
     // Initialize HAL
     hal_interrupt_init();
     
+    // Read the ACPI tables and move interrupts to the I/O APIC if there
+    // is one, before drivers enable theirs
+    acpi_init();
+    irq_init();
+    
+    // Resolve page faults in demand-paged user memory
+    vm_init();
+    
+    // Calibrate the TSC used for scheduler accounting
+    tsc_calibrate();
+    
     // Initialize driver subsystem
     driver_init_all();
     
@@ -155,14 +188,14 @@ void init_drivers(void) {
     pci_init();
     
     // Initialize storage drivers
-    driver_t* storage_driver = driver_find_by_type(DRIVER_TYPE_STORAGE);
-    if (storage_driver) {
-        driver_register(storage_driver);
-    }
+    driver_register(create_ata_driver());
     
     // Initialize network drivers
     driver_t* network_driver = driver_find_by_type(DRIVER_TYPE_NETWORK);
     if (network_driver) {
         driver_register(network_driver);
     }
+    
+    // Start the other processors
+    smp_init();
 }
\ No newline at end of file
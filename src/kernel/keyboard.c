@@ -2,6 +2,9 @@
 #include "io.h"
 #include "pic.h"
 #include "terminal.h"
+#include "waitqueue.h"
+#include "softirq.h"
+#include "irq.h"
 
 // Keyboard buffer size
 #define KEYBOARD_BUFFER_SIZE 256
@@ -11,6 +14,18 @@ static char keyboard_buffer[KEYBOARD_BUFFER_SIZE];
 static int buffer_start = 0;
 static int buffer_end = 0;
 
+// Processes waiting for a key
+static waitqueue_t keyboard_waiters = WAITQUEUE_INIT;
+
+// Scancodes read by the interrupt handler, not yet translated
+#define KEYBOARD_RAW_SIZE 64
+static uint8_t keyboard_raw[KEYBOARD_RAW_SIZE];
+static volatile uint32_t raw_head = 0;
+static volatile uint32_t raw_tail = 0;
+
+static void keyboard_bottom_half(uint32_t data);
+static tasklet_t keyboard_tasklet = TASKLET_INIT(keyboard_bottom_half, 0);
+
 bool keyboard_buffer_empty(void) {
     return buffer_start == buffer_end;
 }
@@ -67,7 +82,6 @@ uint8_t keyboard_status(void) {
 }
 
 // Add a character to the keyboard buffer
-static void keyboard_buffer_put(char c) __attribute__((unused));
 static void keyboard_buffer_put(char c) {
     int next_end = (buffer_end + 1) % KEYBOARD_BUFFER_SIZE;
     if (next_end != buffer_start) {
@@ -85,9 +99,16 @@ char keyboard_getchar(void) {
     return c;
 }
 
+// Block until a key is available, then return it
+char keyboard_wait_char(void) {
+    wait_event(keyboard_waiters, !keyboard_buffer_empty());
+    return keyboard_getchar();
+}
+
 void keyboard_init(void) {
     // Enable keyboard IRQ
-    pic_enable_irq(1);
+    register_interrupt_handler(IRQ1, keyboard_handler);
+    irq_enable(IRQ1, "keyboard");
     
     // Reset keyboard and wait for ACK
     keyboard_write_command(KEYBOARD_CMD_RESET);
@@ -98,37 +119,54 @@ void keyboard_init(void) {
     }
 }
 
+// Translate the scancodes the interrupt handler queued, buffer the
+// characters and wake the readers
+static void keyboard_bottom_half(uint32_t data) {
+    (void)data;
+    bool typed = false;
+
+    while (raw_tail != raw_head) {
+        uint8_t scancode = keyboard_raw[raw_tail % KEYBOARD_RAW_SIZE];
+        raw_tail++;
+
+        // Handle shift keys
+        if (scancode == 0x2A || scancode == 0x36) {
+            shift_pressed = 1;
+        } else if (scancode == 0xAA || scancode == 0xB6) {
+            shift_pressed = 0;
+        }
+
+        // Handle caps lock
+        if (scancode == 0x3A) {
+            caps_lock = !caps_lock;
+        }
+
+        // Only handle key press events (not key release)
+        if (!(scancode & 0x80) && scancode < sizeof(scancode_to_ascii)) {
+            char c = scancode_to_ascii[scancode];
+            if (c) {
+                keyboard_buffer_put(c);
+                typed = true;
+            }
+        }
+    }
+
+    if (typed) {
+        waitqueue_wake_all(&keyboard_waiters);
+    }
+}
+
+// Top half: take the scancode off the controller and leave the rest to
+// the tasklet
 void keyboard_handler(registers_t* regs) {
     (void)regs;  // Unused parameter
     
     uint8_t scancode = keyboard_read_data();
-    
-    // Handle shift keys
-    if (scancode == 0x2A || scancode == 0x36) {
-        shift_pressed = 1;
-    } else if (scancode == 0xAA || scancode == 0xB6) {
-        shift_pressed = 0;
-    }
-    
-    // Handle caps lock
-    if (scancode == 0x3A) {
-        caps_lock = !caps_lock;
-    }
-    
-    // Only handle key press events (not key release)
-    if (!(scancode & 0x80)) {
-        char c = scancode_to_ascii[scancode];
-        if (c) {
-            // Add to buffer if there's space
-            int next_end = (buffer_end + 1) % KEYBOARD_BUFFER_SIZE;
-            if (next_end != buffer_start) {
-                keyboard_buffer[buffer_end] = c;
-                buffer_end = next_end;
-            }
-        }
+    if (raw_head - raw_tail < KEYBOARD_RAW_SIZE) {
+        keyboard_raw[raw_head % KEYBOARD_RAW_SIZE] = scancode;
+        raw_head++;
     }
-    
-    pic_send_eoi(1);
+    tasklet_schedule(&keyboard_tasklet);
 }
 
 int keyboard_haskey(void) {
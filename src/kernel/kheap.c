@@ -1,6 +1,7 @@
 #include "kheap.h"
 #include "memory.h"
 #include "terminal.h"
+#include "spinlock.h"
 #include <stdint.h>
 #include <string.h>
 
@@ -19,8 +20,11 @@ static uint32_t find_free_frame(void) {
 extern uint32_t end;
 uint32_t placement_address = (uint32_t)&end;
 
-// Global kernel heap
+// Global kernel heap. Every CPU allocates from it, interrupt handlers
+// included, so its lists are only touched under kheap_lock with
+// interrupts off.
 static heap_t* kheap = NULL;
+static spinlock_t kheap_lock = SPINLOCK_INIT;
 
 // Forward declarations
 static uint32_t calculate_checksum(header_t* header);
@@ -50,7 +54,7 @@ static void update_checksum(header_t* header) {
 // Initialize the kernel heap
 void kheap_init(void) {
     if (!kheap) {
-        kheap = create_heap(0x100000, 0x200000, 0x1000000, 1, 0);
+        kheap = create_heap(KHEAP_BASE, KHEAP_INITIAL_END, KHEAP_MAX, 1, 0);
         if (!kheap) {
             terminal_writestring("Failed to create kernel heap!\n");
         }
@@ -59,26 +63,26 @@ void kheap_init(void) {
 
 // Allocate memory from the kernel heap
 void* kmalloc(uint32_t size) {
-    if (kheap) {
-        return heap_alloc(kheap, size);
-    }
-    return NULL;
+    if (!kheap) return NULL;
+
+    uint32_t flags = spin_lock_irqsave(&kheap_lock);
+    void* ptr = heap_alloc(kheap, size);
+    spin_unlock_irqrestore(&kheap_lock, flags);
+    return ptr;
 }
 
 // Allocate aligned memory from the kernel heap
 void* kmalloc_aligned(uint32_t size) {
-    if (kheap) {
-        uint32_t aligned_size = (size + 0xFFF) & ~0xFFF;
-        return heap_alloc(kheap, aligned_size);
-    }
-    return NULL;
+    return kmalloc((size + 0xFFF) & ~0xFFF);
 }
 
 // Free memory back to the kernel heap
 void kfree(void* ptr) {
-    if (kheap && ptr) {
-        heap_free(kheap, ptr);
-    }
+    if (!kheap || !ptr) return;
+
+    uint32_t flags = spin_lock_irqsave(&kheap_lock);
+    heap_free(kheap, ptr);
+    spin_unlock_irqrestore(&kheap_lock, flags);
 }
 
 // Create a new heap
@@ -262,6 +266,7 @@ void get_heap_stats(uint32_t* total, uint32_t* used, uint32_t* largest_free) {
         return;
     }
 
+    uint32_t flags = spin_lock_irqsave(&kheap_lock);
     *total = kheap->current_size;
     *used = 0;
     *largest_free = 0;
@@ -275,6 +280,7 @@ void get_heap_stats(uint32_t* total, uint32_t* used, uint32_t* largest_free) {
             largest = block->size;
         }
     }
+    spin_unlock_irqrestore(&kheap_lock, flags);
 
     *largest_free = largest;
 }
@@ -293,6 +299,7 @@ void heap_dump(void) {
     terminal_writestring("Size: "); terminal_writehex(kheap->current_size); terminal_writestring("\n");
 
     terminal_writestring("\nBlocks:\n");
+    uint32_t flags = spin_lock_irqsave(&kheap_lock);
     for (header_t* block = kheap->free_list; block != NULL; block = block->next) {
         terminal_writestring("Block at "); terminal_writehex((uint32_t)block); terminal_writestring(":\n");
         terminal_writestring("  Size: "); terminal_writehex(block->size); terminal_writestring("\n");
@@ -300,6 +307,7 @@ void heap_dump(void) {
         terminal_writestring("  Magic: "); terminal_writehex(block->magic); terminal_writestring("\n");
         terminal_writestring("  Checksum: "); terminal_writehex(block->checksum); terminal_writestring("\n");
     }
+    spin_unlock_irqrestore(&kheap_lock, flags);
 }
 
 // Check heap integrity
@@ -308,26 +316,33 @@ bool heap_check(void) {
         return false;
     }
 
+    bool ok = true;
+    uint32_t flags = spin_lock_irqsave(&kheap_lock);
+
     // Check all blocks
     for (header_t* block = kheap->free_list; block != NULL; block = block->next) {
         // Check magic number
         if (block->magic != HEAP_MAGIC) {
             terminal_writestring("Invalid magic number in block!\n");
-            return false;
+            ok = false;
+            break;
         }
 
         // Check checksum
         if (block->checksum != calculate_checksum(block)) {
             terminal_writestring("Invalid checksum in block!\n");
-            return false;
+            ok = false;
+            break;
         }
 
         // Check block links
         if (block->next != NULL && block->next->prev != block) {
             terminal_writestring("Invalid block links!\n");
-            return false;
+            ok = false;
+            break;
         }
     }
+    spin_unlock_irqrestore(&kheap_lock, flags);
 
-    return true;
+    return ok;
 }
\ No newline at end of file
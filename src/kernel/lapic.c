@@ -0,0 +1,140 @@
+#include <stddef.h>
+#include "lapic.h"
+#include "timer.h"
+#include "io.h"
+
+// Local APIC MMIO base (identity mapped)
+static volatile uint32_t* lapic_base = NULL;
+
+// Timer counts per second at divide-by-16, measured on the BSP
+static uint32_t lapic_timer_rate = 0;
+
+// Read a local APIC register
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic_base[reg / 4];
+}
+
+// Write a local APIC register
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic_base[reg / 4] = value;
+    (void)lapic_base[LAPIC_REG_ID / 4];  // Flush posted write
+}
+
+// Wait for the previous IPI to be accepted
+static void lapic_wait_icr(void) {
+    while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING) {
+        asm volatile("pause");
+    }
+}
+
+// Record the local APIC base address
+void lapic_init(uint32_t base) {
+    lapic_base = (volatile uint32_t*)(base ? base : LAPIC_DEFAULT_BASE);
+}
+
+// Check if a local APIC has been discovered
+bool lapic_available(void) {
+    return lapic_base != NULL;
+}
+
+// Enable the local APIC of the calling CPU
+void lapic_enable(void) {
+    if (!lapic_base) return;
+
+    // Flat logical destination model, accept all priorities
+    lapic_write(LAPIC_REG_DFR, 0xFFFFFFFF);
+    lapic_write(LAPIC_REG_LDR, (lapic_read(LAPIC_REG_LDR) & 0x00FFFFFF) | (1 << 24));
+    lapic_write(LAPIC_REG_TPR, 0);
+
+    // Mask LINT0/LINT1 and errors; legacy interrupts still come from the PIC
+    lapic_write(LAPIC_REG_LVT_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_LVT_LINT1, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_LVT_ERROR, LAPIC_LVT_MASKED);
+
+    // Clear error status
+    lapic_write(LAPIC_REG_ESR, 0);
+    lapic_write(LAPIC_REG_ESR, 0);
+
+    // Software-enable with the spurious vector
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+
+    lapic_eoi();
+}
+
+// Get the local APIC ID of the calling CPU
+uint8_t lapic_id(void) {
+    if (!lapic_base) return 0;
+    return (uint8_t)(lapic_read(LAPIC_REG_ID) >> 24);
+}
+
+// Signal end of interrupt
+void lapic_eoi(void) {
+    if (lapic_base) {
+        lapic_write(LAPIC_REG_EOI, 0);
+    }
+}
+
+// Send a fixed interrupt to another CPU
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector) {
+    if (!lapic_base) return;
+    lapic_wait_icr();
+    lapic_write(LAPIC_REG_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, LAPIC_ICR_ASSERT | vector);
+}
+
+// Send an INIT IPI (assert then de-assert)
+void lapic_send_init(uint8_t apic_id) {
+    if (!lapic_base) return;
+    lapic_wait_icr();
+    lapic_write(LAPIC_REG_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL | LAPIC_ICR_ASSERT);
+    lapic_wait_icr();
+    lapic_write(LAPIC_REG_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, LAPIC_ICR_INIT | LAPIC_ICR_LEVEL);
+    lapic_wait_icr();
+}
+
+// Send a STARTUP IPI; the AP starts executing at page * 4KB in real mode
+void lapic_send_startup(uint8_t apic_id, uint8_t page) {
+    if (!lapic_base) return;
+    lapic_wait_icr();
+    lapic_write(LAPIC_REG_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, LAPIC_ICR_STARTUP | page);
+    lapic_wait_icr();
+}
+
+// Measure the local APIC timer rate against the PIT. Must run on the BSP
+// before any AP is started, since the PIT delay is not shared safely.
+void lapic_timer_calibrate(void) {
+    if (!lapic_base || lapic_timer_rate) return;
+
+    // Divide by 16, count down from the maximum for 10ms
+    lapic_write(LAPIC_REG_TIMER_DIV, 0x3);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0xFFFFFFFF);
+    timer_udelay(10000);
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_REG_TIMER_CUR);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0);
+    lapic_timer_rate = elapsed * 100;
+}
+
+// Start the periodic local APIC timer on the calling CPU
+void lapic_timer_init(uint32_t frequency) {
+    if (!lapic_base || !lapic_timer_rate || frequency == 0) return;
+
+    lapic_write(LAPIC_REG_TIMER_DIV, 0x3);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR | LAPIC_TIMER_PERIODIC);
+    lapic_write(LAPIC_REG_TIMER_INIT, lapic_timer_rate / frequency);
+}
+
+// Microseconds since the calling CPU's local APIC timer last fired. The
+// periodic timer reloads on expiry, so the count still to go says how
+// late the interrupt is being handled.
+uint32_t lapic_timer_elapsed_us(void) {
+    if (!lapic_base || lapic_timer_rate < 1000000) return 0;
+
+    uint32_t initial = lapic_read(LAPIC_REG_TIMER_INIT);
+    uint32_t current = lapic_read(LAPIC_REG_TIMER_CUR);
+    if (current > initial) return 0;
+    return (initial - current) / (lapic_timer_rate / 1000000);
+}
@@ -1,6 +1,8 @@
 #include <memory.h>
 #include <string.h>
 #include "kheap.h"
+#include "vm.h"
+#include "spinlock.h"
 #include "terminal.h"
 
 // Memory map entry structure
@@ -10,46 +12,120 @@ typedef struct {
     uint32_t type;
 } __attribute__((packed)) memory_map_entry_t;
 
-// Memory management data
-static uint32_t* page_bitmap;
+// End of the kernel image, from the linker script
+extern uint32_t end;
+
+// Memory management data. The bitmap and counters are protected by
+// frame_lock; every CPU allocates frames.
+static uint32_t page_bitmap[MEMORY_SIZE / PAGE_SIZE / 32];
 static uint32_t total_pages;
 static uint32_t free_pages;
+static spinlock_t frame_lock = SPINLOCK_INIT;
+
+// Caches that give frames back when memory runs out
+static shrinker_fn shrinkers[MEMORY_MAX_SHRINKERS];
+static int shrinker_count = 0;
+static volatile uint32_t reclaiming = 0;
+
+// Mark the frames of a physical range as never free
+static void memory_reserve(uint32_t start, uint32_t end) {
+    for (uint32_t i = start / PAGE_SIZE; i < end / PAGE_SIZE && i < total_pages; i++) {
+        if (!(page_bitmap[i / 32] & (1 << (i % 32)))) {
+            page_bitmap[i / 32] |= (1 << (i % 32));
+            free_pages--;
+        }
+    }
+}
 
 // Memory initialization
 void memory_init(void) {
-    // Initialize memory management structures
-    page_bitmap = (uint32_t*)0x100000;  // Place bitmap at 1MB
-    total_pages = (get_total_memory() / 4096);
+    total_pages = get_total_memory() / PAGE_SIZE;
     free_pages = total_pages;
-    
-    // Clear bitmap
-    memset(page_bitmap, 0, total_pages / 8);
+    memset(page_bitmap, 0, sizeof(page_bitmap));
+
+    // Frames come from between the kernel image and the heap, and from
+    // above the heap's maximum: low memory, the image and the heap are
+    // never handed out
+    uint32_t image_end = ((uint32_t)&end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (image_end > KHEAP_BASE) {
+        kprintf("Kernel image ends at 0x%x, past the heap at 0x%x\n", image_end, KHEAP_BASE);
+        for (;;) asm volatile("cli; hlt");
+    }
+    memory_reserve(0, image_end);
+    memory_reserve(KHEAP_BASE, KHEAP_MAX);
+
+    kheap_init();
 }
 
-// Page allocation
-page_t* alloc_page(void) {
+// Take the first free frame in the bitmap, or return 0
+static uint32_t alloc_frame_scan(void) {
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
     for (uint32_t i = 0; i < total_pages; i++) {
         if (!(page_bitmap[i / 32] & (1 << (i % 32)))) {
             page_bitmap[i / 32] |= (1 << (i % 32));
             free_pages--;
-            page_t* page = kmalloc(sizeof(page_t));
-            if (page) {
-                page->present = 1;
-                page->frame = i;
-                return page;
-            }
-            // If kmalloc fails, free the frame
-            page_bitmap[i / 32] &= ~(1 << (i % 32));
-            free_pages++;
-            return NULL;
+            spin_unlock_irqrestore(&frame_lock, flags);
+            return i * PAGE_SIZE;
         }
     }
-    return NULL;
+    spin_unlock_irqrestore(&frame_lock, flags);
+    return 0;
+}
+
+// Register a cache to shrink when no frame is free
+void memory_register_shrinker(shrinker_fn fn) {
+    if (shrinker_count < MEMORY_MAX_SHRINKERS) {
+        shrinkers[shrinker_count++] = fn;
+    }
+}
+
+// Allocate a physical frame; returns its address, or 0 if memory is
+// exhausted even after the registered caches gave back what they could.
+// One CPU reclaims at a time; the shrinkers run without frame_lock, as
+// they free frames.
+uint32_t alloc_frame(void) {
+    uint32_t frame = alloc_frame_scan();
+    if (frame || __sync_lock_test_and_set(&reclaiming, 1)) return frame;
+
+    for (int i = 0; i < shrinker_count; i++) {
+        if (shrinkers[i](MEMORY_SHRINK_BATCH)) {
+            frame = alloc_frame_scan();
+            if (frame) break;
+        }
+    }
+    __sync_lock_release(&reclaiming);
+    return frame;
+}
+
+// Return a frame from alloc_frame to the free pool
+void free_frame(uint32_t addr) {
+    uint32_t i = addr / PAGE_SIZE;
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+    if (i < total_pages && (page_bitmap[i / 32] & (1 << (i % 32)))) {
+        page_bitmap[i / 32] &= ~(1 << (i % 32));
+        free_pages++;
+    }
+    spin_unlock_irqrestore(&frame_lock, flags);
+}
+
+// Page allocation
+page_t* alloc_page(void) {
+    uint32_t frame = alloc_frame();
+    if (!frame) return NULL;
+
+    page_t* page = kmalloc(sizeof(page_t));
+    if (!page) {
+        free_frame(frame);
+        return NULL;
+    }
+    page->present = 1;
+    page->frame = frame / PAGE_SIZE;
+    return page;
 }
 
 // Memory information
 size_t get_total_memory(void) {
-    return 16 * 1024 * 1024;  // 16MB for now
+    return MEMORY_SIZE;
 }
 
 size_t get_free_memory(void) {
@@ -122,55 +198,100 @@ int munmap(void* addr, size_t length) {
 // Page directory management
 static page_directory_t* kernel_directory = NULL;
 
-page_directory_t* create_page_directory(void) {
-    page_directory_t* dir = (page_directory_t*)kmalloc(sizeof(page_directory_t));
+// Directory entries outside user space belong to the kernel
+static inline bool page_dir_index_user(uint32_t i) {
+    return (i << 22) >= USER_SPACE_START && (i << 22) < USER_SPACE_END;
+}
+
+// Allocate an empty directory. The directory the CPU walks, and each page
+// table, takes a frame of its own, so it is page-aligned and reached
+// through the identity mapping.
+static page_directory_t* page_directory_alloc(void) {
+    page_directory_t* dir = kmalloc(sizeof(page_directory_t));
     if (!dir) return NULL;
-    
+
     memset(dir, 0, sizeof(page_directory_t));
-    
-    // Copy kernel page tables
-    for (int i = 768; i < 1024; i++) {
-        dir->tables[i] = kernel_directory->tables[i];
-        dir->tables_physical[i] = kernel_directory->tables_physical[i];
+    dir->tables_physical = (uint32_t*)alloc_frame();
+    if (!dir->tables_physical) {
+        kfree(dir);
+        return NULL;
     }
-    
+    memset(dir->tables_physical, 0, PAGE_SIZE);
+    dir->physical_addr = (uint32_t)dir->tables_physical;
     return dir;
 }
 
+// Build the kernel page directory and turn paging on in the boot CPU.
+// Physical memory below USER_SPACE_START and device memory from
+// USER_SPACE_END up are identity-mapped with 4 MB supervisor pages; the
+// application processors load the same directory in the trampoline.
+void paging_init(void) {
+    kernel_directory = page_directory_alloc();
+    if (!kernel_directory) {
+        kprintf("Failed to allocate the kernel page directory\n");
+        for (;;) asm volatile("cli; hlt");
+    }
+
+    for (uint32_t i = 0; i < 1024; i++) {
+        if (!page_dir_index_user(i)) {
+            kernel_directory->tables_physical[i] = (i << 22) | PAGE_PRESENT | PAGE_WRITE | PAGE_LARGE;
+        }
+    }
+
+    // 4 MB pages, then the directory, then paging with supervisor writes
+    // to read-only pages faulting too
+    uint32_t cr0, cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    asm volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_PSE));
+    asm volatile("mov %0, %%cr3" : : "r"(kernel_directory->physical_addr));
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    asm volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_PG | CR0_WP) : "memory");
+}
+
+// Create a directory with the kernel's shared mappings and no user pages
+page_directory_t* create_page_directory(void) {
+    page_directory_t* dir = page_directory_alloc();
+    if (!dir || !kernel_directory) return dir;
+
+    for (uint32_t i = 0; i < 1024; i++) {
+        if (!page_dir_index_user(i)) {
+            dir->tables_physical[i] = kernel_directory->tables_physical[i];
+        }
+    }
+    return dir;
+}
+
+// Copy a directory with its user page tables; the entries still point at
+// the source's frames
 page_directory_t* copy_page_directory(page_directory_t* src) {
-    page_directory_t* dir = (page_directory_t*)kmalloc(sizeof(page_directory_t));
+    page_directory_t* dir = create_page_directory();
     if (!dir) return NULL;
-    
-    // Copy the page directory structure
-    memcpy(dir, src, sizeof(page_directory_t));
-    
-    // Allocate and copy page tables
-    for (int i = 0; i < 768; i++) {  // Only copy user space
-        if (src->tables[i]) {
-            page_table_t* table = (page_table_t*)kmalloc(sizeof(page_table_t));
-            if (!table) {
-                free_page_directory(dir);
-                return NULL;
-            }
-            memcpy(table, src->tables[i], sizeof(page_table_t));
-            dir->tables[i] = table;
-            dir->tables_physical[i] = (uint32_t)table | 0x7;  // Present, RW, User
+
+    for (uint32_t i = 0; i < 1024; i++) {
+        if (!page_dir_index_user(i) || !src->tables[i]) continue;
+
+        page_table_t* table = (page_table_t*)alloc_frame();
+        if (!table) {
+            free_page_directory(dir);
+            return NULL;
         }
+        memcpy(table, src->tables[i], sizeof(page_table_t));
+        dir->tables[i] = table;
+        dir->tables_physical[i] = (uint32_t)table | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
     }
-    
     return dir;
 }
 
+// Free a directory and its user page tables. The kernel's stays.
 void free_page_directory(page_directory_t* dir) {
-    if (!dir) return;
-    
-    // Free page tables (only user space)
-    for (int i = 0; i < 768; i++) {
+    if (!dir || dir == kernel_directory) return;
+
+    for (uint32_t i = 0; i < 1024; i++) {
         if (dir->tables[i]) {
-            kfree(dir->tables[i]);
+            free_frame((uint32_t)dir->tables[i]);
         }
     }
-    
+    free_frame(dir->physical_addr);
     kfree(dir);
 }
 
@@ -178,6 +299,41 @@ page_directory_t* get_kernel_page_directory(void) {
     return kernel_directory;
 }
 
+// Find the page table entry of a user address, creating its page table if
+// asked to. Returns NULL if the table is missing or cannot be allocated,
+// or the address is not in user space.
+page_t* get_page(page_directory_t* dir, uint32_t address, bool create) {
+    if (address < USER_SPACE_START || address >= USER_SPACE_END) return NULL;
+
+    uint32_t table_idx = address / PAGE_SIZE / 1024;
+    uint32_t page_idx = (address / PAGE_SIZE) % 1024;
+
+    if (!dir->tables[table_idx]) {
+        if (!create) return NULL;
+
+        page_table_t* table = (page_table_t*)alloc_frame();
+        if (!table) return NULL;
+
+        memset(table, 0, sizeof(page_table_t));
+        dir->tables[table_idx] = table;
+        dir->tables_physical[table_idx] = (uint32_t)table | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+    }
+
+    return &dir->tables[table_idx]->pages[page_idx];
+}
+
+// Map a page to a frame and flush its stale TLB entry
+void map_frame(page_directory_t* dir, uint32_t address, uint32_t frame, uint32_t flags) {
+    page_t* page = get_page(dir, address, true);
+    if (!page) return;
+
+    page->present = 1;
+    page->rw = (flags & PAGE_WRITE) ? 1 : 0;
+    page->user = (flags & PAGE_USER) ? 1 : 0;
+    page->frame = frame / PAGE_SIZE;
+    asm volatile("invlpg (%0)" : : "r"(address) : "memory");
+}
+
 void switch_page_directory(page_directory_t* dir) {
     if (!dir) return;
     
@@ -189,7 +345,7 @@ void switch_page_directory(page_directory_t* dir) {
 void allocate_page(page_t* page, int is_kernel, int is_writeable) {
     if (page->frame != 0) return;  // Page already allocated
     
-    void* frame = alloc_page();
+    uint32_t frame = alloc_frame();
     if (!frame) {
         kprintf("Failed to allocate physical frame!\n");
         return;
@@ -198,17 +354,16 @@ void allocate_page(page_t* page, int is_kernel, int is_writeable) {
     page->present = 1;
     page->rw = (is_writeable) ? 1 : 0;
     page->user = (is_kernel) ? 0 : 1;
-    page->frame = (uint32_t)frame / 4096;
+    page->frame = frame / PAGE_SIZE;
 }
 
 void free_page(page_t* page) {
     if (!page) return;
     uint32_t frame = page->frame;
     if (frame) {
-        page_bitmap[frame / 32] &= ~(1 << (frame % 32));
+        free_frame(frame * PAGE_SIZE);
         page->frame = 0;
         page->present = 0;
-        free_pages++;
     }
 }
 
@@ -217,20 +372,8 @@ bool allocate_region(page_directory_t* dir, uint32_t start, uint32_t size, uint3
     uint32_t end_page = (start + size - 1) / 4096;
     
     for (uint32_t page = start_page; page <= end_page; page++) {
-        uint32_t table_idx = page / 1024;
-        uint32_t page_idx = page % 1024;
-        
-        if (!dir->tables[table_idx]) {
-            // Create new page table
-            page_table_t* table = (page_table_t*)kmalloc(sizeof(page_table_t));
-            if (!table) return false;
-            
-            memset(table, 0, sizeof(page_table_t));
-            dir->tables[table_idx] = table;
-            dir->tables_physical[table_idx] = (uint32_t)table | (flags & 0x7);
-        }
-        
-        page_t* p = &dir->tables[table_idx]->pages[page_idx];
+        page_t* p = get_page(dir, page * PAGE_SIZE, true);
+        if (!p) return false;
         allocate_page(p, !(flags & PAGE_USER), flags & PAGE_WRITE);
     }
     
@@ -242,11 +385,6 @@ void free_region(page_directory_t* dir, uint32_t start, uint32_t size) {
     uint32_t end_page = (start + size - 1) / 4096;
     
     for (uint32_t page = start_page; page <= end_page; page++) {
-        uint32_t table_idx = page / 1024;
-        uint32_t page_idx = page % 1024;
-        
-        if (dir->tables[table_idx]) {
-            free_page(&dir->tables[table_idx]->pages[page_idx]);
-        }
+        free_page(get_page(dir, page * PAGE_SIZE, false));
     }
 }
@@ -4,6 +4,8 @@
 #include "graphics.h"
 #include <isr.h>
 #include <stddef.h>
+#include "softirq.h"
+#include "irq.h"
 
 // Mouse callback type
 typedef void (*mouse_callback_t)(mouse_state_t*);
@@ -14,6 +16,15 @@ static mouse_callback_t mouse_callback = NULL;
 static uint8_t mouse_cycle = 0;
 static uint8_t mouse_byte[3];
 
+// Bytes read by the interrupt handler, not yet assembled into packets
+#define MOUSE_RAW_SIZE 64
+static uint8_t mouse_raw[MOUSE_RAW_SIZE];
+static volatile uint32_t raw_head = 0;
+static volatile uint32_t raw_tail = 0;
+
+static void mouse_bottom_half(uint32_t data);
+static tasklet_t mouse_tasklet = TASKLET_INIT(mouse_bottom_half, 0);
+
 void mouse_wait(uint8_t type) {
     uint32_t timeout = 100000;
     if (type == 0) {
@@ -41,16 +52,8 @@ uint8_t mouse_read(void) {
     return inb(0x60);
 }
 
-void mouse_handle_interrupt(registers_t* regs) {
-    (void)regs; // Unused parameter
-    
-    uint8_t status = inb(MOUSE_STATUS_PORT);
-    if (!(status & 0x20)) {
-        return; // No mouse data to read
-    }
-
-    uint8_t data = inb(MOUSE_DATA_PORT);
-    
+// Feed one byte to the packet assembler; a full packet moves the cursor
+static void mouse_process_byte(uint8_t data) {
     switch(mouse_cycle) {
         case 0:
             mouse_byte[0] = data;
@@ -98,8 +101,33 @@ void mouse_handle_interrupt(registers_t* regs) {
             }
             break;
     }
+}
+
+// Assemble the bytes the interrupt handler queued
+static void mouse_bottom_half(uint32_t data) {
+    (void)data;
+    while (raw_tail != raw_head) {
+        mouse_process_byte(mouse_raw[raw_tail % MOUSE_RAW_SIZE]);
+        raw_tail++;
+    }
+}
+
+// Top half: take the byte off the controller and leave the rest to the
+// tasklet
+void mouse_handle_interrupt(registers_t* regs) {
+    (void)regs; // Unused parameter
     
-    pic_send_eoi(12);  // Send End of Interrupt
+    uint8_t status = inb(MOUSE_STATUS_PORT);
+    if (!(status & 0x20)) {
+        return; // No mouse data to read
+    }
+
+    uint8_t data = inb(MOUSE_DATA_PORT);
+    if (raw_head - raw_tail < MOUSE_RAW_SIZE) {
+        mouse_raw[raw_head % MOUSE_RAW_SIZE] = data;
+        raw_head++;
+    }
+    tasklet_schedule(&mouse_tasklet);
 }
 
 void mouse_init(void) {
@@ -126,8 +154,8 @@ void mouse_init(void) {
     mouse_read();  // Acknowledge
     
     // Register interrupt handler
-    register_interrupt_handler(44, mouse_handle_interrupt);
-    pic_enable_irq(12);
+    register_interrupt_handler(IRQ12, mouse_handle_interrupt);
+    irq_enable(IRQ12, "mouse");
 }
 
 void mouse_set_callback(mouse_callback_t callback) {
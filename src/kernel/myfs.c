@@ -0,0 +1,687 @@
+#include "myfs.h"
+#include "bcache.h"
+#include "kheap.h"
+#include "terminal.h"
+#include "string.h"
+
+// MyFS: an extent-based file system on a block device, read and written
+// through the buffer cache. Callers (the VFS) serialize every operation,
+// so nothing here takes a lock.
+
+#define MYFS_MAX_VOLUMES  4
+
+// A mounted MyFS volume
+typedef struct {
+    blk_device_t* dev;
+    myfs_super_t sb;                 // Copy of the superblock
+    uint32_t inode_hint;             // Where to look for a free inode
+    fs_node_t* root;
+} myfs_volume_t;
+
+// VFS node of an inode. There is at most one per inode; it lives while
+// the VFS holds references to it (its dentries and open files).
+typedef struct myfs_node {
+    fs_node_t node;                  // First, so an fs_node_t* is a myfs_node_t*
+    myfs_volume_t* vol;
+    uint32_t refs;
+    bcache_ra_t ra;                  // Readahead of the file's reads
+    struct myfs_node* next;
+} myfs_node_t;
+
+static myfs_volume_t myfs_volumes[MYFS_MAX_VOLUMES];
+static myfs_node_t* myfs_live = NULL;
+
+// Newly allocated blocks are zeroed from this
+static const uint8_t myfs_zero_block[MYFS_BLOCK_SIZE];
+
+static fs_node_t* myfs_node(myfs_volume_t* vol, uint32_t ino);
+
+// Write the in-memory superblock back to block 0
+static void myfs_write_super(myfs_volume_t* vol) {
+    buffer_t* b = bread(vol->dev, 0);
+    if (!b) return;
+    memcpy(b->data, &vol->sb, sizeof(myfs_super_t));
+    bdirty(b);
+    brelse(b);
+}
+
+// Read an inode
+static bool myfs_read_inode(myfs_volume_t* vol, uint32_t ino, myfs_inode_t* inode) {
+    if (ino == 0 || ino >= vol->sb.inodes) return false;
+    buffer_t* b = bread(vol->dev, vol->sb.inode_start + ino / MYFS_INODES_PER_BLOCK);
+    if (!b) return false;
+    memcpy(inode, b->data + (ino % MYFS_INODES_PER_BLOCK) * MYFS_INODE_SIZE, sizeof(myfs_inode_t));
+    brelse(b);
+    return true;
+}
+
+// Write an inode
+static bool myfs_write_inode(myfs_volume_t* vol, uint32_t ino, const myfs_inode_t* inode) {
+    buffer_t* b = bread(vol->dev, vol->sb.inode_start + ino / MYFS_INODES_PER_BLOCK);
+    if (!b) return false;
+    memcpy(b->data + (ino % MYFS_INODES_PER_BLOCK) * MYFS_INODE_SIZE, inode, sizeof(myfs_inode_t));
+    bdirty(b);
+    brelse(b);
+    return true;
+}
+
+// Mark a run of blocks used or free in the bitmap
+static void myfs_mark_blocks(myfs_volume_t* vol, uint32_t start, uint32_t count, bool used) {
+    buffer_t* b = NULL;
+    uint32_t map_block = 0;
+
+    for (uint32_t blk = start; blk < start + count; blk++) {
+        uint32_t mb = blk / MYFS_BITS_PER_BLOCK;
+        if (!b || mb != map_block) {
+            if (b) brelse(b);
+            b = bread(vol->dev, vol->sb.bitmap_start + mb);
+            if (!b) return;
+            map_block = mb;
+        }
+        uint32_t bit = blk % MYFS_BITS_PER_BLOCK;
+        if (used) {
+            b->data[bit / 8] |= 1 << (bit % 8);
+        } else {
+            b->data[bit / 8] &= ~(1 << (bit % 8));
+        }
+        bdirty(b);
+    }
+    if (b) brelse(b);
+
+    if (used) {
+        vol->sb.free_blocks -= count;
+    } else {
+        vol->sb.free_blocks += count;
+    }
+    myfs_write_super(vol);
+}
+
+// Find the first run of free blocks in [from, to), up to want long.
+// Returns its start and sets *got, or returns 0.
+static uint32_t myfs_find_free(myfs_volume_t* vol, uint32_t from, uint32_t to, uint32_t want,
+                               uint32_t* got) {
+    buffer_t* b = NULL;
+    uint32_t map_block = 0;
+    uint32_t start = 0;
+    uint32_t run = 0;
+
+    for (uint32_t blk = from; blk < to && run < want; blk++) {
+        uint32_t mb = blk / MYFS_BITS_PER_BLOCK;
+        if (!b || mb != map_block) {
+            if (b) brelse(b);
+            b = bread(vol->dev, vol->sb.bitmap_start + mb);
+            if (!b) return 0;
+            map_block = mb;
+        }
+        uint32_t bit = blk % MYFS_BITS_PER_BLOCK;
+
+        // Skip whole bytes of used blocks
+        if (!run && bit % 8 == 0 && b->data[bit / 8] == 0xFF && blk + 8 <= to) {
+            blk += 7;
+            continue;
+        }
+        if (b->data[bit / 8] & (1 << (bit % 8))) {
+            if (run) break;
+            continue;
+        }
+        if (!run) start = blk;
+        run++;
+    }
+    if (b) brelse(b);
+
+    *got = run;
+    return run ? start : 0;
+}
+
+// Allocate a run of up to want blocks, preferably at goal so the file
+// stays contiguous. Returns its start and sets *got, or returns 0 if the
+// volume is full.
+static uint32_t myfs_alloc_blocks(myfs_volume_t* vol, uint32_t goal, uint32_t want, uint32_t* got) {
+    myfs_super_t* sb = &vol->sb;
+    if (!sb->free_blocks) return 0;
+    if (goal < sb->data_start || goal >= sb->blocks) goal = sb->data_start;
+
+    uint32_t start = myfs_find_free(vol, goal, sb->blocks, want, got);
+    if (!start && goal > sb->data_start) {
+        start = myfs_find_free(vol, sb->data_start, goal, want, got);
+    }
+    if (!start) return 0;
+
+    myfs_mark_blocks(vol, start, *got, true);
+    for (uint32_t i = 0; i < *got; i++) {
+        bcache_write(vol->dev, (uint64_t)(start + i) << MYFS_BLOCK_SHIFT,
+                     myfs_zero_block, MYFS_BLOCK_SIZE);
+    }
+    return start;
+}
+
+// Get extent i of an inode
+static bool myfs_get_extent(myfs_volume_t* vol, const myfs_inode_t* inode, uint32_t i,
+                            myfs_extent_t* ext) {
+    if (i < MYFS_INLINE_EXTENTS) {
+        *ext = inode->extents[i];
+        return true;
+    }
+    buffer_t* b = bread(vol->dev, inode->indirect);
+    if (!b) return false;
+    memcpy(ext, b->data + (i - MYFS_INLINE_EXTENTS) * sizeof(myfs_extent_t), sizeof(myfs_extent_t));
+    brelse(b);
+    return true;
+}
+
+// Set extent i of an inode, giving it an indirect block if it needs one.
+// The caller writes the inode back.
+static bool myfs_set_extent(myfs_volume_t* vol, myfs_inode_t* inode, uint32_t i,
+                            const myfs_extent_t* ext) {
+    if (i < MYFS_INLINE_EXTENTS) {
+        inode->extents[i] = *ext;
+        return true;
+    }
+    if (!inode->indirect) {
+        uint32_t got;
+        inode->indirect = myfs_alloc_blocks(vol, vol->sb.data_start, 1, &got);
+        if (!inode->indirect) return false;
+    }
+    buffer_t* b = bread(vol->dev, inode->indirect);
+    if (!b) return false;
+    memcpy(b->data + (i - MYFS_INLINE_EXTENTS) * sizeof(myfs_extent_t), ext, sizeof(myfs_extent_t));
+    bdirty(b);
+    brelse(b);
+    return true;
+}
+
+// Device block holding block index of a file, or 0 past its end
+static uint32_t myfs_bmap(myfs_volume_t* vol, const myfs_inode_t* inode, uint32_t index) {
+    if (index >= inode->blocks) return 0;
+
+    myfs_extent_t ext;
+    for (uint32_t i = 0; i < inode->nextents; i++) {
+        if (!myfs_get_extent(vol, inode, i, &ext)) return 0;
+        if (index < ext.count) return ext.start + index;
+        index -= ext.count;
+    }
+    return 0;
+}
+
+// Give a file blocks until it has count of them. Each run allocated
+// extends the last extent if it follows it.
+static bool myfs_grow(myfs_volume_t* vol, myfs_inode_t* inode, uint32_t count) {
+    while (inode->blocks < count) {
+        myfs_extent_t last = { 0, 0 };
+        if (inode->nextents && !myfs_get_extent(vol, inode, inode->nextents - 1, &last)) {
+            return false;
+        }
+
+        uint32_t got;
+        uint32_t start = myfs_alloc_blocks(vol, last.start + last.count, count - inode->blocks, &got);
+        if (!start) return false;
+
+        if (inode->nextents && last.start + last.count == start) {
+            last.count += got;
+            myfs_set_extent(vol, inode, inode->nextents - 1, &last);
+        } else {
+            myfs_extent_t ext = { start, got };
+            if (inode->nextents == MYFS_MAX_EXTENTS ||
+                !myfs_set_extent(vol, inode, inode->nextents, &ext)) {
+                myfs_mark_blocks(vol, start, got, false);
+                return false;
+            }
+            inode->nextents++;
+        }
+        inode->blocks += got;
+    }
+    return true;
+}
+
+// Free a file's blocks past the first count
+static void myfs_shrink(myfs_volume_t* vol, myfs_inode_t* inode, uint32_t count) {
+    while (inode->blocks > count && inode->nextents) {
+        myfs_extent_t last;
+        if (!myfs_get_extent(vol, inode, inode->nextents - 1, &last)) return;
+
+        uint32_t drop = inode->blocks - count;
+        if (drop >= last.count) {
+            myfs_mark_blocks(vol, last.start, last.count, false);
+            inode->blocks -= last.count;
+            inode->nextents--;
+        } else {
+            myfs_mark_blocks(vol, last.start + last.count - drop, drop, false);
+            last.count -= drop;
+            inode->blocks -= drop;
+            myfs_set_extent(vol, inode, inode->nextents - 1, &last);
+        }
+    }
+
+    if (inode->indirect && inode->nextents <= MYFS_INLINE_EXTENTS) {
+        myfs_mark_blocks(vol, inode->indirect, 1, false);
+        inode->indirect = 0;
+    }
+}
+
+// Read bytes of an inode's data. ra, if given, is the readahead state of
+// the reader. Returns how many were read.
+static uint32_t myfs_inode_read(myfs_volume_t* vol, const myfs_inode_t* inode, bcache_ra_t* ra,
+                                void* stream, bcache_map_fn map, uint32_t offset, uint32_t size,
+                                uint8_t* buffer) {
+    if (offset >= inode->size) return 0;
+    if (size > inode->size - offset) size = inode->size - offset;
+
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t index = (offset + done) >> MYFS_BLOCK_SHIFT;
+        uint32_t in_block = (offset + done) & (MYFS_BLOCK_SIZE - 1);
+        uint32_t chunk = MYFS_BLOCK_SIZE - in_block;
+        if (chunk > size - done) chunk = size - done;
+
+        buffer_t* b;
+        if (ra) {
+            b = bread_ra(vol->dev, ra, index, map, stream);
+        } else {
+            uint32_t blk = myfs_bmap(vol, inode, index);
+            b = blk ? bread(vol->dev, blk) : NULL;
+        }
+        if (!b) break;
+        memcpy(buffer + done, b->data + in_block, chunk);
+        brelse(b);
+        done += chunk;
+    }
+    return done;
+}
+
+// Write bytes of an inode's data, growing it as needed. The caller
+// writes the inode back. Returns how many were written.
+static uint32_t myfs_inode_write(myfs_volume_t* vol, myfs_inode_t* inode, uint32_t offset,
+                                 uint32_t size, const uint8_t* buffer) {
+    if (size == 0) return 0;
+    if (offset + size < offset) size = -offset;
+
+    uint32_t need = (offset + size + MYFS_BLOCK_SIZE - 1) >> MYFS_BLOCK_SHIFT;
+    if (!myfs_grow(vol, inode, need)) {
+        // Write what fits
+        uint32_t end = inode->blocks << MYFS_BLOCK_SHIFT;
+        if (end <= offset) return 0;
+        size = end - offset;
+    }
+
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t index = (offset + done) >> MYFS_BLOCK_SHIFT;
+        uint32_t in_block = (offset + done) & (MYFS_BLOCK_SIZE - 1);
+        uint32_t chunk = MYFS_BLOCK_SIZE - in_block;
+        if (chunk > size - done) chunk = size - done;
+
+        uint32_t blk = myfs_bmap(vol, inode, index);
+        if (!blk || bcache_write(vol->dev, ((uint64_t)blk << MYFS_BLOCK_SHIFT) + in_block,
+                                 buffer + done, chunk) != 0) {
+            break;
+        }
+        done += chunk;
+    }
+
+    if (offset + done > inode->size) {
+        inode->size = offset + done;
+    }
+    return done;
+}
+
+// Allocate an inode of a type with one link
+static uint32_t myfs_alloc_inode(myfs_volume_t* vol, uint16_t type) {
+    myfs_super_t* sb = &vol->sb;
+    if (!sb->free_inodes) return 0;
+
+    for (uint32_t n = 1; n < sb->inodes; n++) {
+        uint32_t ino = 1 + (vol->inode_hint - 1 + n) % (sb->inodes - 1);
+        myfs_inode_t inode;
+        if (!myfs_read_inode(vol, ino, &inode)) return 0;
+        if (inode.type != MYFS_TYPE_FREE) continue;
+
+        memset(&inode, 0, sizeof(inode));
+        inode.type = type;
+        inode.links = 1;
+        myfs_write_inode(vol, ino, &inode);
+        sb->free_inodes--;
+        myfs_write_super(vol);
+        vol->inode_hint = ino;
+        return ino;
+    }
+    return 0;
+}
+
+// Free an inode and its blocks
+static void myfs_free_inode(myfs_volume_t* vol, uint32_t ino) {
+    myfs_inode_t inode;
+    if (!myfs_read_inode(vol, ino, &inode)) return;
+
+    myfs_shrink(vol, &inode, 0);
+    memset(&inode, 0, sizeof(inode));
+    myfs_write_inode(vol, ino, &inode);
+    vol->sb.free_inodes++;
+    myfs_write_super(vol);
+}
+
+// Find a name in a directory. Returns its inode, or 0, and the entry's
+// slot in *slot if given.
+static uint32_t myfs_dir_find(myfs_volume_t* vol, const myfs_inode_t* dir, const char* name,
+                              uint32_t* slot) {
+    myfs_dirent_t de;
+    uint32_t count = dir->size / MYFS_DIRENT_SIZE;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (myfs_inode_read(vol, dir, NULL, NULL, NULL, i * MYFS_DIRENT_SIZE,
+                            sizeof(de), (uint8_t*)&de) != sizeof(de)) {
+            return 0;
+        }
+        if (de.inode && strcmp(de.name, name) == 0) {
+            if (slot) *slot = i;
+            return de.inode;
+        }
+    }
+    return 0;
+}
+
+// Add an entry to a directory, in the first free slot or at the end.
+// The caller writes the directory's inode back.
+static bool myfs_dir_add(myfs_volume_t* vol, myfs_inode_t* dir, const char* name, uint32_t ino) {
+    myfs_dirent_t de;
+    uint32_t count = dir->size / MYFS_DIRENT_SIZE;
+    uint32_t slot = count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (myfs_inode_read(vol, dir, NULL, NULL, NULL, i * MYFS_DIRENT_SIZE,
+                            sizeof(de), (uint8_t*)&de) != sizeof(de)) {
+            return false;
+        }
+        if (!de.inode) {
+            slot = i;
+            break;
+        }
+    }
+
+    memset(&de, 0, sizeof(de));
+    de.inode = ino;
+    strncpy(de.name, name, MYFS_NAME_MAX);
+    return myfs_inode_write(vol, dir, slot * MYFS_DIRENT_SIZE, sizeof(de),
+                            (const uint8_t*)&de) == sizeof(de);
+}
+
+// Device block of block index of a node's file, for readahead
+static bool myfs_map(void* stream, uint64_t index, uint64_t* block) {
+    myfs_node_t* mn = stream;
+    myfs_inode_t inode;
+    if (!myfs_read_inode(mn->vol, mn->node.inode, &inode)) return false;
+
+    uint32_t blk = myfs_bmap(mn->vol, &inode, (uint32_t)index);
+    *block = blk;
+    return blk != 0;
+}
+
+// VFS: read from a file, with readahead
+static uint32_t myfs_fs_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+    myfs_node_t* mn = (myfs_node_t*)node;
+    myfs_inode_t inode;
+    if (!myfs_read_inode(mn->vol, node->inode, &inode)) return 0;
+    return myfs_inode_read(mn->vol, &inode, &mn->ra, mn, myfs_map, offset, size, buffer);
+}
+
+// VFS: write to a file
+static uint32_t myfs_fs_write(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+    myfs_node_t* mn = (myfs_node_t*)node;
+    myfs_inode_t inode;
+    if (!myfs_read_inode(mn->vol, node->inode, &inode)) return 0;
+
+    uint32_t written = myfs_inode_write(mn->vol, &inode, offset, size, buffer);
+    myfs_write_inode(mn->vol, node->inode, &inode);
+    node->length = inode.size;
+    return written;
+}
+
+// VFS: change a file's length. New bytes read as zeros.
+static int myfs_fs_truncate(fs_node_t* node, uint32_t length) {
+    myfs_node_t* mn = (myfs_node_t*)node;
+    myfs_volume_t* vol = mn->vol;
+    myfs_inode_t inode;
+    if (!myfs_read_inode(vol, node->inode, &inode)) return -1;
+
+    uint32_t count = (length + MYFS_BLOCK_SIZE - 1) >> MYFS_BLOCK_SHIFT;
+    if (length < inode.size) {
+        myfs_shrink(vol, &inode, count);
+
+        // Clear the tail of the last block so growing again reads zeros
+        uint32_t tail = length & (MYFS_BLOCK_SIZE - 1);
+        uint32_t blk = tail ? myfs_bmap(vol, &inode, count - 1) : 0;
+        if (blk) {
+            bcache_write(vol->dev, ((uint64_t)blk << MYFS_BLOCK_SHIFT) + tail,
+                         myfs_zero_block, MYFS_BLOCK_SIZE - tail);
+        }
+    } else if (!myfs_grow(vol, &inode, count)) {
+        return -1;
+    }
+
+    inode.size = length;
+    myfs_write_inode(vol, node->inode, &inode);
+    node->length = length;
+    return 0;
+}
+
+// VFS: take a reference to a node
+static void myfs_fs_open(fs_node_t* node) {
+    ((myfs_node_t*)node)->refs++;
+}
+
+// VFS: drop a reference. The node goes with the last one, and so does
+// its inode if no directory names it any more.
+static void myfs_fs_close(fs_node_t* node) {
+    myfs_node_t* mn = (myfs_node_t*)node;
+    if (!mn->refs || --mn->refs) return;
+
+    myfs_inode_t inode;
+    if (myfs_read_inode(mn->vol, node->inode, &inode) && inode.links == 0) {
+        myfs_free_inode(mn->vol, node->inode);
+    }
+
+    myfs_node_t** link = &myfs_live;
+    while (*link != mn) {
+        link = &(*link)->next;
+    }
+    *link = mn->next;
+    kfree(mn);
+}
+
+// VFS: entry index of a directory, skipping free slots
+static struct dirent* myfs_fs_readdir(fs_node_t* node, uint32_t index) {
+    static struct dirent dirent;
+    myfs_node_t* mn = (myfs_node_t*)node;
+    myfs_inode_t dir;
+    if (!myfs_read_inode(mn->vol, node->inode, &dir)) return NULL;
+
+    myfs_dirent_t de;
+    uint32_t count = dir.size / MYFS_DIRENT_SIZE;
+    for (uint32_t i = 0; i < count; i++) {
+        if (myfs_inode_read(mn->vol, &dir, NULL, NULL, NULL, i * MYFS_DIRENT_SIZE,
+                            sizeof(de), (uint8_t*)&de) != sizeof(de)) {
+            return NULL;
+        }
+        if (!de.inode) continue;
+        if (index-- == 0) {
+            strncpy(dirent.name, de.name, sizeof(dirent.name) - 1);
+            dirent.name[sizeof(dirent.name) - 1] = '\0';
+            dirent.ino = de.inode;
+            return &dirent;
+        }
+    }
+    return NULL;
+}
+
+// VFS: look a name up in a directory
+static fs_node_t* myfs_fs_finddir(fs_node_t* node, char* name) {
+    myfs_volume_t* vol = ((myfs_node_t*)node)->vol;
+    myfs_inode_t dir;
+    if (!myfs_read_inode(vol, node->inode, &dir) || dir.type != MYFS_TYPE_DIR) return NULL;
+
+    uint32_t ino = myfs_dir_find(vol, &dir, name, NULL);
+    if (!ino) return NULL;
+
+    fs_node_t* child = myfs_node(vol, ino);
+    if (child) {
+        strncpy(child->name, name, sizeof(child->name) - 1);
+        child->name[sizeof(child->name) - 1] = '\0';
+    }
+    return child;
+}
+
+// VFS: create a file or directory in a directory
+static fs_node_t* myfs_fs_create(fs_node_t* node, char* name, uint32_t type) {
+    myfs_volume_t* vol = ((myfs_node_t*)node)->vol;
+    uint32_t dir_ino = node->inode;
+    myfs_inode_t dir;
+
+    if (strlen(name) > MYFS_NAME_MAX) return NULL;
+    if (!myfs_read_inode(vol, dir_ino, &dir) || dir.type != MYFS_TYPE_DIR) return NULL;
+    if (myfs_dir_find(vol, &dir, name, NULL)) return NULL;
+
+    uint32_t ino = myfs_alloc_inode(vol, type == FS_DIRECTORY ? MYFS_TYPE_DIR : MYFS_TYPE_FILE);
+    if (!ino) return NULL;
+    if (!myfs_dir_add(vol, &dir, name, ino)) {
+        myfs_free_inode(vol, ino);
+        return NULL;
+    }
+    myfs_write_inode(vol, dir_ino, &dir);
+
+    fs_node_t* child = myfs_node(vol, ino);
+    if (child) {
+        strncpy(child->name, name, sizeof(child->name) - 1);
+        child->name[sizeof(child->name) - 1] = '\0';
+    }
+    return child;
+}
+
+// VFS: remove a name from a directory. Directories must be empty. The
+// inode is freed now, or when the last descriptor on it is closed.
+static int myfs_fs_unlink(fs_node_t* node, char* name) {
+    myfs_volume_t* vol = ((myfs_node_t*)node)->vol;
+    uint32_t dir_ino = node->inode;
+    myfs_inode_t dir;
+    uint32_t slot;
+
+    if (!myfs_read_inode(vol, dir_ino, &dir) || dir.type != MYFS_TYPE_DIR) return -1;
+    uint32_t ino = myfs_dir_find(vol, &dir, name, &slot);
+    if (!ino) return -1;
+
+    myfs_inode_t inode;
+    if (!myfs_read_inode(vol, ino, &inode)) return -1;
+    if (inode.type == MYFS_TYPE_DIR) {
+        myfs_dirent_t de;
+        for (uint32_t i = 0; i < inode.size / MYFS_DIRENT_SIZE; i++) {
+            if (myfs_inode_read(vol, &inode, NULL, NULL, NULL, i * MYFS_DIRENT_SIZE,
+                                sizeof(de), (uint8_t*)&de) == sizeof(de) && de.inode) {
+                return -1;
+            }
+        }
+    }
+
+    myfs_dirent_t empty;
+    memset(&empty, 0, sizeof(empty));
+    myfs_inode_write(vol, &dir, slot * MYFS_DIRENT_SIZE, sizeof(empty), (const uint8_t*)&empty);
+    myfs_write_inode(vol, dir_ino, &dir);
+
+    inode.links--;
+    myfs_write_inode(vol, ino, &inode);
+    if (inode.links) return 0;
+
+    // Still referenced: the last close frees it
+    for (myfs_node_t* mn = myfs_live; mn; mn = mn->next) {
+        if (mn->vol == vol && mn->node.inode == ino) return 0;
+    }
+    myfs_free_inode(vol, ino);
+    return 0;
+}
+
+// Get the node of an inode, the one already in use or a new one. It
+// comes back without a reference; the VFS takes one with open.
+static fs_node_t* myfs_node(myfs_volume_t* vol, uint32_t ino) {
+    for (myfs_node_t* mn = myfs_live; mn; mn = mn->next) {
+        if (mn->vol == vol && mn->node.inode == ino) return &mn->node;
+    }
+
+    myfs_inode_t inode;
+    if (!myfs_read_inode(vol, ino, &inode) || inode.type == MYFS_TYPE_FREE) return NULL;
+
+    myfs_node_t* mn = kmalloc(sizeof(myfs_node_t));
+    if (!mn) return NULL;
+    memset(mn, 0, sizeof(myfs_node_t));
+    mn->vol = vol;
+    mn->next = myfs_live;
+    myfs_live = mn;
+
+    fs_node_t* node = &mn->node;
+    node->inode = ino;
+    node->flags = inode.type == MYFS_TYPE_DIR ? FS_DIRECTORY : FS_FILE;
+    node->length = inode.size;
+    node->mask = 0755;
+    node->impl = (uint32_t)vol;
+    node->read = myfs_fs_read;
+    node->write = myfs_fs_write;
+    node->open = myfs_fs_open;
+    node->close = myfs_fs_close;
+    node->truncate = myfs_fs_truncate;
+    if (inode.type == MYFS_TYPE_DIR) {
+        node->readdir = myfs_fs_readdir;
+        node->finddir = myfs_fs_finddir;
+        node->create = myfs_fs_create;
+        node->unlink = myfs_fs_unlink;
+    }
+    return node;
+}
+
+// Mount the MyFS volume on a block device. Returns its root directory,
+// or NULL if the device holds no valid volume or is already mounted: two
+// volumes with their own superblock copies would undo each other's
+// allocations.
+fs_node_t* myfs_mount(blk_device_t* dev) {
+    if (dev->mounted) return NULL;
+
+    buffer_t* b = bread(dev, 0);
+    if (!b) return NULL;
+    myfs_super_t sb;
+    memcpy(&sb, b->data, sizeof(sb));
+    brelse(b);
+
+    if (sb.magic != MYFS_MAGIC || sb.version != MYFS_VERSION ||
+        sb.block_size != MYFS_BLOCK_SIZE || sb.inodes < 2 ||
+        ((uint64_t)sb.blocks << (MYFS_BLOCK_SHIFT - 9)) > dev->nr_sectors ||
+        sb.data_start >= sb.blocks) {
+        return NULL;
+    }
+
+    myfs_volume_t* vol = NULL;
+    for (int i = 0; i < MYFS_MAX_VOLUMES; i++) {
+        if (!myfs_volumes[i].dev) {
+            vol = &myfs_volumes[i];
+            break;
+        }
+    }
+    if (!vol) return NULL;
+
+    vol->dev = dev;
+    vol->sb = sb;
+    vol->inode_hint = MYFS_ROOT_INODE;
+    vol->root = myfs_node(vol, MYFS_ROOT_INODE);
+    if (!vol->root || !(vol->root->flags & FS_DIRECTORY)) {
+        if (vol->root) {
+            myfs_fs_open(vol->root);
+            myfs_fs_close(vol->root);
+        }
+        vol->dev = NULL;
+        return NULL;
+    }
+
+    // The volume holds its root for as long as it is mounted
+    myfs_fs_open(vol->root);
+    dev->mounted = true;
+    vol->root->name[0] = '/';
+
+    kprintf("myfs: %s mounted, %u of %u KB free, %u inodes free\n", dev->name,
+            sb.free_blocks * (MYFS_BLOCK_SIZE / 1024), sb.blocks * (MYFS_BLOCK_SIZE / 1024),
+            sb.free_inodes);
+    return vol->root;
+}
@@ -1,6 +1,7 @@
 #include "netstack.h"
 #include "memory.h"
 #include "terminal.h"
+#include "acct.h"
 #include <string.h>
 
 // Network interface list
@@ -323,7 +324,11 @@ int netstack_socket_send(socket_t* socket, const void* data, size_t length) {
         memcpy(packet + sizeof(udp_header_t), data, length);
         
         // Send packet
-        return netstack_send_packet(packet, sizeof(udp_header_t) + length);
+        int result = netstack_send_packet(packet, sizeof(udp_header_t) + length);
+        if (result >= 0) {
+            acct_io(true, length);
+        }
+        return result;
     } else if (socket->protocol == IP_PROTO_TCP) {
         // TODO: Implement TCP send
         return -1;
@@ -344,6 +349,7 @@ int netstack_socket_receive(socket_t* socket, void* buffer, size_t max_length) {
             
             memcpy(buffer, socket->rx_buffer, length);
             socket->rx_size = 0;
+            acct_io(false, length);
             
             return length;
         }
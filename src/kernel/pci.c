@@ -208,6 +208,88 @@ void pci_disable_interrupts(pci_device_t* dev) {
     pci_write_config(0, 0, 0, PCI_COMMAND, command);
 }
 
+// Find a capability in a function's capability list. Returns its config
+// space offset, or 0 if the function does not have it.
+uint8_t pci_find_capability(uint8_t bus, uint8_t slot, uint8_t func, uint8_t id) {
+    uint16_t status = pci_read_config(bus, slot, func, PCI_COMMAND) >> 16;
+    if (!(status & PCI_STATUS_CAP_LIST)) {
+        return 0;
+    }
+
+    uint8_t offset = pci_read_config(bus, slot, func, PCI_CAPABILITY_LIST) & 0xFC;
+    for (int guard = 0; offset && guard < 48; guard++) {
+        uint32_t header = pci_read_config(bus, slot, func, offset);
+        if ((header & 0xFF) == id) {
+            return offset;
+        }
+        offset = (header >> 8) & 0xFC;
+    }
+    return 0;
+}
+
+// Stop a function from raising its INTx line
+static void pci_disable_intx(uint8_t bus, uint8_t slot, uint8_t func) {
+    uint32_t command = pci_read_config(bus, slot, func, PCI_COMMAND) & 0xFFFF;
+    pci_write_config(bus, slot, func, PCI_COMMAND, command | PCI_COMMAND_INTX_DISABLE);
+}
+
+// Make a function signal one message, vector, to one local APIC through
+// its MSI capability. Calling it again moves the interrupt.
+bool pci_enable_msi(uint8_t bus, uint8_t slot, uint8_t func, uint8_t vector, uint8_t apic_id) {
+    uint8_t cap = pci_find_capability(bus, slot, func, PCI_CAP_ID_MSI);
+    if (!cap) return false;
+
+    uint32_t header = pci_read_config(bus, slot, func, cap);
+    uint16_t control = header >> 16;
+
+    // Program the message with MSI off, asking for a single vector
+    control &= ~(PCI_MSI_CTRL_ENABLE | PCI_MSI_CTRL_MME_MASK);
+    pci_write_config(bus, slot, func, cap, (header & 0xFFFF) | ((uint32_t)control << 16));
+
+    pci_write_config(bus, slot, func, cap + 4, PCI_MSI_ADDRESS(apic_id));
+    uint8_t data_offset = cap + 8;
+    if (control & PCI_MSI_CTRL_64BIT) {
+        pci_write_config(bus, slot, func, cap + 8, 0);
+        data_offset = cap + 12;
+    }
+    uint32_t data = pci_read_config(bus, slot, func, data_offset);
+    pci_write_config(bus, slot, func, data_offset, (data & 0xFFFF0000) | vector);
+
+    control |= PCI_MSI_CTRL_ENABLE;
+    pci_write_config(bus, slot, func, cap, (header & 0xFFFF) | ((uint32_t)control << 16));
+    pci_disable_intx(bus, slot, func);
+    return true;
+}
+
+// Same through the MSI-X capability, using the first table entry. The
+// table lives in a memory BAR, which must be identity mapped.
+bool pci_enable_msix(uint8_t bus, uint8_t slot, uint8_t func, uint8_t vector, uint8_t apic_id) {
+    uint8_t cap = pci_find_capability(bus, slot, func, PCI_CAP_ID_MSIX);
+    if (!cap) return false;
+
+    uint32_t table = pci_read_config(bus, slot, func, cap + 4);
+    uint32_t bar = pci_read_config(bus, slot, func, PCI_BAR0 + (table & PCI_MSIX_TABLE_BIR) * 4);
+    if (bar & PCI_BAR_TYPE_IO) return false;
+
+    volatile uint32_t* entry = (volatile uint32_t*)((bar & PCI_BAR_MEM_MASK) +
+                                                    (table & ~PCI_MSIX_TABLE_BIR));
+
+    // Mask the function while the entry changes
+    uint32_t header = pci_read_config(bus, slot, func, cap);
+    uint16_t control = (header >> 16) | PCI_MSIX_CTRL_ENABLE | PCI_MSIX_CTRL_MASKALL;
+    pci_write_config(bus, slot, func, cap, (header & 0xFFFF) | ((uint32_t)control << 16));
+
+    entry[0] = PCI_MSI_ADDRESS(apic_id);
+    entry[1] = 0;
+    entry[2] = vector;
+    entry[3] &= ~PCI_MSIX_VECTOR_MASKED;
+
+    control &= ~PCI_MSIX_CTRL_MASKALL;
+    pci_write_config(bus, slot, func, cap, (header & 0xFFFF) | ((uint32_t)control << 16));
+    pci_disable_intx(bus, slot, func);
+    return true;
+}
+
 // Get class string
 const char* pci_class_string(uint8_t class_code) {
     switch (class_code) {
@@ -286,4 +368,23 @@ int pci_find_device_by_id(uint16_t vendor_id, uint16_t device_id, uint8_t* bus_o
         }
     }
     return 0;
-}
\ No newline at end of file
+}
+// Find the first function of a class and subclass
+int pci_find_device_by_class(uint8_t class_code, uint8_t subclass, uint8_t* bus_out, uint8_t* slot_out, uint8_t* func_out) {
+    for (uint16_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            for (uint8_t func = 0; func < 8; func++) {
+                if ((pci_read_config(bus, slot, func, 0) & 0xFFFF) == 0xFFFF) continue;
+
+                uint32_t reg = pci_read_config(bus, slot, func, 0x08);
+                if (((reg >> 24) & 0xFF) == class_code && ((reg >> 16) & 0xFF) == subclass) {
+                    if (bus_out) *bus_out = bus;
+                    if (slot_out) *slot_out = slot;
+                    if (func_out) *func_out = func;
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
@@ -3,28 +3,29 @@
 #include "memory.h"
 #include "terminal.h"
 #include "paging.h"
+#include "tsc.h"
+#include "elf.h"
+#include "trace.h"
+#include "syscall.h"
 
 // Global variables
-process_t* current_process = NULL;
 static uint32_t next_pid = 1;
 static process_t* processes[MAX_PROCESSES] = {NULL};
+static spinlock_t process_table_lock = SPINLOCK_INIT;
+static lock_stats_t process_table_lock_stats;
+
+// Every fair process is in the table, so a fair run queue never overflows
+_Static_assert(SCHED_FAIR_MAX >= MAX_PROCESSES, "fair run queue smaller than process table");
 
 // Define priority levels
 #define PROCESS_PRIORITY_LOW 0
 #define PROCESS_PRIORITY_NORMAL 1
 #define PROCESS_PRIORITY_HIGH 2
 
-// Define starvation threshold and quantum limits
-#define STARVATION_THRESHOLD 1000  // Ticks before priority boost
-#define MAX_QUANTUM 100           // Maximum time slice
-#define MIN_QUANTUM 20            // Minimum time slice
-
-// Process queue for each priority level
-static process_t* ready_queues[3] = {NULL, NULL, NULL};  // Low, Normal, High
-static uint32_t process_wait_times[MAX_PROCESSES] = {0};
-
 // Initialize process management
 void process_init(void) {
+    spin_lock_stats_init(&process_table_lock, &process_table_lock_stats, "process_table");
+
     // Create kernel process
     process_t* kernel_process = kmalloc(sizeof(process_t));
     if (!kernel_process) {
@@ -38,11 +39,97 @@ void process_init(void) {
     kernel_process->pid = 0;
     kernel_process->state = PROCESS_STATE_RUNNING;
     kernel_process->priority = PROCESS_PRIORITY_HIGH;
-    kernel_process->flags = PROCESS_FLAG_KERNEL;
+    kernel_process->flags = PROCESS_FLAG_KERNEL | PROCESS_FLAG_PINNED;
     kernel_process->page_directory = get_kernel_page_directory();
+    kernel_process->cpu = this_cpu()->id;
+    kernel_process->sched_class = &idle_sched_class;
+    kernel_process->heap_index = -1;
+    kernel_process->on_cpu = true;
+    kernel_process->exec_start = rdtsc();
+    kernel_process->acct.stamp = kernel_process->exec_start;
     
-    // Set as current process
+    // Set as current process; it also serves as the BSP's idle process
     current_process = kernel_process;
+    this_cpu()->idle = kernel_process;
+}
+
+// Create the idle process of an application processor. It adopts the
+// AP's boot stack, so it is never queued and never migrates.
+void process_init_ap(cpu_t* cpu) {
+    process_t* idle = kmalloc(sizeof(process_t));
+    if (!idle) {
+        kprintf("Failed to allocate idle process\n");
+        return;
+    }
+
+    memset(idle, 0, sizeof(process_t));
+    strncpy(idle->name, "idle", MAX_PROCESS_NAME - 1);
+    idle->pid = 0;
+    idle->state = PROCESS_STATE_RUNNING;
+    idle->priority = PROCESS_PRIORITY_LOW;
+    idle->flags = PROCESS_FLAG_KERNEL | PROCESS_FLAG_PINNED;
+    idle->page_directory = get_kernel_page_directory();
+    idle->cpu = cpu->id;
+    idle->sched_class = &idle_sched_class;
+    idle->heap_index = -1;
+    idle->on_cpu = true;
+    idle->last_switch = get_timer_ticks();
+    idle->exec_start = rdtsc();
+    idle->acct.stamp = idle->exec_start;
+
+    cpu->idle = idle;
+    cpu->current = idle;
+}
+
+// A new process starts here, returned into by switch_to() with interrupts
+// off. User processes drop to ring 3; kernel-mode ones call their entry
+// and exit if it returns.
+static void process_start(void) {
+    process_switch_finish();
+
+    process_t* self = current_process;
+    if ((self->context.cs & 0x3) == 3) {
+        uint32_t ss = self->context.ss;
+        uint32_t cs = self->context.cs;
+        asm volatile(
+            "movw %w0, %%ds\n"
+            "movw %w0, %%es\n"
+            "movw %w0, %%fs\n"
+            "movw %w0, %%gs\n"
+            "push %0\n"        // ss
+            "push %1\n"        // esp
+            "push %2\n"        // eflags
+            "push %3\n"        // cs
+            "push %4\n"        // eip
+            "iret\n"
+            :
+            : "r"(ss),
+              "r"(self->context.esp),
+              "r"(self->context.eflags),
+              "r"(cs),
+              "r"(self->context.eip)
+            : "memory"
+        );
+        __builtin_unreachable();
+    }
+
+    asm volatile("sti");
+    ((void (*)(void))self->context.eip)();
+    sys_exit(0);
+}
+
+// Build the frame switch_to() pops the first time it switches to a
+// process: zeroed callee-saved registers, EFLAGS with interrupts off, and
+// a return into resume, below sp on the process's kernel stack
+static void process_init_frame(process_t* process, uint32_t sp, void (*resume)(void)) {
+    uint32_t* frame = (uint32_t*)sp;
+    *--frame = (uint32_t)resume;
+    *--frame = 0;                  // ebp
+    *--frame = 0;                  // ebx
+    *--frame = 0;                  // esi
+    *--frame = 0;                  // edi
+    *--frame = 0x002;              // eflags
+    process->kernel_esp = (uint32_t)frame;
 }
 
 // Create a new process
@@ -73,7 +160,7 @@ process_t* process_create(const char* name, void (*entry)(void)) {
     process->context.ds = 0x10;       // Kernel data segment
     process->context.es = 0x10;
     process->context.fs = 0x10;
-    process->context.gs = 0x10;
+    process->context.gs = GDT_PERCPU_SEGMENT;
     process->context.ss = 0x10;
     
     // Allocate kernel stack
@@ -81,20 +168,27 @@ process_t* process_create(const char* name, void (*entry)(void)) {
     process->stack = (uint32_t)kmalloc(process->stack_size);
     if (!process->stack) {
         kprintf("Failed to allocate kernel stack\n");
-        kfree(process->page_directory);
+        free_page_directory(process->page_directory);
         kfree(process);
         return NULL;
     }
     
     process->context.esp = process->stack + process->stack_size;
     process->context.ebp = process->context.esp;
+    process->kernel_stack_top = process->context.esp;
+    process_init_frame(process, process->kernel_stack_top, process_start);
     
     // Initialize other fields
-    process->pid = next_pid++;
+    process->pid = __sync_fetch_and_add(&next_pid, 1);
     process->state = PROCESS_STATE_READY;
     process->priority = PROCESS_PRIORITY_NORMAL;
     process->flags = PROCESS_FLAG_USER;
     process->parent = current_process;
+    process->cpu = this_cpu()->id;
+    process->sched_class = &fair_sched_class;
+    process->nice = 0;
+    process->weight = sched_nice_to_weight(0);
+    process->heap_index = -1;
     
     // Add to process list
     scheduler_add_process(process);
@@ -102,10 +196,151 @@ process_t* process_create(const char* name, void (*entry)(void)) {
     return process;
 }
 
+// Create a kernel thread sharing the kernel address space
+process_t* kthread_create(const char* name, void (*entry)(void)) {
+    return kthread_create_on(name, entry, -1, NULL);
+}
+
+// Create a kernel thread pinned to a CPU (-1: any CPU). The thread finds
+// data in current_process->kthread_data.
+process_t* kthread_create_on(const char* name, void (*entry)(void), int cpu, void* data) {
+    process_t* process = kmalloc(sizeof(process_t));
+    if (!process) {
+        kprintf("Failed to allocate process structure\n");
+        return NULL;
+    }
+
+    memset(process, 0, sizeof(process_t));
+    strncpy(process->name, name, MAX_PROCESS_NAME - 1);
+    process->page_directory = get_kernel_page_directory();
+
+    // Set up kernel-mode context
+    process->context.eip = (uint32_t)entry;
+    process->context.eflags = 0x202;  // IF flag set
+    process->context.cs = 0x08;
+    process->context.ds = 0x10;
+    process->context.es = 0x10;
+    process->context.fs = 0x10;
+    process->context.gs = GDT_PERCPU_SEGMENT;
+    process->context.ss = 0x10;
+
+    // Allocate kernel stack
+    process->stack_size = 8192;
+    process->stack = (uint32_t)kmalloc(process->stack_size);
+    if (!process->stack) {
+        kprintf("Failed to allocate kernel stack\n");
+        kfree(process);
+        return NULL;
+    }
+    process->context.esp = process->stack + process->stack_size;
+    process->context.ebp = process->context.esp;
+    process->kernel_stack_top = process->context.esp;
+    process_init_frame(process, process->kernel_stack_top, process_start);
+
+    process->pid = __sync_fetch_and_add(&next_pid, 1);
+    process->state = PROCESS_STATE_READY;
+    process->priority = PROCESS_PRIORITY_NORMAL;
+    process->flags = PROCESS_FLAG_KERNEL;
+    process->parent = current_process;
+    process->cpu = this_cpu()->id;
+    if (cpu >= 0) {
+        process->flags |= PROCESS_FLAG_PINNED;
+        process->cpu = cpu;
+    }
+    process->kthread_data = data;
+    process->sched_class = &fair_sched_class;
+    process->weight = sched_nice_to_weight(0);
+    process->heap_index = -1;
+
+    scheduler_add_process(process);
+    return process;
+}
+
+// Create a user process around an address space that is already built.
+// It starts in ring 3 at entry with the given user stack pointer.
+process_t* process_create_user(const char* name, page_directory_t* dir, vm_area_t* vmas,
+                               uint32_t entry, uint32_t esp) {
+    process_t* process = kmalloc(sizeof(process_t));
+    if (!process) {
+        kprintf("Failed to allocate process structure\n");
+        return NULL;
+    }
+
+    memset(process, 0, sizeof(process_t));
+    strncpy(process->name, name, MAX_PROCESS_NAME - 1);
+
+    // Allocate kernel stack, used on system calls and interrupts
+    process->stack_size = 8192;
+    process->stack = (uint32_t)kmalloc(process->stack_size);
+    if (!process->stack) {
+        kprintf("Failed to allocate kernel stack\n");
+        kfree(process);
+        return NULL;
+    }
+    process->kernel_stack_top = process->stack + process->stack_size;
+
+    // Set up user-mode context
+    process->page_directory = dir;
+    process->vmas = vmas;
+    process->user_stack_top = USER_STACK_TOP;
+    process->context.eip = entry;
+    process->context.esp = esp;
+    process->context.ebp = esp;
+    process->context.eflags = 0x202;  // IF flag set
+    process->context.cs = GDT_USER_CODE_SEGMENT;
+    process->context.ds = GDT_USER_DATA_SEGMENT;
+    process->context.es = GDT_USER_DATA_SEGMENT;
+    process->context.fs = GDT_USER_DATA_SEGMENT;
+    process->context.gs = GDT_USER_DATA_SEGMENT;
+    process->context.ss = GDT_USER_DATA_SEGMENT;
+    process_init_frame(process, process->kernel_stack_top, process_start);
+
+    process->pid = __sync_fetch_and_add(&next_pid, 1);
+    process->state = PROCESS_STATE_READY;
+    process->priority = PROCESS_PRIORITY_NORMAL;
+    process->flags = PROCESS_FLAG_USER;
+    process->parent = current_process;
+    process->cpu = this_cpu()->id;
+    process->sched_class = &fair_sched_class;
+    process->weight = sched_nice_to_weight(0);
+    process->heap_index = -1;
+
+    scheduler_add_process(process);
+    return process;
+}
+
+// Detach a process's children before it goes away, so none is left
+// pointing at freed memory. Children that already exited and switched out
+// have nobody left to reap them and are freed here; one still switching
+// out is freed by process_switch_finish().
+static void process_orphan_children(process_t* parent) {
+    process_t* reap[MAX_PROCESSES];
+    int count = 0;
+
+    uint32_t flags = spin_lock_irqsave(&process_table_lock);
+    for (int i = 0; i < MAX_PROCESSES; i++) {
+        process_t* proc = processes[i];
+        if (!proc || proc->parent != parent) continue;
+
+        proc->parent = NULL;
+        if (proc->state == PROCESS_STATE_ZOMBIE && !proc->on_cpu) {
+            processes[i] = NULL;
+            reap[count++] = proc;
+        }
+    }
+    spin_unlock_irqrestore(&process_table_lock, flags);
+
+    for (int i = 0; i < count; i++) {
+        process_destroy(reap[i]);
+    }
+}
+
 // Destroy a process
 void process_destroy(process_t* process) {
     if (!process) return;
 
+    process_orphan_children(process);
+
     // Remove from scheduler
     scheduler_remove_process(process);
 
@@ -114,73 +349,59 @@ void process_destroy(process_t* process) {
         kfree((void*)process->stack);
     }
 
+    signal_release(process);
+
     if (process->page_directory) {
+        vm_release(process->page_directory, &process->vmas);
         free_page_directory(process->page_directory);
     }
 
     kfree(process);
 }
 
-// Switch to a process
+// Switch to a process. switch_to() keeps the outgoing process's
+// callee-saved registers on its kernel stack, so it resumes right here the
+// next time it is picked.
 void process_switch(process_t* next) {
-    process_t* prev = current_process;
-    
-    // Save current context if there is one
-    if (prev) {
-        // Save general purpose registers
-        asm volatile(
-            "mov %%esp, %0\n"
-            "mov %%ebp, %1\n"
-            "pushf\n"
-            "pop %2\n"
-            : "=r"(prev->context.esp),
-              "=r"(prev->context.ebp),
-              "=r"(prev->context.eflags)
-            :
-            : "memory"
-        );
-        
-        // Save segment registers
-        asm volatile(
-            "mov %%cs, %%ax\n"
-            "mov %%ax, %0\n"
-            "mov %%ds, %%ax\n"
-            "mov %%ax, %1\n"
-            "mov %%es, %%ax\n"
-            "mov %%ax, %2\n"
-            "mov %%fs, %%ax\n"
-            "mov %%ax, %3\n"
-            "mov %%gs, %%ax\n"
-            "mov %%ax, %4\n"
-            "mov %%ss, %%ax\n"
-            "mov %%ax, %5\n"
-            : "=m"(prev->context.cs),
-              "=m"(prev->context.ds),
-              "=m"(prev->context.es),
-              "=m"(prev->context.fs),
-              "=m"(prev->context.gs),
-              "=m"(prev->context.ss)
-            :
-            : "ax", "memory"
-        );
-        
-        // Save FPU state if used
-        if (prev->flags & PROCESS_FLAG_FPU) {
-            asm volatile("fxsave %0" : "=m"(prev->fpu_state));
-        }
+    cpu_t* cpu = this_cpu();
+    process_t* prev = cpu->current;
+
+    // Save FPU state if used
+    if (prev && (prev->flags & PROCESS_FLAG_FPU)) {
+        asm volatile("fxsave %0" : "=m"(prev->fpu_state));
     }
     
     // Update process states
     if (prev) {
-        if (prev->state == PROCESS_STATE_RUNNING) {
+        bool preempted = prev->state == PROCESS_STATE_RUNNING;
+        if (preempted) {
             prev->state = PROCESS_STATE_READY;
         }
         prev->cpu_time += get_timer_ticks() - prev->last_switch;
+        acct_switch_out(&prev->acct, preempted);
     }
+    trace_event(TRACE_SWITCH, next->pid, prev ? prev->state : 0);
     
     next->state = PROCESS_STATE_RUNNING;
     next->last_switch = get_timer_ticks();
+    next->cpu = cpu->id;
+    next->exec_start = rdtsc();
+    acct_switch_in(&next->acct);
+    next->slice_start_us = next->sum_exec_us;
+    if (next->wake_stamp) {
+        sched_latency_record(tsc_us_since(next->wake_stamp));
+        next->wake_stamp = 0;
+    }
     current_process = next;
+    cpu->nr_switches++;
+    cpu->prev = prev;
+
+    // Its stack is not free to run on until the CPU it last ran on is
+    // done switching away from it
+    while (next->on_cpu) {
+        asm volatile("pause" ::: "memory");
+    }
+    next->on_cpu = true;
     
     // Switch page directory if different
     if (!prev || prev->page_directory != next->page_directory) {
@@ -194,72 +415,48 @@ void process_switch(process_t* next) {
     
     // Switch kernel stack
     tss_set_kernel_stack(next->kernel_stack_top);
-    
-    // Load next context
-    asm volatile(
-        "mov %0, %%esp\n"
-        "mov %1, %%ebp\n"
-        "push %2\n"
-        "popf\n"
-        : 
-        : "r"(next->context.esp),
-          "r"(next->context.ebp),
-          "r"(next->context.eflags)
-        : "memory"
-    );
-    
-    // Restore segment registers
-    asm volatile(
-        "mov %0, %%ax\n"
-        "mov %%ax, %%ds\n"
-        "mov %1, %%ax\n"
-        "mov %%ax, %%es\n"
-        "mov %2, %%ax\n"
-        "mov %%ax, %%fs\n"
-        "mov %3, %%ax\n"
-        "mov %%ax, %%gs\n"
-        : 
-        : "m"(next->context.ds),
-          "m"(next->context.es),
-          "m"(next->context.fs),
-          "m"(next->context.gs)
-        : "ax", "memory"
-    );
-    
-    // Re-enable interrupts
-    asm volatile("sti");
-    
-    // If returning to user mode, use iret
-    if (next->flags & PROCESS_FLAG_USER) {
-        asm volatile(
-            "mov %0, %%ax\n"
-            "mov %%ax, %%ds\n"
-            "mov %%ax, %%es\n"
-            "mov %%ax, %%fs\n"
-            "mov %%ax, %%gs\n"
-            "push %1\n"        // ss
-            "push %2\n"        // esp
-            "push %3\n"        // eflags
-            "push %4\n"        // cs
-            "push %5\n"        // eip
-            "iret\n"
-            : 
-            : "m"(next->context.ds),
-              "m"(next->context.ss),
-              "r"(next->context.esp),
-              "r"(next->context.eflags),
-              "m"(next->context.cs),
-              "r"(next->context.eip)
-            : "ax", "memory"
-        );
-    } else {
-        // Kernel mode - just jump
-        asm volatile(
-            "jmp *%0\n"
-            : 
-            : "r"(next->context.eip)
-            : "memory"
-        );
+
+    // A process switched out inside an interrupt handler finishes that
+    // handler wherever it resumes, so its nesting level goes with it
+    if (prev) {
+        prev->interrupt_depth = cpu->interrupt_depth;
+    }
+
+    uint32_t unused_esp;
+    switch_to(prev ? &prev->kernel_esp : &unused_esp, next->kernel_esp);
+
+    // Back on this process's stack, possibly on another CPU
+    process_switch_finish();
+}
+
+// Complete a switch on the incoming process's side. The outgoing process's
+// stack is no longer in use, so it may now run elsewhere; if it exited,
+// its parent may now reap it, and an orphan is freed here.
+void process_switch_finish(void) {
+    cpu_t* cpu = this_cpu();
+    process_t* prev = cpu->prev;
+    cpu->prev = NULL;
+    cpu->interrupt_depth = current_process->interrupt_depth;
+    if (!prev) return;
+
+    if (prev->state != PROCESS_STATE_ZOMBIE) {
+        __sync_synchronize();
+        prev->on_cpu = false;
+        return;
+    }
+
+    // The table lock keeps the parent from exiting, and orphaning this
+    // process, between reading prev->parent and waking it
+    uint32_t flags = spin_lock_irqsave(&process_table_lock);
+    process_t* parent = prev->parent;
+    prev->on_cpu = false;
+    if (parent) {
+        waitqueue_wake_all(&parent->child_exit);
+    }
+    spin_unlock_irqrestore(&process_table_lock, flags);
+
+    if (!parent) {
+        process_destroy(prev);
     }
 }
 
@@ -281,28 +478,234 @@ process_t* process_get_by_pid(uint32_t pid) {
     return NULL;
 }
 
+// Copy the accounting of every process, the idle processes included,
+// for "top". Returns the number of entries filled in.
+int process_snapshot(process_info_t* info, int max) {
+    int count = 0;
+
+    uint32_t flags = spin_lock_irqsave(&process_table_lock);
+    for (int i = 0; i < MAX_PROCESSES && count < max; i++) {
+        process_t* process = processes[i];
+        if (!process) continue;
+
+        info[count].pid = process->pid;
+        memcpy(info[count].name, process->name, MAX_PROCESS_NAME);
+        info[count].state = process->state;
+        info[count].cpu = process->cpu;
+        info[count].acct = process->acct;
+        count++;
+    }
+    spin_unlock_irqrestore(&process_table_lock, flags);
+
+    // Idle processes are not in the table
+    for (uint32_t id = 0; id < smp_cpu_count() && count < max; id++) {
+        process_t* idle = smp_get_cpu(id)->idle;
+        if (!idle) continue;
+
+        info[count].pid = idle->pid;
+        memcpy(info[count].name, idle->name, MAX_PROCESS_NAME);
+        info[count].state = idle->state;
+        info[count].cpu = id;
+        info[count].acct = idle->acct;
+        count++;
+    }
+    return count;
+}
+
+// Make a process runnable on a run queue. Caller holds rq->lock.
+static void rq_enqueue(runqueue_t* rq, process_t* process) {
+    process->sched_class->enqueue(rq, process);
+    process->on_rq = true;
+    rq->nr_running++;
+}
+
+// Remove a process from a run queue. Caller holds rq->lock.
+static bool rq_dequeue(runqueue_t* rq, process_t* process) {
+    if (!process->sched_class->dequeue(rq, process)) return false;
+    process->on_rq = false;
+    rq->nr_running--;
+    return true;
+}
+
+// Charge the running process for the time since it was last accounted.
+// Caller holds rq->lock.
+static void rq_update_curr(runqueue_t* rq, process_t* curr) {
+    uint64_t now = rdtsc();
+    uint32_t delta_us = tsc_to_us(now - curr->exec_start);
+    if (delta_us == 0) return;
+
+    curr->exec_start = now;
+    curr->sum_exec_us += delta_us;
+    curr->sched_class->update_curr(rq, curr, delta_us);
+}
+
+// Check whether class a ranks above class b
+static bool sched_class_above(const sched_class_t* a, const sched_class_t* b) {
+    for (const sched_class_t* class = sched_class_highest; class; class = class->next) {
+        if (class == b) return false;
+        if (class == a) return true;
+    }
+    return false;
+}
+
+// Pick a CPU for a process that is becoming ready: the least loaded
+// online CPU, preferring the one it last ran on. A process woken before
+// it finished switching out stays where it is still running.
+static uint32_t select_cpu(process_t* process) {
+    uint32_t best = process->cpu;
+    if (!smp_get_cpu(best)) best = 0;
+    if (process->flags & PROCESS_FLAG_PINNED) return best;
+    if (process->on_cpu) return best;
+
+    uint32_t best_load = smp_get_cpu(best)->rq.nr_running;
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        cpu_t* cpu = smp_get_cpu(i);
+        if (cpu->online && cpu->rq.nr_running < best_load) {
+            best = i;
+            best_load = cpu->rq.nr_running;
+        }
+    }
+    return best;
+}
+
+// Queue a process that is becoming ready and preempt the target CPU's
+// current process if the newcomer should run first
+static void sched_enqueue(process_t* process, bool waking) {
+    process->state = PROCESS_STATE_READY;
+    cpu_t* prev_cpu = smp_get_cpu(process->cpu);
+    process->cpu = select_cpu(process);
+    if (waking) {
+        process->wake_stamp = rdtsc();
+    }
+
+    cpu_t* cpu = smp_get_cpu(process->cpu);
+    bool migrated = prev_cpu && prev_cpu != cpu;
+    uint32_t flags;
+    if (migrated) {
+        flags = spin_lock_irqsave(&prev_cpu->rq.lock);
+        sched_fair_detach(&prev_cpu->rq, process);
+        spin_unlock_irqrestore(&prev_cpu->rq.lock, flags);
+    }
+
+    flags = spin_lock_irqsave(&cpu->rq.lock);
+    if (migrated) {
+        sched_fair_attach(&cpu->rq, process);
+    }
+    rq_enqueue(&cpu->rq, process);
+
+    process_t* curr = cpu->current;
+    if (curr == process) {
+        // Woken before it got to sleep; it simply keeps running
+        process->state = PROCESS_STATE_RUNNING;
+        process->wake_stamp = 0;
+        spin_unlock_irqrestore(&cpu->rq.lock, flags);
+        return;
+    }
+    bool preempt = !curr || curr == cpu->idle ||
+                   sched_class_above(process->sched_class, curr->sched_class) ||
+                   (process->sched_class == curr->sched_class &&
+                    process->sched_class->check_preempt(&cpu->rq, curr, process));
+    if (preempt) {
+        cpu->need_resched = true;
+    }
+    spin_unlock_irqrestore(&cpu->rq.lock, flags);
+
+    // Kick the remote CPU so it picks the process up
+    if (preempt) {
+        smp_send_reschedule(process->cpu);
+    }
+}
+
+// Take a process off its CPU's run queue
+static void sched_dequeue(process_t* process) {
+    cpu_t* cpu = smp_get_cpu(process->cpu);
+    if (!cpu) return;
+
+    uint32_t flags = spin_lock_irqsave(&cpu->rq.lock);
+    if (process == cpu->current) {
+        rq_update_curr(&cpu->rq, process);
+    }
+    rq_dequeue(&cpu->rq, process);
+    spin_unlock_irqrestore(&cpu->rq.lock, flags);
+}
+
+// Pull a ready process from the busiest other CPU onto this one
+static process_t* steal_process(cpu_t* self) {
+    cpu_t* victim = NULL;
+    uint32_t max_load = 1;  // Leave a lone process where it is
+
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        cpu_t* cpu = smp_get_cpu(i);
+        if (cpu != self && cpu->online && cpu->rq.nr_running > max_load) {
+            victim = cpu;
+            max_load = cpu->rq.nr_running;
+        }
+    }
+    if (!victim) return NULL;
+
+    // Take the most urgent process the victim is not running
+    process_t* stolen = NULL;
+    uint32_t flags = spin_lock_irqsave(&victim->rq.lock);
+    for (const sched_class_t* class = sched_class_highest; class && !stolen; class = class->next) {
+        stolen = class->steal(&victim->rq, victim->current);
+
+        // One still switching out stays on the victim, which picks it next
+        if (stolen && stolen->on_cpu) {
+            stolen = NULL;
+        }
+    }
+    if (stolen) {
+        rq_dequeue(&victim->rq, stolen);
+        sched_fair_detach(&victim->rq, stolen);
+    }
+    spin_unlock_irqrestore(&victim->rq.lock, flags);
+    if (!stolen) return NULL;
+
+    flags = spin_lock_irqsave(&self->rq.lock);
+    stolen->cpu = self->id;
+    sched_fair_attach(&self->rq, stolen);
+    rq_enqueue(&self->rq, stolen);
+    stolen->state = PROCESS_STATE_RUNNING;  // Claimed; nobody else may pick it
+    spin_unlock_irqrestore(&self->rq.lock, flags);
+
+    self->nr_steals++;
+    return stolen;
+}
+
 // Initialize scheduler
 void scheduler_init(void) {
     // Initialize scheduler data structures
     memset(processes, 0, sizeof(processes));
-    memset(ready_queues, 0, sizeof(ready_queues));
-    memset(process_wait_times, 0, sizeof(process_wait_times));
-    current_process = NULL;
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        cpu_t* cpu = smp_get_cpu(i);
+        memset(&cpu->rq.dl, 0, sizeof(cpu->rq.dl));
+        memset(&cpu->rq.rt, 0, sizeof(cpu->rq.rt));
+        memset(&cpu->rq.rr, 0, sizeof(cpu->rq.rr));
+        memset(&cpu->rq.fair, 0, sizeof(cpu->rq.fair));
+        cpu->rq.nr_running = 0;
+    }
 }
 
 // Add process to scheduler
 void scheduler_add_process(process_t* process) {
     if (!process) return;
 
-    // Find empty slot in process array
+    // Find the process, or an empty slot, in the process array
+    uint32_t flags = spin_lock_irqsave(&process_table_lock);
     int slot = -1;
     for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (!processes[i]) {
-            processes[i] = process;
+        if (processes[i] == process) {
             slot = i;
             break;
         }
+        if (!processes[i] && slot == -1) {
+            slot = i;
+        }
     }
+    if (slot != -1) {
+        processes[slot] = process;
+    }
+    spin_unlock_irqrestore(&process_table_lock, flags);
 
     if (slot == -1) {
         kprintf("Error: Maximum number of processes reached\n");
@@ -310,56 +713,24 @@ void scheduler_add_process(process_t* process) {
         return;
     }
 
-    // Add to priority queue
-    process->state = PROCESS_STATE_READY;
-    process->next = NULL;
-    process_wait_times[slot] = 0;
-
-    int priority = process->priority;
-    if (priority < 0) priority = 0;
-    if (priority > 2) priority = 2;
-
-    if (!ready_queues[priority]) {
-        ready_queues[priority] = process;
-    } else {
-        process_t* current = ready_queues[priority];
-        while (current->next) {
-            current = current->next;
-        }
-        current->next = process;
-    }
+    sched_enqueue(process, false);
 }
 
 // Remove process from scheduler
 void scheduler_remove_process(process_t* process) {
     if (!process) return;
 
-    // Remove from process array and clear wait time
+    // Remove from process array
+    uint32_t flags = spin_lock_irqsave(&process_table_lock);
     for (int i = 0; i < MAX_PROCESSES; i++) {
         if (processes[i] == process) {
             processes[i] = NULL;
-            process_wait_times[i] = 0;
             break;
         }
     }
+    spin_unlock_irqrestore(&process_table_lock, flags);
 
-    // Remove from priority queue
-    int priority = process->priority;
-    if (priority < 0) priority = 0;
-    if (priority > 2) priority = 2;
-
-    if (ready_queues[priority] == process) {
-        ready_queues[priority] = process->next;
-    } else {
-        process_t* current = ready_queues[priority];
-        while (current && current->next != process) {
-            current = current->next;
-        }
-        if (current) {
-            current->next = process->next;
-        }
-    }
-
+    sched_dequeue(process);
     process->state = PROCESS_STATE_ZOMBIE;
     process->next = NULL;
 
@@ -372,105 +743,219 @@ void scheduler_remove_process(process_t* process) {
     }
 }
 
-// Get next process to run using priority scheduling with anti-starvation
+// Get next process to run on this CPU: ask each scheduler class in
+// priority order, then try to steal from other CPUs before idling
 process_t* scheduler_next_process(void) {
-    static uint32_t last_schedule_time = 0;
-    uint32_t current_time = get_timer_ticks();
-    
-    // Update wait times and check for starvation
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (processes[i] && processes[i] != current_process && 
-            processes[i]->state == PROCESS_STATE_READY) {
-            process_wait_times[i] += current_time - last_schedule_time;
-            
-            // Boost priority if waiting too long
-            if (process_wait_times[i] > STARVATION_THRESHOLD && 
-                processes[i]->priority < PROCESS_PRIORITY_HIGH) {
-                // Remove from current queue
-                scheduler_remove_process(processes[i]);
-                // Boost priority and re-add
-                processes[i]->priority++;
-                scheduler_add_process(processes[i]);
-                process_wait_times[i] = 0;
-            }
+    cpu_t* cpu = this_cpu();
+    runqueue_t* rq = &cpu->rq;
+    process_t* curr = cpu->current;
+    process_t* next = NULL;
+
+    uint32_t flags = spin_lock_irqsave(&rq->lock);
+    if (curr) {
+        rq_update_curr(rq, curr);
+
+        // A process that blocked, went to sleep or exited leaves the queue
+        // here, under the lock, so a concurrent wakeup either sees it still
+        // queued or re-queues it
+        if (curr->on_rq && curr->state != PROCESS_STATE_RUNNING &&
+            curr->state != PROCESS_STATE_READY) {
+            rq_dequeue(rq, curr);
         }
     }
-    
-    last_schedule_time = current_time;
-
-    // Try to find a process in each priority level
-    for (int priority = PROCESS_PRIORITY_HIGH; priority >= PROCESS_PRIORITY_LOW; priority--) {
-        process_t* candidate = ready_queues[priority];
-        while (candidate) {
-            if (candidate->state == PROCESS_STATE_READY && candidate != current_process) {
-                // Move to end of queue (round robin within priority)
-                scheduler_remove_process(candidate);
-                scheduler_add_process(candidate);
-                return candidate;
-            }
-            candidate = candidate->next;
-        }
+    for (const sched_class_t* class = sched_class_highest; class && !next; class = class->next) {
+        next = class->pick_next(rq, curr);
     }
+    if (next) {
+        next->state = PROCESS_STATE_RUNNING;  // Claimed; stealers skip it
+    }
+    cpu->need_resched = false;
+    spin_unlock_irqrestore(&rq->lock, flags);
+    if (next) return next;
+
+    // Nothing queued locally: steal before going idle
+    next = steal_process(cpu);
+    if (next) return next;
 
-    // If no other process found, continue with current process
-    return current_process;
+    return cpu->idle;
 }
 
 // Schedule next process
 void process_schedule(void) {
-    if (!current_process) return;
+    cpu_t* cpu = this_cpu();
+    process_t* curr = cpu->current;
+    if (!curr) return;
 
-    // Calculate quantum based on priority
-    uint32_t quantum = MAX_QUANTUM;
-    switch (current_process->priority) {
-        case PROCESS_PRIORITY_HIGH:
-            quantum = MAX_QUANTUM;
-            break;
-        case PROCESS_PRIORITY_NORMAL:
-            quantum = (MAX_QUANTUM + MIN_QUANTUM) / 2;
-            break;
-        case PROCESS_PRIORITY_LOW:
-            quantum = MIN_QUANTUM;
-            break;
+    // Let the current process's class decide whether it has run long enough
+    uint32_t flags = spin_lock_irqsave(&cpu->rq.lock);
+    rq_update_curr(&cpu->rq, curr);
+    bool resched = cpu->need_resched || curr->sched_class->tick(&cpu->rq, curr);
+    for (const sched_class_t* class = sched_class_highest; class; class = class->next) {
+        if (class->rq_tick && class->rq_tick(&cpu->rq)) {
+            resched = true;
+        }
     }
+    spin_unlock_irqrestore(&cpu->rq.lock, flags);
 
-    // Check if quantum expired
-    uint32_t current_time = get_timer_ticks();
-    if (current_time - current_process->last_switch >= quantum) {
+    // An interrupt that arrived during softirqs must not switch away from
+    // them; softirq_run() reschedules once they are done
+    if (resched && cpu->in_softirq) {
+        cpu->need_resched = true;
+        return;
+    }
+
+    if (resched) {
         process_t* next = scheduler_next_process();
-        if (next && next != current_process) {
+        if (next && next != curr) {
             process_switch(next);
         }
     }
 }
 
-// Put a process to sleep
-void process_sleep(uint32_t ticks) {
-    if (!current_process) return;
-    
-    current_process->sleep_until = get_timer_ticks() + ticks;
-    current_process->state = PROCESS_STATE_SLEEPING;
-    
-    // Remove from scheduler
-    scheduler_remove_process(current_process);
-    
-    // Force a context switch
-    process_yield();
+// Put the current process to sleep. Returns 0 once the time is up, or
+// -EINTR if a signal arrives first.
+int process_sleep(uint32_t ticks) {
+    process_t* curr = current_process;
+    if (!curr) return 0;
+
+    uint32_t until = get_timer_ticks() + ticks;
+
+    // The idle process cannot leave its run queue; halt until the time is up
+    if (curr == this_cpu()->idle) {
+        while ((int32_t)(get_timer_ticks() - until) < 0) {
+            process_yield();
+            asm volatile("sti\n"
+                         "hlt");
+        }
+        return 0;
+    }
+
+    // The scheduler takes the process off its run queue on the way out;
+    // scheduler_wake_sleepers() re-queues it. A signal posted after the
+    // state is set finds it asleep and wakes it early.
+    int ret = 0;
+    while ((int32_t)(get_timer_ticks() - until) < 0) {
+        curr->sleep_until = until;
+        curr->state = PROCESS_STATE_SLEEPING;
+        __sync_synchronize();
+        if (signal_deliverable(curr)) {
+            curr->state = PROCESS_STATE_RUNNING;
+            ret = -EINTR;
+            break;
+        }
+        process_yield();
+    }
+    curr->sleep_until = 0;
+    return ret;
 }
 
-// Wake up a sleeping process
-void process_wake(process_t* process) {
+// Make a sleeping or blocked process runnable; a sleep is only cut short
+// if force is set. Only one caller wins the state change, so concurrent
+// wakeups queue the process once.
+static void process_try_wake(process_t* process, bool force) {
     if (!process) return;
-    
-    if (get_timer_ticks() >= process->sleep_until) {
-        process->state = PROCESS_STATE_READY;
-        process->sleep_until = 0;
-        scheduler_add_process(process);
+
+    uint8_t state = process->state;
+    if (state == PROCESS_STATE_SLEEPING) {
+        if (!force && (int32_t)(get_timer_ticks() - process->sleep_until) < 0) return;
+    } else if (state != PROCESS_STATE_BLOCKED) {
+        return;
+    }
+    if (!__sync_bool_compare_and_swap(&process->state, state, PROCESS_STATE_READY)) return;
+    process->sleep_until = 0;
+    trace_event(TRACE_WAKEUP, process->pid, process->cpu);
+
+    // Still queued if it never got as far as switching out
+    cpu_t* cpu = smp_get_cpu(process->cpu);
+    uint32_t flags = spin_lock_irqsave(&cpu->rq.lock);
+    bool queued = process->on_rq;
+    if (queued && process == cpu->current) {
+        process->state = PROCESS_STATE_RUNNING;
+    }
+    spin_unlock_irqrestore(&cpu->rq.lock, flags);
+
+    if (!queued) {
+        sched_enqueue(process, true);
+    }
+}
+
+// Wake up a sleeping or blocked process
+void process_wake(process_t* process) {
+    process_try_wake(process, false);
+}
+
+// Wake a process because a signal is pending for it. It goes back to
+// sleep unless it was waiting somewhere that gives up on a signal.
+void process_interrupt(process_t* process) {
+    process_try_wake(process, true);
+}
+
+// Wake every sleeping process, and every blocked process with a timeout,
+// whose time has passed (called each tick)
+void scheduler_wake_sleepers(void) {
+    uint32_t now = get_timer_ticks();
+    uint32_t flags = spin_lock_irqsave(&process_table_lock);
+    for (int i = 0; i < MAX_PROCESSES; i++) {
+        process_t* process = processes[i];
+        if (!process || !process->sleep_until) continue;
+        if ((process->state == PROCESS_STATE_SLEEPING ||
+             process->state == PROCESS_STATE_BLOCKED) &&
+            (int32_t)(now - process->sleep_until) >= 0) {
+            process_wake(process);
+        }
+    }
+    spin_unlock_irqrestore(&process_table_lock, flags);
+}
+
+// Change the nice level of a process (fair class weight)
+int process_set_nice(process_t* process, int nice) {
+    if (!process) return -1;
+    if (nice < NICE_MIN) nice = NICE_MIN;
+    if (nice > NICE_MAX) nice = NICE_MAX;
+
+    cpu_t* cpu = smp_get_cpu(process->cpu);
+    uint32_t flags = spin_lock_irqsave(&cpu->rq.lock);
+    bool queued = rq_dequeue(&cpu->rq, process);
+    process->nice = nice;
+    process->weight = sched_nice_to_weight(nice);
+    if (queued) {
+        rq_enqueue(&cpu->rq, process);
+    }
+    spin_unlock_irqrestore(&cpu->rq.lock, flags);
+    return 0;
+}
+
+// Move a process to another scheduler class
+int process_set_sched_class(process_t* process, const sched_class_t* sched_class) {
+    if (!process || !sched_class || sched_class == &idle_sched_class) return -1;
+
+    bool leaves_dl = process->sched_class == &dl_sched_class && sched_class != &dl_sched_class;
+
+    cpu_t* cpu = smp_get_cpu(process->cpu);
+    uint32_t flags = spin_lock_irqsave(&cpu->rq.lock);
+    bool queued = rq_dequeue(&cpu->rq, process);
+    process->sched_class = sched_class;
+    if (queued) {
+        rq_enqueue(&cpu->rq, process);
+    }
+    spin_unlock_irqrestore(&cpu->rq.lock, flags);
+
+    if (leaves_dl) {
+        sched_dl_release(process);
     }
+    return 0;
 }
 
 // System call implementations
-int sys_fork(void) {
+
+// Fork the calling user process. user_frame is the caller's system call
+// frame, which runs up to the top of its kernel stack; the child returns
+// to user mode through a copy of it. A kernel-mode caller has no such
+// frame and cannot fork.
+int sys_fork(const void* user_frame) {
+    process_t* current = current_process;
+    if (!current || !user_frame) return -1;
+
     // Create new process structure
     process_t* child = kmalloc(sizeof(process_t));
     if (!child) {
@@ -479,35 +964,54 @@ int sys_fork(void) {
     }
 
     // Copy process structure
-    memcpy(child, current_process, sizeof(process_t));
-    child->pid = next_pid++;
-    child->parent = current_process;
+    memcpy(child, current, sizeof(process_t));
+    child->pid = __sync_fetch_and_add(&next_pid, 1);
+    child->parent = current;
     child->state = PROCESS_STATE_READY;
     child->next = NULL;
+    child->heap_index = -1;
+    child->wake_stamp = 0;
+    child->on_rq = false;
+    child->on_cpu = false;
+    child->interrupt_depth = 0;
+    memset(&child->acct, 0, sizeof(child->acct));
+
+    // A deadline reservation is not inherited; it was admitted for the
+    // parent alone
+    if (child->sched_class == &dl_sched_class) {
+        child->sched_class = &fair_sched_class;
+    }
+    waitqueue_init(&child->child_exit);
+    signal_fork(child);
 
     // Copy page directory
-    child->page_directory = copy_page_directory(current_process->page_directory);
+    child->page_directory = copy_page_directory(current->page_directory);
     if (!child->page_directory) {
         kfree(child);
         return -1;
     }
+    if (!vm_fork(child->page_directory, &child->vmas,
+                 current->page_directory, current->vmas)) {
+        free_page_directory(child->page_directory);
+        kfree(child);
+        return -1;
+    }
 
-    // Allocate and copy stack
-    child->stack = (uint32_t)kmalloc(current_process->stack_size);
+    // Allocate a kernel stack holding only the copied frame
+    child->stack = (uint32_t)kmalloc(current->stack_size);
     if (!child->stack) {
-        kfree(child->page_directory);
+        vm_release(child->page_directory, &child->vmas);
+        free_page_directory(child->page_directory);
         kfree(child);
         return -1;
     }
-    memcpy((void*)child->stack, (void*)current_process->stack, current_process->stack_size);
-
-    // Update stack pointers to point to new stack
-    uint32_t stack_offset = child->stack - current_process->stack;
-    child->context.esp += stack_offset;
-    child->stack_base = current_process->stack_base + stack_offset;
+    child->kernel_stack_top = child->stack + child->stack_size;
 
-    // Set return value for child
-    child->context.eax = 0;  // Child gets 0
+    uint32_t frame_size = current->kernel_stack_top - (uint32_t)user_frame;
+    syscall_frame_t* frame = (syscall_frame_t*)(child->kernel_stack_top - frame_size);
+    memcpy(frame, user_frame, frame_size);
+    frame->eax = 0;  // Child gets 0
+    process_init_frame(child, (uint32_t)frame, syscall_fork_return);
 
     // Add to process list and scheduler
     scheduler_add_process(child);
@@ -515,70 +1019,85 @@ int sys_fork(void) {
     return child->pid;  // Parent gets child's pid
 }
 
-int sys_exec(const char* path, char* const argv[]) {
+int sys_exec(const char* path, char* const argv[], char* const envp[]) {
     if (!path || !current_process) return -1;
 
-    // TODO: Load program from filesystem
-    // For now, just return error
-    return -1;
+    return elf_exec(path, argv, envp);
+}
+
+// Start a program in a new child without copying the caller (posix_spawn)
+int sys_spawn(const char* path, char* const argv[], char* const envp[]) {
+    if (!path || !current_process) return -1;
+
+    return elf_spawn(path, argv, envp);
 }
 
 void sys_exit(int status) {
     process_t* current = current_process;
     if (!current) return;
 
+    // Children left behind are reaped by nobody; free the ones that are
+    // done and let the rest free themselves
+    process_orphan_children(current);
+
     // Mark process as zombie and store exit status
+    sched_dequeue(current);
     current->state = PROCESS_STATE_ZOMBIE;
     current->context.eax = status;  // Store exit status in eax
 
-    // Wake up parent if it's waiting
-    process_t* parent = current->parent;
-    if (parent && parent->state == PROCESS_STATE_BLOCKED) {
-        parent->state = PROCESS_STATE_READY;
-        process_wake(parent);
+    if (current->sched_class == &dl_sched_class) {
+        sched_dl_release(current);
     }
 
-    // If no parent, or parent already dead, cleanup immediately
-    if (!parent || parent->state == PROCESS_STATE_ZOMBIE) {
-        process_destroy(current);
-    }
-
-    // Switch to next process
+    // Switch to next process. The process is still on its own stack, so
+    // waking the parent, or freeing an orphan, is left to
+    // process_switch_finish() on the other side of the switch.
     process_yield();  // Never returns
 }
 
-int sys_wait(int* status) {
-    process_t* current = current_process;
-    if (!current) return -1;
+// Reap one exited child of parent: its pid, 0 if only live children
+// remain, -1 if there are no children at all
+static int wait_reap(process_t* parent, int* status) {
+    bool has_children = false;
+    process_t* reaped = NULL;
 
-    // Check for zombie children
+    uint32_t flags = spin_lock_irqsave(&process_table_lock);
     for (int i = 0; i < MAX_PROCESSES; i++) {
         process_t* proc = processes[i];
-        if (proc && proc->parent == current && proc->state == PROCESS_STATE_ZOMBIE) {
-            int pid = proc->pid;
-            if (status) {
-                *status = proc->context.eax;  // Get exit status from eax
-            }
-            process_destroy(proc);
-            return pid;
+        if (!proc || proc->parent != parent) continue;
+
+        // An exited child is only reaped once it has switched out
+        if (proc->state == PROCESS_STATE_ZOMBIE && !proc->on_cpu) {
+            processes[i] = NULL;
+            reaped = proc;
+            break;
         }
+        has_children = true;
     }
+    spin_unlock_irqrestore(&process_table_lock, flags);
 
-    // Check if we have any children at all
-    bool has_children = false;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        process_t* proc = processes[i];
-        if (proc && proc->parent == current && proc->state != PROCESS_STATE_ZOMBIE) {
-            has_children = true;
-            break;
+    if (reaped) {
+        int pid = reaped->pid;
+        if (status) {
+            *status = reaped->context.eax;  // Get exit status from eax
         }
+        process_destroy(reaped);
+        return pid;
     }
-    if (!has_children) return -1;
+    return has_children ? 0 : -1;
+}
 
-    // Block until a child exits
-    current->state = PROCESS_STATE_BLOCKED;
-    process_yield();
-    return 0;  // Will be updated when we wake up
+int sys_wait(int* status) {
+    process_t* current = current_process;
+    if (!current) return -1;
+
+    // Block on child_exit until a child exits; sys_exit() wakes us
+    int pid;
+    if (!wait_event_interruptible(current->child_exit,
+                                  (pid = wait_reap(current, status)) != 0)) {
+        return -EINTR;
+    }
+    return pid;
 }
 
 int sys_getpid(void) {
@@ -595,21 +1114,13 @@ int sys_kill(int pid, int sig) {
     if (proc->flags & PROCESS_FLAG_KERNEL) return -1;
 
     switch (sig) {
-        case 9:  // SIGKILL
-            proc->state = PROCESS_STATE_ZOMBIE;
-            proc->context.eax = 128 + sig;  // Exit status for signal
-            if (proc->parent && proc->parent->state == PROCESS_STATE_BLOCKED) {
-                proc->parent->state = PROCESS_STATE_READY;
-                process_wake(proc->parent);
-            }
-            if (proc == current_process) {
-                process_yield();  // Never returns
-            } else {
-                process_destroy(proc);
-            }
+        case 0:  // Existence check
             break;
         default:
-            return -1;  // Unsupported signal
+            // SIGKILL too: the target may be running on another CPU, so it
+            // is only marked here and exits itself, with status 128 + SIGKILL,
+            // on its way back to user mode
+            return send_signal(pid, sig);
     }
 
     return 0;
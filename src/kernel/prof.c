@@ -0,0 +1,241 @@
+#include "prof.h"
+#include "trace.h"
+#include "process.h"
+#include "smp.h"
+#include "terminal.h"
+#include "string.h"
+
+// Set while profiling
+volatile bool prof_enabled = false;
+
+// One sample buffer per CPU
+static prof_buffer_t prof_buffers[MAX_CPUS];
+
+// Record a sample on the calling CPU. Kernel samples follow the saved
+// frame pointers of the interrupted code, which runs on the stack this
+// interrupt arrived on; user samples keep the EIP only, since user pages
+// may not be present.
+void prof_sample(uint32_t eip, uint32_t ebp, bool user) {
+    cpu_t* cpu = this_cpu();
+    prof_buffer_t* buf = &prof_buffers[cpu->id];
+    if (!buf->samples) return;
+
+    if (buf->count >= PROF_SAMPLES) {
+        buf->dropped++;
+        return;
+    }
+
+    prof_sample_t* sample = &buf->samples[buf->count];
+    sample->pid = cpu->current ? cpu->current->pid : 0;
+    sample->user = user;
+    sample->pc[0] = eip;
+
+    uint32_t depth = 1;
+    if (!user) {
+        uint32_t low = (uint32_t)__builtin_frame_address(0);
+        uint32_t high = low + PROF_STACK_SPAN;
+        uint32_t frame = ebp;
+
+        while (depth < PROF_DEPTH && frame > low && frame + 8 <= high && !(frame & 3)) {
+            uint32_t* fp = (uint32_t*)frame;
+            if (!fp[1]) break;
+            sample->pc[depth++] = fp[1];
+
+            // Frames must move up the stack, or the chain is garbage
+            if (fp[0] <= frame) break;
+            frame = fp[0];
+        }
+    }
+    sample->depth = depth;
+    buf->count++;
+}
+
+// Allocate the buffers of every CPU and start sampling
+bool prof_start(void) {
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        prof_buffer_t* buf = &prof_buffers[i];
+        if (!buf->samples) {
+            buf->samples = kmalloc(PROF_SAMPLES * sizeof(prof_sample_t));
+            if (!buf->samples) return false;
+            buf->count = 0;
+            buf->dropped = 0;
+        }
+    }
+    prof_enabled = true;
+    return true;
+}
+
+// Stop sampling; the buffers keep their contents
+void prof_stop(void) {
+    prof_enabled = false;
+}
+
+// Forget all samples
+void prof_clear(void) {
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        prof_buffers[i].count = 0;
+        prof_buffers[i].dropped = 0;
+    }
+}
+
+// Write the samples as text:
+// "S <cpu> <pid> <k|u> <pc> [<caller> ...]", with the addresses in hex.
+// tools/profsym.py symbolizes them against myos.bin.
+void prof_export(uint16_t port) {
+    trace_port_init(port);
+    trace_puts(port, "# myos-prof 1\n");
+
+    uint8_t* seen = kmalloc(65536 / 8);
+    if (seen) {
+        memset(seen, 0, 65536 / 8);
+    }
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        prof_buffer_t* buf = &prof_buffers[cpu];
+        if (!buf->samples) continue;
+
+        for (uint32_t i = 0; i < buf->count; i++) {
+            prof_sample_t* sample = &buf->samples[i];
+            if (seen && !(seen[sample->pid / 8] & (1 << (sample->pid % 8)))) {
+                seen[sample->pid / 8] |= 1 << (sample->pid % 8);
+                trace_put_process(port, sample->pid);
+            }
+
+            trace_puts(port, "S ");
+            trace_putdec(port, cpu);
+            trace_puts(port, " ");
+            trace_putdec(port, sample->pid);
+            trace_puts(port, sample->user ? " u" : " k");
+            for (uint32_t j = 0; j < sample->depth; j++) {
+                trace_puts(port, " ");
+                trace_puthex(port, sample->pc[j], 8);
+            }
+            trace_puts(port, "\n");
+        }
+    }
+    kfree(seen);
+    trace_puts(port, "# end\n");
+}
+
+// Sample count of one EIP
+typedef struct {
+    uint32_t pc;
+    uint32_t count;
+} prof_hit_t;
+
+// Show the kernel EIPs seen most often, for a quick look without the
+// host tools
+static void prof_top(uint32_t n) {
+    prof_hit_t* hits = kmalloc(PROF_TOP_SLOTS * sizeof(prof_hit_t));
+    if (!hits) {
+        kprintf("prof: out of memory\n");
+        return;
+    }
+    memset(hits, 0, PROF_TOP_SLOTS * sizeof(prof_hit_t));
+
+    uint32_t total = 0, user = 0, idle = 0, other = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        prof_buffer_t* buf = &prof_buffers[cpu];
+        if (!buf->samples) continue;
+
+        for (uint32_t i = 0; i < buf->count; i++) {
+            prof_sample_t* sample = &buf->samples[i];
+            total++;
+            if (sample->user) {
+                user++;
+                continue;
+            }
+            if (sample->pid == 0) {
+                idle++;
+            }
+
+            // Open addressing on the EIP
+            uint32_t pc = sample->pc[0];
+            uint32_t slot = (pc >> 2) * 2654435761u;
+            uint32_t probes = 0;
+            while (probes < PROF_TOP_SLOTS) {
+                prof_hit_t* hit = &hits[slot & (PROF_TOP_SLOTS - 1)];
+                if (hit->count == 0 || hit->pc == pc) {
+                    hit->pc = pc;
+                    hit->count++;
+                    break;
+                }
+                slot++;
+                probes++;
+            }
+            if (probes == PROF_TOP_SLOTS) {
+                other++;
+            }
+        }
+    }
+
+    if (total == 0) {
+        kprintf("No samples\n");
+        kfree(hits);
+        return;
+    }
+
+    kprintf("%u samples: %u kernel (%u idle), %u user\n",
+            total, total - user, idle, user);
+    kprintf("  samples   %%   kernel EIP\n");
+    for (uint32_t i = 0; i < n; i++) {
+        prof_hit_t* best = NULL;
+        for (uint32_t slot = 0; slot < PROF_TOP_SLOTS; slot++) {
+            if (hits[slot].count && (!best || hits[slot].count > best->count)) {
+                best = &hits[slot];
+            }
+        }
+        if (!best) break;
+
+        kprintf("  %u\t%u\t0x%x\n", best->count, best->count * 100 / total, best->pc);
+        best->count = 0;
+    }
+    if (other) {
+        kprintf("  %u samples at addresses that did not fit the table\n", other);
+    }
+    kprintf("Symbolize with: prof dump, then tools/profsym.py\n");
+    kfree(hits);
+}
+
+// Control profiling: prof start|stop|clear|status|top [n]|dump [serial|debugcon]
+int prof_cmd_prof(int argc, char* argv[]) {
+    const char* op = argc > 1 ? argv[1] : "status";
+
+    if (strcmp(op, "start") == 0) {
+        if (!prof_start()) {
+            kprintf("prof: cannot allocate sample buffers\n");
+            return -1;
+        }
+        kprintf("Profiling on %u CPUs\n", smp_cpu_count());
+    } else if (strcmp(op, "stop") == 0) {
+        prof_stop();
+    } else if (strcmp(op, "clear") == 0) {
+        prof_clear();
+    } else if (strcmp(op, "status") == 0) {
+        kprintf("Profiling %s\n", prof_enabled ? "on" : "off");
+        for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+            kprintf("CPU %u: %u samples, %u dropped\n", i,
+                    prof_buffers[i].count, prof_buffers[i].dropped);
+        }
+    } else if (strcmp(op, "top") == 0) {
+        int n = argc > 2 ? atoi(argv[2]) : 10;
+        prof_top(n > 0 ? (uint32_t)n : 10);
+    } else if (strcmp(op, "dump") == 0) {
+        uint16_t port = TRACE_SERIAL_PORT;
+        if (argc > 2 && strcmp(argv[2], "debugcon") == 0) {
+            port = TRACE_DEBUGCON_PORT;
+        } else if (argc > 2 && strcmp(argv[2], "serial") != 0) {
+            kprintf("usage: prof dump [serial|debugcon]\n");
+            return -1;
+        }
+
+        // The buffers must not change while they are read
+        prof_stop();
+        prof_export(port);
+        kprintf("Profile written to %s\n", port == TRACE_SERIAL_PORT ? "COM1" : "port 0xE9");
+    } else {
+        kprintf("usage: prof start|stop|clear|status|top [n]|dump [serial|debugcon]\n");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "radix.h"
+#include "memory.h"
+#include "string.h"
+
+// Indexes a tree of a height can hold
+static inline uint64_t radix_capacity(uint32_t height) {
+    return 1ULL << (height * RADIX_BITS);
+}
+
+// Shift of the index bits that pick a slot in a node of a height
+static inline uint32_t radix_shift(uint32_t height) {
+    return (height - 1) * RADIX_BITS;
+}
+
+static void** radix_node_alloc(radix_tree_t* tree) {
+    void** node = (void**)alloc_frame();
+    if (!node) return NULL;
+    memset(node, 0, PAGE_SIZE);
+    tree->nodes++;
+    return node;
+}
+
+static void radix_node_free(radix_tree_t* tree, void** node) {
+    free_frame((uint32_t)node);
+    tree->nodes--;
+}
+
+// Item at an index, or NULL
+void* radix_lookup(radix_tree_t* tree, uint32_t index) {
+    if (index >= radix_capacity(tree->height)) return NULL;
+
+    void* node = tree->root;
+    for (uint32_t h = tree->height; h > 0 && node; h--) {
+        node = ((void**)node)[(index >> radix_shift(h)) & (RADIX_SLOTS - 1)];
+    }
+    return node;
+}
+
+// Store an item at an index, replacing what is there. Returns false if
+// a node could not be allocated.
+bool radix_insert(radix_tree_t* tree, uint32_t index, void* item) {
+    // Grow until the index fits; the old root becomes the first slot of
+    // the new one
+    while (index >= radix_capacity(tree->height)) {
+        if (tree->root) {
+            void** node = radix_node_alloc(tree);
+            if (!node) return false;
+            node[0] = tree->root;
+            tree->root = node;
+        }
+        tree->height++;
+    }
+
+    void** slot = &tree->root;
+    for (uint32_t h = tree->height; h > 0; h--) {
+        if (!*slot) {
+            *slot = radix_node_alloc(tree);
+            if (!*slot) return false;
+        }
+        slot = &((void**)*slot)[(index >> radix_shift(h)) & (RADIX_SLOTS - 1)];
+    }
+    *slot = item;
+    return true;
+}
+
+// Remove items at first and past it from the subtree in a slot, which
+// starts at index base, and free its nodes that become empty
+static void radix_trim(radix_tree_t* tree, void** slot, uint32_t height, uint64_t base,
+                       uint32_t first, radix_release_fn release) {
+    if (!*slot) return;
+    if (height == 0) {
+        if (base >= first) {
+            if (release) release(*slot);
+            *slot = NULL;
+        }
+        return;
+    }
+
+    void** node = *slot;
+    uint32_t shift = radix_shift(height);
+    bool empty = true;
+    for (uint32_t i = 0; i < RADIX_SLOTS; i++) {
+        uint64_t child = base + ((uint64_t)i << shift);
+        if (node[i] && child + (1ULL << shift) > first) {
+            radix_trim(tree, &node[i], height - 1, child, first, release);
+        }
+        if (node[i]) empty = false;
+    }
+    if (empty) {
+        radix_node_free(tree, node);
+        *slot = NULL;
+    }
+}
+
+// Remove every item at first or past it, calling release on each, and
+// shrink the tree to the height what is left needs
+void radix_truncate(radix_tree_t* tree, uint32_t first, radix_release_fn release) {
+    radix_trim(tree, &tree->root, tree->height, 0, first, release);
+
+    while (tree->height > 0) {
+        void** node = tree->root;
+        if (node) {
+            for (uint32_t i = 1; i < RADIX_SLOTS; i++) {
+                if (node[i]) return;
+            }
+            tree->root = node[0];
+            radix_node_free(tree, node);
+        }
+        tree->height--;
+    }
+}
@@ -0,0 +1,208 @@
+#include "ramfs.h"
+#include "kheap.h"
+#include "memory.h"
+#include "radix.h"
+#include "string.h"
+
+// ramfs: files and directories that live only in memory. Each mount is
+// its own tree; the nodes are the files. A file's data is a radix tree of
+// pages allocated as they are written, so it takes memory for what was
+// written only and unwritten ranges read as zeros. Callers (the VFS)
+// serialize every operation.
+
+typedef struct ramfs_node {
+    fs_node_t node;                  // First, so an fs_node_t* is a ramfs_node_t*
+    struct ramfs_node* children;     // Entries of a directory
+    struct ramfs_node* sibling;
+    uint32_t refs;                   // VFS references
+    bool linked;                     // Named by a directory (or the root)
+    radix_tree_t pages;              // Data pages by page index
+} ramfs_node_t;
+
+static uint32_t ramfs_next_inode = 1;
+
+static ramfs_node_t* ramfs_new(const char* name, uint32_t type);
+
+static uint32_t ramfs_pages = 0;    // Data pages of all ramfs files
+
+static void ramfs_page_free(void* page) {
+    free_frame((uint32_t)page);
+    ramfs_pages--;
+}
+
+// Free a node that is neither named nor referenced
+static void ramfs_free(ramfs_node_t* rn) {
+    radix_truncate(&rn->pages, 0, ramfs_page_free);
+    kfree(rn);
+}
+
+// Reads of holes give zeros
+static uint32_t ramfs_read(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+    ramfs_node_t* rn = (ramfs_node_t*)node;
+    if (offset >= node->length) return 0;
+    if (size > node->length - offset) size = node->length - offset;
+
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t in_page = (offset + done) & (PAGE_SIZE - 1);
+        uint32_t chunk = PAGE_SIZE - in_page;
+        if (chunk > size - done) chunk = size - done;
+
+        uint8_t* page = radix_lookup(&rn->pages, (offset + done) / PAGE_SIZE);
+        if (page) {
+            memcpy(buffer + done, page + in_page, chunk);
+        } else {
+            memset(buffer + done, 0, chunk);
+        }
+        done += chunk;
+    }
+    return size;
+}
+
+// Pages are allocated as they are first written. Returns what was
+// written before memory ran out.
+static uint32_t ramfs_write(fs_node_t* node, uint32_t offset, uint32_t size, uint8_t* buffer) {
+    ramfs_node_t* rn = (ramfs_node_t*)node;
+    if (offset + size < offset) size = -offset;
+
+    uint32_t done = 0;
+    while (done < size) {
+        uint32_t index = (offset + done) / PAGE_SIZE;
+        uint32_t in_page = (offset + done) & (PAGE_SIZE - 1);
+        uint32_t chunk = PAGE_SIZE - in_page;
+        if (chunk > size - done) chunk = size - done;
+
+        uint8_t* page = radix_lookup(&rn->pages, index);
+        if (!page) {
+            page = (uint8_t*)alloc_frame();
+            if (!page) break;
+            if (!radix_insert(&rn->pages, index, page)) {
+                free_frame((uint32_t)page);
+                break;
+            }
+            memset(page, 0, PAGE_SIZE);
+            ramfs_pages++;
+        }
+        memcpy(page + in_page, buffer + done, chunk);
+        done += chunk;
+    }
+
+    if (offset + done > node->length) {
+        node->length = offset + done;
+    }
+    return done;
+}
+
+// Growing leaves a hole; shrinking frees the pages past the end
+static int ramfs_truncate(fs_node_t* node, uint32_t length) {
+    ramfs_node_t* rn = (ramfs_node_t*)node;
+    if (length < node->length) {
+        radix_truncate(&rn->pages, (length + PAGE_SIZE - 1) / PAGE_SIZE, ramfs_page_free);
+
+        // Growing again must read zeros past the new end
+        uint8_t* page = radix_lookup(&rn->pages, length / PAGE_SIZE);
+        if (page && (length & (PAGE_SIZE - 1))) {
+            memset(page + (length & (PAGE_SIZE - 1)), 0, PAGE_SIZE - (length & (PAGE_SIZE - 1)));
+        }
+    }
+    node->length = length;
+    return 0;
+}
+
+static void ramfs_open(fs_node_t* node) {
+    ((ramfs_node_t*)node)->refs++;
+}
+
+// A removed file goes with its last reference
+static void ramfs_close(fs_node_t* node) {
+    ramfs_node_t* rn = (ramfs_node_t*)node;
+    if (rn->refs && --rn->refs == 0 && !rn->linked) {
+        ramfs_free(rn);
+    }
+}
+
+static struct dirent* ramfs_readdir(fs_node_t* node, uint32_t index) {
+    static struct dirent dirent;
+
+    ramfs_node_t* child = ((ramfs_node_t*)node)->children;
+    while (child && index--) {
+        child = child->sibling;
+    }
+    if (!child) return NULL;
+
+    strncpy(dirent.name, child->node.name, sizeof(dirent.name));
+    dirent.ino = child->node.inode;
+    return &dirent;
+}
+
+static fs_node_t* ramfs_finddir(fs_node_t* node, char* name) {
+    for (ramfs_node_t* child = ((ramfs_node_t*)node)->children; child; child = child->sibling) {
+        if (strcmp(child->node.name, name) == 0) return &child->node;
+    }
+    return NULL;
+}
+
+static fs_node_t* ramfs_create(fs_node_t* node, char* name, uint32_t type) {
+    ramfs_node_t* dir = (ramfs_node_t*)node;
+    if (strlen(name) >= sizeof(node->name) || ramfs_finddir(node, name)) return NULL;
+
+    ramfs_node_t* child = ramfs_new(name, type);
+    if (!child) return NULL;
+    child->sibling = dir->children;
+    dir->children = child;
+    return &child->node;
+}
+
+// Remove an entry; directories must be empty
+static int ramfs_unlink(fs_node_t* node, char* name) {
+    ramfs_node_t** link = &((ramfs_node_t*)node)->children;
+    while (*link && strcmp((*link)->node.name, name) != 0) {
+        link = &(*link)->sibling;
+    }
+
+    ramfs_node_t* child = *link;
+    if (!child || child->children) return -1;
+
+    *link = child->sibling;
+    child->sibling = NULL;
+    child->linked = false;
+    if (!child->refs) ramfs_free(child);
+    return 0;
+}
+
+// Make a node of a type
+static ramfs_node_t* ramfs_new(const char* name, uint32_t type) {
+    ramfs_node_t* rn = kmalloc(sizeof(ramfs_node_t));
+    if (!rn) return NULL;
+
+    memset(rn, 0, sizeof(ramfs_node_t));
+    rn->linked = true;
+    fs_node_t* node = &rn->node;
+    strncpy(node->name, name, sizeof(node->name) - 1);
+    node->inode = ramfs_next_inode++;
+    node->flags = type == FS_DIRECTORY ? FS_DIRECTORY : FS_FILE;
+    node->mask = 0755;
+    node->read = ramfs_read;
+    node->write = ramfs_write;
+    node->open = ramfs_open;
+    node->close = ramfs_close;
+    node->truncate = ramfs_truncate;
+    if (type == FS_DIRECTORY) {
+        node->readdir = ramfs_readdir;
+        node->finddir = ramfs_finddir;
+        node->create = ramfs_create;
+        node->unlink = ramfs_unlink;
+    }
+    return rn;
+}
+
+// Pages of file data held by every ramfs
+uint32_t ramfs_used_pages(void) {
+    return ramfs_pages;
+}
+
+// Make an empty ramfs and return its root directory
+fs_node_t* ramfs_mount(void) {
+    ramfs_node_t* root = ramfs_new("/", FS_DIRECTORY);
+    return root ? &root->node : NULL;
+}
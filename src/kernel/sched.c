@@ -0,0 +1,175 @@
+#include "sched.h"
+#include "process.h"
+#include "terminal.h"
+#include "string.h"
+
+// Wakeup latency samples
+#define SCHED_LATENCY_SAMPLES 256
+
+static uint32_t latency_samples[SCHED_LATENCY_SAMPLES];
+static uint32_t latency_count = 0;
+static volatile bool latency_recording = false;
+static spinlock_t latency_lock = SPINLOCK_INIT;
+
+// schedbench workload
+#define SCHEDBENCH_HOGS     4
+#define SCHEDBENCH_WAKEUPS  100
+
+static volatile bool bench_stop = false;
+static volatile uint32_t bench_exited = 0;
+
+// The idle process is never queued; it runs when no class has work
+static void idle_enqueue(runqueue_t* rq, process_t* process) {
+    (void)rq;
+    (void)process;
+}
+
+static bool idle_dequeue(runqueue_t* rq, process_t* process) {
+    (void)rq;
+    (void)process;
+    return false;
+}
+
+static process_t* idle_pick_next(runqueue_t* rq, process_t* curr) {
+    (void)rq;
+    (void)curr;
+    return NULL;
+}
+
+static void idle_update_curr(runqueue_t* rq, process_t* curr, uint32_t delta_us) {
+    (void)rq;
+    (void)curr;
+    (void)delta_us;
+}
+
+// Leave idle as soon as anything is queued
+static bool idle_tick(runqueue_t* rq, process_t* curr) {
+    (void)curr;
+    return rq->nr_running > 0;
+}
+
+static bool idle_check_preempt(runqueue_t* rq, process_t* curr, process_t* process) {
+    (void)rq;
+    (void)curr;
+    (void)process;
+    return true;
+}
+
+// Idle class: lowest priority, holds only the per-CPU idle process
+const sched_class_t idle_sched_class = {
+    .name = "idle",
+    .next = NULL,
+    .enqueue = idle_enqueue,
+    .dequeue = idle_dequeue,
+    .pick_next = idle_pick_next,
+    .steal = idle_pick_next,
+    .update_curr = idle_update_curr,
+    .tick = idle_tick,
+    .check_preempt = idle_check_preempt,
+};
+
+// Record one wakeup-to-run latency while a benchmark is running
+void sched_latency_record(uint32_t us) {
+    if (!latency_recording) return;
+
+    uint32_t flags = spin_lock_irqsave(&latency_lock);
+    if (latency_count < SCHED_LATENCY_SAMPLES) {
+        latency_samples[latency_count++] = us;
+    }
+    spin_unlock_irqrestore(&latency_lock, flags);
+}
+
+// CPU-bound load: spin until the sleeper is done
+static void bench_hog(void) {
+    while (!bench_stop) {
+        asm volatile("pause");
+    }
+    __sync_fetch_and_add(&bench_exited, 1);
+    sys_exit(0);
+}
+
+// Latency probe: sleep for one tick at a time; every wakeup is sampled
+static void bench_sleeper(void) {
+    for (int i = 0; i < SCHEDBENCH_WAKEUPS; i++) {
+        process_sleep(1);
+    }
+    bench_stop = true;
+    __sync_fetch_and_add(&bench_exited, 1);
+    sys_exit(0);
+}
+
+// Sort samples in place (insertion sort; at most SCHED_LATENCY_SAMPLES)
+static void sort_samples(uint32_t* samples, uint32_t count) {
+    for (uint32_t i = 1; i < count; i++) {
+        uint32_t value = samples[i];
+        uint32_t j = i;
+        while (j > 0 && samples[j - 1] > value) {
+            samples[j] = samples[j - 1];
+            j--;
+        }
+        samples[j] = value;
+    }
+}
+
+// Measure wakeup-to-run latency of a sleeping process while CPU-bound
+// processes keep every run queue busy
+int sched_cmd_schedbench(int argc, char* argv[]) {
+    const sched_class_t* sched_class = &fair_sched_class;
+    if (argc > 1) {
+        if (strcmp(argv[1], "rr") == 0) {
+            sched_class = &rr_sched_class;
+        } else if (strcmp(argv[1], "fair") != 0) {
+            kprintf("Usage: schedbench [fair|rr]\n");
+            return -1;
+        }
+    }
+
+    latency_count = 0;
+    bench_stop = false;
+    bench_exited = 0;
+    latency_recording = true;
+
+    uint32_t started = 0;
+    for (int i = 0; i < SCHEDBENCH_HOGS; i++) {
+        process_t* hog = kthread_create("bench_hog", bench_hog);
+        if (hog) {
+            process_set_sched_class(hog, sched_class);
+            started++;
+        }
+    }
+    process_t* sleeper = kthread_create("bench_sleeper", bench_sleeper);
+    if (!sleeper) {
+        bench_stop = true;
+    } else {
+        process_set_sched_class(sleeper, sched_class);
+        started++;
+    }
+
+    // The shell runs as the idle process, so this only resumes once
+    // the workload has drained
+    while (bench_exited < started) {
+        process_yield();
+        asm volatile("hlt");
+    }
+    latency_recording = false;
+
+    // The threads are the shell's children; reap them so their process
+    // slots are free for the next run
+    uint32_t reaped = 0;
+    while (reaped < started && sys_wait(NULL) > 0) {
+        reaped++;
+    }
+
+    if (latency_count == 0) {
+        kprintf("schedbench: no samples\n");
+        return -1;
+    }
+
+    sort_samples(latency_samples, latency_count);
+    kprintf("schedbench (%s, %d hogs): %d wakeups\n",
+            sched_class->name, SCHEDBENCH_HOGS, latency_count);
+    kprintf("  p50: %d us\n", latency_samples[latency_count / 2]);
+    kprintf("  p99: %d us\n", latency_samples[(latency_count * 99) / 100]);
+    kprintf("  max: %d us\n", latency_samples[latency_count - 1]);
+    return 0;
+}
@@ -0,0 +1,198 @@
+#include "sched.h"
+#include "process.h"
+#include "tsc.h"
+
+// Reserved deadline bandwidth, in 1/1024 of a CPU
+static uint32_t dl_total_bw = 0;
+static spinlock_t dl_bw_lock = SPINLOCK_INIT;
+
+// Bandwidth of a runtime/period reservation, in 1/1024 of a CPU.
+// runtime <= period keeps the quotient in 32 bits, so one divl suffices.
+static uint32_t dl_bandwidth(uint32_t runtime_us, uint32_t period_us) {
+    uint32_t bw, rem;
+    asm("divl %4"
+        : "=a"(bw), "=d"(rem)
+        : "a"(runtime_us << 10), "d"(runtime_us >> 22), "r"(period_us));
+    return bw;
+}
+
+// Insert into a list sorted by absolute deadline
+static void dl_insert_sorted(process_t** list, process_t* process) {
+    while (*list && (*list)->dl_deadline <= process->dl_deadline) {
+        list = &(*list)->next;
+    }
+    process->next = *list;
+    *list = process;
+}
+
+// Unlink from a list
+static bool dl_unlink(process_t** list, process_t* process) {
+    while (*list && *list != process) {
+        list = &(*list)->next;
+    }
+    if (!*list) return false;
+
+    *list = process->next;
+    process->next = NULL;
+    return true;
+}
+
+// Start a new period: fresh budget, deadline one period from now
+static void dl_replenish(process_t* process, uint64_t now) {
+    process->dl_deadline = now + process->dl_period_us;
+    process->dl_remaining = process->dl_runtime_us;
+    process->dl_throttled = false;
+}
+
+// Queue a process. A waking process keeps its deadline only if its
+// leftover budget still fits before it (constant bandwidth server rule);
+// otherwise it starts a new period.
+static void dl_enqueue(runqueue_t* rq, process_t* process) {
+    uint64_t now = tsc_now_us();
+
+    if (process->dl_throttled) {
+        // Wait for the replenishment at the deadline
+        dl_insert_sorted(&rq->dl.throttled, process);
+        return;
+    }
+
+    if (process->dl_deadline <= now || process->dl_remaining <= 0 ||
+        (uint64_t)process->dl_remaining * process->dl_period_us >
+        (process->dl_deadline - now) * process->dl_runtime_us) {
+        dl_replenish(process, now);
+    }
+    dl_insert_sorted(&rq->dl.ready, process);
+}
+
+// Remove a process from whichever list holds it
+static bool dl_dequeue(runqueue_t* rq, process_t* process) {
+    return dl_unlink(&rq->dl.ready, process) || dl_unlink(&rq->dl.throttled, process);
+}
+
+// Earliest deadline first
+static process_t* dl_pick_next(runqueue_t* rq, process_t* curr) {
+    (void)curr;
+    return rq->dl.ready;
+}
+
+// Deadline reservations are per CPU; they never migrate
+static process_t* dl_steal(runqueue_t* rq, process_t* curr) {
+    (void)rq;
+    (void)curr;
+    return NULL;
+}
+
+// Consume budget; throttle the process until its deadline when it runs out
+static void dl_update_curr(runqueue_t* rq, process_t* curr, uint32_t delta_us) {
+    if (curr->dl_throttled) return;
+
+    if (delta_us > 0x7FFFFFFF) delta_us = 0x7FFFFFFF;
+    curr->dl_remaining -= (int32_t)delta_us;
+    if (curr->dl_remaining <= 0 && dl_unlink(&rq->dl.ready, curr)) {
+        curr->dl_throttled = true;
+        dl_insert_sorted(&rq->dl.throttled, curr);
+    }
+}
+
+// Preempt when throttled or when an earlier deadline is ready
+static bool dl_tick(runqueue_t* rq, process_t* curr) {
+    return curr->dl_throttled || rq->dl.ready != curr;
+}
+
+// An earlier deadline preempts on wakeup
+static bool dl_check_preempt(runqueue_t* rq, process_t* curr, process_t* process) {
+    (void)rq;
+    return process->dl_deadline < curr->dl_deadline;
+}
+
+// Give throttled processes a new period once their deadline has passed
+static bool dl_rq_tick(runqueue_t* rq) {
+    uint64_t now = tsc_now_us();
+    bool resched = false;
+
+    while (rq->dl.throttled && rq->dl.throttled->dl_deadline <= now) {
+        process_t* process = rq->dl.throttled;
+        rq->dl.throttled = process->next;
+        dl_replenish(process, now);
+        dl_insert_sorted(&rq->dl.ready, process);
+        resched = true;
+    }
+    return resched;
+}
+
+// Deadline class: earliest deadline first with runtime/period budgets
+const sched_class_t dl_sched_class = {
+    .name = "deadline",
+    .next = &rt_sched_class,
+    .enqueue = dl_enqueue,
+    .dequeue = dl_dequeue,
+    .pick_next = dl_pick_next,
+    .steal = dl_steal,
+    .update_curr = dl_update_curr,
+    .tick = dl_tick,
+    .check_preempt = dl_check_preempt,
+    .rq_tick = dl_rq_tick,
+};
+
+// Move a process to the deadline class with a runtime budget per period.
+// Fails if the reservation would exceed SCHED_DL_BW_LIMIT.
+int sched_set_deadline(process_t* process, uint32_t runtime_us, uint32_t period_us) {
+    if (!process || runtime_us == 0 || period_us == 0 || runtime_us > period_us) return -1;
+
+    uint32_t bw = dl_bandwidth(runtime_us, period_us);
+    uint32_t old_bw = process->sched_class == &dl_sched_class ?
+                      dl_bandwidth(process->dl_runtime_us, process->dl_period_us) : 0;
+
+    // Admission control. A reservation being replaced counts as free; it
+    // is given back when the process leaves the class below.
+    uint32_t flags = spin_lock_irqsave(&dl_bw_lock);
+    if (dl_total_bw - old_bw + bw > SCHED_DL_BW_LIMIT) {
+        spin_unlock_irqrestore(&dl_bw_lock, flags);
+        return -1;
+    }
+    dl_total_bw += bw;
+    spin_unlock_irqrestore(&dl_bw_lock, flags);
+
+    // Leave the class first so the process is requeued with new parameters
+    if (process->sched_class == &dl_sched_class) {
+        process_set_sched_class(process, &fair_sched_class);
+    }
+    process->dl_runtime_us = runtime_us;
+    process->dl_period_us = period_us;
+    process->dl_deadline = 0;
+    process->dl_remaining = 0;
+    process->dl_throttled = false;
+    process->flags |= PROCESS_FLAG_PINNED;
+    return process_set_sched_class(process, &dl_sched_class);
+}
+
+// Give back the bandwidth of a process's reservation, as it leaves the
+// deadline class or exits
+void sched_dl_release(process_t* process) {
+    uint32_t bw = dl_bandwidth(process->dl_runtime_us, process->dl_period_us);
+
+    uint32_t flags = spin_lock_irqsave(&dl_bw_lock);
+    dl_total_bw -= bw;
+    spin_unlock_irqrestore(&dl_bw_lock, flags);
+}
+
+// Give up the rest of this period's budget; the caller runs again at the
+// start of its next period
+void sched_dl_yield(void) {
+    process_t* curr = current_process;
+    if (!curr || curr->sched_class != &dl_sched_class) {
+        process_yield();
+        return;
+    }
+
+    runqueue_t* rq = &this_cpu()->rq;
+    uint32_t flags = spin_lock_irqsave(&rq->lock);
+    if (dl_unlink(&rq->dl.ready, curr)) {
+        curr->dl_remaining = 0;
+        curr->dl_throttled = true;
+        dl_insert_sorted(&rq->dl.throttled, curr);
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    process_yield();
+}
@@ -0,0 +1,203 @@
+#include "sched.h"
+#include "process.h"
+#include "terminal.h"
+
+// Load weight of each nice level (-20..19); every step is ~10% CPU
+static const uint32_t nice_to_weight[40] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */  9548,  7620,  6100,  4904,  3906,
+    /*  -5 */  3121,  2501,  1991,  1586,  1277,
+    /*   0 */  1024,   820,   655,   526,   423,
+    /*   5 */   335,   272,   215,   172,   137,
+    /*  10 */   110,    87,    70,    56,    45,
+    /*  15 */    36,    29,    23,    18,    15,
+};
+
+// Get the load weight of a nice level
+uint32_t sched_nice_to_weight(int nice) {
+    if (nice < NICE_MIN) nice = NICE_MIN;
+    if (nice > NICE_MAX) nice = NICE_MAX;
+    return nice_to_weight[nice - NICE_MIN];
+}
+
+// Heap ordering: smaller vruntime first
+static inline bool fair_before(process_t* a, process_t* b) {
+    return a->vruntime < b->vruntime;
+}
+
+// Place a process at a heap slot
+static inline void heap_set(fair_rq_t* fair, uint32_t index, process_t* process) {
+    fair->heap[index] = process;
+    process->heap_index = index;
+}
+
+// Move a heap entry towards the root while it beats its parent
+static void heap_sift_up(fair_rq_t* fair, uint32_t index) {
+    process_t* process = fair->heap[index];
+    while (index > 0) {
+        uint32_t parent = (index - 1) / 2;
+        if (!fair_before(process, fair->heap[parent])) break;
+        heap_set(fair, index, fair->heap[parent]);
+        index = parent;
+    }
+    heap_set(fair, index, process);
+}
+
+// Move a heap entry towards the leaves while a child beats it
+static void heap_sift_down(fair_rq_t* fair, uint32_t index) {
+    process_t* process = fair->heap[index];
+    for (;;) {
+        uint32_t child = index * 2 + 1;
+        if (child >= fair->nr) break;
+        if (child + 1 < fair->nr && fair_before(fair->heap[child + 1], fair->heap[child])) {
+            child++;
+        }
+        if (!fair_before(fair->heap[child], process)) break;
+        heap_set(fair, index, fair->heap[child]);
+        index = child;
+    }
+    heap_set(fair, index, process);
+}
+
+// Advance min_vruntime to the smallest queued vruntime; it never goes back
+static void update_min_vruntime(fair_rq_t* fair) {
+    if (fair->nr > 0 && fair->heap[0]->vruntime > fair->min_vruntime) {
+        fair->min_vruntime = fair->heap[0]->vruntime;
+    }
+}
+
+// Insert a runnable process. Sleepers get at most half a latency period
+// of credit so they run soon without monopolizing the CPU.
+static void fair_enqueue(runqueue_t* rq, process_t* process) {
+    fair_rq_t* fair = &rq->fair;
+
+    // There is a slot for every process the process table can hold, so a
+    // full heap means that invariant broke; losing the process silently
+    // would leave it runnable but never run
+    if (fair->nr >= SCHED_FAIR_MAX) {
+        kprintf("sched: fair run queue full, cannot queue pid %d\n", process->pid);
+        kprintf("Fatal error. System halted.\n");
+        for (;;) {
+            asm volatile("cli\n"
+                         "hlt");
+        }
+    }
+
+    uint64_t floor = 0;
+    if (fair->min_vruntime > SCHED_LATENCY_US / 2) {
+        floor = fair->min_vruntime - SCHED_LATENCY_US / 2;
+    }
+    if (process->vruntime < floor) {
+        process->vruntime = floor;
+    }
+
+    heap_set(fair, fair->nr++, process);
+    heap_sift_up(fair, process->heap_index);
+    fair->total_weight += process->weight;
+    update_min_vruntime(fair);
+}
+
+// Remove a process from the heap
+static bool fair_dequeue(runqueue_t* rq, process_t* process) {
+    fair_rq_t* fair = &rq->fair;
+    int32_t index = process->heap_index;
+    if (index < 0 || (uint32_t)index >= fair->nr || fair->heap[index] != process) {
+        return false;
+    }
+
+    process_t* last = fair->heap[--fair->nr];
+    process->heap_index = -1;
+    fair->total_weight -= process->weight;
+
+    if (last != process) {
+        heap_set(fair, index, last);
+        heap_sift_up(fair, index);
+        heap_sift_down(fair, last->heap_index);
+    }
+    update_min_vruntime(fair);
+    return true;
+}
+
+// The process with the smallest vruntime runs next
+static process_t* fair_pick_next(runqueue_t* rq, process_t* curr) {
+    (void)curr;
+    return rq->fair.nr ? rq->fair.heap[0] : NULL;
+}
+
+// Find the most deserving queued process another CPU may take
+static process_t* fair_steal(runqueue_t* rq, process_t* curr) {
+    process_t* best = NULL;
+    for (uint32_t i = 0; i < rq->fair.nr; i++) {
+        process_t* candidate = rq->fair.heap[i];
+        if (candidate != curr && candidate->state == PROCESS_STATE_READY &&
+            !(candidate->flags & PROCESS_FLAG_PINNED) &&
+            (!best || fair_before(candidate, best))) {
+            best = candidate;
+        }
+    }
+    return best;
+}
+
+// Advance vruntime by the runtime scaled inversely to the weight
+static void fair_update_curr(runqueue_t* rq, process_t* curr, uint32_t delta_us) {
+    if (delta_us > 1000000) delta_us = 1000000;  // Keep the product in 32 bits
+    curr->vruntime += (delta_us * NICE_0_WEIGHT) / curr->weight;
+
+    if (curr->heap_index >= 0) {
+        heap_sift_down(&rq->fair, curr->heap_index);
+        update_min_vruntime(&rq->fair);
+    }
+}
+
+// Preempt when the slice is used up or another process is far behind
+static bool fair_tick(runqueue_t* rq, process_t* curr) {
+    fair_rq_t* fair = &rq->fair;
+    if (fair->nr < 2 || curr->heap_index < 0) return false;
+
+    // Slice: the process's share of the latency period
+    uint32_t slice = (SCHED_LATENCY_US * curr->weight) / fair->total_weight;
+    if (slice < SCHED_MIN_GRANULARITY_US) slice = SCHED_MIN_GRANULARITY_US;
+    if (curr->sum_exec_us - curr->slice_start_us >= slice) return true;
+
+    process_t* leftmost = fair->heap[0];
+    return leftmost != curr &&
+           curr->vruntime > leftmost->vruntime + SCHED_WAKEUP_GRANULARITY_US;
+}
+
+// A woken process preempts if it is sufficiently behind the current one
+static bool fair_check_preempt(runqueue_t* rq, process_t* curr, process_t* process) {
+    (void)rq;
+    return process->vruntime + SCHED_WAKEUP_GRANULARITY_US < curr->vruntime;
+}
+
+// A fair process's vruntime only means something next to the
+// min_vruntime of the queue it ran on. When it moves to another CPU it is
+// detached from the old queue's timeline (made relative to its
+// min_vruntime, without sleeper credit) and attached to the new one's.
+// Callers hold the respective rq->lock.
+void sched_fair_detach(runqueue_t* rq, process_t* process) {
+    if (process->sched_class != &fair_sched_class) return;
+
+    uint64_t min = rq->fair.min_vruntime;
+    process->vruntime = process->vruntime > min ? process->vruntime - min : 0;
+}
+
+void sched_fair_attach(runqueue_t* rq, process_t* process) {
+    if (process->sched_class != &fair_sched_class) return;
+
+    process->vruntime += rq->fair.min_vruntime;
+}
+
+// Fair class: weighted virtual runtime, smallest vruntime runs first
+const sched_class_t fair_sched_class = {
+    .name = "fair",
+    .next = &idle_sched_class,
+    .enqueue = fair_enqueue,
+    .dequeue = fair_dequeue,
+    .pick_next = fair_pick_next,
+    .steal = fair_steal,
+    .update_curr = fair_update_curr,
+    .tick = fair_tick,
+    .check_preempt = fair_check_preempt,
+};
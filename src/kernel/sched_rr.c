@@ -0,0 +1,149 @@
+#include "sched.h"
+#include "process.h"
+#include "timer.h"
+
+// Starvation threshold and quantum limits
+#define STARVATION_THRESHOLD 1000  // Ticks before priority boost
+#define MAX_QUANTUM 100           // Maximum time slice
+#define MIN_QUANTUM 20            // Minimum time slice
+
+// Clamp a priority to a valid queue index
+static int rr_queue_index(process_t* process) {
+    int priority = process->priority;
+    if (priority < PROCESS_PRIORITY_LOW) priority = PROCESS_PRIORITY_LOW;
+    if (priority > PROCESS_PRIORITY_HIGH) priority = PROCESS_PRIORITY_HIGH;
+    return priority;
+}
+
+// Append a process to the queue of its priority
+static void rr_enqueue(runqueue_t* rq, process_t* process) {
+    int priority = rr_queue_index(process);
+    process->next = NULL;
+    process->wait_start = get_timer_ticks();
+
+    if (!rq->rr.queues[priority]) {
+        rq->rr.queues[priority] = process;
+    } else {
+        process_t* current = rq->rr.queues[priority];
+        while (current->next) {
+            current = current->next;
+        }
+        current->next = process;
+    }
+}
+
+// Unlink a process from the queue of its priority
+static bool rr_dequeue(runqueue_t* rq, process_t* process) {
+    process_t** link = &rq->rr.queues[rr_queue_index(process)];
+
+    while (*link && *link != process) {
+        link = &(*link)->next;
+    }
+    if (!*link) return false;
+
+    *link = process->next;
+    process->next = NULL;
+    return true;
+}
+
+// Boost ready processes that have waited longer than STARVATION_THRESHOLD
+static void rr_age(runqueue_t* rq, process_t* curr) {
+    uint32_t now = get_timer_ticks();
+
+    for (int priority = PROCESS_PRIORITY_NORMAL; priority >= PROCESS_PRIORITY_LOW; priority--) {
+        process_t* process = rq->rr.queues[priority];
+        while (process) {
+            process_t* next = process->next;
+            if (process != curr && process->state == PROCESS_STATE_READY &&
+                now - process->wait_start > STARVATION_THRESHOLD) {
+                rr_dequeue(rq, process);
+                process->priority++;
+                rr_enqueue(rq, process);
+            }
+            process = next;
+        }
+    }
+}
+
+// Pick the first ready process of the highest priority level and rotate
+// it to the end of its queue
+static process_t* rr_pick_next(runqueue_t* rq, process_t* curr) {
+    rr_age(rq, curr);
+
+    for (int priority = PROCESS_PRIORITY_HIGH; priority >= PROCESS_PRIORITY_LOW; priority--) {
+        for (process_t* candidate = rq->rr.queues[priority]; candidate; candidate = candidate->next) {
+            if (candidate->state == PROCESS_STATE_READY && candidate != curr) {
+                rr_dequeue(rq, candidate);
+                rr_enqueue(rq, candidate);
+                return candidate;
+            }
+        }
+    }
+
+    // If no other process found, continue with current process
+    if (curr && curr->sched_class == &rr_sched_class &&
+        curr->state == PROCESS_STATE_RUNNING) {
+        return curr;
+    }
+    return NULL;
+}
+
+// Find a ready process another CPU may take, most urgent first
+static process_t* rr_steal(runqueue_t* rq, process_t* curr) {
+    for (int priority = PROCESS_PRIORITY_HIGH; priority >= PROCESS_PRIORITY_LOW; priority--) {
+        for (process_t* candidate = rq->rr.queues[priority]; candidate; candidate = candidate->next) {
+            if (candidate->state == PROCESS_STATE_READY && candidate != curr &&
+                !(candidate->flags & PROCESS_FLAG_PINNED)) {
+                return candidate;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Round-robin processes are charged in ticks, not microseconds
+static void rr_update_curr(runqueue_t* rq, process_t* curr, uint32_t delta_us) {
+    (void)rq;
+    (void)curr;
+    (void)delta_us;
+}
+
+// Preempt once the priority-dependent quantum has expired
+static bool rr_tick(runqueue_t* rq, process_t* curr) {
+    (void)rq;
+
+    // Calculate quantum based on priority
+    uint32_t quantum = MAX_QUANTUM;
+    switch (curr->priority) {
+        case PROCESS_PRIORITY_HIGH:
+            quantum = MAX_QUANTUM;
+            break;
+        case PROCESS_PRIORITY_NORMAL:
+            quantum = (MAX_QUANTUM + MIN_QUANTUM) / 2;
+            break;
+        case PROCESS_PRIORITY_LOW:
+            quantum = MIN_QUANTUM;
+            break;
+    }
+
+    return get_timer_ticks() - curr->last_switch >= quantum;
+}
+
+// Higher priority levels preempt lower ones on wakeup
+static bool rr_check_preempt(runqueue_t* rq, process_t* curr, process_t* process) {
+    (void)rq;
+    return process->priority > curr->priority;
+}
+
+// Round-robin class: three fixed priorities with anti-starvation aging
+const sched_class_t rr_sched_class = {
+    .name = "rr",
+    .next = &fair_sched_class,
+    .enqueue = rr_enqueue,
+    .dequeue = rr_dequeue,
+    .pick_next = rr_pick_next,
+    .steal = rr_steal,
+    .update_curr = rr_update_curr,
+    .tick = rr_tick,
+    .check_preempt = rr_check_preempt,
+};
@@ -0,0 +1,105 @@
+#include "sched.h"
+#include "process.h"
+
+// Clamp a real-time priority to a valid queue index
+static int rt_queue_index(process_t* process) {
+    return process->rt_priority < RT_PRIO_LEVELS ? process->rt_priority : RT_PRIO_LEVELS - 1;
+}
+
+// Append a process to the tail of its priority queue
+static void rt_enqueue(runqueue_t* rq, process_t* process) {
+    int priority = rt_queue_index(process);
+    process_t** link = &rq->rt.queues[priority];
+
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = process;
+    process->next = NULL;
+    rq->rt.bitmap |= 1u << priority;
+}
+
+// Unlink a process from its priority queue
+static bool rt_dequeue(runqueue_t* rq, process_t* process) {
+    int priority = rt_queue_index(process);
+    process_t** link = &rq->rt.queues[priority];
+
+    while (*link && *link != process) {
+        link = &(*link)->next;
+    }
+    if (!*link) return false;
+
+    *link = process->next;
+    process->next = NULL;
+    if (!rq->rt.queues[priority]) {
+        rq->rt.bitmap &= ~(1u << priority);
+    }
+    return true;
+}
+
+// Head of the highest non-empty priority queue. A FIFO process keeps the
+// CPU until it blocks or something of higher priority becomes ready.
+static process_t* rt_pick_next(runqueue_t* rq, process_t* curr) {
+    (void)curr;
+    if (!rq->rt.bitmap) return NULL;
+
+    uint32_t priority;
+    asm("bsr %1, %0" : "=r"(priority) : "r"(rq->rt.bitmap));
+    return rq->rt.queues[priority];
+}
+
+// Find a queued process another CPU may take, highest priority first
+static process_t* rt_steal(runqueue_t* rq, process_t* curr) {
+    for (int priority = RT_PRIO_LEVELS - 1; priority >= 0; priority--) {
+        for (process_t* candidate = rq->rt.queues[priority]; candidate; candidate = candidate->next) {
+            if (candidate != curr && candidate->state == PROCESS_STATE_READY &&
+                !(candidate->flags & PROCESS_FLAG_PINNED)) {
+                return candidate;
+            }
+        }
+    }
+    return NULL;
+}
+
+// FIFO processes have no budget to charge
+static void rt_update_curr(runqueue_t* rq, process_t* curr, uint32_t delta_us) {
+    (void)rq;
+    (void)curr;
+    (void)delta_us;
+}
+
+// No time slice; only a higher priority process displaces the current one
+static bool rt_tick(runqueue_t* rq, process_t* curr) {
+    return rt_pick_next(rq, curr) != curr;
+}
+
+// Higher real-time priorities preempt on wakeup
+static bool rt_check_preempt(runqueue_t* rq, process_t* curr, process_t* process) {
+    (void)rq;
+    return process->rt_priority > curr->rt_priority;
+}
+
+// Real-time class: fixed-priority FIFO (SCHED_FIFO)
+const sched_class_t rt_sched_class = {
+    .name = "fifo",
+    .next = &rr_sched_class,
+    .enqueue = rt_enqueue,
+    .dequeue = rt_dequeue,
+    .pick_next = rt_pick_next,
+    .steal = rt_steal,
+    .update_curr = rt_update_curr,
+    .tick = rt_tick,
+    .check_preempt = rt_check_preempt,
+};
+
+// Move a process to the FIFO class at the given priority
+int sched_set_fifo(process_t* process, int rt_priority) {
+    if (!process || rt_priority < 0 || rt_priority >= RT_PRIO_LEVELS) return -1;
+
+    // Requeue under the new priority if already in the FIFO class
+    if (process->sched_class == &rt_sched_class) {
+        process_set_sched_class(process, &fair_sched_class);
+    }
+    process->rt_priority = rt_priority;
+    return process_set_sched_class(process, &rt_sched_class);
+}
@@ -1,88 +1,448 @@
 #include "signal.h"
 #include "process.h"
+#include "syscall.h"
 #include "terminal.h"
+#include "string.h"
 
-#define MAX_SIGNALS 32
+// Signals whose default action is to do nothing
+#define SIG_DEFAULT_IGNORE (SIGMASK(SIGCHLD) | SIGMASK(SIGCONT) | SIGMASK(SIGURG) | SIGMASK(SIGWINCH))
 
-// Signal handler table
-static signal_handler_t signal_handlers[MAX_SIGNALS] = {0};
-static uint32_t pending_signals = 0;
+// Signals whose default action is to stop the process
+#define SIG_DEFAULT_STOP (SIGMASK(SIGSTOP) | SIGMASK(SIGTSTP) | SIGMASK(SIGTTIN) | SIGMASK(SIGTTOU))
 
-// Initialize signal handling
-void signal_init(void) {
-    // Set all handlers to default
-    for (int i = 0; i < MAX_SIGNALS; i++) {
-        signal_handlers[i] = default_signal_handler;
+// Signals that can be neither blocked nor caught
+#define SIG_UNBLOCKABLE (SIGMASK(SIGKILL) | SIGMASK(SIGSTOP))
+
+// EFLAGS bits a handler may change through its saved context
+#define SIG_EFLAGS_USER 0xCD5  // CF PF AF ZF SF DF OF
+
+// Code copied into every signal frame: SYS_SIGRETURN through int 0x80
+static const uint8_t signal_trampoline[8] = {
+    0xB8, SYS_SIGRETURN, 0x00, 0x00, 0x00,  // mov eax, SYS_SIGRETURN
+    0xCD, SYSCALL_VECTOR,                   // int 0x80
+    0x90,                                   // nop
+};
+
+// Lowest-numbered signal in a set, 0 if it is empty
+static int sigset_first(sigset_t set) {
+    uint32_t low = (uint32_t)set;
+    uint32_t high = (uint32_t)(set >> 32);
+    uint32_t bit;
+
+    if (low) {
+        asm("bsf %1, %0" : "=r"(bit) : "r"(low));
+        return bit;
     }
-    pending_signals = 0;
+    if (high) {
+        asm("bsf %1, %0" : "=r"(bit) : "r"(high));
+        return bit + 32;
+    }
+    return 0;
 }
 
-// Register a signal handler
-void register_signal_handler(int signum, signal_handler_t handler) {
-    if (signum < 0 || signum >= MAX_SIGNALS) {
-        return;
+// Check whether a signal would be thrown away on arrival. Caller holds
+// the signal lock.
+static bool signal_ignored(signal_state_t* sig, int signum) {
+    if (sig->blocked & SIGMASK(signum)) return false;
+
+    signal_handler_t handler = sig->actions[signum].handler;
+    return handler == SIG_IGN ||
+           (handler == SIG_DFL && (SIG_DEFAULT_IGNORE & SIGMASK(signum)));
+}
+
+// Make a signal pending on a process. Standard signals keep one pending
+// instance; real-time signals queue every instance with its payload.
+static int signal_post(process_t* process, const siginfo_t* info) {
+    signal_state_t* sig = &process->signals;
+    int signum = info->si_signo;
+    bool resume = false;
+    bool wake = false;
+
+    sigqueue_entry_t* entry = NULL;
+    if (signum >= SIGRTMIN) {
+        entry = kmalloc(sizeof(sigqueue_entry_t));
+        if (!entry) return -1;
+        entry->info = *info;
+        entry->next = NULL;
     }
-    signal_handlers[signum] = handler ? handler : default_signal_handler;
+
+    uint32_t flags = spin_lock_irqsave(&sig->lock);
+
+    // SIGCONT cancels pending stops and resumes, and so does SIGKILL so the
+    // process can act on it; a stop cancels SIGCONT
+    if (signum == SIGCONT || signum == SIGKILL) {
+        sig->pending &= ~SIG_DEFAULT_STOP;
+        resume = sig->stopped;
+        sig->stopped = false;
+    } else if (SIG_DEFAULT_STOP & SIGMASK(signum)) {
+        sig->pending &= ~SIGMASK(SIGCONT);
+    }
+
+    if (signal_ignored(sig, signum)) {
+        spin_unlock_irqrestore(&sig->lock, flags);
+        kfree(entry);
+    } else if (entry) {
+        if (sig->queued >= SIGQUEUE_MAX) {
+            spin_unlock_irqrestore(&sig->lock, flags);
+            kfree(entry);
+            return -1;
+        }
+
+        int slot = signum - SIGRTMIN;
+        if (sig->rt_tail[slot]) {
+            sig->rt_tail[slot]->next = entry;
+        } else {
+            sig->rt_head[slot] = entry;
+        }
+        sig->rt_tail[slot] = entry;
+        sig->queued++;
+        sig->pending |= SIGMASK(signum);
+        wake = !(sig->blocked & SIGMASK(signum));
+        spin_unlock_irqrestore(&sig->lock, flags);
+    } else {
+        if (!(sig->pending & SIGMASK(signum))) {
+            sig->info[signum] = *info;
+        }
+        sig->pending |= SIGMASK(signum);
+        wake = !(sig->blocked & SIGMASK(signum));
+        spin_unlock_irqrestore(&sig->lock, flags);
+    }
+
+    if (resume) {
+        waitqueue_wake_all(&sig->cont);
+    }
+
+    // A target waiting in sys_wait() or a sleep gives up and takes the
+    // signal; other waits re-check their condition and carry on
+    if (wake) {
+        process_interrupt(process);
+    }
+    return 0;
 }
 
-// Send a signal to a process
+// Look up the user process a signal is sent to
+static process_t* signal_target(uint32_t pid, int signum) {
+    if (signum <= 0 || signum >= NSIG) return NULL;
+
+    process_t* process = process_get_by_pid(pid);
+    if (!process || (process->flags & PROCESS_FLAG_KERNEL)) return NULL;
+    return process;
+}
+
+// Send a signal to a process (kill)
 int send_signal(uint32_t pid, int signum) {
-    if (signum < 0 || signum >= MAX_SIGNALS) {
-        return -1;
+    process_t* process = signal_target(pid, signum);
+    if (!process) return -1;
+
+    process_t* current = current_process;
+    siginfo_t info = { signum, SI_USER, current ? current->pid : 0, 0 };
+    return signal_post(process, &info);
+}
+
+// Send a signal with a payload (sigqueue)
+int signal_queue(uint32_t pid, int signum, uint32_t value) {
+    process_t* process = signal_target(pid, signum);
+    if (!process) return -1;
+
+    process_t* current = current_process;
+    siginfo_t info = { signum, SI_QUEUE, current ? current->pid : 0, value };
+    return signal_post(process, &info);
+}
+
+// Raise a signal the process cannot block or ignore, e.g. for a fault.
+// A handler still runs if one is installed.
+void signal_force(process_t* process, int signum) {
+    signal_state_t* sig = &process->signals;
+
+    uint32_t flags = spin_lock_irqsave(&sig->lock);
+    sig->blocked &= ~SIGMASK(signum);
+    if (sig->actions[signum].handler == SIG_IGN) {
+        sig->actions[signum].handler = SIG_DFL;
     }
-    
-    // For now, just set the pending signal bit
-    pending_signals |= (1 << signum);
-    return 0;
+    spin_unlock_irqrestore(&sig->lock, flags);
+
+    siginfo_t info = { signum, SI_KERNEL, 0, 0 };
+    signal_post(process, &info);
+}
+
+// Check whether a process has a signal to take
+bool signal_deliverable(process_t* process) {
+    return (process->signals.pending & ~process->signals.blocked) != 0;
+}
+
+// Take one instance of a pending signal. Caller holds the signal lock;
+// a returned queue entry is freed by the caller after unlocking.
+static sigqueue_entry_t* signal_dequeue(signal_state_t* sig, int signum, siginfo_t* info) {
+    if (signum < SIGRTMIN) {
+        *info = sig->info[signum];
+        sig->pending &= ~SIGMASK(signum);
+        return NULL;
+    }
+
+    int slot = signum - SIGRTMIN;
+    sigqueue_entry_t* entry = sig->rt_head[slot];
+    *info = entry->info;
+    sig->rt_head[slot] = entry->next;
+    if (!entry->next) {
+        sig->rt_tail[slot] = NULL;
+        sig->pending &= ~SIGMASK(signum);
+    }
+    sig->queued--;
+    return entry;
+}
+
+// Push a signal frame on the user stack and point the context at the
+// handler. Fails if the stack cannot hold the frame.
+static bool signal_setup_frame(sigcontext_t* ctx, int signum, const siginfo_t* info,
+                               signal_handler_t handler, sigset_t blocked) {
+    process_t* current = current_process;
+
+    // The handler sees its arguments 16-byte aligned, as after a call
+    uint32_t addr = ((ctx->esp - sizeof(sigframe_t)) & ~0xF) - sizeof(uint32_t);
+    if (!vm_access_ok(current->vmas, addr, sizeof(sigframe_t), true)) return false;
+
+    sigframe_t* frame = (sigframe_t*)addr;
+    frame->ret = (uint32_t)frame->trampoline;
+    frame->signo = signum;
+    frame->info = (uint32_t)&frame->siginfo;
+    frame->context = (uint32_t)&frame->sigcontext;
+    frame->siginfo = *info;
+    frame->sigcontext = *ctx;
+    frame->blocked = blocked;
+    memcpy(frame->trampoline, signal_trampoline, sizeof(signal_trampoline));
+
+    ctx->eip = (uint32_t)handler;
+    ctx->esp = addr;
+    return true;
+}
+
+// Stop the calling process until SIGCONT arrives
+static void signal_stop(process_t* current) {
+    signal_state_t* sig = &current->signals;
+
+    uint32_t flags = spin_lock_irqsave(&sig->lock);
+    sig->stopped = true;
+    spin_unlock_irqrestore(&sig->lock, flags);
+
+    wait_event(sig->cont, !sig->stopped);
 }
 
-// Check and handle pending signals
-void check_pending_signals(void) {
-    // Process each pending signal
-    for (int signum = 0; signum < MAX_SIGNALS; signum++) {
-        if (pending_signals & (1 << signum)) {
-            // Clear the pending bit
-            pending_signals &= ~(1 << signum);
-            
-            // Call the handler
-            if (signal_handlers[signum]) {
-                signal_handlers[signum](signum);
+// Act on the pending signals of the current process as it returns to user
+// mode. ctx holds the registers the return restores; it is rewritten to
+// enter a handler. Default actions run here. Returns true if ctx changed.
+bool signal_deliver(sigcontext_t* ctx) {
+    process_t* current = current_process;
+    if (!current || !signal_deliverable(current)) return false;
+
+    signal_state_t* sig = &current->signals;
+    for (;;) {
+        uint32_t flags = spin_lock_irqsave(&sig->lock);
+        int signum = sigset_first(sig->pending & ~sig->blocked);
+        if (!signum) {
+            spin_unlock_irqrestore(&sig->lock, flags);
+            return false;
+        }
+
+        siginfo_t info;
+        sigqueue_entry_t* entry = signal_dequeue(sig, signum, &info);
+        sigaction_t action = sig->actions[signum];
+        sigset_t blocked = sig->blocked;
+
+        if (action.handler != SIG_DFL && action.handler != SIG_IGN) {
+            sig->blocked |= action.mask;
+            if (!(action.flags & SA_NODEFER)) {
+                sig->blocked |= SIGMASK(signum);
             }
+            sig->blocked &= ~SIG_UNBLOCKABLE;
+            if (action.flags & SA_RESETHAND) {
+                sig->actions[signum].handler = SIG_DFL;
+            }
+        }
+        spin_unlock_irqrestore(&sig->lock, flags);
+        kfree(entry);
+
+        if (action.handler == SIG_IGN) continue;
+
+        if (action.handler != SIG_DFL) {
+            if (signal_setup_frame(ctx, signum, &info, action.handler, blocked)) {
+                return true;
+            }
+            sys_exit(128 + SIGSEGV);
+        }
+
+        if (SIG_DEFAULT_IGNORE & SIGMASK(signum)) continue;
+        if (SIG_DEFAULT_STOP & SIGMASK(signum)) {
+            signal_stop(current);
+            continue;
         }
+        sys_exit(128 + signum);
     }
 }
 
-// Check if there are any pending signals
-bool has_pending_signals(void) {
-    return pending_signals != 0;
-}
-
-// Default signal handler
-void default_signal_handler(int signum) {
-    switch (signum) {
-        case SIGKILL:
-        case SIGTERM:
-            terminal_writestring("\nProcess terminated\n");
-            // TODO: Implement process termination
-            break;
-            
-        case SIGINT:
-            terminal_writestring("\nProcess interrupted\n");
-            // TODO: Implement process interruption
-            break;
-            
-        case SIGSTOP:
-            terminal_writestring("\nProcess stopped\n");
-            // TODO: Implement process stopping
-            break;
-            
-        case SIGCONT:
-            terminal_writestring("\nProcess continued\n");
-            // TODO: Implement process continuation
-            break;
-            
-        default:
-            terminal_writestring("\nUnhandled signal\n");
-            break;
+// Return from a handler: ctx arrives with the registers of the
+// SYS_SIGRETURN call and leaves with the context the frame saved
+bool signal_return(sigcontext_t* ctx) {
+    process_t* current = current_process;
+
+    // The handler's ret popped the return address off the frame
+    uint32_t addr = ctx->esp - sizeof(uint32_t);
+    if (!vm_access_ok(current->vmas, addr, sizeof(sigframe_t), false)) return false;
+
+    sigframe_t* frame = (sigframe_t*)addr;
+    sigcontext_t* saved = &frame->sigcontext;
+    uint32_t eflags = (ctx->eflags & ~SIG_EFLAGS_USER) | (saved->eflags & SIG_EFLAGS_USER);
+    *ctx = *saved;
+    ctx->eflags = eflags;
+
+    signal_state_t* sig = &current->signals;
+    uint32_t flags = spin_lock_irqsave(&sig->lock);
+    sig->blocked = frame->blocked & ~SIG_UNBLOCKABLE;
+    spin_unlock_irqrestore(&sig->lock, flags);
+    return true;
+}
+
+// Give a forked child its parent's handlers and mask but nothing pending
+void signal_fork(process_t* child) {
+    signal_state_t* sig = &child->signals;
+
+    spin_init(&sig->lock);
+    waitqueue_init(&sig->cont);
+    sig->pending = 0;
+    sig->stopped = false;
+    sig->queued = 0;
+    memset(sig->rt_head, 0, sizeof(sig->rt_head));
+    memset(sig->rt_tail, 0, sizeof(sig->rt_tail));
+}
+
+// Reset caught signals to their defaults; the new program has no handlers
+void signal_exec(process_t* process) {
+    signal_state_t* sig = &process->signals;
+
+    uint32_t flags = spin_lock_irqsave(&sig->lock);
+    for (int i = 0; i < NSIG; i++) {
+        if (sig->actions[i].handler != SIG_IGN) {
+            sig->actions[i].handler = SIG_DFL;
+        }
+        sig->actions[i].mask = 0;
+        sig->actions[i].flags = 0;
+    }
+    spin_unlock_irqrestore(&sig->lock, flags);
+}
+
+// Free the queued signals of a process being destroyed
+void signal_release(process_t* process) {
+    signal_state_t* sig = &process->signals;
+
+    for (int slot = 0; slot < NSIG - SIGRTMIN; slot++) {
+        sigqueue_entry_t* entry = sig->rt_head[slot];
+        while (entry) {
+            sigqueue_entry_t* next = entry->next;
+            kfree(entry);
+            entry = next;
+        }
+        sig->rt_head[slot] = NULL;
+        sig->rt_tail[slot] = NULL;
+    }
+    sig->queued = 0;
+    sig->pending = 0;
+}
+
+// Check a user pointer argument of the calling process; NULL is allowed
+static bool signal_user_ok(process_t* current, const void* ptr, uint32_t len, bool write) {
+    return !ptr || vm_access_ok(current->vmas, (uint32_t)ptr, len, write);
+}
+
+// Examine and change the action of a signal. The user structures are
+// copied outside the lock, which is not held across a page fault.
+int sys_sigaction(int signum, const sigaction_t* act, sigaction_t* oldact) {
+    process_t* current = current_process;
+    if (!current || signum <= 0 || signum >= NSIG) return -1;
+    if (act && (SIG_UNBLOCKABLE & SIGMASK(signum))) return -1;
+    if (!signal_user_ok(current, act, sizeof(sigaction_t), false) ||
+        !signal_user_ok(current, oldact, sizeof(sigaction_t), true)) {
+        return -EFAULT;
+    }
+
+    sigaction_t new_action, old_action;
+    if (act) {
+        new_action = *act;
     }
+
+    signal_state_t* sig = &current->signals;
+    uint32_t flags = spin_lock_irqsave(&sig->lock);
+    old_action = sig->actions[signum];
+    if (act) {
+        sig->actions[signum] = new_action;
+
+        // Setting SIG_IGN discards what is already pending
+        if (signal_ignored(sig, signum) && signum < SIGRTMIN) {
+            sig->pending &= ~SIGMASK(signum);
+        }
+    }
+    spin_unlock_irqrestore(&sig->lock, flags);
+
+    if (oldact) {
+        *oldact = old_action;
+    }
+    return 0;
+}
+
+// Examine and change the blocked signals
+int sys_sigprocmask(int how, const sigset_t* set, sigset_t* oldset) {
+    process_t* current = current_process;
+    if (!current) return -1;
+    if (!signal_user_ok(current, set, sizeof(sigset_t), false) ||
+        !signal_user_ok(current, oldset, sizeof(sigset_t), true)) {
+        return -EFAULT;
+    }
+
+    sigset_t new_set = set ? *set : 0;
+
+    signal_state_t* sig = &current->signals;
+    uint32_t flags = spin_lock_irqsave(&sig->lock);
+    sigset_t old_set = sig->blocked;
+
+    int ret = 0;
+    if (set) {
+        switch (how) {
+            case SIG_BLOCK:   sig->blocked |= new_set; break;
+            case SIG_UNBLOCK: sig->blocked &= ~new_set; break;
+            case SIG_SETMASK: sig->blocked = new_set; break;
+            default:          ret = -1; break;
+        }
+        sig->blocked &= ~SIG_UNBLOCKABLE;
+    }
+    spin_unlock_irqrestore(&sig->lock, flags);
+
+    if (oldset) {
+        *oldset = old_set;
+    }
+    return ret;
+}
+
+// Parse a decimal argument; returns -1 if it is not a number
+static int signal_parse_number(const char* s) {
+    int value = 0;
+    if (!*s) return -1;
+    for (; *s; s++) {
+        if (*s < '0' || *s > '9') return -1;
+        value = value * 10 + (*s - '0');
+    }
+    return value;
+}
+
+// Send a signal: kill <pid> [signal], SIGTERM by default
+int signal_cmd_kill(int argc, char* argv[]) {
+    int pid = argc > 1 ? signal_parse_number(argv[1]) : -1;
+    int signum = argc > 2 ? signal_parse_number(argv[2]) : SIGTERM;
+    if (pid <= 0 || signum < 0 || signum >= NSIG) {
+        kprintf("usage: kill <pid> [signal]\n");
+        return -1;
+    }
+
+    if (sys_kill(pid, signum) < 0) {
+        kprintf("kill: cannot signal process %d\n", pid);
+        return -1;
+    }
+    return 0;
 }
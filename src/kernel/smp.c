@@ -0,0 +1,206 @@
+#include "smp.h"
+#include "lapic.h"
+#include "acpi.h"
+#include "process.h"
+#include "timer.h"
+#include "terminal.h"
+#include "string.h"
+#include "kheap.h"
+#include "interrupt.h"
+#include "syscall.h"
+#include "trace.h"
+#include "prof.h"
+
+// Scheduler tick rate of the AP local APIC timers (matches the PIT on the BSP)
+#define SMP_TIMER_HZ 100
+
+// Per-CPU data
+cpu_t cpus[MAX_CPUS];
+
+// Run queue lock names shown by lockstat
+static const char* const rq_lock_names[MAX_CPUS] = {
+    "runqueue0", "runqueue1", "runqueue2", "runqueue3",
+    "runqueue4", "runqueue5", "runqueue6", "runqueue7",
+};
+static uint32_t cpu_count = 1;
+
+// AP trampoline (smp_trampoline.asm), copied to SMP_TRAMPOLINE_ADDR
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint8_t smp_trampoline_params[];
+
+// Parameter block read by the trampoline
+typedef struct {
+    uint32_t cr3;     // Kernel page directory
+    uint32_t stack;   // Initial stack pointer
+    uint32_t entry;   // 32-bit entry point
+    uint32_t arg;     // Argument passed to entry (cpu_t*)
+} __attribute__((packed)) smp_boot_params_t;
+
+// Set up the per-CPU data, GDT and TSS of a CPU
+static void cpu_setup(cpu_t* cpu, uint32_t id, uint8_t apic_id) {
+    memset(cpu, 0, sizeof(cpu_t));
+    cpu->self = cpu;
+    cpu->id = id;
+    cpu->apic_id = apic_id;
+    spin_init(&cpu->rq.lock);
+    spin_lock_stats_init(&cpu->rq.lock, &cpu->rq_lock_stats, rq_lock_names[id]);
+    tss_setup(&cpu->tss);
+    gdt_init_cpu(cpu->gdt, &cpu->gdt_ptr,
+                 (uint32_t)cpu, sizeof(cpu_t),
+                 (uint32_t)&cpu->tss, sizeof(tss_t));
+}
+
+// Local APIC timer interrupt (APs only; the BSP is driven by the PIT)
+static void smp_timer_interrupt(registers_t regs) {
+    cpu_t* cpu = this_cpu();
+    cpu->ticks++;
+    trace_event(TRACE_TICK, cpu->ticks, 0);
+    prof_tick(regs.eip, regs.ebp, (regs.cs & 0x3) == 3);
+    if (cpu->current == cpu->idle) {
+        cpu->idle_ticks++;
+    }
+    process_schedule();
+}
+
+// Reschedule IPI: another CPU queued work that should preempt ours
+static void smp_resched_interrupt(registers_t regs) {
+    (void)regs;
+    process_schedule();
+}
+
+// Idle loop: halt until an interrupt arrives, then look for work.
+// An empty local queue makes the scheduler steal from other CPUs.
+void smp_idle_loop(void) {
+    for (;;) {
+        process_yield();
+        asm volatile("sti\n"
+                     "hlt");
+    }
+}
+
+// Entry point of an application processor, called by the trampoline
+static void ap_main(cpu_t* cpu) {
+    // Switch to the per-CPU GDT, TSS and GS, and the shared IDT
+    gdt_load_cpu(&cpu->gdt_ptr);
+    interrupt_load_idt();
+    syscall_init_cpu();
+
+    // Bring up the local APIC and the idle process
+    lapic_enable();
+    process_init_ap(cpu);
+
+    cpu->online = true;
+
+    lapic_timer_init(SMP_TIMER_HZ);
+    smp_idle_loop();
+}
+
+// Set up the per-CPU data of the bootstrap processor. Must run before
+// anything touches current_process.
+void smp_bsp_init(void) {
+    cpu_setup(&cpus[0], 0, 0);
+    gdt_load_cpu(&cpus[0].gdt_ptr);
+    syscall_init_cpu();
+    cpus[0].online = true;
+}
+
+// Start the application processors listed in the ACPI MADT
+void smp_init(void) {
+    int count = acpi_get_cpu_count();
+    if (count <= 1 || !acpi_get_lapic_address()) {
+        kprintf("SMP: single processor\n");
+        return;
+    }
+
+    lapic_init(acpi_get_lapic_address());
+    lapic_enable();
+    lapic_timer_calibrate();
+    cpus[0].apic_id = lapic_id();
+
+    register_interrupt_handler(LAPIC_TIMER_VECTOR, smp_timer_interrupt);
+    register_interrupt_handler(LAPIC_RESCHED_VECTOR, smp_resched_interrupt);
+
+    // Copy the trampoline below 1MB
+    uint32_t size = (uint32_t)(smp_trampoline_end - smp_trampoline_start);
+    memcpy((void*)SMP_TRAMPOLINE_ADDR, smp_trampoline_start, size);
+    smp_boot_params_t* params = (smp_boot_params_t*)(SMP_TRAMPOLINE_ADDR +
+        (uint32_t)(smp_trampoline_params - smp_trampoline_start));
+
+
+    for (int i = 0; i < count && cpu_count < MAX_CPUS; i++) {
+        uint8_t apic_id = acpi_get_cpu_apic_id(i);
+        if (apic_id == cpus[0].apic_id) continue;
+
+        cpu_t* cpu = &cpus[cpu_count];
+        cpu_setup(cpu, cpu_count, apic_id);
+        cpu->kernel_stack = (uint32_t)kmalloc(SMP_AP_STACK_SIZE);
+        if (!cpu->kernel_stack) {
+            kprintf("SMP: failed to allocate AP stack\n");
+            break;
+        }
+
+        // APs are started one at a time, so one parameter block is enough
+        params->cr3 = get_kernel_page_directory()->physical_addr;
+        params->stack = cpu->kernel_stack + SMP_AP_STACK_SIZE;
+        params->entry = (uint32_t)ap_main;
+        params->arg = (uint32_t)cpu;
+
+        // INIT-SIPI-SIPI
+        lapic_send_init(apic_id);
+        timer_udelay(10000);
+        lapic_send_startup(apic_id, SMP_TRAMPOLINE_ADDR >> 12);
+        timer_udelay(200);
+        if (!cpu->online) {
+            lapic_send_startup(apic_id, SMP_TRAMPOLINE_ADDR >> 12);
+        }
+
+        // Give the AP up to 100ms to come online
+        for (int t = 0; t < 100 && !cpu->online; t++) {
+            timer_udelay(1000);
+        }
+
+        if (!cpu->online) {
+            kprintf("SMP: CPU with APIC ID %d did not respond\n", apic_id);
+            kfree((void*)cpu->kernel_stack);
+            continue;
+        }
+
+        cpu_count++;
+    }
+
+    kprintf("SMP: %d CPUs online\n", cpu_count);
+}
+
+// Get the number of online CPUs
+uint32_t smp_cpu_count(void) {
+    return cpu_count;
+}
+
+// Get a CPU by logical ID
+cpu_t* smp_get_cpu(uint32_t id) {
+    if (id >= cpu_count) return NULL;
+    return &cpus[id];
+}
+
+// Ask another CPU to run its scheduler
+void smp_send_reschedule(uint32_t id) {
+    if (id >= cpu_count || id == this_cpu()->id) return;
+    lapic_send_ipi(cpus[id].apic_id, LAPIC_RESCHED_VECTOR);
+}
+
+// Show per-CPU scheduler state
+int smp_cmd_cpus(int argc, char* argv[]) {
+    (void)argc;
+    (void)argv;
+
+    kprintf("CPU  APIC  QUEUED  SWITCHES  STEALS  IDLE  CURRENT\n");
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        cpu_t* cpu = &cpus[i];
+        kprintf("%d    %d     %d       %d         %d       %d     %s\n",
+                cpu->id, cpu->apic_id, cpu->rq.nr_running,
+                cpu->nr_switches, cpu->nr_steals, cpu->idle_ticks,
+                cpu->current ? cpu->current->name : "-");
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+; Application processor startup trampoline.
+; smp_init() copies this code to 0x8000 and fills in the parameter block;
+; each AP starts executing it in real mode after a STARTUP IPI.
+
+section .text
+global smp_trampoline_start
+global smp_trampoline_end
+global smp_trampoline_params
+
+%define TRAMPOLINE_BASE 0x8000
+%define REL(x) ((x) - smp_trampoline_start + TRAMPOLINE_BASE)
+
+bits 16
+smp_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [REL(tramp_gdt_ptr)]   ; Load temporary flat GDT
+
+    mov eax, cr0               ; Enter protected mode
+    or eax, 1
+    mov cr0, eax
+    jmp dword 0x08:REL(tramp_protected)
+
+bits 32
+tramp_protected:
+    mov ax, 0x10               ; Load kernel data segment
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    mov eax, cr4               ; The kernel maps itself with 4 MB pages
+    or eax, 0x10               ; CR4.PSE
+    mov cr4, eax
+    mov eax, [REL(smp_trampoline_params)]      ; Kernel page directory
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80010000         ; CR0.PG | CR0.WP
+    mov cr0, eax
+
+    mov esp, [REL(smp_trampoline_params) + 4]  ; AP stack
+    push dword [REL(smp_trampoline_params) + 12] ; Argument (cpu_t*)
+    mov eax, [REL(smp_trampoline_params) + 8]  ; Entry point
+    call eax
+
+.halt:                         ; Entry point should never return
+    cli
+    hlt
+    jmp .halt
+
+; Temporary GDT: null, kernel code, kernel data
+align 8
+tramp_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+tramp_gdt_ptr:
+    dw tramp_gdt_ptr - tramp_gdt - 1
+    dd REL(tramp_gdt)
+
+; Parameter block, filled in by smp_init()
+align 4
+smp_trampoline_params:
+    dd 0                       ; cr3
+    dd 0                       ; stack
+    dd 0                       ; entry
+    dd 0                       ; arg
+smp_trampoline_end:
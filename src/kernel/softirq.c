@@ -0,0 +1,213 @@
+#include "softirq.h"
+#include "process.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "waitqueue.h"
+#include "terminal.h"
+#include "string.h"
+
+// Softirq names, for "softirqs"
+static const char* softirq_names[NR_SOFTIRQS] = {
+    "HI", "NET_TX", "NET_RX", "BLOCK", "TASKLET"
+};
+
+// Tasklets queued on one CPU, oldest first
+typedef struct {
+    tasklet_t* head;
+    tasklet_t* tail;
+} tasklet_list_t;
+
+// Softirq state of one CPU. Only that CPU changes it, with interrupts
+// disabled.
+typedef struct {
+    volatile uint32_t pending;       // Raised softirqs, one bit each
+    tasklet_list_t hi;               // Tasklets for SOFTIRQ_HI
+    tasklet_list_t normal;           // Tasklets for SOFTIRQ_TASKLET
+    process_t* ksoftirqd;            // Runs what interrupt exit left over
+    waitqueue_t wake;                // ksoftirqd waits here
+    uint32_t runs[NR_SOFTIRQS];      // Handler invocations
+    uint32_t deferred;               // Times the rest was left to ksoftirqd
+} softirq_cpu_t;
+
+static softirq_cpu_t softirq_cpus[MAX_CPUS];
+static softirq_handler_t softirq_handlers[NR_SOFTIRQS];
+
+// Install the handler of a softirq
+void softirq_open(uint32_t nr, softirq_handler_t handler) {
+    if (nr < NR_SOFTIRQS) {
+        softirq_handlers[nr] = handler;
+    }
+}
+
+// Mark a softirq pending on the calling CPU. Raised with interrupts
+// disabled, as in an interrupt handler, it runs when the interrupt
+// returns; raised from a process, ksoftirqd runs it.
+void softirq_raise(uint32_t nr) {
+    uint32_t flags = irq_save();
+    cpu_t* cpu = this_cpu();
+    softirq_cpu_t* sc = &softirq_cpus[cpu->id];
+    sc->pending |= 1u << nr;
+    bool wake = (flags & 0x200) && !cpu->in_softirq;
+    irq_restore(flags);
+
+    if (wake && sc->ksoftirqd) {
+        waitqueue_wake_one(&sc->wake);
+    }
+}
+
+// Run the pending softirqs of the calling CPU. Called with interrupts
+// disabled on the way out of an interrupt that arrived with interrupts
+// enabled, and by ksoftirqd. Handlers run with interrupts enabled; the
+// CPU does not switch processes until they are done.
+void softirq_run(void) {
+    cpu_t* cpu = this_cpu();
+    softirq_cpu_t* sc = &softirq_cpus[cpu->id];
+    if (cpu->in_softirq || !sc->pending) return;
+
+    cpu->in_softirq = true;
+    for (int round = 0; round < SOFTIRQ_MAX_RESTART && sc->pending; round++) {
+        uint32_t pending = sc->pending;
+        sc->pending = 0;
+
+        asm volatile("sti" : : : "memory");
+        for (uint32_t nr = 0; nr < NR_SOFTIRQS; nr++) {
+            if ((pending & (1u << nr)) && softirq_handlers[nr]) {
+                softirq_handlers[nr]();
+                sc->runs[nr]++;
+            }
+        }
+        asm volatile("cli" : : : "memory");
+    }
+    cpu->in_softirq = false;
+
+    // Still busy: let ksoftirqd finish at process priority
+    if (sc->pending && sc->ksoftirqd) {
+        sc->deferred++;
+        waitqueue_wake_one(&sc->wake);
+    }
+
+    // A switch was asked for while the handlers ran
+    if (cpu->need_resched) {
+        process_schedule();
+    }
+}
+
+// Per-CPU thread running softirqs raised from process context, or left
+// over by a busy interrupt exit
+static void ksoftirqd_thread(void) {
+    softirq_cpu_t* sc = current_process->kthread_data;
+    for (;;) {
+        wait_event(sc->wake, sc->pending != 0);
+
+        uint32_t flags = irq_save();
+        softirq_run();
+        irq_restore(flags);
+    }
+}
+
+// Append a tasklet to a list. Interrupts are disabled.
+static void tasklet_enqueue(tasklet_list_t* list, tasklet_t* tasklet) {
+    tasklet->next = NULL;
+    if (list->tail) {
+        list->tail->next = tasklet;
+    } else {
+        list->head = tasklet;
+    }
+    list->tail = tasklet;
+}
+
+// Queue a tasklet on the calling CPU unless it is already queued
+static void tasklet_queue(tasklet_t* tasklet, bool hi) {
+    if (__sync_fetch_and_or(&tasklet->state, TASKLET_SCHEDULED) & TASKLET_SCHEDULED) return;
+
+    uint32_t flags = irq_save();
+    softirq_cpu_t* sc = &softirq_cpus[this_cpu()->id];
+    tasklet_enqueue(hi ? &sc->hi : &sc->normal, tasklet);
+    irq_restore(flags);
+
+    softirq_raise(hi ? SOFTIRQ_HI : SOFTIRQ_TASKLET);
+}
+
+// Set up a tasklet
+void tasklet_init(tasklet_t* tasklet, void (*func)(uint32_t data), uint32_t data) {
+    tasklet->next = NULL;
+    tasklet->state = 0;
+    tasklet->func = func;
+    tasklet->data = data;
+}
+
+// Run a tasklet soon, after the other softirqs
+void tasklet_schedule(tasklet_t* tasklet) {
+    tasklet_queue(tasklet, false);
+}
+
+// Run a tasklet soon, ahead of the other softirqs
+void tasklet_hi_schedule(tasklet_t* tasklet) {
+    tasklet_queue(tasklet, true);
+}
+
+// Run the tasklets queued on this CPU. One already running on another
+// CPU is put back and retried, so a tasklet never runs twice at once.
+static void tasklet_run_list(tasklet_list_t* list, uint32_t nr) {
+    uint32_t flags = irq_save();
+    tasklet_t* tasklet = list->head;
+    list->head = NULL;
+    list->tail = NULL;
+    irq_restore(flags);
+
+    while (tasklet) {
+        tasklet_t* next = tasklet->next;
+
+        if (__sync_fetch_and_or(&tasklet->state, TASKLET_RUNNING) & TASKLET_RUNNING) {
+            flags = irq_save();
+            tasklet_enqueue(list, tasklet);
+            irq_restore(flags);
+            softirq_raise(nr);
+        } else {
+            // Clear SCHEDULED first, so the function can queue it again
+            __sync_fetch_and_and(&tasklet->state, ~TASKLET_SCHEDULED);
+            tasklet->func(tasklet->data);
+            __sync_fetch_and_and(&tasklet->state, ~TASKLET_RUNNING);
+        }
+        tasklet = next;
+    }
+}
+
+static void tasklet_hi_action(void) {
+    tasklet_run_list(&softirq_cpus[this_cpu()->id].hi, SOFTIRQ_HI);
+}
+
+static void tasklet_action(void) {
+    tasklet_run_list(&softirq_cpus[this_cpu()->id].normal, SOFTIRQ_TASKLET);
+}
+
+// Install the tasklet softirqs and start ksoftirqd on every CPU
+void softirq_init(void) {
+    softirq_open(SOFTIRQ_HI, tasklet_hi_action);
+    softirq_open(SOFTIRQ_TASKLET, tasklet_action);
+
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        softirq_cpu_t* sc = &softirq_cpus[i];
+        waitqueue_init(&sc->wake);
+
+        char name[MAX_PROCESS_NAME] = "ksoftirqd/";
+        name[10] = '0' + i;
+        sc->ksoftirqd = kthread_create_on(name, ksoftirqd_thread, i, sc);
+    }
+}
+
+// Show how often each softirq ran on each CPU
+int softirq_cmd_softirqs(int argc, char* argv[]) {
+    (void)argc;
+    (void)argv;
+
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        softirq_cpu_t* sc = &softirq_cpus[i];
+        kprintf("CPU %u:", i);
+        for (uint32_t nr = 0; nr < NR_SOFTIRQS; nr++) {
+            kprintf(" %s %u", softirq_names[nr], sc->runs[nr]);
+        }
+        kprintf(", %u deferred to ksoftirqd\n", sc->deferred);
+    }
+    return 0;
+}
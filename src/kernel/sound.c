@@ -2,6 +2,8 @@
 #include "memory.h"
 #include "string.h"
 #include "kheap.h"
+#include "process.h"
+#include "terminal.h"
 
 // Sound globals
 static sound_device_t* current_device = NULL;
@@ -47,6 +49,34 @@ void sound_update(void) {
     sound_mix_buffers(mix_buffer, DEFAULT_BUFFER_SIZE / 4); // Assuming stereo 16-bit
 }
 
+// Mixer thread: mix once per period, then sleep until the next one. On
+// the FIFO fallback there is no period to wait for, and yielding would
+// just pick the mixer again, so it sleeps on the timer instead.
+static void sound_mixer_thread(void) {
+    for (;;) {
+        sound_update();
+        if (current_process->sched_class == &dl_sched_class) {
+            sched_dl_yield();
+        } else {
+            sleep(SOUND_MIXER_PERIOD_US / 1000);
+        }
+    }
+}
+
+// Start the mixer as a real-time kernel thread so busy processes
+// cannot delay it
+void sound_start_mixer(void) {
+    process_t* mixer = kthread_create("sound_mixer", sound_mixer_thread);
+    if (!mixer) {
+        kprintf("Failed to start sound mixer\n");
+        return;
+    }
+
+    if (sched_set_deadline(mixer, SOUND_MIXER_RUNTIME_US, SOUND_MIXER_PERIOD_US) != 0) {
+        sched_set_fifo(mixer, SOUND_MIXER_FIFO_PRIO);
+    }
+}
+
 // Register a sound device
 int sound_device_register(sound_device_t* device) {
     if (!device) return -1;
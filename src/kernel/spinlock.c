@@ -0,0 +1,66 @@
+#include "spinlock.h"
+#include <stdbool.h>
+#include "terminal.h"
+#include "string.h"
+
+// Locks with statistics, newest first
+static lock_stats_t* lock_stats_list = NULL;
+static spinlock_t lock_stats_lock = SPINLOCK_INIT;
+
+// Attach statistics to a spinlock and list it in lockstat
+void spin_lock_stats_init(spinlock_t* lock, lock_stats_t* stats, const char* name) {
+    memset(stats, 0, sizeof(lock_stats_t));
+    stats->name = name;
+
+    uint32_t flags = spin_lock_irqsave(&lock_stats_lock);
+    stats->next = lock_stats_list;
+    lock_stats_list = stats;
+    spin_unlock_irqrestore(&lock_stats_lock, flags);
+
+    lock->stats = stats;
+}
+
+// Attach statistics to a reader-writer lock. Readers count as
+// acquisitions; the hold time is that of writers.
+void rwlock_stats_init(rwlock_t* rw, lock_stats_t* stats, const char* name) {
+    spin_lock_stats_init(&rw->lock, stats, name);
+}
+
+// Saturate a cycle count to 32 bits for printing
+static uint32_t lockstat_cycles(uint64_t cycles) {
+    return cycles > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)cycles;
+}
+
+// Show lock contention statistics; "lockstat reset" clears them
+int spin_cmd_lockstat(int argc, char* argv[]) {
+    bool reset = argc > 1 && strcmp(argv[1], "reset") == 0;
+
+    if (!reset) {
+        kprintf("LOCK              ACQUIRED    CONTENDED  SPINS       MAX HOLD (cycles/us)\n");
+    }
+
+    uint32_t flags = spin_lock_irqsave(&lock_stats_lock);
+    for (lock_stats_t* stats = lock_stats_list; stats; stats = stats->next) {
+        if (reset) {
+            stats->acquisitions = 0;
+            stats->contended = 0;
+            stats->spins = 0;
+            stats->max_hold = 0;
+            continue;
+        }
+
+        kprintf("%s", stats->name);
+        for (int pad = strlen(stats->name); pad < 18; pad++) {
+            kprintf(" ");
+        }
+        kprintf("%u  %u  %u  %u/%u\n",
+                stats->acquisitions, stats->contended, stats->spins,
+                lockstat_cycles(stats->max_hold), tsc_to_us(stats->max_hold));
+    }
+    spin_unlock_irqrestore(&lock_stats_lock, flags);
+
+    if (reset) {
+        kprintf("Lock statistics cleared\n");
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+; Kernel context switch.
+
+section .text
+global switch_to
+
+; void switch_to(uint32_t* prev_esp, uint32_t next_esp)
+; Push the callee-saved registers and EFLAGS on the outgoing process's
+; kernel stack, store its stack pointer in *prev_esp, then pop the same
+; frame off next_esp and return into whatever call saved it. A process
+; that has never run has a frame built by process_init_frame().
+switch_to:
+    mov eax, [esp + 4]  ; prev_esp
+    mov edx, [esp + 8]  ; next_esp
+
+    push ebp
+    push ebx
+    push esi
+    push edi
+    pushfd
+    mov [eax], esp
+
+    mov esp, edx
+    popfd
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
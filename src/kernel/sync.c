@@ -0,0 +1,89 @@
+#include "sync.h"
+#include "process.h"
+
+// Initialize a mutex
+void mutex_init(mutex_t* mutex) {
+    mutex->locked = 0;
+    mutex->owner = NULL;
+    waitqueue_init(&mutex->waiters);
+}
+
+// Take the mutex without blocking
+bool mutex_trylock(mutex_t* mutex) {
+    if (__sync_lock_test_and_set(&mutex->locked, 1)) return false;
+    mutex->owner = current_process;
+    return true;
+}
+
+// Take the mutex, sleeping while another process holds it
+void mutex_lock(mutex_t* mutex) {
+    wait_event(mutex->waiters, mutex_trylock(mutex));
+}
+
+// Release the mutex and hand the chance to take it to one waiter
+void mutex_unlock(mutex_t* mutex) {
+    mutex->owner = NULL;
+    __sync_lock_release(&mutex->locked);
+    waitqueue_wake_one(&mutex->waiters);
+}
+
+// Initialize a semaphore
+void semaphore_init(semaphore_t* sem, int32_t count) {
+    sem->count = count;
+    waitqueue_init(&sem->waiters);
+}
+
+// Decrement the count if it is positive
+bool semaphore_trydown(semaphore_t* sem) {
+    int32_t count = sem->count;
+    while (count > 0) {
+        int32_t seen = __sync_val_compare_and_swap(&sem->count, count, count - 1);
+        if (seen == count) return true;
+        count = seen;
+    }
+    return false;
+}
+
+// Decrement the count, sleeping until it is positive
+void semaphore_down(semaphore_t* sem) {
+    wait_event(sem->waiters, semaphore_trydown(sem));
+}
+
+// Like semaphore_down, but give up after a number of ticks
+bool semaphore_down_timeout(semaphore_t* sem, uint32_t ticks) {
+    return wait_event_timeout(sem->waiters, semaphore_trydown(sem), ticks);
+}
+
+// Increment the count and wake one waiter. Safe from interrupt handlers.
+void semaphore_up(semaphore_t* sem) {
+    __sync_fetch_and_add(&sem->count, 1);
+    waitqueue_wake_one(&sem->waiters);
+}
+
+// Initialize a condition variable
+void condvar_init(condvar_t* cv) {
+    waitqueue_init(&cv->waiters);
+}
+
+// Release the mutex and sleep until signalled, then retake the mutex.
+// Queueing before the unlock means a signal sent in between is not lost.
+// Callers re-check their predicate in a loop.
+void condvar_wait(condvar_t* cv, mutex_t* mutex) {
+    wait_entry_t entry;
+
+    waitqueue_prepare(&cv->waiters, &entry);
+    mutex_unlock(mutex);
+    waitqueue_sleep(0);
+    waitqueue_finish(&cv->waiters, &entry);
+    mutex_lock(mutex);
+}
+
+// Wake one waiter
+void condvar_signal(condvar_t* cv) {
+    waitqueue_wake_one(&cv->waiters);
+}
+
+// Wake all waiters
+void condvar_broadcast(condvar_t* cv) {
+    waitqueue_wake_all(&cv->waiters);
+}
@@ -0,0 +1,466 @@
+#include "syscall.h"
+#include "process.h"
+#include "terminal.h"
+#include "string.h"
+#include "tsc.h"
+#include "smp.h"
+#include "signal.h"
+#include "trace.h"
+#include "vm.h"
+#include "elf.h"
+
+// Entry stubs (syscall_asm.asm)
+extern void syscall_sysenter_entry(void);
+
+// Default number of calls per path in syscallbench, and the program it
+// writes to make them from user mode
+#define SYSCALL_BENCH_ITERATIONS 100000
+#define SYSCALL_BENCH_PATH "/bin/nullcall"
+
+// Set once the BSP finds SYSENTER support
+static bool sysenter_supported = false;
+
+// Per-syscall statistics, updated atomically from every CPU
+static syscall_stats_t syscall_stats[NR_SYSCALLS];
+
+// Check that a user range lies inside the caller's address space
+static bool syscall_user_ok(uint32_t address, uint32_t len, bool write) {
+    process_t* current = current_process;
+    return current && vm_access_ok(current->vmas, address, len, write);
+}
+
+// Check a user string
+static bool syscall_user_string_ok(uint32_t str) {
+    process_t* current = current_process;
+    return current && vm_string_ok(current->vmas, str, EXEC_ARG_MAX) >= 0;
+}
+
+// Check a NULL-terminated user vector of strings; NULL itself is allowed
+static bool syscall_user_vector_ok(uint32_t vec) {
+    for (; vec; vec += sizeof(uint32_t)) {
+        if (!syscall_user_ok(vec, sizeof(uint32_t), false)) return false;
+        uint32_t str = *(uint32_t*)vec;
+        if (!str) break;
+        if (!syscall_user_string_ok(str)) return false;
+    }
+    return true;
+}
+
+// Handlers adapting the sys_* functions to the register convention. Every
+// pointer argument is checked against the caller's areas before the kernel
+// touches it.
+static int syscall_null(uint32_t a1, uint32_t a2, uint32_t a3) {
+    (void)a1; (void)a2; (void)a3;
+    return 0;
+}
+
+static int syscall_exit(uint32_t status, uint32_t a2, uint32_t a3) {
+    (void)a2; (void)a3;
+    sys_exit((int)status);
+    return 0;
+}
+
+// fork needs the caller's frame, so syscall_dispatch() calls sys_fork()
+// itself; the table entry only marks the call as valid
+static int syscall_fork(uint32_t a1, uint32_t a2, uint32_t a3) {
+    (void)a1; (void)a2; (void)a3;
+    return sys_fork(NULL);
+}
+
+static int syscall_wait(uint32_t status, uint32_t a2, uint32_t a3) {
+    (void)a2; (void)a3;
+    if (status && !syscall_user_ok(status, sizeof(int), true)) return -EFAULT;
+    return sys_wait((int*)status);
+}
+
+static int syscall_getpid(uint32_t a1, uint32_t a2, uint32_t a3) {
+    (void)a1; (void)a2; (void)a3;
+    return sys_getpid();
+}
+
+static int syscall_kill(uint32_t pid, uint32_t sig, uint32_t a3) {
+    (void)a3;
+    return sys_kill((int)pid, (int)sig);
+}
+
+static int syscall_exec(uint32_t path, uint32_t argv, uint32_t envp) {
+    if (!syscall_user_string_ok(path) || !syscall_user_vector_ok(argv) ||
+        !syscall_user_vector_ok(envp)) {
+        return -EFAULT;
+    }
+    return sys_exec((const char*)path, (char* const*)argv, (char* const*)envp);
+}
+
+static int syscall_spawn(uint32_t path, uint32_t argv, uint32_t envp) {
+    if (!syscall_user_string_ok(path) || !syscall_user_vector_ok(argv) ||
+        !syscall_user_vector_ok(envp)) {
+        return -EFAULT;
+    }
+    return sys_spawn((const char*)path, (char* const*)argv, (char* const*)envp);
+}
+
+// Placeholder: syscall_dispatch handles SYS_SIGRETURN, which needs the frame
+static int syscall_sigreturn(uint32_t a1, uint32_t a2, uint32_t a3) {
+    (void)a1; (void)a2; (void)a3;
+    return -1;
+}
+
+static int syscall_sigaction(uint32_t sig, uint32_t act, uint32_t oldact) {
+    return sys_sigaction((int)sig, (const sigaction_t*)act, (sigaction_t*)oldact);
+}
+
+static int syscall_sigprocmask(uint32_t how, uint32_t set, uint32_t oldset) {
+    return sys_sigprocmask((int)how, (const sigset_t*)set, (sigset_t*)oldset);
+}
+
+static int syscall_sigqueue(uint32_t pid, uint32_t sig, uint32_t value) {
+    return signal_queue(pid, (int)sig, value);
+}
+
+static int syscall_sleep(uint32_t ticks, uint32_t a2, uint32_t a3) {
+    (void)a2; (void)a3;
+    return process_sleep(ticks);
+}
+
+static int syscall_yield(uint32_t a1, uint32_t a2, uint32_t a3) {
+    (void)a1; (void)a2; (void)a3;
+    process_yield();
+    return 0;
+}
+
+// Dispatch table, indexed by system call number
+static const syscall_fn_t syscall_table[NR_SYSCALLS] = {
+    [SYS_NULL]   = syscall_null,
+    [SYS_EXIT]   = syscall_exit,
+    [SYS_FORK]   = syscall_fork,
+    [SYS_WAIT]   = syscall_wait,
+    [SYS_GETPID] = syscall_getpid,
+    [SYS_KILL]   = syscall_kill,
+    [SYS_EXEC]   = syscall_exec,
+    [SYS_SLEEP]  = syscall_sleep,
+    [SYS_YIELD]  = syscall_yield,
+    [SYS_SPAWN]  = syscall_spawn,
+    [SYS_SIGRETURN]   = syscall_sigreturn,
+    [SYS_SIGACTION]   = syscall_sigaction,
+    [SYS_SIGPROCMASK] = syscall_sigprocmask,
+    [SYS_SIGQUEUE]    = syscall_sigqueue,
+};
+
+static const char* const syscall_names[NR_SYSCALLS] = {
+    [SYS_NULL]   = "null",
+    [SYS_EXIT]   = "exit",
+    [SYS_FORK]   = "fork",
+    [SYS_WAIT]   = "wait",
+    [SYS_GETPID] = "getpid",
+    [SYS_KILL]   = "kill",
+    [SYS_EXEC]   = "exec",
+    [SYS_SLEEP]  = "sleep",
+    [SYS_YIELD]  = "yield",
+    [SYS_SPAWN]  = "spawn",
+    [SYS_SIGRETURN]   = "sigreturn",
+    [SYS_SIGACTION]   = "sigaction",
+    [SYS_SIGPROCMASK] = "sigprocmask",
+    [SYS_SIGQUEUE]    = "sigqueue",
+};
+
+// Write a model-specific register
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+// Check whether the CPU supports SYSENTER/SYSEXIT
+bool syscall_has_sysenter(void) {
+    return sysenter_supported;
+}
+
+// Point the calling CPU's SYSENTER MSRs at the kernel. Runs on every CPU.
+void syscall_init_cpu(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+
+    // SEP is unreliable on family 6 models before 3 (Pentium Pro)
+    uint32_t family = (eax >> 8) & 0xF;
+    uint32_t model = (eax >> 4) & 0xF;
+    if (!(edx & (1 << 11)) || (family == 6 && model < 3)) return;
+
+    wrmsr(MSR_SYSENTER_CS, GDT_CODE_SEGMENT);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)&this_cpu()->tss.esp0);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)syscall_sysenter_entry);
+    sysenter_supported = true;
+}
+
+// Log2 histogram bucket of a cycle count
+static uint32_t syscall_hist_bucket(uint64_t cycles) {
+    if (cycles >> 32) return SYSCALL_HIST_BUCKETS - 1;
+
+    uint32_t low = (uint32_t)cycles | 1;
+    uint32_t bucket;
+    asm("bsr %1, %0" : "=r"(bucket) : "r"(low));
+    return bucket < SYSCALL_HIST_BUCKETS ? bucket : SYSCALL_HIST_BUCKETS - 1;
+}
+
+// Find the user return state saved above a frame: the SYSENTER return EIP
+// and ESP, or the int 0x80 iret frame when the CPU came from ring 3.
+// Kernel callers of int 0x80 have none.
+static bool syscall_user_return(syscall_frame_t* frame, uint32_t** ret, bool* sysenter) {
+    uint32_t* above = (uint32_t*)(frame + 1);
+    *ret = above;
+    *sysenter = frame->entry == SYSCALL_ENTRY_SYSENTER;
+    return *sysenter || (above[1] & 0x3) == 3;
+}
+
+// SYSEXIT loads the return EIP and ESP as they are; both came from the
+// caller's registers or its signal frame, so they must be user addresses
+static bool syscall_sysexit_ok(syscall_frame_t* frame) {
+    uint32_t* ret = (uint32_t*)(frame + 1);
+    return ret[0] >= USER_SPACE_START && ret[0] < USER_SPACE_END &&
+           ret[1] >= USER_SPACE_START && ret[1] <= USER_SPACE_END;
+}
+
+// Gather the registers a system call returns to user mode with
+static bool syscall_user_context(syscall_frame_t* frame, sigcontext_t* ctx) {
+    uint32_t* ret;
+    bool sysenter;
+    if (!syscall_user_return(frame, &ret, &sysenter)) return false;
+
+    ctx->edi = frame->edi;
+    ctx->esi = frame->esi;
+    ctx->ebp = frame->ebp;
+    ctx->ebx = frame->ebx;
+    ctx->edx = frame->edx;
+    ctx->ecx = frame->ecx;
+    ctx->eax = frame->eax;
+    if (sysenter) {
+        ctx->eip = ret[0];
+        ctx->eflags = 0x202;
+        ctx->esp = ret[1];
+    } else {
+        ctx->eip = ret[0];
+        ctx->eflags = ret[2];
+        ctx->esp = ret[3];
+    }
+    return true;
+}
+
+// Make a system call return to user mode with the given registers.
+// SYSEXIT cannot restore EFLAGS, ECX or EDX; int 0x80 restores all.
+static void syscall_set_user_context(syscall_frame_t* frame, const sigcontext_t* ctx) {
+    uint32_t* ret;
+    bool sysenter;
+    if (!syscall_user_return(frame, &ret, &sysenter)) return;
+
+    frame->edi = ctx->edi;
+    frame->esi = ctx->esi;
+    frame->ebp = ctx->ebp;
+    frame->ebx = ctx->ebx;
+    frame->edx = ctx->edx;
+    frame->ecx = ctx->ecx;
+    frame->eax = ctx->eax;
+    if (sysenter) {
+        ret[0] = ctx->eip;
+        ret[1] = ctx->esp;
+    } else {
+        ret[0] = ctx->eip;
+        ret[2] = ctx->eflags;
+        ret[3] = ctx->esp;
+    }
+}
+
+// Return from a signal handler to the context its frame saved
+static void syscall_sigreturn_frame(syscall_frame_t* frame) {
+    sigcontext_t ctx;
+    if (!syscall_user_context(frame, &ctx)) {
+        frame->eax = (uint32_t)-1;
+        return;
+    }
+    if (!signal_return(&ctx)) {
+        sys_exit(128 + SIGSEGV);
+    }
+    syscall_set_user_context(frame, &ctx);
+}
+
+// Common system call handler, called by both entry stubs
+void syscall_dispatch(syscall_frame_t* frame) {
+    uint32_t num = frame->eax;
+    if (num >= NR_SYSCALLS || !syscall_table[num]) {
+        frame->eax = (uint32_t)-1;
+        return;
+    }
+
+    // Kernel threads call in too; only user callers change mode
+    process_t* current = current_process;
+    uint32_t* ret;
+    bool sysenter;
+    bool from_user = syscall_user_return(frame, &ret, &sysenter);
+    if (current) {
+        current->acct.syscalls++;
+        if (from_user) {
+            acct_kernel_enter(&current->acct);
+        }
+    }
+
+    trace_event(TRACE_SYSCALL_ENTRY, num, frame->ebx);
+    uint64_t start = rdtsc();
+    if (num == SYS_SIGRETURN) {
+        syscall_sigreturn_frame(frame);
+    } else if (num == SYS_FORK) {
+        // The child leaves the kernel through a copy of this frame, so it
+        // must be one fit to return through
+        bool ok = from_user &&
+                  (frame->entry != SYSCALL_ENTRY_SYSENTER || syscall_sysexit_ok(frame));
+        frame->eax = (uint32_t)sys_fork(ok ? frame : NULL);
+    } else {
+        frame->eax = (uint32_t)syscall_table[num](frame->ebx, frame->esi, frame->edi);
+    }
+    uint64_t cycles = rdtsc() - start;
+    trace_event(TRACE_SYSCALL_EXIT, num, frame->eax);
+
+    syscall_stats_t* stats = &syscall_stats[num];
+    __sync_fetch_and_add(&stats->count, 1);
+    __sync_fetch_and_add(&stats->total_cycles, cycles);
+    __sync_fetch_and_add(&stats->hist[syscall_hist_bucket(cycles)], 1);
+
+    // Signals are taken on the way back to user mode
+    sigcontext_t ctx;
+    if (current && signal_deliverable(current) && syscall_user_context(frame, &ctx) &&
+        signal_deliver(&ctx)) {
+        syscall_set_user_context(frame, &ctx);
+    }
+
+    if (frame->entry == SYSCALL_ENTRY_SYSENTER && !syscall_sysexit_ok(frame)) {
+        sys_exit(128 + SIGSEGV);
+    }
+
+    if (current && from_user) {
+        acct_kernel_exit(&current->acct);
+    }
+}
+
+// Show per-syscall counts and latency histograms; "syscalls reset" clears them
+int syscall_cmd_syscalls(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        memset(syscall_stats, 0, sizeof(syscall_stats));
+        kprintf("System call statistics cleared\n");
+        return 0;
+    }
+
+    kprintf("Entry: %s\n", sysenter_supported ? "sysenter, int 0x80" : "int 0x80");
+    for (int i = 0; i < NR_SYSCALLS; i++) {
+        syscall_stats_t* stats = &syscall_stats[i];
+        if (!stats->count) continue;
+
+        kprintf("%s: %u calls, %u us total\n", syscall_names[i], stats->count,
+                tsc_to_us(stats->total_cycles));
+        for (int b = 0; b < SYSCALL_HIST_BUCKETS; b++) {
+            if (stats->hist[b]) {
+                kprintf("  >= %u cycles: %u\n", 1u << b, stats->hist[b]);
+            }
+        }
+    }
+    return 0;
+}
+
+// Write the benchmark program for one entry path. It makes iterations
+// SYS_NULL calls between two RDTSC reads and exits with the cycles per
+// call; SYSEXIT only returns to ring 3, so this has to run in user mode.
+static bool syscall_bench_install(uint32_t iterations, bool sysenter) {
+    static const uint8_t head[] = {
+        0xBE, 0x00, 0x00, 0x00, 0x00,      // mov esi, iterations
+        0x0F, 0x31,                        // rdtsc
+        0x89, 0xC7,                        // mov edi, eax
+        0x89, 0xD5,                        // mov ebp, edx
+    };
+    static const uint8_t call_int80[] = {
+        0xB8, SYS_NULL, 0x00, 0x00, 0x00,  // mov eax, SYS_NULL
+        0xCD, SYSCALL_VECTOR,              // int 0x80
+    };
+    static const uint8_t call_sysenter[] = {
+        0xB8, SYS_NULL, 0x00, 0x00, 0x00,  // mov eax, SYS_NULL
+        0x89, 0xE1,                        // mov ecx, esp
+        0xBA, 0x00, 0x00, 0x00, 0x00,      // mov edx, return address
+        0x0F, 0x34,                        // sysenter
+    };
+    static const uint8_t tail[] = {
+        0x4E,                              // dec esi
+        0x75, 0x00,                        // jnz back to the call
+        0x0F, 0x31,                        // rdtsc
+        0x29, 0xF8,                        // sub eax, edi
+        0x19, 0xEA,                        // sbb edx, ebp
+        0xB9, 0x00, 0x00, 0x00, 0x00,      // mov ecx, iterations
+        0xF7, 0xF1,                        // div ecx
+        0x89, 0xC3,                        // mov ebx, eax
+        0xB8, SYS_EXIT, 0x00, 0x00, 0x00,  // mov eax, SYS_EXIT
+        0xCD, SYSCALL_VECTOR,              // int 0x80
+        0xEB, 0xFE,                        // jmp $
+    };
+
+    const uint8_t* call = sysenter ? call_sysenter : call_int80;
+    uint32_t call_size = sysenter ? sizeof(call_sysenter) : sizeof(call_int80);
+    uint32_t loop = sizeof(head);
+    uint32_t back = loop + call_size;
+
+    uint8_t code[sizeof(head) + sizeof(call_sysenter) + sizeof(tail)];
+    memcpy(code, head, sizeof(head));
+    memcpy(code + loop, call, call_size);
+    memcpy(code + back, tail, sizeof(tail));
+
+    memcpy(code + 1, &iterations, sizeof(uint32_t));
+    memcpy(code + back + 10, &iterations, sizeof(uint32_t));
+    code[back + 2] = (uint8_t)-(int8_t)(call_size + 3);
+    if (sysenter) {
+        uint32_t ret = ELF_FLAT_ENTRY + back;
+        memcpy(code + loop + 8, &ret, sizeof(uint32_t));
+    }
+    return elf_install_flat(SYSCALL_BENCH_PATH, code, back + sizeof(tail));
+}
+
+// Time null calls through one entry path from user mode; returns the
+// cycles per call, or -1
+static int syscall_bench_run(uint32_t iterations, bool sysenter) {
+    int status;
+    if (!syscall_bench_install(iterations, sysenter) ||
+        elf_run(SYSCALL_BENCH_PATH, &status) < 0) {
+        return -1;
+    }
+    return status;
+}
+
+// Compare null system call round trips from user mode through int 0x80
+// and SYSENTER
+int syscall_cmd_syscallbench(int argc, char* argv[]) {
+    uint32_t iterations = SYSCALL_BENCH_ITERATIONS;
+    if (argc > 1) {
+        iterations = 0;
+        for (const char* p = argv[1]; *p >= '0' && *p <= '9'; p++) {
+            iterations = iterations * 10 + (*p - '0');
+        }
+        if (!iterations) {
+            kprintf("usage: syscallbench [iterations]\n");
+            return -1;
+        }
+    }
+
+    int int80 = syscall_bench_run(iterations, false);
+    if (int80 < 0) {
+        kprintf("syscallbench: cannot run %s\n", SYSCALL_BENCH_PATH);
+        return -1;
+    }
+    kprintf("%u null calls from user mode\n", iterations);
+    kprintf("int 0x80: %u cycles/call\n", int80);
+
+    if (!sysenter_supported) {
+        kprintf("sysenter: not supported by this CPU\n");
+        return 0;
+    }
+    int sysenter = syscall_bench_run(iterations, true);
+    if (sysenter < 0) {
+        kprintf("syscallbench: cannot run %s\n", SYSCALL_BENCH_PATH);
+        return -1;
+    }
+    kprintf("sysenter: %u cycles/call\n", sysenter);
+    if (sysenter) {
+        kprintf("int 0x80 / sysenter: %u.%02u\n", int80 / sysenter,
+                (int80 % sysenter) * 100 / sysenter);
+    }
+    return 0;
+}
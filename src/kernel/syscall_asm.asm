@@ -0,0 +1,103 @@
+; System call entry points.
+; Both stubs save the same frame (syscall_frame_t), tagged with the entry
+; path, and call syscall_dispatch(frame), which leaves the result in the
+; saved EAX.
+
+section .text
+global syscall_int80_entry
+global syscall_sysenter_entry
+global syscall_fork_return
+extern syscall_dispatch
+extern process_switch_finish
+
+SYSCALL_ENTRY_INT80    equ 0
+SYSCALL_ENTRY_SYSENTER equ 1
+
+; Save the caller's registers and the entry path, and switch to kernel
+; segments
+%macro SYSCALL_SAVE 1
+    push ebp
+    push edi
+    push esi
+    push edx
+    push ecx
+    push ebx
+    push eax
+    push ds
+    push es
+    push fs
+    push gs
+    push dword %1
+
+    mov ax, 0x10        ; Load kernel data segment
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov ax, 0x30        ; Load per-CPU data segment
+    mov gs, ax
+%endmacro
+
+; Restore the caller's registers; EAX holds the result. ECX and EDX only
+; matter to int 0x80 callers: SYSENTER returns through them.
+%macro SYSCALL_RESTORE 0
+    add esp, 4          ; Entry path
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    pop eax
+    pop ebx
+    pop ecx
+    pop edx
+    pop esi
+    pop edi
+    pop ebp
+%endmacro
+
+; int 0x80, through a DPL 3 trap gate (interrupts stay enabled)
+syscall_int80_entry:
+    SYSCALL_SAVE SYSCALL_ENTRY_INT80
+    push esp            ; syscall_frame_t*
+    call syscall_dispatch
+    add esp, 4
+    SYSCALL_RESTORE
+    iret
+
+; SYSENTER, from user mode only. The CPU loads ESP from MSR_SYSENTER_ESP,
+; which points at this CPU's tss.esp0: the kernel stack of the current
+; process. ECX and EDX are whatever the caller left there, so they are only
+; saved as its return stack and address; syscall_dispatch checks them
+; before SYSEXIT loads them in ring 3.
+syscall_sysenter_entry:
+    mov esp, [esp]      ; Switch to the kernel stack
+    push ecx            ; Return stack pointer
+    push edx            ; Return address
+    SYSCALL_SAVE SYSCALL_ENTRY_SYSENTER
+    sti                 ; SYSENTER clears IF
+
+    push esp            ; syscall_frame_t*
+    call syscall_dispatch
+    add esp, 4
+
+    cli
+    SYSCALL_RESTORE
+    pop edx
+    pop ecx
+    sti                 ; Takes effect after SYSEXIT
+    sysexit
+
+; A forked child starts here, returned into by switch_to() with interrupts
+; off and ESP at its copy of the parent's frame, whose EAX is 0. It leaves
+; the kernel the way the parent entered it.
+syscall_fork_return:
+    call process_switch_finish
+    cmp dword [esp], SYSCALL_ENTRY_SYSENTER
+    je .sysenter
+    SYSCALL_RESTORE
+    iret
+.sysenter:
+    SYSCALL_RESTORE
+    pop edx
+    pop ecx
+    sti                 ; Takes effect after SYSEXIT
+    sysexit
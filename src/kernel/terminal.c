@@ -136,12 +136,8 @@ void terminal_writedec(uint32_t value) {
 }
 
 char terminal_getchar(void) {
-    // Wait for a key from the keyboard buffer
-    while (keyboard_buffer_empty()) {
-        // Sleep or yield to other processes
-        process_yield();
-    }
-    return keyboard_getchar();
+    // Sleep until the keyboard interrupt queues a key
+    return keyboard_wait_char();
 }
 
 int kvprintf(const char* format, va_list args) {
@@ -188,6 +184,15 @@ int kvprintf(const char* format, va_list args) {
                 } while (temp > 0);
                 break;
             }
+            case 'u': {
+                uint32_t num = va_arg(args, uint32_t);
+                terminal_writedec(num);
+                do {
+                    written++;
+                    num /= 10;
+                } while (num > 0);
+                break;
+            }
             case 'x': {
                 uint32_t num = va_arg(args, uint32_t);
                 terminal_writehex(num);
@@ -35,7 +35,7 @@ void test_process_management(void) {
     
     // Test 2: Fork test
     terminal_writestring("Test 2: Testing fork\n");
-    int child_pid = sys_fork();
+    int child_pid = sys_fork(NULL);  // Kernel-mode callers cannot fork
     if (child_pid < 0) {
         terminal_writestring("Fork failed\n");
     } else if (child_pid == 0) {
@@ -2,20 +2,30 @@
 #include "io.h"
 #include "isr.h"
 #include "process.h"
+#include "tsc.h"
+#include "hal.h"
+#include "trace.h"
 
 // Timer variables
 static uint32_t tick = 0;
 static uint32_t frequency = 0;
 
+// TSC frequency in MHz; a conservative guess until tsc_calibrate() runs
+uint32_t tsc_mhz = 1000;
+
+// Advance the system tick, wake sleepers and run the scheduler.
+// Called on the BSP from IRQ0 after the interrupt has been acknowledged.
+void timer_tick(void) {
+    tick++;
+    trace_event(TRACE_TICK, tick, 0);
+    scheduler_wake_sleepers();
+    process_schedule();
+}
+
 // Timer callback
 static void timer_callback(registers_t* regs) {
-    tick++;
-    
-    // Acknowledge interrupt
-    hal_pic_eoi(0);
-    
     // Schedule next process if needed
-    process_schedule();
+    timer_tick();
 }
 
 // Initialize timer
@@ -38,6 +48,12 @@ void timer_init(uint32_t freq) {
 
 // Wait for specified number of ticks
 void timer_wait(uint32_t ticks) {
+    // Once processes exist, sleep instead of holding the CPU
+    if (current_process) {
+        process_sleep(ticks);
+        return;
+    }
+
     uint32_t end_tick = tick + ticks;
     while (tick < end_tick) {
         asm volatile("hlt");
@@ -49,6 +65,47 @@ uint32_t get_timer_ticks(void) {
     return tick;
 }
 
+// Busy-wait for the given number of microseconds using PIT channel 2.
+// Does not depend on IRQ0, so it works with interrupts disabled and on
+// application processors during bring-up.
+void timer_udelay(uint32_t us) {
+    while (us > 0) {
+        // The 16-bit counter covers at most ~54ms per pass
+        uint32_t chunk = us > 50000 ? 50000 : us;
+        uint32_t count = (1193 * chunk) / 1000;
+        if (count == 0) count = 1;
+
+        // Gate channel 2 off and disconnect the speaker
+        outb(0x61, inb(0x61) & ~0x03);
+
+        // Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count)
+        outb(0x43, 0xB0);
+        outb(0x42, (uint8_t)(count & 0xFF));
+        outb(0x42, (uint8_t)((count >> 8) & 0xFF));
+
+        // Raise the gate to start counting and wait for OUT2 to go high
+        outb(0x61, (inb(0x61) & ~0x02) | 0x01);
+        while (!(inb(0x61) & 0x20)) {
+            asm volatile("pause");
+        }
+
+        us -= chunk;
+    }
+}
+
+// Measure the TSC frequency against the PIT
+void tsc_calibrate(void) {
+    uint64_t start = rdtsc();
+    timer_udelay(10000);
+    uint64_t cycles = rdtsc() - start;
+
+    // 10ms worth of cycles fits in 32 bits below ~400GHz
+    uint32_t mhz = (uint32_t)cycles / 10000;
+    if (mhz > 0) {
+        tsc_mhz = mhz;
+    }
+}
+
 // Sleep for specified number of milliseconds
 void sleep(uint32_t ms) {
     if (frequency > 0) {
@@ -0,0 +1,223 @@
+#include "trace.h"
+#include "process.h"
+#include "smp.h"
+#include "tsc.h"
+#include "io.h"
+#include "terminal.h"
+#include "string.h"
+
+// Set while tracing
+volatile bool trace_enabled = false;
+
+// One ring per CPU
+static trace_ring_t trace_rings[MAX_CPUS];
+
+// Record an event in the calling CPU's ring
+void trace_record(uint8_t type, uint32_t arg0, uint32_t arg1) {
+    cpu_t* cpu = this_cpu();
+    trace_ring_t* ring = &trace_rings[cpu->id];
+    if (!ring->events) return;
+
+    uint32_t slot = __sync_fetch_and_add(&ring->head, 1) & (TRACE_RING_SIZE - 1);
+    trace_event_t* event = &ring->events[slot];
+    event->tsc = rdtsc();
+    event->pid = cpu->current ? cpu->current->pid : 0;
+    event->type = type;
+    event->arg0 = arg0;
+    event->arg1 = arg1;
+}
+
+// Allocate the rings of every CPU and start recording
+bool trace_start(void) {
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        trace_ring_t* ring = &trace_rings[i];
+        if (!ring->events) {
+            ring->events = kmalloc(TRACE_RING_SIZE * sizeof(trace_event_t));
+            if (!ring->events) return false;
+            ring->head = 0;
+        }
+    }
+    trace_enabled = true;
+    return true;
+}
+
+// Stop recording; the rings keep their contents for export
+void trace_stop(void) {
+    trace_enabled = false;
+}
+
+// Forget everything recorded so far
+void trace_clear(void) {
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        trace_rings[i].head = 0;
+    }
+}
+
+// Prepare an export port. COM1 is programmed for 115200 baud, 8N1.
+void trace_port_init(uint16_t port) {
+    if (port != TRACE_SERIAL_PORT) return;
+
+    outb(TRACE_SERIAL_PORT + 1, 0x00);  // No interrupts
+    outb(TRACE_SERIAL_PORT + 3, 0x80);  // DLAB on
+    outb(TRACE_SERIAL_PORT + 0, 0x01);  // Divisor 1: 115200 baud
+    outb(TRACE_SERIAL_PORT + 1, 0x00);
+    outb(TRACE_SERIAL_PORT + 3, 0x03);  // 8N1, DLAB off
+    outb(TRACE_SERIAL_PORT + 2, 0xC7);  // FIFO on, cleared
+}
+
+// Write a character to the export port
+void trace_putc(uint16_t port, char c) {
+    if (port == TRACE_SERIAL_PORT) {
+        while (!(inb(TRACE_SERIAL_PORT + 5) & 0x20)) {
+            asm volatile("pause");
+        }
+    }
+    outb(port, c);
+}
+
+// Write a string to the export port
+void trace_puts(uint16_t port, const char* s) {
+    while (*s) {
+        trace_putc(port, *s++);
+    }
+}
+
+// Write a number in hex with the given number of digits
+void trace_puthex(uint16_t port, uint32_t value, int digits) {
+    static const char hex[] = "0123456789abcdef";
+    for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4) {
+        trace_putc(port, hex[(value >> shift) & 0xF]);
+    }
+}
+
+// Write a number in decimal
+void trace_putdec(uint16_t port, uint32_t value) {
+    char buf[10];
+    int len = 0;
+    do {
+        buf[len++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (len) {
+        trace_putc(port, buf[--len]);
+    }
+}
+
+// Name a process: "P <pid> <name>"
+void trace_put_process(uint16_t port, uint32_t pid) {
+    process_t* process = pid ? process_get_by_pid(pid) : NULL;
+    trace_puts(port, "P ");
+    trace_putdec(port, pid);
+    trace_puts(port, " ");
+    trace_puts(port, pid == 0 ? "idle" : process ? process->name : "exited");
+    trace_puts(port, "\n");
+}
+
+// Name the processes that appear in the rings
+static void trace_export_names(uint16_t port) {
+    uint8_t* seen = kmalloc(65536 / 8);
+    if (!seen) return;
+    memset(seen, 0, 65536 / 8);
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        trace_ring_t* ring = &trace_rings[cpu];
+        if (!ring->events) continue;
+
+        uint32_t count = ring->head < TRACE_RING_SIZE ? ring->head : TRACE_RING_SIZE;
+        for (uint32_t i = 0; i < count; i++) {
+            trace_event_t* event = &ring->events[i];
+            uint16_t pids[2] = { event->pid, event->pid };
+            if (event->type == TRACE_SWITCH || event->type == TRACE_WAKEUP) {
+                pids[1] = (uint16_t)event->arg0;
+            }
+
+            for (int j = 0; j < 2; j++) {
+                uint16_t pid = pids[j];
+                if (seen[pid / 8] & (1 << (pid % 8))) continue;
+                seen[pid / 8] |= 1 << (pid % 8);
+
+                trace_put_process(port, pid);
+            }
+        }
+    }
+    kfree(seen);
+}
+
+// Write the rings as text, oldest event first per CPU:
+// "E <cpu> <tsc> <type> <pid> <arg0> <arg1>", with tsc and the args in hex.
+// tools/trace2json.py turns this into a Chrome/Perfetto trace.
+void trace_export(uint16_t port) {
+    trace_port_init(port);
+    trace_puts(port, "# myos-trace 1\n# tsc_mhz ");
+    trace_putdec(port, tsc_mhz);
+    trace_puts(port, "\n");
+    trace_export_names(port);
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        trace_ring_t* ring = &trace_rings[cpu];
+        if (!ring->events || !ring->head) continue;
+
+        uint32_t head = ring->head;
+        uint32_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        for (uint32_t n = first; n < head; n++) {
+            trace_event_t* event = &ring->events[n & (TRACE_RING_SIZE - 1)];
+            trace_puts(port, "E ");
+            trace_putdec(port, cpu);
+            trace_puts(port, " ");
+            trace_puthex(port, (uint32_t)(event->tsc >> 32), 8);
+            trace_puthex(port, (uint32_t)event->tsc, 8);
+            trace_puts(port, " ");
+            trace_putdec(port, event->type);
+            trace_puts(port, " ");
+            trace_putdec(port, event->pid);
+            trace_puts(port, " ");
+            trace_puthex(port, event->arg0, 8);
+            trace_puts(port, " ");
+            trace_puthex(port, event->arg1, 8);
+            trace_puts(port, "\n");
+        }
+    }
+    trace_puts(port, "# end\n");
+}
+
+// Control tracing: trace start|stop|clear|status|dump [serial|debugcon]
+int trace_cmd_trace(int argc, char* argv[]) {
+    const char* op = argc > 1 ? argv[1] : "status";
+
+    if (strcmp(op, "start") == 0) {
+        if (!trace_start()) {
+            kprintf("trace: cannot allocate ring buffers\n");
+            return -1;
+        }
+        kprintf("Tracing on %u CPUs\n", smp_cpu_count());
+    } else if (strcmp(op, "stop") == 0) {
+        trace_stop();
+    } else if (strcmp(op, "clear") == 0) {
+        trace_clear();
+    } else if (strcmp(op, "status") == 0) {
+        kprintf("Tracing %s\n", trace_enabled ? "on" : "off");
+        for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+            uint32_t head = trace_rings[i].head;
+            kprintf("CPU %u: %u events, %u overwritten\n", i,
+                    head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE,
+                    head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0);
+        }
+    } else if (strcmp(op, "dump") == 0) {
+        uint16_t port = TRACE_SERIAL_PORT;
+        if (argc > 2 && strcmp(argv[2], "debugcon") == 0) {
+            port = TRACE_DEBUGCON_PORT;
+        } else if (argc > 2 && strcmp(argv[2], "serial") != 0) {
+            kprintf("usage: trace dump [serial|debugcon]\n");
+            return -1;
+        }
+
+        // The rings must not move while they are read
+        trace_stop();
+        trace_export(port);
+        kprintf("Trace written to %s\n", port == TRACE_SERIAL_PORT ? "COM1" : "port 0xE9");
+    } else {
+        kprintf("usage: trace start|stop|clear|status|dump [serial|debugcon]\n");
+        return -1;
+    }
+    return 0;
+}
@@ -1,10 +1,24 @@
 #include "tss.h"
 #include "memory.h"
 #include "gdt.h"
+#include "smp.h"
 
-// Global TSS structure
+// Boot TSS, used until smp_bsp_init() switches to the per-CPU one
 static tss_t tss;
 
+// Fill in a TSS with the initial values
+void tss_setup(tss_t* t) {
+    // Zero out TSS
+    memset(t, 0, sizeof(tss_t));
+    
+    // Set up some initial values
+    t->ss0 = 0x10;  // Kernel data segment
+    t->esp0 = 0;    // Will be set by tss_set_kernel_stack
+    t->cs = 0x0B;   // User code segment
+    t->ss = t->ds = t->es = t->fs = t->gs = 0x13; // User data segment
+    t->iomap_base = sizeof(tss_t);
+}
+
 // Initialize TSS
 void tss_init(uint32_t gdt_entry) {
     // Get base address of TSS
@@ -13,20 +27,12 @@ void tss_init(uint32_t gdt_entry) {
     // Set up the TSS entry in the GDT
     gdt_set_gate(gdt_entry, base, sizeof(tss_t), 0xE9, 0x00); // Present, Ring 3, TSS
     
-    // Zero out TSS
-    memset(&tss, 0, sizeof(tss_t));
-    
-    // Set up some initial values
-    tss.ss0 = 0x10;  // Kernel data segment
-    tss.esp0 = 0;    // Will be set by tss_set_kernel_stack
-    tss.cs = 0x0B;   // User code segment
-    tss.ss = tss.ds = tss.es = tss.fs = tss.gs = 0x13; // User data segment
-    tss.iomap_base = sizeof(tss_t);
+    tss_setup(&tss);
 }
 
-// Set kernel stack pointer in TSS
+// Set kernel stack pointer in the calling CPU's TSS
 void tss_set_kernel_stack(uint32_t stack) {
-    tss.esp0 = stack;
+    this_cpu()->tss.esp0 = stack;
 }
 
 // Load TSS
@@ -0,0 +1,482 @@
+#include "vfs.h"
+#include "myfs.h"
+#include "ramfs.h"
+#include "blk.h"
+#include "memory.h"
+#include "terminal.h"
+#include "string.h"
+
+mutex_t vfs_lock = MUTEX_INIT;
+
+// Dentries, the hash chains of cached ones keyed by parent and name, the
+// LRU list of cached ones and the unused ones
+static dentry_t dcache[DCACHE_ENTRIES];
+static dentry_t* dcache_hash[DCACHE_HASH_SIZE];
+static dentry_t* dcache_lru_head = NULL;
+static dentry_t* dcache_lru_tail = NULL;
+static dentry_t* dcache_free = NULL;
+static bool dcache_ready = false;
+
+static vfs_mount_t vfs_mounts[VFS_MAX_MOUNTS];
+static vfs_mount_t* vfs_root_mount = NULL;
+
+// Statistics
+static struct {
+    uint32_t hits;
+    uint32_t negative_hits;          // Hits that found a name missing
+    uint32_t misses;                 // Lookups that asked the file system
+    uint32_t evictions;
+    uint32_t cached;
+    uint32_t negative;
+} dcache_stats;
+
+// Hash of a name in a directory
+static uint32_t dcache_hashfn(dentry_t* parent, const char* name) {
+    uint32_t h = (uint32_t)parent >> 4;
+    while (*name) {
+        h = h * 31 + (uint8_t)*name++;
+    }
+    return h ^ (h >> 16);
+}
+
+static inline dentry_t** dcache_chain(uint32_t hash) {
+    return &dcache_hash[hash & (DCACHE_HASH_SIZE - 1)];
+}
+
+static void dcache_lru_remove(dentry_t* d) {
+    if (d->lru_prev) d->lru_prev->lru_next = d->lru_next;
+    else dcache_lru_head = d->lru_next;
+    if (d->lru_next) d->lru_next->lru_prev = d->lru_prev;
+    else dcache_lru_tail = d->lru_prev;
+    d->lru_prev = d->lru_next = NULL;
+}
+
+static void dcache_lru_add(dentry_t* d) {
+    d->lru_next = NULL;
+    d->lru_prev = dcache_lru_tail;
+    if (dcache_lru_tail) dcache_lru_tail->lru_next = d;
+    else dcache_lru_head = d;
+    dcache_lru_tail = d;
+}
+
+// Take a dentry out of the hash chains and the LRU list
+static void dcache_unhash(dentry_t* d) {
+    dentry_t** link = dcache_chain(d->hash);
+    while (*link && *link != d) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) *link = d->hash_next;
+    dcache_lru_remove(d);
+    d->flags &= ~DENTRY_HASHED;
+    dcache_stats.cached--;
+    if (!d->node) dcache_stats.negative--;
+}
+
+// Give a dentry back to the pool, dropping what it holds
+static void dcache_release(dentry_t* d) {
+    if (d->flags & DENTRY_HASHED) dcache_unhash(d);
+    if (d->node) close_fs(d->node);
+    if (d->parent) d->parent->children--;
+
+    memset(d, 0, sizeof(dentry_t));
+    d->lru_next = dcache_free;
+    dcache_free = d;
+}
+
+// Reuse the least recently used dentry nothing depends on. Returns false
+// if every cached one is in use.
+static bool dcache_evict(void) {
+    for (dentry_t* d = dcache_lru_head; d; d = d->lru_next) {
+        if (d->refs || d->children || d->mounted) continue;
+        dcache_release(d);
+        dcache_stats.evictions++;
+        return true;
+    }
+    return false;
+}
+
+static void dcache_init(void) {
+    for (int i = DCACHE_ENTRIES - 1; i >= 0; i--) {
+        dcache[i].lru_next = dcache_free;
+        dcache_free = &dcache[i];
+    }
+    dcache_ready = true;
+}
+
+// Get an unused dentry with one reference
+static dentry_t* dcache_alloc(dentry_t* parent, const char* name) {
+    if (!dcache_ready) dcache_init();
+    if (!dcache_free && !dcache_evict()) return NULL;
+
+    dentry_t* d = dcache_free;
+    dcache_free = d->lru_next;
+    memset(d, 0, sizeof(dentry_t));
+    strncpy(d->name, name, VFS_NAME_MAX);
+    d->parent = parent;
+    d->refs = 1;
+    d->flags = DENTRY_USED;
+    if (parent) parent->children++;
+    return d;
+}
+
+// Take a reference to a dentry
+dentry_t* dget(dentry_t* d) {
+    if (d) d->refs++;
+    return d;
+}
+
+// Drop a reference. Cached dentries stay for later lookups; unhashed
+// ones (their name was removed while in use) go with the last one.
+void dput(dentry_t* d) {
+    if (!d || !d->refs || --d->refs) return;
+    if (!(d->flags & DENTRY_HASHED) && !d->mount_root) {
+        dcache_release(d);
+    }
+}
+
+// The directory a walk is in after following mounts on top of it
+static dentry_t* vfs_follow_mounts(dentry_t* d) {
+    while (d->mounted) {
+        dentry_t* root = dget(d->mounted->root);
+        dput(d);
+        d = root;
+    }
+    return d;
+}
+
+// Parent of a dentry for "..", leaving mounts through their mountpoint
+static dentry_t* vfs_parent(dentry_t* d) {
+    while (d->mount_root && d->mount_root->mountpoint) {
+        d = d->mount_root->mountpoint;
+    }
+    return d->parent ? d->parent : d;
+}
+
+// Look a name up in a directory, in the cache or by asking its file
+// system. Returns the dentry with a reference, negative if the name does
+// not exist, or NULL if the lookup could not be made.
+dentry_t* vfs_lookup_child(dentry_t* dir, const char* name) {
+    if (!dir->node || !(dir->node->flags & FS_DIRECTORY)) return NULL;
+    if (strlen(name) > VFS_NAME_MAX) return NULL;
+
+    uint32_t hash = dcache_hashfn(dir, name);
+    for (dentry_t* d = *dcache_chain(hash); d; d = d->hash_next) {
+        if (d->hash == hash && d->parent == dir && strcmp(d->name, name) == 0) {
+            dcache_lru_remove(d);
+            dcache_lru_add(d);
+            if (d->node) {
+                dcache_stats.hits++;
+            } else {
+                dcache_stats.negative_hits++;
+            }
+            return vfs_follow_mounts(dget(d));
+        }
+    }
+
+    dcache_stats.misses++;
+    dentry_t* d = dcache_alloc(dir, name);
+    if (!d) return NULL;
+
+    d->node = finddir_fs(dir->node, d->name);
+    if (d->node) {
+        open_fs(d->node);
+    } else {
+        dcache_stats.negative++;
+    }
+
+    d->hash = hash;
+    d->hash_next = *dcache_chain(hash);
+    *dcache_chain(hash) = d;
+    d->flags |= DENTRY_HASHED;
+    dcache_lru_add(d);
+    dcache_stats.cached++;
+    return d;
+}
+
+// Walk a path from the root, one dentry per component. With name given,
+// stop at the parent of the last component and copy that there.
+// Returns the dentry with a reference, or NULL.
+static dentry_t* vfs_walk(const char* path, char* name) {
+    char part[VFS_NAME_MAX + 1];
+
+    if (!vfs_root_mount || !path) return NULL;
+    dentry_t* d = dget(vfs_root_mount->root);
+
+    while (*path) {
+        while (*path == '/') path++;
+        if (!*path) break;
+
+        size_t len = 0;
+        while (path[len] && path[len] != '/') len++;
+        if (len > VFS_NAME_MAX) {
+            dput(d);
+            return NULL;
+        }
+        memcpy(part, path, len);
+        part[len] = '\0';
+        path += len;
+
+        const char* rest = path;
+        while (*rest == '/') rest++;
+        if (name && !*rest) {
+            if (strcmp(part, ".") == 0 || strcmp(part, "..") == 0) break;
+            strncpy(name, part, VFS_NAME_MAX + 1);
+            return d;
+        }
+
+        if (!(d->node->flags & FS_DIRECTORY)) {
+            dput(d);
+            return NULL;
+        }
+        if (strcmp(part, ".") == 0) continue;
+        if (strcmp(part, "..") == 0) {
+            dentry_t* parent = dget(vfs_parent(d));
+            dput(d);
+            d = parent;
+            continue;
+        }
+
+        dentry_t* child = vfs_lookup_child(d, part);
+        dput(d);
+        if (!child || !child->node) {
+            dput(child);
+            return NULL;
+        }
+        d = child;
+    }
+
+    // The path names a directory with no last component to give back
+    if (name) {
+        dput(d);
+        return NULL;
+    }
+    return d;
+}
+
+// Dentry of an existing path, with a reference
+dentry_t* vfs_lookup(const char* path) {
+    return vfs_walk(path, NULL);
+}
+
+// Dentry of the directory holding the last component of a path, with a
+// reference; the component is copied to name (VFS_NAME_MAX + 1 bytes)
+dentry_t* vfs_lookup_parent(const char* path, char* name) {
+    dentry_t* dir = vfs_walk(path, name);
+    if (dir && (!dir->node || !(dir->node->flags & FS_DIRECTORY))) {
+        dput(dir);
+        return NULL;
+    }
+    return dir;
+}
+
+// Create a file or directory for a negative dentry
+int vfs_create(dentry_t* d, uint32_t type) {
+    fs_node_t* dir = d->parent ? d->parent->node : NULL;
+    if (d->node || !dir || !dir->create) return -1;
+
+    fs_node_t* node = dir->create(dir, d->name, type);
+    if (!node) return -1;
+
+    open_fs(node);
+    d->node = node;
+    dcache_stats.negative--;
+    return 0;
+}
+
+// Remove the name of a dentry. The caller's reference and any others
+// keep the node; later lookups find the name missing.
+int vfs_unlink(dentry_t* d) {
+    fs_node_t* dir = d->parent ? d->parent->node : NULL;
+    if (!d->node || !dir || !dir->unlink || d->mounted || d->mount_root) return -1;
+    if (dir->unlink(dir, d->name) < 0) return -1;
+
+    // A removed directory was empty, so what is cached below it is
+    // negative and unused
+    for (int i = 0; d->children && i < DCACHE_ENTRIES; i++) {
+        if (dcache[i].parent == d && !dcache[i].refs && !dcache[i].children) {
+            dcache_release(&dcache[i]);
+        }
+    }
+
+    if (d->refs > 1) {
+        // Still open: the dentry leaves the cache and goes with its users
+        dcache_unhash(d);
+    } else {
+        close_fs(d->node);
+        d->node = NULL;
+        dcache_stats.negative++;
+    }
+    return 0;
+}
+
+// Find where a mount on path would go: *mountpoint gets the directory
+// with a reference, or NULL for the first mount, which must be "/".
+// A directory something is already mounted on is refused; lookups follow
+// mounts, so that shows up as landing on the root of a mount.
+static int vfs_mountpoint(const char* path, dentry_t** mountpoint) {
+    *mountpoint = NULL;
+    if (!vfs_root_mount) return strcmp(path, "/") == 0 ? 0 : -1;
+
+    dentry_t* d = vfs_lookup(path);
+    if (!d) return -1;
+    if (!(d->node->flags & FS_DIRECTORY) || d->mounted || d->mount_root) {
+        dput(d);
+        return -1;
+    }
+    *mountpoint = d;
+    return 0;
+}
+
+// Mount a file system's root directory on a directory, or as the root
+// if none is mounted yet
+int vfs_mount(const char* path, fs_node_t* root, const char* source, const char* type) {
+    if (!root || !(root->flags & FS_DIRECTORY)) return -1;
+
+    vfs_mount_t* mount = NULL;
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (!vfs_mounts[i].used) {
+            mount = &vfs_mounts[i];
+            break;
+        }
+    }
+    if (!mount) return -1;
+
+    dentry_t* mountpoint;
+    if (vfs_mountpoint(path, &mountpoint) < 0) return -1;
+
+    dentry_t* d = dcache_alloc(NULL, "/");
+    if (!d) {
+        dput(mountpoint);
+        return -1;
+    }
+    d->node = root;
+    d->mount_root = mount;
+    open_fs(root);
+
+    // The mount keeps its reference to both dentries
+    memset(mount, 0, sizeof(vfs_mount_t));
+    mount->used = true;
+    mount->mountpoint = mountpoint;
+    mount->root = d;
+    strncpy(mount->source, source, sizeof(mount->source) - 1);
+    strncpy(mount->type, type, sizeof(mount->type) - 1);
+
+    if (mountpoint) {
+        mountpoint->mounted = mount;
+    } else {
+        vfs_root_mount = mount;
+        fs_root = root;
+    }
+    return 0;
+}
+
+// Path of a mount's mountpoint, built from its dentries
+static void vfs_mount_path(vfs_mount_t* mount, char* path, uint32_t size) {
+    char* parts[16];
+    int count = 0;
+
+    dentry_t* d = mount->mountpoint;
+    while (d && count < 16) {
+        if (d->mount_root) {
+            d = d->mount_root->mountpoint;
+            continue;
+        }
+        parts[count++] = d->name;
+        d = d->parent;
+    }
+
+    path[0] = '\0';
+    uint32_t len = 0;
+    for (int i = count - 1; i >= 0; i--) {
+        uint32_t n = strlen(parts[i]);
+        if (len + n + 2 > size) break;
+        path[len++] = '/';
+        memcpy(path + len, parts[i], n + 1);
+        len += n;
+    }
+    if (!len) strncpy(path, "/", size);
+}
+
+// Show mounts, or mount a file system: mount [device|ramfs path]
+int vfs_cmd_mount(int argc, char* argv[]) {
+    if (argc == 1) {
+        char path[128];
+        mutex_lock(&vfs_lock);
+        for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+            if (!vfs_mounts[i].used) continue;
+            vfs_mount_path(&vfs_mounts[i], path, sizeof(path));
+            kprintf("%s on %s type %s\n", vfs_mounts[i].source, path, vfs_mounts[i].type);
+        }
+        kprintf("ramfs data: %u KB\n", ramfs_used_pages() * (PAGE_SIZE / 1024));
+        mutex_unlock(&vfs_lock);
+        return 0;
+    }
+    if (argc != 3) {
+        kprintf("usage: mount [device|ramfs path]\n");
+        return -1;
+    }
+
+    // Check the mountpoint before a file system is set up for it
+    mutex_lock(&vfs_lock);
+    dentry_t* mountpoint;
+    if (vfs_mountpoint(argv[2], &mountpoint) < 0) {
+        mutex_unlock(&vfs_lock);
+        kprintf("mount: cannot mount on %s\n", argv[2]);
+        return -1;
+    }
+    dput(mountpoint);
+
+    fs_node_t* root = NULL;
+    const char* type = "myfs";
+    blk_device_t* dev = NULL;
+    if (strcmp(argv[1], "ramfs") == 0) {
+        root = ramfs_mount();
+        type = "ramfs";
+    } else {
+        dev = blk_find(argv[1]);
+        root = dev && !dev->mounted ? myfs_mount(dev) : NULL;
+    }
+    int status = root ? vfs_mount(argv[2], root, argv[1], type) : -1;
+    mutex_unlock(&vfs_lock);
+
+    if (dev && dev->mounted && !root) {
+        kprintf("mount: %s is already mounted\n", argv[1]);
+    } else if (!root) {
+        kprintf("mount: no %s file system on %s\n", type, argv[1]);
+    } else if (status < 0) {
+        kprintf("mount: cannot mount on %s\n", argv[2]);
+    }
+    return status;
+}
+
+// Show dentry cache statistics: dcache [drop|reset]
+int vfs_cmd_dcache(int argc, char* argv[]) {
+    const char* cmd = argc > 1 ? argv[1] : "";
+
+    if (strcmp(cmd, "") == 0) {
+        uint32_t lookups = dcache_stats.hits + dcache_stats.negative_hits + dcache_stats.misses;
+        uint32_t hits = dcache_stats.hits + dcache_stats.negative_hits;
+        kprintf("Dentries: %u cached (%u negative), %u max\n", dcache_stats.cached,
+                dcache_stats.negative, DCACHE_ENTRIES);
+        kprintf("Lookups: %u hits, %u negative hits, %u misses (%u%% hit)\n",
+                dcache_stats.hits, dcache_stats.negative_hits, dcache_stats.misses,
+                lookups ? hits * 100 / lookups : 0);
+        kprintf("Evicted: %u\n", dcache_stats.evictions);
+    } else if (strcmp(cmd, "drop") == 0) {
+        uint32_t dropped = 0;
+        mutex_lock(&vfs_lock);
+        while (dcache_evict()) {
+            dropped++;
+        }
+        mutex_unlock(&vfs_lock);
+        kprintf("Dropped %u dentries\n", dropped);
+    } else if (strcmp(cmd, "reset") == 0) {
+        dcache_stats.hits = dcache_stats.negative_hits = 0;
+        dcache_stats.misses = dcache_stats.evictions = 0;
+        kprintf("Dentry cache statistics cleared\n");
+    } else {
+        kprintf("usage: dcache [drop|reset]\n");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,292 @@
+#include "vm.h"
+#include "elf.h"
+#include "process.h"
+#include "interrupt.h"
+#include "terminal.h"
+#include "string.h"
+#include "trace.h"
+
+// Page fault vector
+#define PAGE_FAULT_VECTOR 14
+
+// Fault counters, updated atomically from every CPU
+static vm_stats_t vm_stats;
+
+// Find the area containing an address
+vm_area_t* vm_find(vm_area_t* areas, uint32_t address) {
+    for (vm_area_t* area = areas; area; area = area->next) {
+        if (address >= area->start && address < area->end) {
+            return area;
+        }
+    }
+    return NULL;
+}
+
+// Check that a user range lies inside areas allowing the access
+bool vm_access_ok(vm_area_t* areas, uint32_t start, uint32_t len, bool write) {
+    if (start + len < start) return false;
+
+    uint32_t address = start;
+    while (address < start + len) {
+        vm_area_t* area = vm_find(areas, address);
+        if (!area || (write && !(area->flags & VM_WRITE))) return false;
+        address = area->end;
+    }
+    return true;
+}
+
+// Length of a user string that lies inside the areas, or -1 if it leaves
+// them or runs max bytes without a terminator
+int vm_string_ok(vm_area_t* areas, uint32_t start, uint32_t max) {
+    uint32_t address = start;
+    while (address - start < max) {
+        vm_area_t* area = vm_find(areas, address);
+        if (!area) return -1;
+        for (; address < area->end && address - start < max; address++) {
+            if (!*(const char*)address) return address - start;
+        }
+    }
+    return -1;
+}
+
+// Add an area to an address space. Nothing is mapped until the pages are
+// touched. Fails if the range is malformed or overlaps an existing area.
+bool vm_map(vm_area_t** areas, uint32_t start, uint32_t end, uint32_t flags,
+            elf_image_t* image, uint32_t offset, uint32_t filesz) {
+    if ((start | end | offset) & (PAGE_SIZE - 1)) return false;
+    if (start < USER_SPACE_START || end > USER_SPACE_END || start >= end) return false;
+
+    for (vm_area_t* area = *areas; area; area = area->next) {
+        if (start < area->end && end > area->start) return false;
+    }
+
+    vm_area_t* area = kmalloc(sizeof(vm_area_t));
+    if (!area) return false;
+
+    area->start = start;
+    area->end = end;
+    area->flags = flags;
+    area->image = image;
+    area->offset = offset;
+    area->filesz = filesz;
+    area->next = *areas;
+    *areas = area;
+
+    if (image) {
+        elf_image_ref(image);
+    }
+    return true;
+}
+
+// Check whether a page of an area is mapped from its image's shared copy:
+// read-only and backed by the file for its whole length
+static bool vm_page_shared(vm_area_t* area, uint32_t page) {
+    return area->image && !(area->flags & VM_WRITE) &&
+           page - area->start + PAGE_SIZE <= area->filesz;
+}
+
+// Fill in the page holding an address. Frames are reached through the
+// kernel's identity mapping of low memory. *major is set if the page had
+// to be read from the file.
+static bool vm_fault(page_directory_t* dir, vm_area_t* areas, uint32_t address, bool write,
+                     bool* major) {
+    *major = false;
+
+    vm_area_t* area = vm_find(areas, address);
+    if (!area || (write && !(area->flags & VM_WRITE))) return false;
+
+    uint32_t page = address & ~(PAGE_SIZE - 1);
+    uint32_t flags = PAGE_USER | ((area->flags & VM_WRITE) ? PAGE_WRITE : 0);
+
+    // Another access may have filled it in before this fault was taken
+    page_t* pte = get_page(dir, page, false);
+    if (pte && pte->present) return true;
+
+    if (vm_page_shared(area, page)) {
+        uint32_t frame = elf_image_shared_page(area->image, area->offset + (page - area->start),
+                                               major);
+        if (!frame) return false;
+
+        map_frame(dir, page, frame, flags);
+        __sync_fetch_and_add(&vm_stats.shared_pages, 1);
+        return true;
+    }
+
+    uint32_t frame = alloc_frame();
+    if (!frame) return false;
+
+    // Private copy: file contents up to filesz, zeros after it
+    uint32_t filled = 0;
+    uint32_t offset = page - area->start;
+    if (area->image && offset < area->filesz) {
+        filled = area->filesz - offset < PAGE_SIZE ? area->filesz - offset : PAGE_SIZE;
+        if (!elf_image_read(area->image, (void*)frame, filled, area->offset + offset)) {
+            free_frame(frame);
+            return false;
+        }
+        __sync_fetch_and_add(&vm_stats.file_pages, 1);
+        *major = true;
+    } else {
+        __sync_fetch_and_add(&vm_stats.zero_pages, 1);
+    }
+    memset((uint8_t*)frame + filled, 0, PAGE_SIZE - filled);
+
+    map_frame(dir, page, frame, flags);
+    return true;
+}
+
+// Page fault handler. Faults inside an area are resolved and the access is
+// retried; others raise SIGSEGV in a user process and halt the kernel.
+static void page_fault_handler(registers_t regs) {
+    uint32_t address;
+    asm volatile("mov %%cr2, %0" : "=r"(address));
+
+    __sync_fetch_and_add(&vm_stats.faults, 1);
+    trace_event(TRACE_PAGE_FAULT, address, regs.err_code);
+
+    // Filling a page may sleep reading the file, so take interrupts again
+    // if the faulting code had them; CR2 is already read
+    if (regs.eflags & 0x200) {
+        asm volatile("sti");
+    }
+
+    process_t* current = current_process;
+    bool major;
+    if (current && vm_fault(current->page_directory, current->vmas, address,
+                            regs.err_code & PF_ERR_WRITE, &major)) {
+        if (major) {
+            current->acct.maj_flt++;
+        } else {
+            current->acct.min_flt++;
+        }
+        return;
+    }
+    __sync_fetch_and_add(&vm_stats.segv, 1);
+
+    if (current && (regs.err_code & PF_ERR_USER)) {
+        kprintf("Segmentation fault: pid %d at 0x%x (EIP: 0x%x)\n",
+                current->pid, address, regs.eip);
+        signal_force(current, SIGSEGV);
+        return;
+    }
+
+    kprintf("Exception: Page Fault\n");
+    kprintf("Address: 0x%x\n", address);
+    kprintf("Error code: %d\n", regs.err_code);
+    kprintf("EIP: 0x%x\n", regs.eip);
+    kprintf("Fatal exception. System halted.\n");
+    for(;;);
+}
+
+// Copy data into an address space that need not be the current one,
+// filling in its pages as needed
+bool vm_copy_out(page_directory_t* dir, vm_area_t* areas, uint32_t address,
+                 const void* src, uint32_t len) {
+    const uint8_t* from = src;
+    bool major;
+    while (len) {
+        if (!vm_fault(dir, areas, address, true, &major)) return false;
+
+        page_t* pte = get_page(dir, address, false);
+        uint32_t offset = address & (PAGE_SIZE - 1);
+        uint32_t chunk = PAGE_SIZE - offset < len ? PAGE_SIZE - offset : len;
+        memcpy((uint8_t*)(pte->frame * PAGE_SIZE) + offset, from, chunk);
+
+        address += chunk;
+        from += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+// Install the page fault handler
+void vm_init(void) {
+    register_interrupt_handler(PAGE_FAULT_VECTOR, page_fault_handler);
+}
+
+// Copy an address space for fork. Shared text stays shared; private pages
+// that have been touched are copied, the rest stay demand-paged.
+bool vm_fork(page_directory_t* child_dir, vm_area_t** child_areas,
+             page_directory_t* parent_dir, vm_area_t* parent_areas) {
+    *child_areas = NULL;
+
+    for (vm_area_t* area = parent_areas; area; area = area->next) {
+        if (!vm_map(child_areas, area->start, area->end, area->flags,
+                    area->image, area->offset, area->filesz)) {
+            vm_release(child_dir, child_areas);
+            return false;
+        }
+    }
+
+    // The child's page tables are copies of the parent's, so its private
+    // entries still point at parent frames. Drop them before copying, so
+    // a failure part way never frees a frame the parent owns.
+    for (vm_area_t* area = *child_areas; area; area = area->next) {
+        for (uint32_t page = area->start; page < area->end; page += PAGE_SIZE) {
+            page_t* pte = get_page(child_dir, page, false);
+            if (pte && !vm_page_shared(area, page)) {
+                pte->present = 0;
+                pte->frame = 0;
+            }
+        }
+    }
+
+    for (vm_area_t* area = *child_areas; area; area = area->next) {
+        for (uint32_t page = area->start; page < area->end; page += PAGE_SIZE) {
+            page_t* src = get_page(parent_dir, page, false);
+            if (!src || !src->present || vm_page_shared(area, page)) continue;
+
+            uint32_t frame = alloc_frame();
+            if (!frame) {
+                vm_release(child_dir, child_areas);
+                return false;
+            }
+            memcpy((void*)frame, (void*)(src->frame * PAGE_SIZE), PAGE_SIZE);
+            map_frame(child_dir, page, frame, PAGE_USER | (src->rw ? PAGE_WRITE : 0));
+        }
+    }
+    return true;
+}
+
+// Unmap every area of an address space, freeing private frames and
+// dropping image references. The page tables themselves stay.
+void vm_release(page_directory_t* dir, vm_area_t** areas) {
+    vm_area_t* area = *areas;
+    while (area) {
+        for (uint32_t page = area->start; page < area->end; page += PAGE_SIZE) {
+            page_t* pte = get_page(dir, page, false);
+            if (!pte || !pte->present) continue;
+
+            if (!vm_page_shared(area, page)) {
+                free_frame(pte->frame * PAGE_SIZE);
+            }
+            pte->present = 0;
+            pte->frame = 0;
+        }
+
+        vm_area_t* next = area->next;
+        if (area->image) {
+            elf_image_put(area->image);
+        }
+        kfree(area);
+        area = next;
+    }
+    *areas = NULL;
+}
+
+// Show page fault counters; "vmstat reset" clears them
+int vm_cmd_vmstat(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        memset(&vm_stats, 0, sizeof(vm_stats));
+        kprintf("VM statistics cleared\n");
+        return 0;
+    }
+
+    kprintf("Page faults:   %u\n", vm_stats.faults);
+    kprintf("  file pages:  %u\n", vm_stats.file_pages);
+    kprintf("  shared text: %u\n", vm_stats.shared_pages);
+    kprintf("  zero-filled: %u\n", vm_stats.zero_pages);
+    kprintf("  bad access:  %u\n", vm_stats.segv);
+    kprintf("Free memory:   %u KB\n", get_free_memory() / 1024);
+    return 0;
+}
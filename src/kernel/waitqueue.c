@@ -0,0 +1,113 @@
+#include "waitqueue.h"
+#include "process.h"
+
+// Initialize a wait queue
+void waitqueue_init(waitqueue_t* wq) {
+    spin_init(&wq->lock);
+    wq->head = NULL;
+}
+
+// Unlink an entry. Caller holds wq->lock.
+static void waitqueue_unlink(waitqueue_t* wq, wait_entry_t* entry) {
+    wait_entry_t** link = &wq->head;
+    while (*link && *link != entry) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = entry->next;
+    }
+    entry->next = NULL;
+    entry->queued = false;
+}
+
+// Queue the calling process and mark it blocked. The caller re-checks its
+// condition afterwards and either sleeps or calls waitqueue_finish().
+void waitqueue_prepare(waitqueue_t* wq, wait_entry_t* entry) {
+    process_t* curr = current_process;
+    entry->process = curr;
+    entry->next = NULL;
+
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    wait_entry_t** link = &wq->head;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = entry;
+    entry->queued = true;
+
+    // The idle process must stay runnable; it halts in waitqueue_sleep()
+    if (curr && curr != this_cpu()->idle) {
+        curr->state = PROCESS_STATE_BLOCKED;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// Leave the queue after waking up, or after finding the condition already
+// true. A process that never went to sleep is made running again.
+void waitqueue_finish(waitqueue_t* wq, wait_entry_t* entry) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    if (entry->queued) {
+        waitqueue_unlink(wq, entry);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    process_wake(entry->process);
+}
+
+// Give up the CPU until woken, or until the tick deadline if nonzero
+void waitqueue_sleep(uint32_t deadline) {
+    process_t* curr = current_process;
+
+    // Before the scheduler runs, or on the idle process, run whatever else
+    // is ready and halt until the next interrupt
+    if (!curr || curr == this_cpu()->idle) {
+        process_yield();
+        asm volatile("sti\n"
+                     "hlt");
+        return;
+    }
+
+    curr->sleep_until = deadline;
+    process_yield();
+    curr->sleep_until = 0;
+}
+
+// Check whether the calling process has a signal to take. Called after
+// waitqueue_prepare(), so a signal posted from then on finds the process
+// blocked and wakes it.
+bool waitqueue_interrupted(void) {
+    process_t* curr = current_process;
+    if (!curr || curr == this_cpu()->idle) return false;
+
+    __sync_synchronize();
+    return signal_deliverable(curr);
+}
+
+// Wake the first blocked waiter; false if there was none. Waiters that are
+// not asleep (the idle process, or one already woken by its timeout)
+// re-check their condition anyway, so they are dropped and passed over.
+bool waitqueue_wake_one(waitqueue_t* wq) {
+    bool woken = false;
+
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    while (wq->head && !woken) {
+        wait_entry_t* entry = wq->head;
+        process_t* process = entry->process;
+        waitqueue_unlink(wq, entry);
+        woken = process && process->state == PROCESS_STATE_BLOCKED;
+        process_wake(process);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return woken;
+}
+
+// Wake every waiter
+void waitqueue_wake_all(waitqueue_t* wq) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    while (wq->head) {
+        wait_entry_t* entry = wq->head;
+        waitqueue_unlink(wq, entry);
+        process_wake(entry->process);
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
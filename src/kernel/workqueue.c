@@ -0,0 +1,169 @@
+#include "workqueue.h"
+#include "process.h"
+#include "terminal.h"
+#include "string.h"
+
+// Shared queue for work that does not need its own
+workqueue_t* system_wq = NULL;
+
+// Every workqueue, for "workqueues"
+static workqueue_t* workqueues = NULL;
+static spinlock_t workqueue_list_lock = SPINLOCK_INIT;
+
+// Worker thread: run the work queued on its pool, sleeping when there is
+// none. Work items may sleep themselves.
+static void worker_thread(void) {
+    worker_pool_t* pool = current_process->kthread_data;
+
+    for (;;) {
+        wait_event(pool->more, pool->head != NULL);
+
+        uint32_t flags = spin_lock_irqsave(&pool->lock);
+        work_t* work = pool->head;
+        if (!work) {
+            // Another worker took it
+            spin_unlock_irqrestore(&pool->lock, flags);
+            continue;
+        }
+        pool->head = work->next;
+        if (!pool->head) {
+            pool->tail = NULL;
+        }
+        work->pending = false;
+        pool->running++;
+        spin_unlock_irqrestore(&pool->lock, flags);
+
+        // The item may free or requeue itself; do not touch it after this
+        work->func(work);
+
+        flags = spin_lock_irqsave(&pool->lock);
+        pool->running--;
+        pool->processed++;
+        bool idle = !pool->head && !pool->running;
+        spin_unlock_irqrestore(&pool->lock, flags);
+
+        if (idle) {
+            waitqueue_wake_all(&pool->idle);
+        }
+    }
+}
+
+// Name a worker "<queue>/<cpu>"
+static void workqueue_worker_name(char* buf, const char* name, uint32_t cpu) {
+    strncpy(buf, name, MAX_PROCESS_NAME - 3);
+    buf[MAX_PROCESS_NAME - 3] = '\0';
+    uint32_t len = strlen(buf);
+    buf[len] = '/';
+    buf[len + 1] = '0' + cpu;
+    buf[len + 2] = '\0';
+}
+
+// Create a workqueue with WORKQUEUE_WORKERS threads on every CPU
+workqueue_t* workqueue_create(const char* name) {
+    workqueue_t* wq = kmalloc(sizeof(workqueue_t));
+    if (!wq) return NULL;
+    memset(wq, 0, sizeof(workqueue_t));
+    wq->name = name;
+
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        worker_pool_t* pool = &wq->pools[cpu];
+        spin_init(&pool->lock);
+        waitqueue_init(&pool->more);
+        waitqueue_init(&pool->idle);
+        pool->wq = wq;
+        pool->cpu = cpu;
+
+        char thread_name[MAX_PROCESS_NAME];
+        workqueue_worker_name(thread_name, name, cpu);
+        for (int i = 0; i < WORKQUEUE_WORKERS; i++) {
+            if (!kthread_create_on(thread_name, worker_thread, cpu, pool)) {
+                kprintf("workqueue %s: cannot start worker on CPU %u\n", name, cpu);
+            }
+        }
+    }
+
+    uint32_t flags = spin_lock_irqsave(&workqueue_list_lock);
+    wq->next = workqueues;
+    workqueues = wq;
+    spin_unlock_irqrestore(&workqueue_list_lock, flags);
+    return wq;
+}
+
+// Set up a work item
+void work_init(work_t* work, void (*func)(work_t* work)) {
+    work->next = NULL;
+    work->func = func;
+    work->pending = false;
+}
+
+// Queue work on a CPU's pool. Safe from interrupt handlers. Returns false
+// if the item was already queued; it then runs once for both requests.
+bool queue_work_on(uint32_t cpu, workqueue_t* wq, work_t* work) {
+    if (cpu >= smp_cpu_count()) {
+        cpu = 0;
+    }
+    if (__sync_lock_test_and_set(&work->pending, true)) return false;
+
+    worker_pool_t* pool = &wq->pools[cpu];
+    uint32_t flags = spin_lock_irqsave(&pool->lock);
+    work->next = NULL;
+    if (pool->tail) {
+        pool->tail->next = work;
+    } else {
+        pool->head = work;
+    }
+    pool->tail = work;
+    spin_unlock_irqrestore(&pool->lock, flags);
+
+    waitqueue_wake_one(&pool->more);
+    return true;
+}
+
+// Queue work on the calling CPU, keeping its data cache-warm
+bool queue_work(workqueue_t* wq, work_t* work) {
+    return queue_work_on(this_cpu()->id, wq, work);
+}
+
+// Queue work on the shared system workqueue
+bool schedule_work(work_t* work) {
+    return queue_work(system_wq, work);
+}
+
+// Wait until everything queued so far has run. Must not be called from
+// a worker of the same queue.
+void workqueue_flush(workqueue_t* wq) {
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        worker_pool_t* pool = &wq->pools[cpu];
+        wait_event(pool->idle, !pool->head && !pool->running);
+    }
+}
+
+// Create the system workqueue
+void workqueue_init(void) {
+    system_wq = workqueue_create("events");
+    if (!system_wq) {
+        kprintf("workqueue: cannot create the system workqueue\n");
+    }
+}
+
+// Show the queued, running and completed work of every pool
+int workqueue_cmd_workqueues(int argc, char* argv[]) {
+    (void)argc;
+    (void)argv;
+
+    uint32_t flags = spin_lock_irqsave(&workqueue_list_lock);
+    for (workqueue_t* wq = workqueues; wq; wq = wq->next) {
+        kprintf("%s:\n", wq->name);
+        for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+            worker_pool_t* pool = &wq->pools[cpu];
+            uint32_t queued = 0;
+            for (work_t* work = pool->head; work; work = work->next) {
+                queued++;
+            }
+            kprintf("  CPU %u: %u queued, %u running, %u done\n",
+                    cpu, queued, pool->running, pool->processed);
+        }
+    }
+    spin_unlock_irqrestore(&workqueue_list_lock, flags);
+    return 0;
+}
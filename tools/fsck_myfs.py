@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+"""Check a MyFS disk image, and optionally repair it.
+
+    python3 tools/fsck_myfs.py disk.img
+    python3 tools/fsck_myfs.py --repair disk.img
+
+Checks the superblock, that every block is owned by at most one inode,
+that extents stay inside the data area, directory entries and link
+counts, and that the bitmap and free counts match what the inodes use.
+--repair clears bad directory entries, frees unreachable inodes (files
+removed while open when the machine stopped), fixes link counts and
+rewrites the bitmap and free counts. Run it only on an image no kernel
+has mounted.
+
+Exit status: 0 clean, 1 errors repaired, 4 errors left.
+"""
+
+import argparse
+import collections
+import sys
+
+import myfs
+
+
+class Checker:
+    def __init__(self, image, repair):
+        self.image = image
+        self.repair = repair
+        self.errors = 0
+        self.fixed = 0
+
+    def error(self, message, fixable=True):
+        self.errors += 1
+        if self.repair and fixable:
+            self.fixed += 1
+            print("%s (repaired)" % message)
+        else:
+            print(message)
+
+    def check_super(self):
+        sb = self.image.read_super()
+        if sb.magic != myfs.MAGIC:
+            sys.exit("fsck_myfs: no MyFS superblock (magic %#x)" % sb.magic)
+        if sb.version != myfs.VERSION or sb.block_size != myfs.BLOCK_SIZE:
+            sys.exit("fsck_myfs: unsupported version %d or block size %d"
+                     % (sb.version, sb.block_size))
+        if (sb.bitmap_start != 1
+                or sb.bitmap_blocks * myfs.BITS_PER_BLOCK < sb.blocks
+                or sb.inode_start != sb.bitmap_start + sb.bitmap_blocks
+                or sb.inode_blocks * myfs.INODES_PER_BLOCK < sb.inodes
+                or sb.data_start != sb.inode_start + sb.inode_blocks
+                or sb.data_start >= sb.blocks or sb.inodes < 2):
+            sys.exit("fsck_myfs: superblock layout is inconsistent")
+        return sb
+
+    def check_inodes(self, sb):
+        """Read every inode and claim its blocks. Returns {ino: Inode}."""
+        owner = {}
+        inodes = {}
+        for ino in range(1, sb.inodes):
+            inode = self.image.read_inode(sb, ino)
+            if inode.type == myfs.TYPE_FREE:
+                continue
+            if inode.type not in (myfs.TYPE_FILE, myfs.TYPE_DIR):
+                self.error("inode %d: bad type %d" % (ino, inode.type), fixable=False)
+                continue
+            inodes[ino] = inode
+
+            if inode.nextents > myfs.MAX_EXTENTS:
+                self.error("inode %d: %d extents" % (ino, inode.nextents), fixable=False)
+                continue
+            if inode.nextents > myfs.INLINE_EXTENTS and not inode.indirect:
+                self.error("inode %d: extents past the inode but no indirect block" % ino,
+                           fixable=False)
+                continue
+
+            claimed = []
+            if inode.indirect:
+                claimed.append(inode.indirect)
+            total = 0
+            for start, count in self.image.extents(inode):
+                if count == 0 or start < sb.data_start or start + count > sb.blocks:
+                    self.error("inode %d: extent %d+%d outside the data area"
+                               % (ino, start, count), fixable=False)
+                    continue
+                claimed.extend(range(start, start + count))
+                total += count
+            for block in claimed:
+                if block in owner:
+                    self.error("block %d: used by inodes %d and %d" % (block, owner[block], ino),
+                               fixable=False)
+                else:
+                    owner[block] = ino
+
+            if total != inode.blocks:
+                self.error("inode %d: extents hold %d blocks, inode says %d"
+                           % (ino, total, inode.blocks), fixable=False)
+            if inode.size > inode.blocks * myfs.BLOCK_SIZE:
+                self.error("inode %d: size %d past its %d blocks"
+                           % (ino, inode.size, inode.blocks), fixable=False)
+            if inode.type == myfs.TYPE_DIR and inode.size % myfs.DIRENT_SIZE:
+                self.error("inode %d: directory size %d is not whole entries"
+                           % (ino, inode.size), fixable=False)
+        return inodes, owner
+
+    def check_tree(self, sb, inodes):
+        """Walk the directories from the root. Returns {ino: entries naming it}."""
+        links = collections.Counter()
+        root = inodes.get(myfs.ROOT_INODE)
+        if not root or root.type != myfs.TYPE_DIR:
+            sys.exit("fsck_myfs: root inode is not a directory")
+        links[myfs.ROOT_INODE] = 1
+
+        pending = [(myfs.ROOT_INODE, "/")]
+        seen = {myfs.ROOT_INODE}
+        while pending:
+            dir_ino, path = pending.pop()
+            directory = inodes[dir_ino]
+            blocks = list(self.image.file_blocks(directory))
+            for slot in range(directory.size // myfs.DIRENT_SIZE):
+                index = slot * myfs.DIRENT_SIZE // myfs.BLOCK_SIZE
+                if index >= len(blocks):
+                    break
+                block = blocks[index]
+                data = bytearray(self.image.read_block(block))
+                offset = slot * myfs.DIRENT_SIZE % myfs.BLOCK_SIZE
+                ino, raw = myfs.DIRENT.unpack_from(data, offset)
+                if ino == 0:
+                    continue
+                name = raw.split(b"\0", 1)[0].decode("utf-8", "replace")
+                where = "%s%s" % (path, name)
+
+                bad = None
+                if ino >= sb.inodes or ino not in inodes:
+                    bad = "names free inode %d" % ino
+                elif ino in seen and inodes[ino].type == myfs.TYPE_DIR:
+                    bad = "is a second link to directory inode %d" % ino
+                elif not name:
+                    bad = "has an empty name"
+                if bad:
+                    self.error("%s: entry %s" % (where, bad))
+                    if self.repair:
+                        data[offset:offset + myfs.DIRENT_SIZE] = bytes(myfs.DIRENT_SIZE)
+                        self.image.write_block(block, bytes(data))
+                    continue
+
+                links[ino] += 1
+                if ino not in seen:
+                    seen.add(ino)
+                    if inodes[ino].type == myfs.TYPE_DIR:
+                        pending.append((ino, where + "/"))
+        return links
+
+    def check_links(self, sb, inodes, owner, links):
+        for ino, inode in sorted(inodes.items()):
+            if links[ino] == 0:
+                self.error("inode %d: not in any directory" % ino)
+                if self.repair:
+                    self.image.write_inode(sb, ino, myfs.Inode())
+                    for block in [b for b, o in owner.items() if o == ino]:
+                        del owner[block]
+            elif inode.links != links[ino]:
+                self.error("inode %d: link count %d, should be %d" % (ino, inode.links, links[ino]))
+                if self.repair:
+                    inode.links = links[ino]
+                    self.image.write_inode(sb, ino, inode)
+        return sum(1 for ino in inodes if links[ino])
+
+    def check_bitmap(self, sb, owner):
+        used = bytearray(sb.bitmap_blocks * myfs.BLOCK_SIZE)
+        for block in list(range(sb.data_start)) + list(owner) + \
+                list(range(sb.blocks, len(used) * 8)):
+            used[block // 8] |= 1 << (block % 8)
+
+        wrong = 0
+        for i in range(sb.bitmap_blocks):
+            want = bytes(used[i * myfs.BLOCK_SIZE:(i + 1) * myfs.BLOCK_SIZE])
+            have = self.image.read_block(sb.bitmap_start + i)
+            if have != want:
+                for byte in range(myfs.BLOCK_SIZE):
+                    wrong += bin(have[byte] ^ want[byte]).count("1")
+                if self.repair:
+                    self.image.write_block(sb.bitmap_start + i, want)
+        if wrong:
+            self.error("bitmap: %d blocks marked wrongly" % wrong)
+
+    def run(self):
+        sb = self.check_super()
+        inodes, owner = self.check_inodes(sb)
+        links = self.check_tree(sb, inodes)
+        live = self.check_links(sb, inodes, owner, links)
+        self.check_bitmap(sb, owner)
+
+        free_blocks = sb.blocks - sb.data_start - sum(1 for b in owner if b >= sb.data_start)
+        free_inodes = sb.inodes - 1 - (live if self.repair else len(inodes))
+        if (sb.free_blocks, sb.free_inodes) != (free_blocks, free_inodes):
+            self.error("superblock: free counts %d blocks, %d inodes; should be %d, %d"
+                       % (sb.free_blocks, sb.free_inodes, free_blocks, free_inodes))
+            if self.repair:
+                sb.free_blocks = free_blocks
+                sb.free_inodes = free_inodes
+                self.image.write_super(sb)
+
+        print("fsck_myfs: %d files, %d of %d blocks used, %d errors%s"
+              % (live, sb.blocks - free_blocks, sb.blocks, self.errors,
+                 ", %d repaired" % self.fixed if self.repair else ""))
+        if self.errors == 0:
+            return 0
+        return 1 if self.fixed == self.errors else 4
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Check a MyFS disk image.")
+    parser.add_argument("image", help="disk image")
+    parser.add_argument("--repair", action="store_true", help="fix what can be fixed")
+    args = parser.parse_args()
+
+    image = myfs.Image(args.image, writable=args.repair)
+    status = Checker(image, args.repair).run()
+    image.close()
+    sys.exit(status)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Make an empty MyFS file system in a disk image.
+
+    python3 tools/mkfs_myfs.py disk.img --size 64M
+    qemu-system-i386 -cdrom myos.iso -hda disk.img -boot d
+
+The image is created, or grown or shrunk to --size if one is given;
+without --size an existing image keeps its size. The kernel mounts the
+first ATA drive holding MyFS as its root at boot. Use --inodes to set how
+many files it can hold (default: one per 16 KB).
+"""
+
+import argparse
+import os
+import sys
+
+import myfs
+
+
+def parse_size(text):
+    """Bytes of a size such as 65536, 512K, 64M or 1G."""
+    units = {"K": 1 << 10, "M": 1 << 20, "G": 1 << 30}
+    scale = units.get(text[-1:].upper(), 1)
+    digits = text[:-1] if scale > 1 else text
+    try:
+        return int(digits) * scale
+    except ValueError:
+        raise argparse.ArgumentTypeError("bad size: %s" % text)
+
+
+def layout(blocks, inodes):
+    """Superblock of an empty file system of blocks blocks."""
+    if inodes is None:
+        inodes = blocks // 4
+    inodes = max(inodes, 2)
+    inodes = -(-inodes // myfs.INODES_PER_BLOCK) * myfs.INODES_PER_BLOCK
+
+    sb = myfs.Super(magic=myfs.MAGIC, version=myfs.VERSION, block_size=myfs.BLOCK_SIZE,
+                    blocks=blocks, inodes=inodes)
+    sb.bitmap_start = 1
+    sb.bitmap_blocks = -(-blocks // myfs.BITS_PER_BLOCK)
+    sb.inode_start = sb.bitmap_start + sb.bitmap_blocks
+    sb.inode_blocks = inodes // myfs.INODES_PER_BLOCK
+    sb.data_start = sb.inode_start + sb.inode_blocks
+    if sb.data_start + 1 > blocks:
+        sys.exit("mkfs_myfs: %d blocks leave no room for data" % blocks)
+    sb.free_blocks = blocks - sb.data_start
+    sb.free_inodes = inodes - 2
+    return sb
+
+
+def bitmap(sb):
+    """Bitmap blocks with the metadata, and bits past the end, marked used."""
+    bits = bytearray(sb.bitmap_blocks * myfs.BLOCK_SIZE)
+    for block in list(range(sb.data_start)) + list(range(sb.blocks, len(bits) * 8)):
+        bits[block // 8] |= 1 << (block % 8)
+    return bits
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Make a MyFS file system in a disk image.")
+    parser.add_argument("image", help="disk image, created if missing")
+    parser.add_argument("--size", type=parse_size, help="image size, e.g. 64M")
+    parser.add_argument("--inodes", type=int, help="number of inodes")
+    args = parser.parse_args()
+
+    if args.size is None and not os.path.exists(args.image):
+        sys.exit("mkfs_myfs: %s does not exist, give --size to create it" % args.image)
+    if not os.path.exists(args.image):
+        open(args.image, "wb").close()
+    if args.size is not None:
+        os.truncate(args.image, args.size)
+
+    blocks = os.path.getsize(args.image) // myfs.BLOCK_SIZE
+    sb = layout(blocks, args.inodes)
+
+    image = myfs.Image(args.image, writable=True)
+    image.write_block(0, sb.pack() + bytes(myfs.BLOCK_SIZE - myfs.SUPER.size))
+    bits = bitmap(sb)
+    for i in range(sb.bitmap_blocks):
+        image.write_block(sb.bitmap_start + i,
+                          bytes(bits[i * myfs.BLOCK_SIZE:(i + 1) * myfs.BLOCK_SIZE]))
+    for i in range(sb.inode_blocks):
+        image.write_block(sb.inode_start + i, bytes(myfs.BLOCK_SIZE))
+    image.write_inode(sb, myfs.ROOT_INODE, myfs.Inode(myfs.TYPE_DIR, links=1))
+    image.close()
+
+    print("mkfs_myfs: %s: %d blocks of %d bytes, %d inodes, data from block %d"
+          % (args.image, sb.blocks, myfs.BLOCK_SIZE, sb.inodes, sb.data_start))
+
+
+if __name__ == "__main__":
+    main()
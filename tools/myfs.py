@@ -0,0 +1,131 @@
+"""On-disk layout of MyFS, shared by mkfs_myfs.py and fsck_myfs.py.
+
+Mirrors src/kernel/include/myfs.h; change them together.
+"""
+
+import struct
+
+MAGIC = 0x5346594D
+VERSION = 1
+BLOCK_SIZE = 4096
+ROOT_INODE = 1
+
+INODE_SIZE = 128
+INODES_PER_BLOCK = BLOCK_SIZE // INODE_SIZE
+BITS_PER_BLOCK = BLOCK_SIZE * 8
+
+INLINE_EXTENTS = 13
+INDIRECT_EXTENTS = BLOCK_SIZE // 8
+MAX_EXTENTS = INLINE_EXTENTS + INDIRECT_EXTENTS
+
+DIRENT_SIZE = 64
+NAME_MAX = 59
+
+TYPE_FREE = 0
+TYPE_FILE = 1
+TYPE_DIR = 2
+
+SUPER = struct.Struct("<12I")
+SUPER_FIELDS = ("magic", "version", "block_size", "blocks", "inodes",
+                "bitmap_start", "bitmap_blocks", "inode_start", "inode_blocks",
+                "data_start", "free_blocks", "free_inodes")
+INODE = struct.Struct("<HHIIIII%dI" % (INLINE_EXTENTS * 2))
+EXTENT = struct.Struct("<II")
+DIRENT = struct.Struct("<I60s")
+
+
+class Super:
+    """The superblock, with its fields as attributes."""
+
+    def __init__(self, **fields):
+        for name in SUPER_FIELDS:
+            setattr(self, name, fields.get(name, 0))
+
+    @classmethod
+    def unpack(cls, data):
+        return cls(**dict(zip(SUPER_FIELDS, SUPER.unpack_from(data))))
+
+    def pack(self):
+        return SUPER.pack(*(getattr(self, name) for name in SUPER_FIELDS))
+
+
+class Inode:
+    """An inode; extents holds the inline (start, count) pairs in use."""
+
+    def __init__(self, type=TYPE_FREE, links=0, size=0, blocks=0, indirect=0, extents=None):
+        self.type = type
+        self.links = links
+        self.size = size
+        self.blocks = blocks
+        self.indirect = indirect
+        self.nextents = len(extents) if extents else 0
+        self.extents = list(extents or [])
+
+    @classmethod
+    def unpack(cls, data, offset=0):
+        fields = INODE.unpack_from(data, offset)
+        inode = cls(fields[0], fields[1], fields[2], fields[3], fields[5])
+        inode.nextents = fields[4]
+        pairs = fields[7:]
+        inode.extents = [(pairs[i], pairs[i + 1]) for i in range(0, len(pairs), 2)]
+        return inode
+
+    def pack(self):
+        pairs = []
+        for start, count in (self.extents + [(0, 0)] * INLINE_EXTENTS)[:INLINE_EXTENTS]:
+            pairs += [start, count]
+        return INODE.pack(self.type, self.links, self.size, self.blocks, self.nextents,
+                          self.indirect, 0, *pairs)
+
+
+class Image:
+    """A MyFS image file, read and written a block at a time."""
+
+    def __init__(self, path, writable=False):
+        self.file = open(path, "r+b" if writable else "rb")
+
+    def close(self):
+        self.file.close()
+
+    def read_block(self, block):
+        self.file.seek(block * BLOCK_SIZE)
+        data = self.file.read(BLOCK_SIZE)
+        return data + bytes(BLOCK_SIZE - len(data))
+
+    def write_block(self, block, data):
+        assert len(data) == BLOCK_SIZE
+        self.file.seek(block * BLOCK_SIZE)
+        self.file.write(data)
+
+    def read_super(self):
+        return Super.unpack(self.read_block(0))
+
+    def write_super(self, sb):
+        data = bytearray(self.read_block(0))
+        data[:SUPER.size] = sb.pack()
+        self.write_block(0, bytes(data))
+
+    def read_inode(self, sb, ino):
+        data = self.read_block(sb.inode_start + ino // INODES_PER_BLOCK)
+        return Inode.unpack(data, (ino % INODES_PER_BLOCK) * INODE_SIZE)
+
+    def write_inode(self, sb, ino, inode):
+        block = sb.inode_start + ino // INODES_PER_BLOCK
+        data = bytearray(self.read_block(block))
+        offset = (ino % INODES_PER_BLOCK) * INODE_SIZE
+        data[offset:offset + INODE_SIZE] = inode.pack()
+        self.write_block(block, bytes(data))
+
+    def extents(self, inode):
+        """All (start, count) extents of an inode, inline then indirect."""
+        result = inode.extents[:min(inode.nextents, INLINE_EXTENTS)]
+        if inode.nextents > INLINE_EXTENTS and inode.indirect:
+            data = self.read_block(inode.indirect)
+            for i in range(inode.nextents - INLINE_EXTENTS):
+                result.append(EXTENT.unpack_from(data, i * EXTENT.size))
+        return result
+
+    def file_blocks(self, inode):
+        """Device blocks of an inode's data, in file order."""
+        for start, count in self.extents(inode):
+            yield from range(start, start + count)
@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""Symbolize MyOS profiler samples and fold them for flame graphs.
+
+Capture the output of "prof dump" (COM1 or the 0xE9 debug console), e.g.
+
+    qemu-system-i386 -kernel myos.bin -serial file:prof.txt
+
+then run
+
+    python3 tools/profsym.py prof.txt > prof.folded
+    flamegraph.pl prof.folded > prof.svg
+
+The folded output ("root;caller;callee count" per line) also loads into
+https://www.speedscope.app. Use --top for a flat listing
+of the functions the samples landed in. Kernel addresses are resolved
+with nm against myos.bin; user-mode samples show up as "[user]".
+"""
+
+import argparse
+import bisect
+import collections
+import subprocess
+import sys
+
+
+def load_symbols(kernel, nm):
+    """Return sorted (address, name) pairs of the kernel's text symbols."""
+    try:
+        out = subprocess.run([nm, "-n", "--defined-only", kernel],
+                             check=True, capture_output=True, text=True).stdout
+    except (OSError, subprocess.CalledProcessError) as err:
+        sys.exit("profsym: cannot read symbols from %s: %s" % (kernel, err))
+
+    symbols = []
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[1] in "tTwW":
+            symbols.append((int(fields[0], 16), fields[2]))
+    symbols.sort()
+    return symbols
+
+
+class Symbolizer:
+    def __init__(self, symbols):
+        self.addrs = [a for a, _ in symbols]
+        self.names = [n for _, n in symbols]
+
+    def lookup(self, pc):
+        i = bisect.bisect_right(self.addrs, pc) - 1
+        if i < 0:
+            return "0x%08x" % pc
+        return self.names[i]
+
+
+def parse(lines):
+    """Return (names, samples); each sample is (cpu, pid, user, pcs)."""
+    names = {}
+    samples = []
+    for line in lines:
+        fields = line.split()
+        if not fields:
+            continue
+        try:
+            if fields[0] == "P" and len(fields) >= 3:
+                names[int(fields[1])] = " ".join(fields[2:])
+            elif fields[0] == "S" and len(fields) >= 5 and fields[3] in ("k", "u"):
+                pcs = [int(f, 16) for f in fields[4:]]
+                samples.append((int(fields[1]), int(fields[2]), fields[3] == "u", pcs))
+        except ValueError:
+            continue
+    return names, samples
+
+
+def fold(samples, names, sym, by_process, by_cpu):
+    stacks = collections.Counter()
+    for cpu, pid, user, pcs in samples:
+        frames = []
+        if by_cpu:
+            frames.append("cpu%d" % cpu)
+        if by_process:
+            frames.append("%s (%d)" % (names.get(pid, "pid"), pid))
+        if user:
+            frames.append("[user]")
+        else:
+            # Callers are return addresses; step back into the call
+            callers = [sym.lookup(pc - 1) for pc in reversed(pcs[1:])]
+            frames.extend(callers)
+            frames.append(sym.lookup(pcs[0]))
+        stacks[";".join(f.replace(";", ":") for f in frames)] += 1
+    return stacks
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", nargs="?", help="captured samples (default: stdin)")
+    parser.add_argument("-k", "--kernel", default="myos.bin", help="kernel image (default: myos.bin)")
+    parser.add_argument("--nm", default="nm", help="nm to use, e.g. i686-elf-nm")
+    parser.add_argument("--no-process", action="store_true", help="do not root stacks at the process")
+    parser.add_argument("--per-cpu", action="store_true", help="root stacks at the CPU")
+    parser.add_argument("--kernel-only", action="store_true", help="drop user-mode samples")
+    parser.add_argument("--no-idle", action="store_true", help="drop samples of the idle process")
+    parser.add_argument("--top", type=int, metavar="N", help="print the N hottest functions instead")
+    args = parser.parse_args()
+
+    if args.input:
+        with open(args.input, errors="replace") as f:
+            names, samples = parse(f)
+    else:
+        names, samples = parse(sys.stdin)
+
+    if args.kernel_only:
+        samples = [s for s in samples if not s[2]]
+    if args.no_idle:
+        samples = [s for s in samples if s[1] != 0]
+    if not samples:
+        sys.exit("profsym: no samples found")
+
+    sym = Symbolizer(load_symbols(args.kernel, args.nm))
+
+    if args.top:
+        hits = collections.Counter("[user]" if user else sym.lookup(pcs[0])
+                                   for _, _, user, pcs in samples)
+        total = len(samples)
+        print("%8s %6s  %s" % ("samples", "%", "function"))
+        for name, count in hits.most_common(args.top):
+            print("%8d %6.2f  %s" % (count, 100.0 * count / total, name))
+        return
+
+    stacks = fold(samples, names, sym, not args.no_process, args.per_cpu)
+    for stack, count in sorted(stacks.items()):
+        print("%s %d" % (stack, count))
+    print("profsym: %d samples, %d stacks" % (len(samples), len(stacks)), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+"""Convert a MyOS scheduler trace to Chrome trace-event JSON.
+
+Capture the output of "trace dump" (COM1 or the 0xE9 debug console), e.g.
+
+    qemu-system-i386 -kernel myos.bin -serial file:trace.txt
+    qemu-system-i386 -kernel myos.bin -debugcon file:trace.txt
+
+then run
+
+    python3 tools/trace2json.py trace.txt -o trace.json
+
+and open trace.json in https://ui.perfetto.dev or chrome://tracing.
+Lines that are not part of the trace are ignored, so the capture may
+contain other serial output.
+"""
+
+import argparse
+import json
+import sys
+
+TRACE_SWITCH = 1
+TRACE_WAKEUP = 2
+TRACE_IRQ_ENTRY = 3
+TRACE_IRQ_EXIT = 4
+TRACE_PAGE_FAULT = 5
+TRACE_SYSCALL_ENTRY = 6
+TRACE_SYSCALL_EXIT = 7
+TRACE_TICK = 8
+
+STATES = {1: "running", 2: "ready", 3: "blocked", 4: "zombie", 5: "sleeping"}
+
+SYSCALLS = {
+    0: "null", 1: "exit", 2: "fork", 3: "wait", 4: "getpid", 5: "kill",
+    6: "exec", 7: "sleep", 8: "yield", 9: "spawn", 10: "sigreturn",
+    11: "sigaction", 12: "sigprocmask", 13: "sigqueue",
+}
+
+# Trace-viewer "processes" the events are grouped under
+CPU_PID = 0
+PROC_PID = 1
+IRQ_TID_BASE = 100
+
+
+def parse(lines):
+    """Return (tsc_mhz, names, events) from the exported text."""
+    mhz = 0
+    names = {}
+    events = []
+    for line in lines:
+        fields = line.split()
+        if not fields:
+            continue
+        try:
+            if fields[0] == "#" and len(fields) == 3 and fields[1] == "tsc_mhz":
+                mhz = int(fields[2])
+            elif fields[0] == "P" and len(fields) >= 3:
+                names[int(fields[1])] = " ".join(fields[2:])
+            elif fields[0] == "E" and len(fields) == 7:
+                cpu, tsc, type_, pid, arg0, arg1 = fields[1:]
+                events.append((int(tsc, 16), int(cpu), int(type_), int(pid),
+                               int(arg0, 16), int(arg1, 16)))
+        except ValueError:
+            continue
+    events.sort()
+    return mhz, names, events
+
+
+def convert(mhz, names, events, ticks):
+    if not events:
+        return []
+    if mhz <= 0:
+        mhz = 1
+    tsc0 = events[0][0]
+
+    def us(tsc):
+        return (tsc - tsc0) / mhz
+
+    def name(pid):
+        return names.get(pid, "pid %d" % pid)
+
+    out = [
+        {"ph": "M", "name": "process_name", "pid": CPU_PID, "args": {"name": "CPUs"}},
+        {"ph": "M", "name": "process_name", "pid": PROC_PID, "args": {"name": "Processes"}},
+    ]
+    for pid in sorted(names):
+        out.append({"ph": "M", "name": "thread_name", "pid": PROC_PID, "tid": pid,
+                    "args": {"name": "%s (%d)" % (name(pid), pid)}})
+
+    cpus = sorted({e[1] for e in events})
+    for cpu in cpus:
+        out.append({"ph": "M", "name": "thread_name", "pid": CPU_PID, "tid": cpu,
+                    "args": {"name": "CPU %d" % cpu}})
+        out.append({"ph": "M", "name": "thread_name", "pid": CPU_PID,
+                    "tid": IRQ_TID_BASE + cpu,
+                    "args": {"name": "CPU %d interrupts" % cpu}})
+
+    running = {}       # cpu -> (pid, start tsc)
+    irqs = {}          # cpu -> stack of (vector, start tsc)
+    syscalls = {}      # pid -> (number, arg, start tsc)
+    wakeups = {}       # pid -> flow id waiting for the next switch-in
+    flow = 0
+
+    def close_slice(cpu, tsc, state=None):
+        if cpu not in running:
+            return
+        pid, start = running.pop(cpu)
+        args = {"pid": pid}
+        if state is not None:
+            args["end_state"] = STATES.get(state, str(state))
+        out.append({"ph": "X", "name": name(pid), "pid": CPU_PID, "tid": cpu,
+                    "ts": us(start), "dur": us(tsc) - us(start), "args": args})
+
+    for tsc, cpu, type_, pid, arg0, arg1 in events:
+        ts = us(tsc)
+        if cpu not in running and type_ != TRACE_SWITCH:
+            # First sighting of this CPU: it was running the recording pid
+            running[cpu] = (pid, tsc)
+
+        if type_ == TRACE_SWITCH:
+            close_slice(cpu, tsc, arg1)
+            running[cpu] = (arg0, tsc)
+            if arg0 in wakeups:
+                out.append({"ph": "f", "bp": "e", "name": "wakeup", "cat": "sched",
+                            "id": wakeups.pop(arg0), "pid": CPU_PID, "tid": cpu,
+                            "ts": ts})
+        elif type_ == TRACE_WAKEUP:
+            flow += 1
+            wakeups[arg0] = flow
+            out.append({"ph": "i", "s": "t", "name": "wakeup %s" % name(arg0),
+                        "pid": CPU_PID, "tid": cpu, "ts": ts,
+                        "args": {"pid": arg0, "target_cpu": arg1}})
+            out.append({"ph": "s", "name": "wakeup", "cat": "sched", "id": flow,
+                        "pid": CPU_PID, "tid": cpu, "ts": ts})
+        elif type_ == TRACE_IRQ_ENTRY:
+            irqs.setdefault(cpu, []).append((arg0, tsc))
+        elif type_ == TRACE_IRQ_EXIT:
+            stack = irqs.get(cpu)
+            if stack:
+                vector, start = stack.pop()
+                out.append({"ph": "X", "name": "irq %d" % vector, "pid": CPU_PID,
+                            "tid": IRQ_TID_BASE + cpu, "ts": us(start),
+                            "dur": ts - us(start), "args": {"vector": vector}})
+        elif type_ == TRACE_PAGE_FAULT:
+            out.append({"ph": "i", "s": "t", "name": "page fault", "pid": PROC_PID,
+                        "tid": pid, "ts": ts,
+                        "args": {"address": "0x%08x" % arg0, "error": arg1}})
+        elif type_ == TRACE_SYSCALL_ENTRY:
+            syscalls[pid] = (arg0, arg1, tsc)
+        elif type_ == TRACE_SYSCALL_EXIT:
+            entry = syscalls.pop(pid, None)
+            if entry and entry[0] == arg0:
+                number, arg, start = entry
+                ret = arg1 - (1 << 32) if arg1 & 0x80000000 else arg1
+                out.append({"ph": "X", "name": SYSCALLS.get(number, "syscall %d" % number),
+                            "pid": PROC_PID, "tid": pid, "ts": us(start),
+                            "dur": ts - us(start),
+                            "args": {"arg1": "0x%x" % arg, "ret": ret}})
+        elif type_ == TRACE_TICK and ticks:
+            out.append({"ph": "i", "s": "t", "name": "tick", "pid": CPU_PID,
+                        "tid": cpu, "ts": ts, "args": {"tick": arg0}})
+
+    last = events[-1][0]
+    for cpu in list(running):
+        close_slice(cpu, last)
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("input", nargs="?", help="captured trace (default: stdin)")
+    parser.add_argument("-o", "--output", help="JSON file (default: stdout)")
+    parser.add_argument("--ticks", action="store_true", help="include timer ticks")
+    args = parser.parse_args()
+
+    if args.input:
+        with open(args.input, errors="replace") as f:
+            mhz, names, events = parse(f)
+    else:
+        mhz, names, events = parse(sys.stdin)
+
+    if not events:
+        sys.exit("trace2json: no trace events found")
+
+    trace = {"traceEvents": convert(mhz, names, events, args.ticks),
+             "displayTimeUnit": "ns"}
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+    print("trace2json: %d events, %d CPUs" % (len(events), len({e[1] for e in events})),
+          file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()